@@ -76,7 +76,8 @@ static double band_constraint(int n, const double *u, double *grad, void *data)
 	MMA code always calls all the constraints at once (in
 	sequence); it never changes u in between one constraint & the next. */
      if (!vector3_equal(cur_kvector, d->ks.items[ik]) || d->unsolved) {
-	  randomize_fields();
+	  if (k_point_predictor == PREDICT_NONE)
+	       randomize_fields();
 	  solve_kpoint(d->ks.items[ik]);
      }
      d->unsolved = 0;
@@ -111,6 +111,7 @@ void randomize_epsilon(number delta)
 
      }
 
+     maxwell_compress_dielectric(mdata);
 }
 /**************************************************************************/
 
@@ -583,8 +584,8 @@ static void material_grids_SPt(scalar_complex *Asp, const double *depsdu, const
     int cur_num_bands = 1;
 
     CHECK(band1 <= num_bands && band2 <= num_bands, "reducedA0 called for uncomputed band\n");
-    field1 = (scalar_complex *) malloc(sizeof(scalar_complex) * mdata->fft_output_size*3);
-    field2 = (scalar_complex *) malloc(sizeof(scalar_complex) * mdata->fft_output_size*3);
+    ARENA_MALLOC(&scratch_arena, field1, scalar_complex, mdata->fft_output_size*3);
+    ARENA_MALLOC(&scratch_arena, field2, scalar_complex, mdata->fft_output_size*3);
     /* Ai = (scalar_complex *) malloc(sizeof(scalar_complex) * ntot); */
 
     /* compute A0: Dfield_1'*Efield_2 */
@@ -607,7 +608,7 @@ static void material_grids_SPt(scalar_complex *Asp, const double *depsdu, const
         get_Efield_from_Dfield(field1, cur_num_bands);
     else
     {
-        free(field1);
+        arena_free(&scratch_arena, field1);
         field1 = field2;
     }
 
@@ -637,7 +638,7 @@ static void material_grids_SPt(scalar_complex *Asp, const double *depsdu, const
     Asp[ntot*stride].re =  A0.re - Aisum.re;
     Asp[ntot*stride].im =  A0.im - Aisum.im;
 
-    free(field2);
+    arena_free(&scratch_arena, field2);
 }
 
 /* returns transposed Asp. Key is in the way Asp(Ai) is updated (stride = final count, Asp starts from the offset (=current count)) */
@@ -650,8 +651,8 @@ static void material_grids_SPt_blas(scalar_complex *Ai, scalar_complex *depsdu_s
   int cur_num_bands = 1;
 
     CHECK(band1 <= num_bands && band2 <= num_bands, "reducedA0 called for uncomputed band\n");
-    field1 = (scalar_complex *) malloc(sizeof(scalar_complex) * mdata->fft_output_size*3);
-    field2 = (scalar_complex *) malloc(sizeof(scalar_complex) * mdata->fft_output_size*3);
+    ARENA_MALLOC(&scratch_arena, field1, scalar_complex, mdata->fft_output_size*3);
+    ARENA_MALLOC(&scratch_arena, field2, scalar_complex, mdata->fft_output_size*3);
 
     /* compute A0: Dfield_1'*Efield_2 */
     if (band1)
@@ -675,7 +676,7 @@ static void material_grids_SPt_blas(scalar_complex *Ai, scalar_complex *depsdu_s
         get_Efield_from_Dfield(field1, cur_num_bands);
     else
     {
-        free(field1);
+        arena_free(&scratch_arena, field1);
         field1 = field2;
     }
     
@@ -704,7 +705,7 @@ static void material_grids_SPt_blas(scalar_complex *Ai, scalar_complex *depsdu_s
     Ai[ntot*stride].re =  A0.re - Aisum.re;
     Ai[ntot*stride].im =  A0.im - Aisum.im;
 
-    free(field2);
+    arena_free(&scratch_arena, field2);
 }
 
 static void SDP2LP(double_array *Alin, scalar_complex *Avec, double_array *avec, int spdim, int n)
@@ -1026,7 +1027,8 @@ number run_matgrid_optgap_lp_DCG(vector3_list kpoints,
 	  u_sc[j].re = u[j];
 
 	for (k = 0; k < nk; ++k) {
-            randomize_fields();
+            if (k_point_predictor == PREDICT_NONE)
+                randomize_fields();
             solve_kpoint(kpoints.items[k]);
 
 	    for (j = 0; j < num_bands; ++j)
@@ -1512,7 +1514,8 @@ number run_matgrid_optgap_lp(vector3_list kpoints,
 	  u_sc[j].re = u[j];
 
 	for (k = 0; k < nk; ++k) {
-            randomize_fields();
+            if (k_point_predictor == PREDICT_NONE)
+                randomize_fields();
             solve_kpoint(kpoints.items[k]);
 
 	    for (j = 0; j < num_bands; ++j)
@@ -1809,7 +1812,8 @@ number run_matgrid_optgap_lp_fa(vector3_list kpoints,
 	  u_sc[j].re = u[j];
 
 	for (k = 0; k < nk; ++k) {
-            randomize_fields();
+            if (k_point_predictor == PREDICT_NONE)
+                randomize_fields();
             solve_kpoint(kpoints.items[k]);
 
 	    for (j = 0; j < num_bands; ++j)
@@ -2316,7 +2320,8 @@ number run_matgrid_optgap_lp_fa_mpi(vector3_list kpoints,
 
 	
 	for (k = 0; k < nk; ++k) {
-            randomize_fields();
+            if (k_point_predictor == PREDICT_NONE)
+                randomize_fields();
             solve_kpoint(kpoints.items[k]);
 
 	    for (j = 0; j < num_bands; ++j)
@@ -737,7 +737,8 @@ number run_matgrid_optgap_mosek(vector3_list kpoints,
 
       for (k = mpb_mygroup; k < nk; k+=mpb_numgroups) {
 
-        randomize_fields();
+        if (k_point_predictor == PREDICT_NONE)
+          randomize_fields();
         solve_kpoint(kpoints.items[k]);
 
         MPI_Barrier(MPI_COMM_WORLD);
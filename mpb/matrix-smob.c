@@ -308,6 +308,7 @@ void load_eigenvectors(char *filename)
      CHECK(mdata, "init-params must be called before load-eigenvectors");
      printf("Loading eigenvectors from \"%s\"...\n", filename);
      evectmatrixio_readall_raw(filename, H);
+     predict_fields_reset();
      curfield_reset();
 }
 
@@ -35,10 +35,14 @@
 #include <mpiglue.h>
 #include <mpi_utils.h>
 #include <check.h>
+#include <prof.h>
+#include <arena.h>
+#include <bigmem.h>
 #include <blasglue.h>
 #include <matrices.h>
 #include <eigensolver.h>
 #include <maxwell.h>
+#include <matrixio.h>
 
 /* Header file for the ctl-file (Guile) interface; automatically
    generated from mpb.scm */
@@ -129,8 +133,27 @@ void ctl_start_hook(int *argc, char ***argv)
 #endif
 }
 
+/* FFTW wisdom file read by init-params, to which the accumulated
+   wisdom is saved on exit (NULL if none). */
+static char *fft_wisdom_fname = NULL;
+
 void ctl_stop_hook(void)
 {
+     if (fft_wisdom_fname) {
+	  if (maxwell_export_fft_wisdom(fft_wisdom_fname))
+	       mpi_one_printf("Saved FFTW wisdom to \"%s\".\n",
+			      fft_wisdom_fname);
+	  free(fft_wisdom_fname);
+	  fft_wisdom_fname = NULL;
+     }
+     if (verbose) {
+	  int nplans;
+	  double hits, misses;
+	  maxwell_fft_plan_cache_stats(&nplans, &hits, &misses);
+	  mpi_one_printf("FFT plan cache: %d plans, %g hits, %g misses.\n",
+			 nplans, hits, misses);
+     }
+     maxwell_clear_fft_plan_cache();
 #ifdef HAVE_FFTW3_MPI
      FFTW(mpi_cleanup)();
 #endif
@@ -231,10 +254,16 @@ void matrix3x3_to_arr(real arr[3][3], matrix3x3 m)
    calls from Guile: */
 
 int nwork_alloc = 0;
+int block_size = 0; /* number of bands solved for at a time */
 
 maxwell_data *mdata = NULL;
 maxwell_target_data *mtdata = NULL;
-evectmatrix H, W[MAX_NWORK], Hblock, muinvH;
+evectmatrix H, W[MAX_NWORK], muinvH;
+
+/* cache for the temporary arrays that are allocated anew for each
+   k point (eigenvalues, deflation and group-velocity scratch, field
+   arrays); emptied by init-params.  See also display-scratch-memory. */
+arena scratch_arena;
 
 vector3 cur_kvector;
 scalar_complex *curfield = NULL;
@@ -255,6 +284,56 @@ real Vol; /* computational cell volume = |det Rm| */
 /* index of current kpoint, for labeling output */
 int kpoint_index = 0;
 
+/* profiling totals since init-params (if profile? is true); the timings
+   of each solve_kpoint are accumulated in prof_counters (see prof.h) */
+static prof_counter prof_totals[PROF_NUM_PHASES];
+static int prof_totals_nk = 0; /* # k-points in prof_totals */
+
+/* data for predicting the fields at each k point from the previous
+   ones (see k-point-predictor and predict_fields, below): whether H
+   holds the solutions at mdata->current_k, and the solutions Hprev at
+   the k point before that (Cartesian Hprev_k), if Hprev_valid, in the
+   same (transverse) basis as H.  Hprev is only allocated for
+   PREDICT_EXTRAPOLATE. */
+static int H_solved = 0;
+static evectmatrix Hprev;
+static int Hprev_valid = 0;
+static real Hprev_k[3];
+
+/* k.p models (see kdotp_save_model, below) at the last two k points
+   where they were saved, kdotp[1] being the latest, with the exact
+   eigenvalues there, and the corrections of each model for the
+   segment between the two k points (see kdotp_interpolate). */
+typedef struct {
+     maxwell_kdotp_model *model;
+     real *eigenvals;
+     real *correction;
+} kdotp_point;
+static kdotp_point kdotp[2];
+
+/* the fields H at the k point kdotp_kvector, saved by kdotp_save_fields
+   (allocated when first needed) */
+static evectmatrix kdotp_H;
+static vector3 kdotp_kvector;
+static int kdotp_H_valid = 0;
+
+static void kdotp_clear(void)
+{
+     int i;
+     for (i = 0; i < 2; ++i) {
+	  destroy_maxwell_kdotp_model(kdotp[i].model);
+	  free(kdotp[i].eigenvals);
+	  free(kdotp[i].correction);
+	  kdotp[i].model = NULL;
+	  kdotp[i].eigenvals = kdotp[i].correction = NULL;
+     }
+     if (kdotp_H.data) {
+	  destroy_evectmatrix(kdotp_H);
+	  kdotp_H.data = NULL;
+     }
+     kdotp_H_valid = 0;
+}
+
 /**************************************************************************/
 
 scalar_complex cnumber2cscalar(cnumber c)
@@ -285,6 +364,14 @@ void cvector32cscalar3(scalar_complex *cs, cvector3 v)
      cs[2] = cnumber2cscalar(v.z);
 }
 
+/* H was overwritten with fields that are not known to be the solutions
+   at mdata->current_k (e.g. by load-eigenvectors), so the next k point
+   cannot be predicted from them. */
+void predict_fields_reset(void)
+{
+     H_solved = Hprev_valid = 0;
+}
+
 /**************************************************************************/
 
 /* initialize the field to random numbers; should only be called
@@ -295,6 +382,7 @@ void randomize_fields(void)
 
      if (!mdata)
 	  return;
+     predict_fields_reset();
      mpi_one_printf("Initializing fields to random numbers...\n");
      for (i = 0; i < H.n * H.p; ++i) {
 	  ASSIGN_SCALAR(H.data[i], rand() * 1.0 / RAND_MAX,
@@ -364,6 +452,8 @@ void set_parity(integer p)
 
      last_p = p;
      set_kpoint_index(0);  /* reset index */
+     Hprev_valid = 0; /* don't extrapolate from the previous parity */
+     kdotp_clear(); /* ...nor interpolate */
 }
 
 /**************************************************************************/
@@ -375,10 +465,32 @@ void num_proc_per_k(integer processes_per_k)
   MPI_Comm_size(MPI_COMM_WORLD, &sz);
 
   mpb_numgroups = sz/processes_per_k;
+  maxwell_clear_fft_plan_cache(); /* plans depend on mpb_comm */
   mpb_mygroup = divide_parallel_processes(mpb_numgroups);
 
 }
 
+/* Number of work arrays to allocate for the selected eigensolver.  LOBPCG
+   needs a fixed set: AX, W, AW, scratch, P, AP (plus BX, BW, BP with mu),
+   and the Chebyshev filter needs three arrays for its recurrence.
+   Jacobi-Davidson (only used with a target frequency) needs seven
+   arrays plus a V and an AV array for each block of its search basis,
+   which we allow to grow to six blocks before restarting.  Davidson
+   needs V and AV (and BV with mu) for each block of its search basis,
+   whose size is set by eigensolver-davidson-max-blocks. */
+static int eigensolver_nwork_needed(int have_mu)
+{
+     if (eigensolver_jdp && target_freq != 0.0)
+	  return 7 + 2 * 6;
+     if (eigensolver_davidsonp)
+	  return (2 + have_mu) * MAX2(2, MIN2(eigensolver_davidson_max_blocks,
+					      MAX_NWORK / (2 + have_mu)));
+     if (eigensolver_chebyshevp)
+	  return 4;
+     if (eigensolver_lobpcgp)
+	  return 6 + 3 * have_mu;
+     return eigensolver_nwork + have_mu;
+}
 
 /* Guile-callable function: init-params, which initializes any data
    that we need for the eigenvalue calculation.  When this function
@@ -397,7 +509,7 @@ void init_params(integer p, boolean reset_fields)
      int i, local_N, N_start, alloc_N;
      int nx, ny, nz;
      int have_old_fields = 0;
-     int block_size;
+     int old_block_size = block_size;
      
      /* Output a bunch of stuff so that the user can see what we're
 	doing and what we've read in. */
@@ -448,21 +560,27 @@ void init_params(integer p, boolean reset_fields)
 
      if (mdata) {  /* need to clean up from previous init_params call */
 	  if (nx == mdata->nx && ny == mdata->ny && nz == mdata->nz &&
-	      block_size == Hblock.alloc_p && num_bands == H.p &&
-	      eigensolver_nwork + (mdata->mu_inv!=NULL) == nwork_alloc)
+	      block_size == old_block_size && num_bands == H.p &&
+	      eigensolver_nwork_needed(mdata->mu_inv!=NULL) == nwork_alloc)
 	       have_old_fields = 1; /* don't need to reallocate */
 	  else {
 	       destroy_evectmatrix(H);
 	       for (i = 0; i < nwork_alloc; ++i)
 		    destroy_evectmatrix(W[i]);
-	       if (Hblock.data != H.data)
-		    destroy_evectmatrix(Hblock);
                if (muinvH.data != H.data)
                    destroy_evectmatrix(muinvH);                   
 	  }
+	  if (Hprev.data && (!have_old_fields ||
+			     k_point_predictor != PREDICT_EXTRAPOLATE)) {
+	       destroy_evectmatrix(Hprev);
+	       Hprev.data = NULL;
+	  }
+	  H_solved = Hprev_valid = 0; /* the new mdata has current_k = 0 */
+	  kdotp_clear();
 	  destroy_maxwell_target_data(mtdata); mtdata = NULL;
 	  destroy_maxwell_data(mdata); mdata = NULL;
 	  curfield_reset();
+	  arena_reset(&scratch_arena); /* sizes depend on the old params */
      }
      else
 	  srand(time(NULL)); /* init random seed for field initialization */
@@ -475,11 +593,38 @@ void init_params(integer p, boolean reset_fields)
 	  srand(314159 * (rank + 1));
      }
 
+     if (num_threads > 0) {
+#ifdef USE_OPENMP
+	  mpi_one_printf("Using %d threads.\n", num_threads);
+#else
+	  mpi_one_fprintf(stderr, "WARNING: num-threads is ignored "
+			  "(not compiled with OpenMP).\n");
+#endif
+	  maxwell_set_num_threads(num_threads);
+     }
+
+     /* how to allocate H, W, and the FFT data (see bigmem.h): */
+     bigmem_policy = memory_policy;
+     bigmem_first_touch = first_touchp;
+
      mpi_one_printf("Creating Maxwell data...\n");
      mdata = create_maxwell_data(nx, ny, nz, &local_N, &N_start, &alloc_N,
                                  block_size, NUM_FFT_BANDS);
      CHECK(mdata, "NULL mdata");
 
+     maxwell_set_fft_rigor(mdata, fft_planner_rigor);
+     maxwell_set_fft_plan_cache_size(fft_plan_cache_size);
+     maxwell_set_kpG_on_the_fly(mdata, kpg_on_the_flyp);
+     if (fft_wisdom_file[0] && (!fft_wisdom_fname ||
+				strcmp(fft_wisdom_file, fft_wisdom_fname))) {
+	  free(fft_wisdom_fname);
+	  CHK_MALLOC(fft_wisdom_fname, char, strlen(fft_wisdom_file) + 1);
+	  strcpy(fft_wisdom_fname, fft_wisdom_file);
+	  if (maxwell_import_fft_wisdom(fft_wisdom_fname))
+	       mpi_one_printf("Read FFTW wisdom from \"%s\".\n",
+			      fft_wisdom_fname);
+     }
+
      if (target_freq != 0.0)
 	  mtdata = create_maxwell_target_data(mdata, target_freq);
      else
@@ -491,15 +636,11 @@ void init_params(integer p, boolean reset_fields)
 	  mpi_one_printf("Allocating fields...\n");
 	  H = create_evectmatrix(nx * ny * nz, 2, num_bands,
 				 local_N, N_start, alloc_N);
-	  nwork_alloc = eigensolver_nwork + (mdata->mu_inv!=NULL);
+	  nwork_alloc = eigensolver_nwork_needed(mdata->mu_inv!=NULL);
+	  CHECK(nwork_alloc <= MAX_NWORK, "too many work arrays");
 	  for (i = 0; i < nwork_alloc; ++i)
 	       W[i] = create_evectmatrix(nx * ny * nz, 2, block_size,
 					 local_N, N_start, alloc_N);
-	  if (block_size < num_bands)
-	       Hblock = create_evectmatrix(nx * ny * nz, 2, block_size,
-					   local_N, N_start, alloc_N);
-	  else
-	       Hblock = H;
           if (using_mup() && block_size < num_bands) {
               muinvH = create_evectmatrix(nx * ny * nz, 2, num_bands,
                                           local_N, N_start, alloc_N);
@@ -531,6 +672,9 @@ void init_params(integer p, boolean reset_fields)
      }
 
      evectmatrix_flops = eigensolver_flops; /* reset, if changed */
+
+     prof_reset(prof_totals);
+     prof_totals_nk = 0;
 }
 
 boolean using_mup(void)
@@ -558,41 +702,258 @@ typedef struct {
 static void deflation_constraint(evectmatrix X, void *data)
 {
      deflation_data *d = (deflation_data *) data;
+     prof_clock_t prof_start = 0;
 
      CHECK(X.n == d->BY.n && d->BY.p >= d->p && d->Y.p >= d->p,
            "invalid dimensions");
 
+     PROF_START(prof_start);
+
      /* compute (1 - Y (BY)t) X = (1 - Y Yt B) X
           = projection of X so that Yt B X = 0 */
 
-     /* (Sigh...call the BLAS functions directly since we are not
-	using all the columns of BY...evectmatrix is not set up for
-	this case.) */
-
      /* compute S = Xt BY (i.e. all the dot products): */
      blasglue_gemm('C', 'N', X.p, d->p, X.n,
-		   1.0, X.data, X.p, d->BY.data, d->BY.p, 0.0, d->S2, d->p);
+		   1.0, X.data, X.fd, d->BY.data, d->BY.fd, 0.0, d->S2, d->p);
      mpi_allreduce(d->S2, d->S, d->p * X.p * SCALAR_NUMVALS,
 		   real, SCALAR_MPI_TYPE, MPI_SUM, mpb_comm);
 
      /* compute X = X - Y*St = (1 - BY Yt B) X */
      blasglue_gemm('N', 'C', X.n, X.p, d->p,
-		   -1.0, d->Y.data, d->Y.p, d->S, d->p,
-		   1.0, X.data, X.p);
+		   -1.0, d->Y.data, d->Y.fd, d->S, d->p,
+		   1.0, X.data, X.fd);
+
+     PROF_STOP(PROF_DEFLATION, prof_start,
+	       2 * X.n * (double) (X.p + d->p) * sizeof(scalar));
 }
 
 /**************************************************************************/
 
+/* Print the column labels for the lines of print_profile. */
+static void print_profile_header(const char *name, const char *index_name)
+{
+     int i;
+     mpi_one_printf("%s%s:, %s", parity_string(mdata), name, index_name);
+     for (i = 0; i < PROF_NUM_PHASES; ++i)
+	  mpi_one_printf(", %s time, %s calls, %s bytes",
+			 prof_phase_name(i), prof_phase_name(i),
+			 prof_phase_name(i));
+     mpi_one_printf("\n");
+}
+
+/* Print the counters c, combined over all processes, on one line. */
+static void print_profile(const char *name, int index, const prof_counter *c)
+{
+     prof_counter sum[PROF_NUM_PHASES];
+     int i, prof_enabled_save = prof_enabled;
+
+     prof_enabled = 0; /* don't count our own reductions */
+     prof_allreduce(c, sum);
+     prof_enabled = prof_enabled_save;
+
+     mpi_one_printf("%s%s:, %d", parity_string(mdata), name, index);
+     for (i = 0; i < PROF_NUM_PHASES; ++i)
+	  mpi_one_printf(", %g, %g, %g",
+			 sum[i].time, sum[i].count, sum[i].bytes);
+     mpi_one_printf("\n");
+}
+
+void display_profile_total(void)
+{
+     if (!mdata) {
+	  mpi_one_fprintf(stderr,
+			  "init-params must be called before "
+			  "display-profile-total!\n");
+	  return;
+     }
+     print_profile_header("profile-total", "# k points");
+     print_profile("profile-total", prof_totals_nk, prof_totals);
+}
+
+/* Print the memory statistics of scratch_arena since init-params: the
+   maximum number of bytes in use at once (the high-water mark) and the
+   number of bytes allocated (in use or cached), which are the maxima
+   over the processes, and the number of allocations and the fraction
+   of them that reused cached memory. */
+void display_scratch_memory(void)
+{
+     double mem[2], mem_max[2];
+
+     mem[0] = scratch_arena.high_water;
+     mem[1] = scratch_arena.bytes_held;
+     mpi_allreduce(mem, mem_max, 2, double, MPI_DOUBLE, MPI_MAX, mpb_comm);
+     mpi_one_printf("scratch-memory:, high-water bytes, allocated bytes, "
+		    "allocations, reused fraction\n");
+     mpi_one_printf("scratch-memory:, %g, %g, %g, %g\n",
+		    mem_max[0], mem_max[1], scratch_arena.nalloc,
+		    scratch_arena.nalloc > 0 ?
+		    scratch_arena.nreuse / scratch_arena.nalloc : 0.0);
+}
+
+/**************************************************************************/
+
+/* Before solving at a new k point, predict the solutions from those of
+   the previous k point(s), according to k_point_predictor.  old_k is
+   the (Cartesian) k of the previous k point, whose transverse basis H
+   is expressed in, and mdata is already updated for the new k. */
+static void predict_fields(const real old_k[3])
+{
+     real dk0[3], dk1[3], dot = 0, norm0 = 0, norm1 = 0;
+     int i, extrapolated = 0;
+
+     if (!H_solved) {  /* nothing to predict from */
+	  Hprev_valid = 0;
+	  return;
+     }
+
+     /* The same fields have different coefficients in the transverse
+	basis of the new k, and it is the fields that vary smoothly with
+	k, so that their coefficients are the better initial guess: */
+     maxwell_change_k_basis(mdata, H, old_k);
+
+     if (k_point_predictor != PREDICT_EXTRAPOLATE)
+	  return;
+
+     if (!Hprev.data)
+	  Hprev = create_evectmatrix(H.N, H.c, H.p,
+				     H.localN, H.Nstart, H.allocN);
+
+     if (Hprev_valid) {
+	  maxwell_change_k_basis(mdata, Hprev, old_k);
+	  for (i = 0; i < 3; ++i) {
+	       dk0[i] = old_k[i] - Hprev_k[i];
+	       dk1[i] = mdata->current_k[i] - old_k[i];
+	       dot += dk0[i] * dk1[i];
+	       norm0 += dk0[i] * dk0[i];
+	       norm1 += dk1[i] * dk1[i];
+	  }
+
+	  /* Only extrapolate linearly along (nearly) straight segments
+	     of the k path, e.g. not around the corners of the Brillouin
+	     zone, and not more than twice the previous step; t is the
+	     new step relative to the previous one. */
+	  if (dot > 0 && dot * dot >= 0.81 * norm0 * norm1
+	      && dot <= 2 * norm0) {
+	       real t = dot / norm0;
+	       if (eigensolver_extrapolate(Hprev, H, t, 0.5) >= 0.5) {
+		    evectmatrix swap = H;
+		    if (muinvH.data == H.data)
+			 muinvH = Hprev;
+		    H = Hprev;
+		    Hprev = swap;
+		    extrapolated = 1;
+	       }
+	  }
+     }
+
+     if (!extrapolated)
+	  evectmatrix_copy(Hprev, H);
+     for (i = 0; i < 3; ++i)
+	  Hprev_k[i] = old_k[i];
+     Hprev_valid = 1;
+}
+
+/* After solving, print the bands whose eigenvectors overlap the most
+   with a different band at the previous k point (Hprev), i.e. the band
+   crossings (or anti-crossings) between the two k points. */
+static void print_band_crossings(void)
+{
+     int *match, ib;
+     real *overlap, subspace_overlap;
+
+     ARENA_MALLOC(&scratch_arena, match, int, num_bands);
+     ARENA_MALLOC(&scratch_arena, overlap, real, num_bands);
+
+     subspace_overlap = eigensolver_match_bands(Hprev, H, match, overlap);
+     for (ib = 0; ib < num_bands; ++ib)
+	  if (match[ib] != ib && overlap[ib] > 0.5)
+	       mpi_one_printf("Band %d was band %d at the previous k point "
+			      "(overlap %g).\n",
+			      ib + 1, match[ib] + 1, overlap[ib]);
+     if (subspace_overlap < 0.5)
+	  mpi_one_printf("Bands changed from the previous k point "
+			 "(subspace overlap %g); the k points may be "
+			 "too far apart to follow the bands.\n",
+			 subspace_overlap);
+
+     arena_free(&scratch_arena, overlap);
+     arena_free(&scratch_arena, match);
+}
+
+/* Print the "freqs:" and "eigenvalues:" lines for the next k index,
+   for the k point kvector with the given eigenvalues, storing the
+   frequencies and eigenvalues in freqs_out and eigs_out (of length
+   num_bands). */
+static void print_freqs(vector3 kvector, const real *eigvals,
+			number *freqs_out, number *eigs_out)
+{
+     int i;
+
+     set_kpoint_index(kpoint_index + 1);
+
+     mpi_one_printf("%sfreqs:, %d, %g, %g, %g, %g",
+		    parity_string(mdata),
+		    kpoint_index, kvector.x, kvector.y, kvector.z,
+		    vector3_norm(matrix3x3_vector3_mult(Gm, kvector)));
+     for (i = 0; i < num_bands; ++i) {
+	  freqs_out[i] =
+	       negative_epsilon_okp ? eigvals[i] : sqrt(eigvals[i]);
+	  mpi_one_printf(", %g", freqs_out[i]);
+     }
+     mpi_one_printf("\n");
+
+     mpi_one_printf("%seigenvalues:, %d, %g, %g, %g, %g",
+		    parity_string(mdata),
+		    kpoint_index, kvector.x, kvector.y, kvector.z,
+		    vector3_norm(matrix3x3_vector3_mult(Gm, kvector)));
+     for (i = 0; i < num_bands; ++i) {
+	  eigs_out[i] = eigvals[i];
+	  mpi_one_printf(", %g", eigs_out[i]);
+     }
+     mpi_one_printf("\n");
+}
+
+/* Numbers identifying the problem at the current k point, so that an
+   eigensolver checkpoint (see evectmatrixio_checkpoint) is not resumed
+   for a different one: the k vector, the parity, the target frequency
+   (if any), and checksums of eps_inv and mu_inv (the sums over the grid
+   of their traces and of the squared traces). */
+#define CHECKPOINT_NID 9
+static void get_checkpoint_id(real id[CHECKPOINT_NID])
+{
+     int i, j;
+
+     for (i = 0; i < 3; ++i)
+	  id[i] = mdata->current_k[i];
+     id[3] = mdata->parity;
+     id[4] = mtdata ? mtdata->target_frequency : 0;
+     for (j = 0; j < 2; ++j) {
+	  symmetric_matrix *m = j ? mdata->mu_inv : mdata->eps_inv;
+	  real sum = 0, sum2 = 0;
+	  if (m)
+	       for (i = 0; i < mdata->fft_output_size; ++i) {
+		    real tr = m[i].m00 + m[i].m11 + m[i].m22;
+		    sum += tr;
+		    sum2 += tr * tr;
+	       }
+	  mpi_allreduce_1(&sum, real, SCALAR_MPI_TYPE, MPI_SUM, mpb_comm);
+	  mpi_allreduce_1(&sum2, real, SCALAR_MPI_TYPE, MPI_SUM, mpb_comm);
+	  id[5 + 2*j] = sum;
+	  id[6 + 2*j] = sum2;
+     }
+}
+
 /* Solve for the bands at a given k point.
    Must only be called after init_params! */
 void solve_kpoint(vector3 kvector)
 {
-     int i, total_iters = 0, ib, ib0;
+     int i, total_iters = 0, ib, ib0, deflate;
      real *eigvals;
-     real k[3];
+     real k[3], old_k[3];
      int flags;
      deflation_data deflation;
      int prev_parity;
+     real ckid[CHECKPOINT_NID];
 
      /* if we get too close to singular k==0 point, just set k=0
 	to exploit our special handling of this k */
@@ -627,45 +988,56 @@ void solve_kpoint(vector3 kvector)
 		      i + 1);
 	  printf("\n");
      }
+     if (!kpoint_index && profilep)
+	  print_profile_header("profile", "k index");
+
+     prof_reset(prof_counters);
+     prof_enabled = profilep;
 
      prev_parity = mdata->parity;
      cur_kvector = kvector;
      vector3_to_arr(k, kvector);
+     for (i = 0; i < 3; ++i)
+	  old_k[i] = mdata->current_k[i];
      update_maxwell_data_k(mdata, k, G[0], G[1], G[2]);
      CHECK(mdata->parity == prev_parity,
 	   "k vector is incompatible with specified parity");
 
-     CHK_MALLOC(eigvals, real, num_bands);
+     if (k_point_predictor != PREDICT_NONE)
+	  predict_fields(old_k);
+
+     ARENA_MALLOC(&scratch_arena, eigvals, real, num_bands);
 
      flags = eigensolver_flags; /* ctl file input variable */
      if (verbose)
 	  flags |= EIGS_VERBOSE;
 
      /* constant (zero frequency) bands at k=0 are handled specially,
-        so remove them from the solutions for the eigensolver: */
-     if (mdata->zero_k && !mtdata) {
-	  int in, ip;
+        so exclude them from the solutions for the eigensolver: */
+     if (mdata->zero_k && !mtdata)
 	  ib0 = maxwell_zero_k_num_const_bands(H, mdata);
-	  for (in = 0; in < H.n; ++in)
-	       for (ip = 0; ip < H.p - ib0; ++ip)
-		    H.data[in * H.p + ip] = H.data[in * H.p + ip + ib0];
-	  evectmatrix_resize(&H, H.p - ib0, 1);
-     }
      else
 	  ib0 = 0; /* solve for all bands */
 
-     /* Set up deflation data: */
-     if (muinvH.data != Hblock.data) {
-          deflation.Y = H;
-          deflation.BY = muinvH.data != H.data ? muinvH : H;
+     /* Set up deflation data, if we solve in more than one block: */
+     deflate = num_bands - ib0 > block_size;
+     if (deflate) {
+          deflation.Y = evectmatrix_view(H, ib0, num_bands - ib0);
+          deflation.BY = muinvH.data != H.data ? muinvH : deflation.Y;
 	  deflation.p = 0;
-	  CHK_MALLOC(deflation.S, scalar, H.p * Hblock.p);
-	  CHK_MALLOC(deflation.S2, scalar, H.p * Hblock.p);
+	  ARENA_MALLOC(&scratch_arena, deflation.S, scalar, H.p * block_size);
+	  ARENA_MALLOC(&scratch_arena, deflation.S2, scalar, H.p * block_size);
      }
 
-     for (ib = ib0; ib < num_bands; ib += Hblock.alloc_p) {
+     if (eigensolver_checkpoint_file[0])
+	  get_checkpoint_id(ckid);
+
+     for (ib = ib0; ib < num_bands; ib += block_size) {
 	  evectconstraint_chain *constraints;
 	  int num_iters;
+	  char *ckname = NULL;
+	  evectmatrixio_checkpoint_data ckdata;
+	  evectmatrix Hblock;
 
 	  /* don't solve for too many bands if the block size doesn't divide
 	     the number of bands: */
@@ -673,12 +1045,29 @@ void solve_kpoint(vector3 kvector)
 	       maxwell_set_num_bands(mdata, num_bands - ib);
 	       for (i = 0; i < nwork_alloc; ++i)
 		    evectmatrix_resize(&W[i], num_bands - ib, 0);
-	       evectmatrix_resize(&Hblock, num_bands - ib, 0);
 	  }
 
+	  /* the eigensolver works in place on the columns of H for
+	     the current block: */
+	  Hblock = evectmatrix_view(H, ib, mdata->num_bands);
+
 	  mpi_one_printf("Solving for bands %d to %d...\n",
 			 ib + 1, ib + Hblock.p);
 
+	  /* checkpoint file for this block, e.g. "foo.tek03.b01.h5"; if
+	     it exists (from a preempted run), the CG solver resumes from it */
+	  if (eigensolver_checkpoint_file[0]) {
+	       CHK_MALLOC(ckname, char,
+			  strlen(eigensolver_checkpoint_file)
+			  + strlen(parity_string(mdata)) + 32);
+	       sprintf(ckname, "%s.%sk%02d.b%02d.h5",
+		       eigensolver_checkpoint_file, parity_string(mdata),
+		       kpoint_index + 1, ib / block_size + 1);
+	       ckdata.fname = ckname;
+	       ckdata.id = ckid;
+	       ckdata.nid = CHECKPOINT_NID;
+	  }
+
 	  constraints = NULL;
 	  constraints = evect_add_constraint(constraints,
 					     maxwell_parity_constraint,
@@ -689,18 +1078,14 @@ void solve_kpoint(vector3 kvector)
 						  maxwell_zero_k_constraint,
 						  (void *) mdata);
 
-	  if (Hblock.data != H.data) {  /* initialize fields of block from H */
-	       int in, ip;
-	       for (in = 0; in < Hblock.n; ++in)
-		    for (ip = 0; ip < Hblock.p; ++ip)
-			 Hblock.data[in * Hblock.p + ip] =
-			      H.data[in * H.p + ip + (ib-ib0)];
+	  if (deflate) {
 	       deflation.p = ib-ib0;
 	       if (deflation.p > 0) {
-                    if (deflation.BY.data != H.data) {
+                    if (deflation.BY.data != deflation.Y.data) {
                         evectmatrix_resize(&deflation.BY, deflation.p, 0);
-                        maxwell_muinv_operator(H, deflation.BY, (void *) mdata,
-                                               1, deflation.BY);
+                        maxwell_muinv_operator(
+			     evectmatrix_view(deflation.Y, 0, deflation.p),
+			     deflation.BY, (void *) mdata, 1, deflation.BY);
                     }
 		    constraints = evect_add_constraint(constraints,
 						       deflation_constraint,
@@ -710,10 +1095,24 @@ void solve_kpoint(vector3 kvector)
 
 	  if (mtdata) {  /* solving for bands near a target frequency */
                CHECK(mdata->mu_inv==NULL, "targeted solver doesn't handle mu");
-               if (eigensolver_davidsonp)
+               if (eigensolver_jdp)
+		    eigensolver_jacobi_davidson(
+			 Hblock, eigvals + ib,
+			 maxwell_operator, (void *) mdata,
+			 simple_preconditionerp ?
+			 maxwell_preconditioner :
+			 maxwell_preconditioner2,
+			 (void *) mdata,
+			 evectconstraint_chain_func,
+			 (void *) constraints,
+			 W, nwork_alloc, target_freq * target_freq,
+			 eigensolver_jd_inner_iters,
+			 tolerance, &num_iters, flags);
+	       else if (eigensolver_davidsonp)
 		    eigensolver_davidson(
 			 Hblock, eigvals + ib,
 			 maxwell_target_operator, (void *) mtdata,
+			 NULL, NULL,
 			 simple_preconditionerp ? 
 			 maxwell_target_preconditioner :
 			 maxwell_target_preconditioner2,
@@ -721,8 +1120,28 @@ void solve_kpoint(vector3 kvector)
 			 evectconstraint_chain_func,
 			 (void *) constraints,
 			 W, nwork_alloc, tolerance, &num_iters, flags, 0.0);
+	       else if (eigensolver_chebyshevp)
+		    eigensolver_chebyshev(
+			 Hblock, eigvals + ib,
+			 maxwell_target_operator, (void *) mtdata,
+			 evectconstraint_chain_func,
+			 (void *) constraints,
+			 W, nwork_alloc, eigensolver_chebyshev_degree,
+			 tolerance, &num_iters, flags);
+	       else if (eigensolver_lobpcgp)
+		    eigensolver_lobpcg(
+			 Hblock, eigvals + ib,
+			 maxwell_target_operator, (void *) mtdata,
+			 NULL, NULL,
+			 simple_preconditionerp ?
+			 maxwell_target_preconditioner :
+			 maxwell_target_preconditioner2,
+			 (void *) mtdata,
+			 evectconstraint_chain_func,
+			 (void *) constraints,
+			 W, nwork_alloc, tolerance, &num_iters, flags);
 	       else
-		   eigensolver(Hblock, eigvals + ib,
+		   eigensolver_lagrange(Hblock, eigvals + ib,
 				maxwell_target_operator, (void *) mtdata,
                                 NULL, NULL,
 				simple_preconditionerp ? 
@@ -731,7 +1150,11 @@ void solve_kpoint(vector3 kvector)
 				(void *) mtdata,
 				evectconstraint_chain_func,
 				(void *) constraints,
-				W, nwork_alloc, tolerance, &num_iters, flags);
+				0, 0, 0,
+				W, nwork_alloc, tolerance, &num_iters, flags,
+				ckname ? evectmatrixio_checkpoint : NULL,
+				(void *) &ckdata,
+				eigensolver_checkpoint_interval);
 
 	       /* now, diagonalize the real Maxwell operator in the
 		  solution subspace to get the true eigenvalues and
@@ -741,11 +1164,12 @@ void solve_kpoint(vector3 kvector)
 					 maxwell_operator,mdata, W[0],W[1]);
 	  }
 	  else {
-               if (eigensolver_davidsonp) {
-                    CHECK(mdata->mu_inv==NULL, "Davidson doesn't handle mu");
+               if (eigensolver_davidsonp)
 		    eigensolver_davidson(
 			 Hblock, eigvals + ib,
 			 maxwell_operator, (void *) mdata,
+			 mdata->mu_inv ? maxwell_muinv_operator : NULL,
+			 (void *) mdata,
 			 simple_preconditionerp ?
 			 maxwell_preconditioner :
 			 maxwell_preconditioner2,
@@ -753,9 +1177,32 @@ void solve_kpoint(vector3 kvector)
 			 evectconstraint_chain_func,
 			 (void *) constraints,
 			 W, nwork_alloc, tolerance, &num_iters, flags, 0.0);
-               }
+	       else if (eigensolver_chebyshevp) {
+		    CHECK(mdata->mu_inv == NULL,
+			  "Chebyshev eigensolver doesn't handle mu");
+		    eigensolver_chebyshev(
+			 Hblock, eigvals + ib,
+			 maxwell_operator, (void *) mdata,
+			 evectconstraint_chain_func,
+			 (void *) constraints,
+			 W, nwork_alloc, eigensolver_chebyshev_degree,
+			 tolerance, &num_iters, flags);
+	       }
+	       else if (eigensolver_lobpcgp)
+		    eigensolver_lobpcg(
+			 Hblock, eigvals + ib,
+			 maxwell_operator, (void *) mdata,
+			 mdata->mu_inv ? maxwell_muinv_operator : NULL,
+			 (void *) mdata,
+			 simple_preconditionerp ?
+			 maxwell_preconditioner :
+			 maxwell_preconditioner2,
+			 (void *) mdata,
+			 evectconstraint_chain_func,
+			 (void *) constraints,
+			 W, nwork_alloc, tolerance, &num_iters, flags);
 	       else
-  		    eigensolver(Hblock, eigvals + ib,
+  		    eigensolver_lagrange(Hblock, eigvals + ib,
 				maxwell_operator, (void *) mdata,
                                 mdata->mu_inv ? maxwell_muinv_operator : NULL,
                                 (void *) mdata,
@@ -765,50 +1212,50 @@ void solve_kpoint(vector3 kvector)
 				(void *) mdata,
 				evectconstraint_chain_func,
 				(void *) constraints,
-				W, nwork_alloc, tolerance, &num_iters, flags);
-	  }
-	  
-	  if (Hblock.data != H.data) {  /* save solutions of current block */
-	       int in, ip;
-	       for (in = 0; in < Hblock.n; ++in)
-		    for (ip = 0; ip < Hblock.p; ++ip)
-			 H.data[in * H.p + ip + (ib-ib0)] =
-			      Hblock.data[in * Hblock.p + ip];
+				0, 0, 0,
+				W, nwork_alloc, tolerance, &num_iters, flags,
+				ckname ? evectmatrixio_checkpoint : NULL,
+				(void *) &ckdata,
+				eigensolver_checkpoint_interval);
 	  }
 
 	  evect_destroy_constraints(constraints);
+
+	  if (ckname) {  /* block is done; its checkpoint is obsolete */
+	       if (mpi_is_master())
+		    remove(ckname);
+	       free(ckname);
+	  }
 	  
 	  mpi_one_printf("Finished solving for bands %d to %d after "
 			 "%d iterations.\n", ib + 1, ib + Hblock.p, num_iters);
 	  total_iters += num_iters * Hblock.p;
      }
 
-     if (num_bands - ib0 > Hblock.alloc_p)
+     if (deflate)
 	  mpi_one_printf("Finished k-point with %g mean iterations/band.\n",
 			 total_iters * 1.0 / num_bands);
 
      /* Manually put in constant (zero-frequency) solutions for k=0: */
      if (mdata->zero_k && !mtdata) {
-	  int in, ip;
-	  evectmatrix_resize(&H, H.alloc_p, 1);
-	  for (in = 0; in < H.n; ++in)
-	       for (ip = H.p - ib0 - 1; ip >= 0; --ip)
-		    H.data[in * H.p + ip + ib0] = H.data[in * H.p + ip];
 	  maxwell_zero_k_set_const_bands(H, mdata);
 	  for (ib = 0; ib < ib0; ++ib)
 	       eigvals[ib] = 0;
      }
+     H_solved = 1;
+
+     if (k_point_predictor == PREDICT_EXTRAPOLATE && Hprev_valid)
+	  print_band_crossings();
 
      /* Reset scratch matrix sizes: */
-     evectmatrix_resize(&Hblock, Hblock.alloc_p, 0);
      for (i = 0; i < nwork_alloc; ++i)
 	  evectmatrix_resize(&W[i], W[i].alloc_p, 0);
-     maxwell_set_num_bands(mdata, Hblock.alloc_p);
+     maxwell_set_num_bands(mdata, block_size);
 
      /* Destroy deflation data: */
-     if (H.data != Hblock.data) {
-	  free(deflation.S2);
-	  free(deflation.S);
+     if (deflate) {
+	  arena_free(&scratch_arena, deflation.S2);
+	  arena_free(&scratch_arena, deflation.S);
      }
 
      if (num_write_output_vars > 0) {
@@ -828,33 +1275,227 @@ void solve_kpoint(vector3 kvector)
      eigenvalues.num_items = num_bands;
      CHK_MALLOC(eigenvalues.items, number, eigenvalues.num_items);
 
-     set_kpoint_index(kpoint_index + 1);
+     print_freqs(kvector, eigvals, freqs.items, eigenvalues.items);
 
-     mpi_one_printf("%sfreqs:, %d, %g, %g, %g, %g",
-		    parity,
-		    kpoint_index, (double)k[0], (double)k[1], (double)k[2],
-		    vector3_norm(matrix3x3_vector3_mult(Gm, kvector)));
+     if (prof_enabled) {
+	  prof_enabled = 0;
+	  prof_accumulate(prof_totals, prof_counters);
+	  ++prof_totals_nk;
+	  print_profile("profile", kpoint_index, prof_counters);
+     }
+
+     eigensolver_flops = evectmatrix_flops;
+
+     arena_free(&scratch_arena, eigvals);
+}
+
+/**************************************************************************/
+
+/* k.p interpolation of the bands, for dense band structures (see
+   kdotp-step in mpb.scm).  After solving at a k point,
+   kdotp_save_model builds the k.p model of the bands in the basis of
+   the eigenvectors (see maxwell_kdotp.c); kdotp_interpolate then
+   computes the bands at any k point between the last two such k
+   points from their models, at the cost of diagonalizing a
+   num_bands x num_bands matrix.
+
+   The models are exact at their own k points, and their error grows
+   quadratically away from them (mainly from the coupling to the
+   bands that are not in the basis).  Since we know the error of
+   each model at the other k point, we add a correction growing
+   quadratically along the segment to match it, and interpolate
+   linearly between the two corrected models, whose difference serves
+   as an estimate of the error. */
+
+/* Build the k.p model at the current k point, after solve-kpoint.
+   (Guile-callable.) */
+void kdotp_save_model(void)
+{
+     real *ev;
+     int i;
+
+     if (!mdata) {
+	  mpi_one_fprintf(stderr, "init-params must be called first!\n");
+	  return;
+     }
+     if (!H_solved || eigenvalues.num_items != num_bands) {
+	  mpi_one_fprintf(stderr,
+			  "solve-kpoint must be called before "
+			  "kdotp-save-model!\n");
+	  return;
+     }
+     if (mdata->mu_inv) {
+	  mpi_one_fprintf(stderr, "k.p models are not supported with mu\n");
+	  return;
+     }
+
+     /* shift the previous model, if any, to kdotp[0]: */
+     destroy_maxwell_kdotp_model(kdotp[0].model);
+     free(kdotp[0].eigenvals);
+     free(kdotp[0].correction);
+     kdotp[0] = kdotp[1];
+
+     CHK_MALLOC(kdotp[1].eigenvals, real, num_bands);
+     CHK_MALLOC(kdotp[1].correction, real, num_bands);
      for (i = 0; i < num_bands; ++i) {
-	  freqs.items[i] =
-	       negative_epsilon_okp ? eigvals[i] : sqrt(eigvals[i]);
-	  mpi_one_printf(", %g", freqs.items[i]);
+	  kdotp[1].eigenvals[i] = eigenvalues.items[i];
+	  kdotp[1].correction[i] = 0;
      }
-     mpi_one_printf("\n");
+     kdotp[1].model = create_maxwell_kdotp_model(mdata, H,
+						 kdotp[1].eigenvals, W[0]);
 
-     mpi_one_printf("%seigenvalues:, %d, %g, %g, %g, %g",
-		    parity,
-		    kpoint_index, (double)k[0], (double)k[1], (double)k[2],
-		    vector3_norm(matrix3x3_vector3_mult(Gm, kvector)));
+     if (!kdotp[0].model)
+	  return;
+
+     /* the corrections: the exact eigenvalues at each k point minus
+	those of the model of the other k point */
+     ARENA_MALLOC(&scratch_arena, ev, real, num_bands);
+     maxwell_kdotp_eigenvals(kdotp[0].model, kdotp[1].model->k0, ev);
+     for (i = 0; i < num_bands; ++i)
+	  kdotp[0].correction[i] = kdotp[1].eigenvals[i] - ev[i];
+     maxwell_kdotp_eigenvals(kdotp[1].model, kdotp[0].model->k0, ev);
+     for (i = 0; i < num_bands; ++i)
+	  kdotp[1].correction[i] = kdotp[0].eigenvals[i] - ev[i];
+     arena_free(&scratch_arena, ev);
+}
+
+static real eigenval_to_freq(real lambda)
+{
+     if (negative_epsilon_okp)
+	  return lambda;
+     return lambda > 0 ? sqrt(lambda) : 0.0;
+}
+
+/* Interpolate the bands at kvector (which should be between the last
+   two k points of kdotp_save_model) and print them in the same
+   "freqs:" format as solve-kpoint, returning the list of frequencies,
+   unless the estimated error of any frequency is greater than
+   tolerance, in which case nothing is printed and the empty list is
+   returned (so that the caller can solve for the k point instead).
+   The fields and the output variables are not changed.
+   (Guile-callable.) */
+number_list kdotp_interpolate(vector3 kvector, number tolerance)
+{
+     number_list fs;
+     number *eigs;
+     real k[3], *ka, *kb, *la, *lb, *ev;
+     real dot = 0, norm = 0, t, err = 0;
+     int i;
+
+     fs.num_items = 0;  fs.items = (number *) NULL;
+
+     if (!mdata || !kdotp[0].model) {
+	  mpi_one_fprintf(stderr, "kdotp-save-model must be called at "
+			  "two k points before kdotp-interpolate!\n");
+	  return fs;
+     }
+
+     if (vector3_norm(kvector) < 1e-10)  /* as in solve_kpoint */
+	  kvector.x = kvector.y = kvector.z = 0;
+
+     /* the cartesian k (as in update_maxwell_data_k), and its position
+	t along the segment between the k points of the models: */
+     for (i = 0; i < 3; ++i)
+	  k[i] = G[0][i] * kvector.x + G[1][i] * kvector.y
+	       + G[2][i] * kvector.z;
+     ka = kdotp[0].model->k0;
+     kb = kdotp[1].model->k0;
+     for (i = 0; i < 3; ++i) {
+	  dot += (k[i] - ka[i]) * (kb[i] - ka[i]);
+	  norm += (kb[i] - ka[i]) * (kb[i] - ka[i]);
+     }
+     t = norm > 0 ? dot / norm : 0;
+     t = MAX2(0, MIN2(1, t));
+
+     ARENA_MALLOC(&scratch_arena, la, real, num_bands);
+     ARENA_MALLOC(&scratch_arena, lb, real, num_bands);
+     ARENA_MALLOC(&scratch_arena, ev, real, num_bands);
+
+     maxwell_kdotp_eigenvals(kdotp[0].model, k, la);
+     maxwell_kdotp_eigenvals(kdotp[1].model, k, lb);
      for (i = 0; i < num_bands; ++i) {
-	  eigenvalues.items[i] = eigvals[i];
-	  mpi_one_printf(", %g", eigenvalues.items[i]);
+	  real e;
+	  la[i] += kdotp[0].correction[i] * t * t;
+	  lb[i] += kdotp[1].correction[i] * (1 - t) * (1 - t);
+	  ev[i] = (1 - t) * la[i] + t * lb[i];
+	  if (!negative_epsilon_okp && ev[i] < 0)
+	       ev[i] = 0;
+	  e = fabs(eigenval_to_freq(la[i]) - eigenval_to_freq(lb[i]));
+	  err = MAX2(err, e);
      }
-     mpi_one_printf("\n");
 
+     if (err > tolerance)
+	  mpi_one_printf("kdotp-interpolate (%g,%g,%g): estimated error "
+			 "%g is too large\n",
+			 kvector.x, kvector.y, kvector.z, err);
+     else {
+	  mpi_one_printf("kdotp-interpolate (%g,%g,%g): estimated error "
+			 "%g\n", kvector.x, kvector.y, kvector.z, err);
+	  fs.num_items = num_bands;
+	  CHK_MALLOC(fs.items, number, num_bands);
+	  ARENA_MALLOC(&scratch_arena, eigs, number, num_bands);
+	  print_freqs(kvector, ev, fs.items, eigs);
+	  arena_free(&scratch_arena, eigs);
+     }
 
-     eigensolver_flops = evectmatrix_flops;
+     arena_free(&scratch_arena, ev);
+     arena_free(&scratch_arena, lb);
+     arena_free(&scratch_arena, la);
+     return fs;
+}
 
-     free(eigvals);
+/* When kdotp_interpolate fails, the k point has to be solved after
+   all, but it lies behind the last solved k point, whose fields are
+   the better starting point for the next solve.  So, kdotp_save_fields
+   saves the fields (after solve-kpoint), and kdotp_restore_fields
+   restores them along with their k point.  (The output variables,
+   such as freqs, are not restored.)  (Guile-callable.) */
+void kdotp_save_fields(void)
+{
+     if (!mdata) {
+	  mpi_one_fprintf(stderr, "init-params must be called first!\n");
+	  return;
+     }
+     if (!H_solved) {
+	  mpi_one_fprintf(stderr,
+			  "solve-kpoint must be called before "
+			  "kdotp-save-fields!\n");
+	  return;
+     }
+     if (mdata->mu_inv) {
+	  mpi_one_fprintf(stderr, "k.p models are not supported with mu\n");
+	  return;
+     }
+
+     if (!kdotp_H.data)
+	  kdotp_H = create_evectmatrix(H.N, H.c, H.p,
+				       H.localN, H.Nstart, H.allocN);
+     evectmatrix_copy(kdotp_H, H);
+     kdotp_kvector = cur_kvector;
+     kdotp_H_valid = 1;
+}
+
+void kdotp_restore_fields(void)
+{
+     real k[3];
+     int prev_parity;
+
+     if (!mdata || !kdotp_H_valid) {
+	  mpi_one_fprintf(stderr, "kdotp-save-fields must be called before "
+			  "kdotp-restore-fields!\n");
+	  return;
+     }
+
+     prev_parity = mdata->parity;
+     cur_kvector = kdotp_kvector;
+     vector3_to_arr(k, kdotp_kvector);
+     update_maxwell_data_k(mdata, k, G[0], G[1], G[2]);
+     CHECK(mdata->parity == prev_parity,
+	   "k vector is incompatible with specified parity");
+     evectmatrix_copy(H, kdotp_H);
+     H_solved = 1;
+     Hprev_valid = 0; /* Hprev is from before the fallback solve */
+     curfield_reset();
 }
 
 /**************************************************************************/
@@ -909,22 +1550,29 @@ number_list compute_group_velocity_component(vector3 d)
 
      group_v.num_items = num_bands;
      CHK_MALLOC(group_v.items, number, group_v.num_items);
-     CHK_MALLOC(gv_scratch, real, group_v.num_items * 2);
+     ARENA_MALLOC(&scratch_arena, gv_scratch, real, group_v.num_items * 2);
      
      /* now, compute group_v.items = diag Re <H| curl 1/eps i u x |H>: */
 
      /* ...we have to do this in blocks of eigensolver_block_size since
 	the work matrix W[0] may not have enough space to do it all at once. */
      
-     for (ib = 0; ib < num_bands; ib += Hblock.alloc_p) {
+     for (ib = 0; ib < num_bands; ib += block_size) {
+	  evectmatrix Hblock;
 	  if (ib + mdata->num_bands > num_bands) {
 	       maxwell_set_num_bands(mdata, num_bands - ib);
-	       evectmatrix_resize(&W[0], num_bands - ib, 0);
-	       evectmatrix_resize(&Hblock, num_bands - ib, 0);
+	       for (i = 0; i < 2; ++i)
+		    evectmatrix_resize(&W[i], num_bands - ib, 0);
+	  }
+	  /* without mu, H is used in place; otherwise, W[1] = mu^-1 B: */
+	  if (mdata->mu_inv) {
+	       Hblock = W[1];
+	       maxwell_compute_H_from_B(mdata, H, Hblock,
+					(scalar_complex *) mdata->fft_data,
+					ib, 0, Hblock.p);
 	  }
-          maxwell_compute_H_from_B(mdata, H, Hblock,
-                                   (scalar_complex *) mdata->fft_data,
-                                   ib, 0, Hblock.p);
+	  else
+	       Hblock = evectmatrix_view(H, ib, mdata->num_bands);
 	  maxwell_ucross_op(Hblock, W[0], mdata, u);
 	  evectmatrix_XtY_diag_real(Hblock, W[0], gv_scratch,
 				    gv_scratch + group_v.num_items);
@@ -935,12 +1583,12 @@ number_list compute_group_velocity_component(vector3 d)
 	  }
      }
 
-     free(gv_scratch);
+     arena_free(&scratch_arena, gv_scratch);
 
      /* Reset scratch matrix sizes: */
-     evectmatrix_resize(&Hblock, Hblock.alloc_p, 0);
-     evectmatrix_resize(&W[0], W[0].alloc_p, 0);
-     maxwell_set_num_bands(mdata, Hblock.alloc_p);
+     for (i = 0; i < 2; ++i)
+	  evectmatrix_resize(&W[i], W[i].alloc_p, 0);
+     maxwell_set_num_bands(mdata, block_size);
 
      /* The group velocity is given by:
 
@@ -1007,20 +1655,173 @@ number compute_1_group_velocity_component(vector3 d, integer b)
      return group_v;
 }
 
+/* Divide the derivative of the eigenvalue of band ib by 2*omega, giving
+   the derivative of the frequency (or zero if omega is zero, in which
+   case it is undefined). */
+static real eigenval_deriv_to_freq(real dl, int ib)
+{
+     if (freqs.items[ib] == 0)
+	  return 0.0;
+     return dl * 0.5 / (negative_epsilon_okp ? sqrt(fabs(freqs.items[ib]))
+			: freqs.items[ib]);
+}
+
 /* returns group velocity for band b, in Cartesian coordinates */
 vector3 compute_1_group_velocity(integer b)
 {
-     vector3 v, d;
-     matrix3x3 RmT = matrix3x3_transpose(Rm);
-     d.x = 1; d.y = d.z = 0;
-     v.x = compute_1_group_velocity_component(matrix3x3_vector3_mult(RmT,d),b);
-     d.y = 1; d.x = d.z = 0;
-     v.y = compute_1_group_velocity_component(matrix3x3_vector3_mult(RmT,d),b);
-     d.z = 1; d.y = d.x = 0;
-     v.z = compute_1_group_velocity_component(matrix3x3_vector3_mult(RmT,d),b);
+     vector3 v = {0,0,0};
+     int ib = b - 1;
+     real grad[3];
+
+     curfield_reset();
+
+     if (!mdata) {
+	  mpi_one_fprintf(stderr, "init-params must be called first!\n");
+	  return v;
+     }
+     if (!kpoint_index) {
+	  mpi_one_fprintf(stderr, "solve-kpoint must be called first!\n");
+	  return v;
+     }
+
+     /* all three components come from a single eps_inv pass: */
+     evectmatrix_resize(&W[0], 1, 0);
+     maxwell_compute_H_from_B(mdata, H, W[0],
+                              (scalar_complex *) mdata->fft_data,
+                              ib, 0, 1);
+     maxwell_k_derivatives(mdata, W[0], NULL, grad, NULL);
+     evectmatrix_resize(&W[0], W[0].alloc_p, 0);
+
+     v.x = eigenval_deriv_to_freq(grad[0], ib);
+     v.y = eigenval_deriv_to_freq(grad[1], ib);
+     v.z = eigenval_deriv_to_freq(grad[2], ib);
      return v;
 }
 
+/* Return a list of the group velocity vector3's for all the bands, in
+   the cartesian basis (and units of c).  This computes all three
+   components at once, which is about three times faster than calling
+   compute_group_velocity_component for each direction. */
+vector3_list compute_group_velocities(void)
+{
+     vector3_list group_v;
+     real *grad;
+     int i, ib;
+
+     group_v.num_items = 0;  group_v.items = (vector3 *) NULL;
+
+     curfield_reset(); /* has the side effect of overwriting curfield scratch */
+
+     if (!mdata) {
+	  mpi_one_fprintf(stderr, "init-params must be called first!\n");
+	  return group_v;
+     }
+     if (!kpoint_index) {
+	  mpi_one_fprintf(stderr, "solve-kpoint must be called first!\n");
+	  return group_v;
+     }
+
+     ARENA_MALLOC(&scratch_arena, grad, real, 3 * num_bands);
+
+     if (mdata->mu_inv) {
+	  /* need H = mu^-1 B, in blocks as in
+	     compute_group_velocity_component: */
+	  for (ib = 0; ib < num_bands; ib += block_size) {
+	       if (ib + mdata->num_bands > num_bands) {
+		    maxwell_set_num_bands(mdata, num_bands - ib);
+		    evectmatrix_resize(&W[0], num_bands - ib, 0);
+	       }
+	       maxwell_compute_H_from_B(mdata, H, W[0],
+					(scalar_complex *) mdata->fft_data,
+					ib, 0, W[0].p);
+	       maxwell_k_derivatives(mdata, W[0], NULL, grad + 3*ib, NULL);
+	  }
+	  evectmatrix_resize(&W[0], W[0].alloc_p, 0);
+	  maxwell_set_num_bands(mdata, block_size);
+     }
+     else
+	  maxwell_k_derivatives(mdata, H, NULL, grad, NULL);
+
+     group_v.num_items = num_bands;
+     CHK_MALLOC(group_v.items, vector3, num_bands);
+     for (i = 0; i < num_bands; ++i) {
+	  group_v.items[i].x = eigenval_deriv_to_freq(grad[3*i], i);
+	  group_v.items[i].y = eigenval_deriv_to_freq(grad[3*i+1], i);
+	  group_v.items[i].z = eigenval_deriv_to_freq(grad[3*i+2], i);
+     }
+
+     arena_free(&scratch_arena, grad);
+     return group_v;
+}
+
+/* Return a list, one per band, of the second derivatives of the
+   frequency with respect to the (cartesian) k vector, i.e. the inverse
+   effective-mass tensors d^2 omega / dk_i dk_j (in units of c a / 2pi),
+   from second-order perturbation theory.  The sum over intermediate
+   states only includes the computed bands, so the higher bands
+   converge as num-bands is increased; there is no need to solve any
+   extra k-points, as with finite differences.  (Not supported with
+   mu, nor for degenerate bands, whose individual tensors are
+   ill-defined.) */
+matrix3x3_list compute_inverse_mass_tensors(void)
+{
+     matrix3x3_list mass;
+     real *grad, *hess, *eigvals;
+     int i;
+
+     mass.num_items = 0;  mass.items = (matrix3x3 *) NULL;
+
+     curfield_reset();
+
+     if (!mdata) {
+	  mpi_one_fprintf(stderr, "init-params must be called first!\n");
+	  return mass;
+     }
+     if (!kpoint_index) {
+	  mpi_one_fprintf(stderr, "solve-kpoint must be called first!\n");
+	  return mass;
+     }
+     if (mdata->mu_inv) {
+	  mpi_one_fprintf(stderr, "inverse mass tensors are not "
+			  "implemented for mu != 1\n");
+	  return mass;
+     }
+
+     ARENA_MALLOC(&scratch_arena, grad, real, 3 * num_bands);
+     ARENA_MALLOC(&scratch_arena, hess, real, 9 * num_bands);
+     ARENA_MALLOC(&scratch_arena, eigvals, real, num_bands);
+     for (i = 0; i < num_bands; ++i)
+	  eigvals[i] = negative_epsilon_okp ? freqs.items[i]
+	       : freqs.items[i] * freqs.items[i];
+
+     maxwell_k_derivatives(mdata, H, eigvals, grad, hess);
+
+     /* d^2 omega = (d^2 lambda - 2 d omega d omega) / 2 omega */
+     mass.num_items = num_bands;
+     CHK_MALLOC(mass.items, matrix3x3, num_bands);
+     for (i = 0; i < num_bands; ++i) {
+	  real v[3], m[3][3];
+	  int i1, i2;
+	  for (i1 = 0; i1 < 3; ++i1)
+	       v[i1] = eigenval_deriv_to_freq(grad[3*i + i1], i);
+	  for (i1 = 0; i1 < 3; ++i1)
+	       for (i2 = 0; i2 < 3; ++i2)
+		    m[i1][i2] = eigenval_deriv_to_freq(hess[9*i + 3*i1 + i2]
+						       - 2 * v[i1] * v[i2], i);
+	  mass.items[i].c0.x = m[0][0]; mass.items[i].c0.y = m[1][0];
+	  mass.items[i].c0.z = m[2][0];
+	  mass.items[i].c1.x = m[0][1]; mass.items[i].c1.y = m[1][1];
+	  mass.items[i].c1.z = m[2][1];
+	  mass.items[i].c2.x = m[0][2]; mass.items[i].c2.y = m[1][2];
+	  mass.items[i].c2.z = m[2][2];
+     }
+
+     arena_free(&scratch_arena, eigvals);
+     arena_free(&scratch_arena, hess);
+     arena_free(&scratch_arena, grad);
+     return mass;
+}
+
 /* as above, but returns "group velocity" given by gradient of
    frequency with respect to k in reciprocal coords ... this is useful
    for band optimization. */
@@ -18,6 +18,7 @@
 #ifndef MPB_H
 #define MPB_H
 
+#include <arena.h>
 #include <maxwell.h>
 #include <ctl-io.h>
 #include <ctlgeom.h>
@@ -46,14 +47,23 @@ extern real linear_interpolate(real rx, real ry, real rz,
 /* global variables for retaining data about the eigenvectors between
    calls from Guile: */
 
-#define MAX_NWORK 10
+#define MAX_NWORK 20
 extern int nwork_alloc;
+extern int block_size;
 
 #define NUM_FFT_BANDS 20 /* max number of bands to FFT at a time */
 
 extern maxwell_data *mdata;
 extern maxwell_target_data *mtdata;
-extern evectmatrix H, W[MAX_NWORK], Hblock;
+extern evectmatrix H, W[MAX_NWORK];
+extern arena scratch_arena;
+
+/* values of the k-point-predictor input variable (see solve_kpoint) */
+typedef enum {
+     PREDICT_NONE = 0, PREDICT_ROTATE = 1, PREDICT_EXTRAPOLATE = 2
+} k_point_predictors;
+
+extern void predict_fields_reset(void);
 
 extern vector3 cur_kvector;
 extern scalar_complex *curfield;
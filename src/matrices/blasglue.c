@@ -39,6 +39,7 @@
 
 #include "config.h"
 #include <check.h>
+#include <prof.h>
 
 #include "blasglue.h"
 #include "scalar.h"
@@ -97,6 +98,8 @@ extern void F(herk,HERK) (char *, char *, int *, int *,
 extern void F(syrk,SYRK) (char *, char *, int *, int *,
 			  real *, scalar *, int *,
 			  real *, scalar *, int *);
+extern void F(trsm,TRSM) (char *, char *, char *, char *, int *, int *,
+			  scalar *, scalar *, int *, scalar *, int *);
 extern void F(potrf,POTRF) (char *, int *, scalar *, int *, int *);
 extern void F(potri,POTRI) (char *, int *, scalar *, int *, int *);
 extern void F(hetrf,HETRF) (char *, int *, scalar *, int *,
@@ -196,8 +199,10 @@ void blasglue_gemm(char transa, char transb, int m, int n, int k,
      ASSIGN_REAL(alpha,a);
      ASSIGN_REAL(beta,b);
 
-     F(gemm,GEMM) (&transb, &transa, &n, &m, &k,
-		   &alpha, B, &fdB, A, &fdA, &beta, C, &fdC);
+     PROF_OP(PROF_GEMM, (m * (double) k + k * (double) n + m * (double) n)
+	     * sizeof(scalar),
+	     F(gemm,GEMM) (&transb, &transa, &n, &m, &k,
+			   &alpha, B, &fdB, A, &fdA, &beta, C, &fdC));
 }
 
 void blasglue_herk(char uplo, char trans, int n, int k,
@@ -221,14 +226,41 @@ void blasglue_herk(char uplo, char trans, int n, int k,
      trans = (trans == 'C' || trans == 'T') ? 'N' : 'C';
 
 #ifdef SCALAR_COMPLEX
-     F(herk,HERK) (&uplo, &trans, &n, &k,
-		   &a, A, &fdA, &b, C, &fdC);
+     PROF_OP(PROF_GEMM, (n * (double) k + n * (double) n) * sizeof(scalar),
+	     F(herk,HERK) (&uplo, &trans, &n, &k,
+			   &a, A, &fdA, &b, C, &fdC));
 #else
-     F(syrk,SYRK) (&uplo, &trans, &n, &k,
-		   &a, A, &fdA, &b, C, &fdC);
+     PROF_OP(PROF_GEMM, (n * (double) k + n * (double) n) * sizeof(scalar),
+	     F(syrk,SYRK) (&uplo, &trans, &n, &k,
+			   &a, A, &fdA, &b, C, &fdC));
 #endif
 }
 
+/* Triangular solve: B = a * inverse(op(A)) * B if side == 'L', or
+   B = a * B * inverse(op(A)) if side == 'R', where B is m x n and A
+   is triangular (uplo = 'U' or 'L', in row-major order). */
+void blasglue_trsm(char side, char uplo, char transa, char diag,
+		   int m, int n, real a, scalar *A, int fdA,
+		   scalar *B, int fdB)
+{
+     scalar alpha;
+     double nA = side == 'L' ? m : n; /* A is nA x nA */
+
+     if (m*n == 0)
+	  return;
+
+     CHECK(A != B, "trsm output array must be distinct");
+
+     ASSIGN_REAL(alpha,a);
+
+     side = side == 'L' ? 'R' : 'L';
+     uplo = uplo == 'U' ? 'L' : 'U';
+
+     PROF_OP(PROF_GEMM, (2 * m * (double) n + nA * nA) * sizeof(scalar),
+	     F(trsm,TRSM) (&side, &uplo, &transa, &diag, &n, &m,
+			   &alpha, A, &fdA, B, &fdB));
+}
+
 /*************************************************************************/
 
 #ifndef NO_LAPACK
@@ -32,6 +32,9 @@ void blasglue_gemm(char transa, char transb, int m, int n, int k,
 extern void blasglue_herk(char uplo, char trans, int n, int k,
 			  real a, scalar *A, int fdA,
 			  real b, scalar *C, int fdC);
+extern void blasglue_trsm(char side, char uplo, char transa, char diag,
+			  int m, int n, real a, scalar *A, int fdA,
+			  scalar *B, int fdB);
 extern int lapackglue_potrf(char uplo, int n, scalar *A, int fdA);
 extern int lapackglue_potri(char uplo, int n, scalar *A, int fdA);
 extern int lapackglue_hetrf(char uplo, int n, scalar *A, int fdA,
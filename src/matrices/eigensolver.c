@@ -72,19 +72,23 @@ extern void eigensolver_get_eigenvals_aux(evectmatrix Y, real *eigenvals,
    size?) */
 #define CG_RESET_ITERS 70
 
-/* Threshold for trace(1/YtBY) = trace(U) before we reorthogonalize: */
-#define EIGS_TRACE_U_THRESHOLD 1e8
+/* With EIGS_LOCK_BANDS, the number of iterations between checks for
+   converged bands to lock: */
+#define EIGS_LOCK_CHECK_ITERS 10
 
 /**************************************************************************/
 
 /* estimated times/iteration for different iteration schemes, based
-   on the measure times for various operations and the operation counts: */
+   on the measure times for various operations and the operation counts.
+   t_ZtZ is the time to compute YtBY and YtAY together (with a single
+   reduction); the exact line minimization computes four such matrices
+   at once, while the approximate one recomputes YtBY and YtAY. */
 
-#define EXACT_LINMIN_TIME(t_AZ, t_KZ, t_ZtW, t_ZS, t_ZtZ, t_linmin) \
-     ((t_AZ)*2 + (t_KZ) + (t_ZtW)*4 + (t_ZS)*2 + (t_ZtZ)*2 + (t_linmin))
+#define EXACT_LINMIN_TIME(t_AZ, t_KZ, t_ZS, t_ZtZ, t_linmin) \
+     ((t_AZ)*2 + (t_KZ) + (t_ZS)*2 + (t_ZtZ)*3 + (t_linmin))
 
-#define APPROX_LINMIN_TIME(t_AZ, t_KZ, t_ZtW, t_ZS, t_ZtZ) \
-     ((t_AZ)*2 + (t_KZ) + (t_ZtW)*2 + (t_ZS)*2 + (t_ZtZ)*2)
+#define APPROX_LINMIN_TIME(t_AZ, t_KZ, t_ZS, t_ZtZ) \
+     ((t_AZ)*2 + (t_KZ) + (t_ZS)*2 + (t_ZtZ)*2)
 
 /* Guess for the convergence slowdown factor due to the approximate
    line minimization.  It is probably best to be conservative, as the
@@ -179,8 +183,60 @@ static linmin_real trace_func(linmin_real theta, linmin_real *trace_deriv, void
 
 /**************************************************************************/
 
+/* Band locking (EIGS_LOCK_BANDS): once the lowest bands have converged,
+   we move them out of the active block Y into a "locked" set, and
+   continue the minimization for the remaining bands only, projecting
+   out the locked bands exactly as in mpb's deflation for block solves.
+   This way, the converged bands are no longer multiplied by A,
+   preconditioned, and orthogonalized at every iteration.
+
+   The locked vectors are the first nlocked columns of Y, and the
+   active block is a view (see evectmatrix_view) of the remaining
+   columns; the same is done for B*Y in the generalized case. */
+
+/* Compute X = (1 - Ylock BYlockt) X, where Ylock is B-orthonormal and
+   BYlock = B * Ylock.  S and S2 are scratch arrays of at least
+   Ylock.p * X.p elements. */
+static void deflate_locked(evectmatrix X, evectmatrix Ylock,
+			   evectmatrix BYlock, scalar *S, scalar *S2)
+{
+     blasglue_gemm('C', 'N', X.p, Ylock.p, X.n,
+		   1.0, X.data, X.fd, BYlock.data, BYlock.fd, 0.0, S2, Ylock.p);
+     mpi_allreduce(S2, S, Ylock.p * X.p * SCALAR_NUMVALS,
+		   real, SCALAR_MPI_TYPE, MPI_SUM, mpb_comm);
+     blasglue_gemm('N', 'C', X.n, X.p, Ylock.p,
+		   -1.0, Ylock.data, Ylock.fd, S, Ylock.p,
+		   1.0, X.data, X.fd);
+}
+
+/**************************************************************************/
+
+/* Each iteration needs several small (p x p) matrices and traces, each
+   of which requires a global sum over the processes.  These reductions
+   are latency-bound for small p (and many processes), so we group the
+   matrices that are needed at the same time into a single reduction
+   via evectmatrix_XtY_multi. */
+
+/* Compute YtBY and YtAY, given BY and AY, with a single reduction.
+   scratch must hold 4 * Y.p^2 entries. */
+static void compute_YtBY_YtAY(sqmatrix YtBY, sqmatrix YtAY, evectmatrix Y,
+			      evectmatrix BY, evectmatrix AY, scalar *scratch)
+{
+     sqmatrix U[2];
+     evectmatrix X[2], Z[2];
+
+     U[0] = YtBY; X[0] = Y; Z[0] = BY;
+     U[1] = YtAY; X[1] = Y; Z[1] = AY;
+     evectmatrix_XtY_multi(2, U, X, Z, scratch);
+}
+
+/**************************************************************************/
+
 #define EIG_HISTORY_SIZE 5
 
+/* number of scalars in a checkpoint, in addition to the eigenvalues: */
+#define CHECKPOINT_NVALS (13 + EIG_HISTORY_SIZE)
+
 /* find generalized eigenvectors Y of (A,B) by minimizing Rayleigh quotient
 
         tr [ Yt A Y / (Yt B Y) ] + lag * tr [ Yt L Y ]
@@ -192,6 +248,12 @@ static linmin_real trace_func(linmin_real theta, linmin_real *trace_deriv, void
    Constraints that commute with A and B (and L) are specified via the
    "constraint" argument, which gives the projection operator for
    the constraint(s).
+
+   If checkpoint is not NULL, the state of the minimization (Y, the
+   search direction, the previous gradient, and the iteration counters
+   and line-minimization state) is saved through it every
+   checkpoint_interval iterations, and if a saved state can be read
+   when we start, we resume from it instead of from the given Y.
 */
 
 void eigensolver_lagrange(evectmatrix Y, real *eigenvals,
@@ -202,7 +264,9 @@ void eigensolver_lagrange(evectmatrix Y, real *eigenvals,
 			  evectoperator L, void *Ldata, real *lag,
 			  evectmatrix Work[], int nWork,
 			  real tolerance, int *num_iterations,
-			  int flags)
+			  int flags,
+			  evectcheckpoint checkpoint, void *checkpoint_data,
+			  int checkpoint_interval)
 {
      real convergence_history[EIG_HISTORY_SIZE];
      evectmatrix G, D, X, BY, prev_G, BD;
@@ -215,10 +279,22 @@ void eigensolver_lagrange(evectmatrix Y, real *eigenvals,
      real theta, prev_theta = 0.5;
      int i, iteration = 0, num_emergency_restarts = 0;
      mpiglue_clock_t prev_feedback_time;
-     real time_AZ, time_KZ=0, time_ZtZ, time_ZtW, time_ZS, time_linmin=0;
+     real time_AZ, time_KZ=0, time_ZtZ, time_ZS, time_linmin=0;
      real linmin_improvement = 0;
+     real times[2], times_sum[2]; /* t_exact and t_approx, below */
+     mpiglue_request_t times_req;
+     int times_pending = 0;
+     scalar *Sgram, trs[2], trs_scratch[2];
      sqmatrix YtAYU, DtAD, symYtAD, YtBY, U, DtBD, symYtBD, S1, S2, S3;
      trace_func_data tfd;
+     evectmatrix Yall = Y, BYall, Ylock, BYlock;
+     int lock_bands, nlocked = 0, just_locked = 0;
+     real *band_err = NULL;
+     scalar *Sdefl = NULL, *Sdefl2 = NULL;
+     evectmatrix ck[4];
+     real *ckvals = NULL;
+     int nck = B ? 4 : 3, nckvals = CHECKPOINT_NVALS + Y.p;
+     short resume = 0;
 
      prev_feedback_time = MPIGLUE_CLOCK;
      
@@ -236,6 +312,8 @@ void eigensolver_lagrange(evectmatrix Y, real *eigenvals,
      }
      else
          BY = Y;
+     BYall = BY;
+     Ylock = BYlock = Y; /* not used until nlocked > 0 */
 
      usingConjugateGradient = nWork >= 3 + (B != NULL);
      if (usingConjugateGradient) {
@@ -264,7 +342,7 @@ void eigensolver_lagrange(evectmatrix Y, real *eigenvals,
      DtAD = create_sqmatrix(Y.p);  /* holds Dt A D */
      symYtAD = create_sqmatrix(Y.p);  /* holds (Yt A D + Dt A Y) / 2 */
      YtBY = create_sqmatrix(Y.p);  /* holds Yt B Y */
-     U = create_sqmatrix(Y.p);  /* holds 1 / (Yt Y) */
+     U = create_sqmatrix(Y.p);  /* holds 1 / (Yt B Y), where needed */
      DtBD = create_sqmatrix(Y.p);  /* holds Dt B D */
      symYtBD = create_sqmatrix(Y.p);  /* holds (Yt B D + Dt B Y) / 2 */
 
@@ -280,110 +358,180 @@ void eigensolver_lagrange(evectmatrix Y, real *eigenvals,
      tfd.YtBY = YtBY; tfd.DtBD = DtBD; tfd.symYtBD = symYtBD;
      tfd.S1 = YtAYU; tfd.S2 = S2; tfd.S3 = S3;
 
- restartY:
+     /* scratch space for up to four p x p matrices in one reduction: */
+     CHK_MALLOC(Sgram, scalar, 8 * Y.p * Y.p);
 
-     if (flags & EIGS_ORTHONORMALIZE_FIRST_STEP) {
-          if (B) {
-              B(Y, BY, Bdata, 1, G); /* B*Y; G is scratch */
-              evectmatrix_XtY(U, Y, BY, S2);
-          }
-          else {
-              evectmatrix_XtX(U, Y, S2);
-          }
-	  sqmatrix_assert_hermitian(U);
-	  CHECK(sqmatrix_invert(U, 1, S2), "non-independent initial Y");
-	  sqmatrix_sqrt(S1, U, S2); /* S1 = 1/sqrt(Yt*Y) */
-	  evectmatrix_XeYS(G, Y, S1, 1); /* G = orthonormalize Y */
-	  evectmatrix_copy(Y, G);
+     lock_bands = (flags & EIGS_LOCK_BANDS) && !L && Y.p > 1;
+     if (lock_bands) {
+	  CHK_MALLOC(band_err, real, 2 * Y.p);
+	  CHK_MALLOC(Sdefl, scalar, Y.p * Y.p);
+	  CHK_MALLOC(Sdefl2, scalar, Y.p * Y.p);
      }
 
-     for (i = 0; i < Y.p; ++i)
-          eigenvals[i] = 0.0;
+/* apply the constraints, including the projection onto the complement
+   of the locked bands (if any): */
+#define APPLY_CONSTRAINTS(X) { \
+     if (constraint) \
+	  constraint(X, constraint_data); \
+     if (nlocked > 0) \
+	  deflate_locked(X, Ylock, BYlock, Sdefl, Sdefl2); \
+}
+
+/* make Y and BY the active block following the nlocked locked vectors
+   (Ylock and BYlock), and shrink everything else to match: */
+#define SET_ACTIVE_BLOCK { \
+     int pa = Yall.p - nlocked; \
+     Ylock = evectmatrix_view(Yall, 0, nlocked); \
+     Y = evectmatrix_view(Yall, nlocked, pa); \
+     if (B) { \
+	  BYlock = evectmatrix_view(BYall, 0, nlocked); \
+	  BY = evectmatrix_view(BYall, nlocked, pa); \
+     } \
+     else { \
+	  BYlock = Ylock; \
+	  BY = Y; \
+     } \
+     evectmatrix_resize(&G, pa, 0); \
+     evectmatrix_resize(&X, pa, 0); \
+     evectmatrix_resize(&D, pa, 0); \
+     evectmatrix_resize(&prev_G, pa, 0); \
+     BD = B ? BY : D; \
+     sqmatrix_resize(&YtAYU, pa, 0); \
+     sqmatrix_resize(&DtAD, pa, 0); \
+     sqmatrix_resize(&symYtAD, pa, 0); \
+     sqmatrix_resize(&YtBY, pa, 0); \
+     sqmatrix_resize(&U, pa, 0); \
+     sqmatrix_resize(&DtBD, pa, 0); \
+     sqmatrix_resize(&symYtBD, pa, 0); \
+     sqmatrix_resize(&S1, pa, 0); \
+     sqmatrix_resize(&S2, pa, 0); \
+     sqmatrix_resize(&S3, pa, 0); \
+     tfd.YtAY = S1; tfd.DtAD = DtAD; tfd.symYtAD = symYtAD; \
+     tfd.YtBY = YtBY; tfd.DtBD = DtBD; tfd.symYtBD = symYtBD; \
+     tfd.S1 = YtAYU; tfd.S2 = S2; tfd.S3 = S3; \
+}
+
+/* the column bundles of a checkpoint, at their full (unlocked) size: */
+#define SET_CHECKPOINT_ARRAYS { \
+     ck[0] = Yall; \
+     ck[1] = D; \
+     evectmatrix_resize(&ck[1], Yall.p, 0); \
+     ck[2] = prev_G; \
+     evectmatrix_resize(&ck[2], Yall.p, 0); \
+     ck[3] = BYall; \
+}
+
+     if (checkpoint) {
+	  CHK_MALLOC(ckvals, real, nckvals);
+	  SET_CHECKPOINT_ARRAYS;
+	  if (checkpoint(0, ck, nck, ckvals, nckvals, checkpoint_data)) {
+	       iteration = ckvals[0];
+	       nlocked = ckvals[1];
+	       use_linmin = ckvals[2] != 0;
+	       if (ckvals[3] != 0)
+		    flags |= EIGS_FORCE_EXACT_LINMIN;
+	       num_emergency_restarts = ckvals[4];
+	       prev_traceGtX = ckvals[5];
+	       prev_theta = ckvals[6];
+	       prev_E = ckvals[7];
+	       d_scale = ckvals[8];
+	       prev_g_lag = ckvals[9];
+	       d_lag = ckvals[10];
+	       if (L) *lag = ckvals[11];
+	       linmin_improvement = ckvals[12];
+	       for (i = 0; i < EIG_HISTORY_SIZE; ++i)
+		    convergence_history[i] = ckvals[13 + i];
+	       for (i = 0; i < Yall.p; ++i)
+		    eigenvals[i] = ckvals[CHECKPOINT_NVALS + i];
+	       CHECK(nlocked == 0 || lock_bands,
+		     "checkpoint has locked bands, but locking is disabled");
+	       if (nlocked > 0)
+		    SET_ACTIVE_BLOCK;
+	       mpi_one_printf("    resuming from checkpoint at iteration %d\n",
+			      iteration);
+	       resume = 1;
+	  }
+     }
+
+ restartY:
+
+     if (!resume) {
+	  if (flags & EIGS_ORTHONORMALIZE_FIRST_STEP) {
+	       if (B)
+		    B(Y, BY, Bdata, 1, G); /* B*Y; G is scratch */
+	       evectmatrix_XtY_multi(1, &U, &Y, &BY, Sgram);
+	       CHECK(evectmatrix_cholqr2(Y, BY, NULL, 0, U, NULL, 1,
+					 S2, Sgram),
+		     "non-independent initial Y");
+	  }
+
+	  for (i = 0; i < Y.p; ++i)
+	       eigenvals[nlocked + i] = 0.0;
 
-     for (i = 0; i < EIG_HISTORY_SIZE; ++i)
-	  convergence_history[i] = 10000.0;
+	  for (i = 0; i < EIG_HISTORY_SIZE; ++i)
+	       convergence_history[i] = 10000.0;
 
-     if (constraint)
-	  constraint(Y, constraint_data);
+	  APPLY_CONSTRAINTS(Y);
+     }
+     resume = 0;
 
      do {
-	  real y_norm, gamma_numerator = 0;
+	  real gamma_numerator = 0;
+	  int npass;
 
 	  if (flags & EIGS_FORCE_APPROX_LINMIN)
 	       use_linmin = 0;
 
-          if (B) {
+          if (B)
               B(Y, BY, Bdata, 1, G); /* B*Y; G is scratch */
-              TIME_OP(time_ZtZ, evectmatrix_XtY(YtBY, Y, BY, S2));
-          }
-          else {
-              TIME_OP(time_ZtZ, evectmatrix_XtX(YtBY, Y, S2));
-          }
-	  sqmatrix_assert_hermitian(YtBY);
+	  TIME_OP(time_AZ, A(Y, X, Adata, 1, G)); /* X = AY; G is scratch */
 
-	  y_norm = sqrt(SCALAR_RE(sqmatrix_trace(YtBY)) / Y.p);
-	  blasglue_rscal(Y.p * Y.n, 1/y_norm, Y.data, 1);
-	  if (B) blasglue_rscal(Y.p * Y.n, 1/y_norm, BY.data, 1);
-	  blasglue_rscal(Y.p * Y.p, 1/(y_norm*y_norm), YtBY.data, 1);
+	  /* YtBY and S1 = YtAY, with a single reduction: */
+	  TIME_OP(time_ZtZ, compute_YtBY_YtAY(YtBY, S1, Y, BY, X, Sgram));
+	  sqmatrix_assert_hermitian(YtBY);
+	  sqmatrix_assert_hermitian(S1);
 
-	  sqmatrix_copy(U, YtBY);
-	  if (!sqmatrix_invert(U, 1, S2)) { /* non-independent Y columns */
+	  /* Keep Y B-orthonormal, by CholeskyQR, transforming BY and
+	     X = AY along with it and S1 = YtAY accordingly.  Then we
+	     have YtBY = 1, and there is no need to invert YtBY: */
+	  TIME_OP(time_ZS, npass = evectmatrix_cholqr2(Y, BY, &X, 1, YtBY,
+						       &S1, 0, S2, Sgram));
+	  if (!npass) { /* non-independent Y columns */
 	       /* emergency restart with random Y */
 	       CHECK(iteration + 10 * ++num_emergency_restarts
 		     < EIGENSOLVER_MAX_ITERATIONS, 
 		     "too many emergency restarts");
 	       mpi_one_printf("    emergency randomization of Y on iter. %d\n",
 			      iteration);
-	       for (i = 0; i < Y.p * Y.n; ++i)
-		    ASSIGN_SCALAR(Y.data[i],
-				  rand() * 1.0 / RAND_MAX - 0.5,
-				  rand() * 1.0 / RAND_MAX - 0.5);
+	       for (i = 0; i < Y.n; ++i) {
+		    int j;
+		    for (j = 0; j < Y.p; ++j)
+			 ASSIGN_SCALAR(Y.data[i * Y.fd + j],
+				       rand() * 1.0 / RAND_MAX - 0.5,
+				       rand() * 1.0 / RAND_MAX - 0.5);
+	       }
 	       goto restartY;
 	  }
-
-	  /* If trace(1/YtBY) gets big, it means that the columns
-	     of Y are becoming nearly parallel.  This sometimes happens,
-	     especially in the targeted eigensolver, because the
-	     preconditioner pushes all the columns towards the ground
-	     state.  If it gets too big, it seems to be a good idea
-	     to re-orthogonalize, resetting conjugate-gradient, as
-	     otherwise we start to encounter numerical problems. */
-	  if (flags & EIGS_REORTHOGONALIZE) {
-	       real traceU = SCALAR_RE(sqmatrix_trace(U));
-	       mpi_assert_equal(traceU);
-	       if (traceU > EIGS_TRACE_U_THRESHOLD * U.p) {
-		    mpi_one_printf("    re-orthonormalizing Y\n");
-		    sqmatrix_sqrt(S1, U, S2); /* S1 = 1/sqrt(Yt*Y) */
-		    evectmatrix_XeYS(G, Y, S1, 1); /* G = orthonormalize Y */
-		    evectmatrix_copy(Y, G);
-		    prev_traceGtX = 0.0;
-                    if (B) {
-                        B(Y, BY, Bdata, 1, G); /* B*Y; G is scratch */
-                        evectmatrix_XtY(YtBY, Y, BY, S2);
-                    }
-                    else
-                        evectmatrix_XtX(YtBY, Y, S2);
-		    y_norm = sqrt(SCALAR_RE(sqmatrix_trace(YtBY)) / Y.p);
-		    blasglue_rscal(Y.p * Y.n, 1/y_norm, Y.data, 1);
-		    if (B) blasglue_rscal(Y.p * Y.n, 1/y_norm, BY.data, 1);
-		    blasglue_rscal(Y.p * Y.p, 1/(y_norm*y_norm), YtBY.data, 1);
-		    sqmatrix_copy(U, YtBY);
-		    CHECK(sqmatrix_invert(U, 1, S2),
-			  "non-independent Y after re-orthogonalization");
-	       }
+	  for (i = 0; i < Y.p * Y.p; ++i) {
+	       ASSIGN_ZERO(YtBY.data[i]);
+	  }
+	  for (i = 0; i < Y.p; ++i)
+	       ASSIGN_REAL(YtBY.data[i * Y.p + i], 1.0);
+
+	  /* If Y was so ill-conditioned that CholeskyQR needed a shift,
+	     it means that the columns of Y were becoming nearly parallel.
+	     This sometimes happens, especially in the targeted
+	     eigensolver, because the preconditioner pushes all the
+	     columns towards the ground state.  It seems to be a good idea
+	     to reset conjugate-gradient in this case, as otherwise we
+	     start to encounter numerical problems. */
+	  if ((flags & EIGS_REORTHOGONALIZE) && npass > 2) {
+	       mpi_one_printf("    re-orthonormalizing Y\n");
+	       prev_traceGtX = 0.0;
 	  }
 
-	  TIME_OP(time_AZ, A(Y, X, Adata, 1, G)); /* X = AY; G is scratch */
-
-#ifdef DEBUG
-	  evectmatrix_XtY(S1, Y, X, S2);
-	  sqmatrix_assert_hermitian(S1);
-#endif
-
-	  /* G = AYU; note that U is Hermitian: */
-	  TIME_OP(time_ZS, evectmatrix_XeYS(G, X, U, 1));
-
-	  TIME_OP(time_ZtW, evectmatrix_XtY(YtAYU, Y, G, S2));
+	  evectmatrix_copy(G, X); /* G = AY */
+	  sqmatrix_copy(YtAYU, S1); /* YtAYU = Yt A Y, since U = 1 */
 	  E = SCALAR_RE(sqmatrix_trace(YtAYU));
 	  CHECK(!BADNUM(E), "crazy number detected in trace!!\n");
 	  mpi_assert_equal(E);
@@ -402,8 +550,16 @@ void eigensolver_lagrange(evectmatrix Y, real *eigenvals,
 	      ((flags & EIGS_VERBOSE) ||
 	       MPIGLUE_CLOCK_DIFF(MPIGLUE_CLOCK, prev_feedback_time)
 	       > FEEDBACK_TIME)) {
-               mpi_one_printf("    iteration %4d: "
-                      "trace = %0.16g (%g%% change)\n", iteration, (double)E,
+	       if (lock_bands)
+		    mpi_one_printf("    iteration %4d: "
+				   "trace = %0.16g (%g%% change), "
+				   "%d/%d bands locked\n", iteration, (double)E,
+	           (double)convergence_history[iteration % EIG_HISTORY_SIZE],
+				   nlocked, Yall.p);
+	       else
+		    mpi_one_printf("    iteration %4d: "
+				   "trace = %0.16g (%g%% change)\n",
+				   iteration, (double)E,
 	           (double)convergence_history[iteration % EIG_HISTORY_SIZE]);
 	       if (flags & EIGS_VERBOSE)
 		    debug_output_malloc_count();
@@ -411,13 +567,13 @@ void eigensolver_lagrange(evectmatrix Y, real *eigenvals,
                prev_feedback_time = MPIGLUE_CLOCK; /* reset feedback clock */
           }
 
-	  if (iteration > 0 &&
+	  if (iteration > 0 && !just_locked &&
               fabs(E - prev_E) < tolerance * 0.5 * (E + prev_E + 1e-7))
                break; /* convergence!  hooray! */
+	  just_locked = 0;
 	  
-	  /* Compute gradient of functional: G = (1 - BY U Yt) A Y U */
-	  sqmatrix_AeBC(S1, U, 0, YtAYU, 0);
-	  evectmatrix_XpaYS(G, -1.0, BY, S1, 1);
+	  /* Compute gradient of functional: G = (1 - BY Yt) A Y */
+	  evectmatrix_XpaYS(G, -1.0, BY, YtAYU, 1);
 
 	  if (L) { /* include Lagrange gradient; note X = LY from above */
 	       evectmatrix_aXpbY(1.0, G, *lag, X);
@@ -427,21 +583,98 @@ void eigensolver_lagrange(evectmatrix Y, real *eigenvals,
 	  if (K != NULL) {
 	       TIME_OP(time_KZ, K(G, X, Kdata, Y, NULL, YtBY));
 	       /* Note: we passed NULL for eigenvals since we haven't
-                  diagonalized YAY (nor are the Y's orthonormal). */
+                  diagonalized YAY. */
 	  }
 	  else
                evectmatrix_copy(X, G);  /* preconditioner is identity */
 	  
 	  /* We have to apply the constraint here, in case it doesn't
              commute with the preconditioner. */
-	  if (constraint)
-               constraint(X, constraint_data);
+	  APPLY_CONSTRAINTS(X);
+
+	  /* Every so often, check for converged bands to lock.  The
+	     B-orthonormal Ritz vectors are Y S1, with residuals
+	     R = A Y S1 - B Y S1 diag(lambda) = G S1 (since YtBY = 1).
+	     As an estimate of the eigenvalue error of each band, we use
+	     the preconditioned residual norm Rt K R, which is the diagonal
+	     of S1t Gt X S1 since X = K(G) = K0(G) for the
+	     band-by-band preconditioner K0.  (The plain residual |R|^2 is
+	     a poor estimate for Maxwell's equations, where the residual
+	     is mostly in high-frequency components.)  The lowest bands
+	     whose errors are within the tolerance are moved into the
+	     locked set. */
+	  if (lock_bands && iteration > 0 &&
+	      iteration % EIGS_LOCK_CHECK_ITERS == 0 && Y.p > 1) {
+	       int nlock;
+	       real *lambda = eigenvals + nlocked;
+
+	       sqmatrix_copy(DtAD, YtAYU); /* Yt A Y */
+	       sqmatrix_eigensolve(DtAD, lambda, S3);
+	       for (i = 0; i < Y.p; ++i) { /* S1 = adjoint(eigenvectors) */
+		    int j;
+		    for (j = 0; j < Y.p; ++j)
+			 ASSIGN_CONJ(S1.data[i * Y.p + j],
+				     DtAD.data[j * Y.p + i]);
+	       }
+
+	       evectmatrix_XtY(S3, G, X, S2);
+	       sqmatrix_AeBC(S2, S3, 0, S1, 0);
+	       for (i = 0; i < Y.p; ++i) {
+		    int j;
+		    band_err[i] = 0;
+		    for (j = 0; j < Y.p; ++j)
+			 band_err[i] += SCALAR_RE(S1.data[j * Y.p + i])
+			      * SCALAR_RE(S2.data[j * Y.p + i])
+			      + SCALAR_IM(S1.data[j * Y.p + i])
+			      * SCALAR_IM(S2.data[j * Y.p + i]);
+		    if (K == NULL) /* no preconditioner: rescale |R|^2 */
+			 band_err[i] /= fabs(lambda[i]) + 1e-7;
+	       }
+	       for (nlock = 0; nlock < Y.p - 1; ++nlock)
+		    if (!(fabs(band_err[nlock]) <= tolerance
+			  * (fabs(lambda[nlock]) + 1e-7)))
+			 break;
+	       if (flags & EIGS_VERBOSE)
+		    for (i = 0; i < Y.p; ++i)
+			 mpi_one_printf("    band %d: eigenvalue %g, "
+					"error estimate %g%s\n", nlocked + i + 1,
+					(double) lambda[i],
+					(double) band_err[i],
+					i < nlock ? " (locked)" : "");
+
+	       if (nlock > 0) {
+		    /* rotate Y to the Ritz vectors, the first nlock of
+		       which become the new locked columns: */
+		    evectmatrix_XeYS(G, Y, S1, 0);
+		    evectmatrix_copy(Y, G);
+		    if (B) {
+			 evectmatrix_XeYS(G, BY, S1, 0);
+			 evectmatrix_copy(BY, G);
+		    }
+		    nlocked += nlock;
+		    SET_ACTIVE_BLOCK;
+
+		    /* restart conjugate-gradient on the new active block: */
+		    if (usingConjugateGradient)
+			 for (i = 0; i < D.n * D.p; ++i)
+			      ASSIGN_ZERO(D.data[i]);
+		    if (use_polak_ribiere)
+			 for (i = 0; i < prev_G.n * prev_G.p; ++i)
+			      ASSIGN_ZERO(prev_G.data[i]);
+		    prev_traceGtX = 0.0;
+		    for (i = 0; i < EIG_HISTORY_SIZE; ++i)
+			 convergence_history[i] = 10000.0;
+
+		    APPLY_CONSTRAINTS(Y);
+		    just_locked = 1;
+		    continue;
+	       }
+	  }
 
 	  if (flags & EIGS_PROJECT_PRECONDITIONING) {
-               /* Operate projection P = (1 - BY U Yt) on X: */
+               /* Operate projection P = (1 - BY Yt) on X: */
                evectmatrix_XtY(symYtBD, Y, X, S2);  /* symYtBD = Yt X */
-	       sqmatrix_AeBC(S1, U, 0, symYtBD, 0);
-	       evectmatrix_XpaYS(X, -1.0, BY, S1, 0);
+	       evectmatrix_XpaYS(X, -1.0, BY, symYtBD, 0);
           }
 
 	  /* Now, for the case of EIGS_ORTHOGONAL_PRECONDITIONER, we
@@ -450,9 +683,17 @@ void eigensolver_lagrange(evectmatrix Y, real *eigenvals,
 	     any computations that we need with G.  (Yes, we're
 	     playing tricksy games here, but isn't it fun?) */
 
-	  mpi_assert_equal(traceGtX = 
-			   SCALAR_RE(evectmatrix_traceXtY(G, X))
-			   + g_lag * g_lag);
+	  /* Compute tr(Gt X), and tr(prev_Gt X) for Polak-Ribiere, with
+	     a single reduction: */
+	  {
+	       evectmatrix Xtr[2], Ytr[2];
+	       Xtr[0] = G; Xtr[1] = prev_G;
+	       Ytr[0] = Ytr[1] = X;
+	       evectmatrix_traceXtY_multi(usingConjugateGradient &&
+					  use_polak_ribiere ? 2 : 1,
+					  trs, Xtr, Ytr, trs_scratch);
+	  }
+	  mpi_assert_equal(traceGtX = SCALAR_RE(trs[0]) + g_lag * g_lag);
 	  if (usingConjugateGradient) {
                if (use_polak_ribiere) {
                     /* assign G = G - prev_G and copy prev_G = G in the
@@ -463,7 +704,8 @@ void eigensolver_lagrange(evectmatrix Y, real *eigenvals,
                          ACCUMULATE_DIFF(G.data[i], prev_G.data[i]);
                          prev_G.data[i] = g;
                     }
-                    gamma_numerator = SCALAR_RE(evectmatrix_traceXtY(G, X));
+		    /* tr((G - prev_G)t X): */
+                    gamma_numerator = SCALAR_RE(trs[0]) - SCALAR_RE(trs[1]);
 
 		    { real g = g_lag; g_lag -= prev_g_lag; prev_g_lag = g; }
 		    gamma_numerator += g_lag * prev_g_lag;
@@ -553,6 +795,34 @@ void eigensolver_lagrange(evectmatrix Y, real *eigenvals,
 
 	  d_scale = 1.0;
 
+	  /* Use the (summed) times from the previous iteration to pick
+	     the line-minimization algorithm: */
+	  if (times_pending) {
+	       real t_exact, t_approx;
+
+	       mpi_wait(&times_req);
+	       times_pending = 0;
+	       t_exact = times_sum[0];
+	       t_approx = times_sum[1];
+	       if (!(flags & EIGS_FORCE_EXACT_LINMIN) &&
+		   linmin_improvement > 0 &&
+		   linmin_improvement <= APPROX_LINMIN_IMPROVEMENT_THRESHOLD &&
+		   t_exact > t_approx * APPROX_LINMIN_SLOWDOWN_GUESS) {
+		    if ((flags & EIGS_VERBOSE) && use_linmin)
+			 mpi_one_printf("    switching to approximate "
+				"line minimization (decrease time by %g%%)\n",
+			    (double) ((t_exact - t_approx) * 100.0 / t_exact));
+		    use_linmin = 0;
+	       }
+	       else if (!(flags & EIGS_FORCE_APPROX_LINMIN)) {
+		    if ((flags & EIGS_VERBOSE) && !use_linmin)
+			 mpi_one_printf("    switching back to exact "
+					"line minimization\n");
+		    use_linmin = 1;
+		    prev_theta = atan(prev_theta); /* convert to angle */
+	       }
+	  }
+
 	  /* Minimize the trace along Y + lambda*D: */
 
 	  if (!use_linmin) {
@@ -567,28 +837,32 @@ void eigensolver_lagrange(evectmatrix Y, real *eigenvals,
 	          matrix multiplications compared to the exact linmin. */
 
                if (B) B(D, BD, Bdata, 0, BD); /* B*Y; no scratch */
+
+	       /* tr(BDt D) and tr(prev_Gt D), with a single reduction: */
+	       {
+		    evectmatrix Xtr[2], Ytr[2];
+		    Xtr[0] = BD; Xtr[1] = prev_G;
+		    Ytr[0] = Ytr[1] = D;
+		    evectmatrix_traceXtY_multi(2, trs, Xtr, Ytr, trs_scratch);
+	       }
                
-	       d_norm = sqrt(SCALAR_RE(evectmatrix_traceXtY(BD,D)) / Y.p);
+	       d_norm = sqrt(SCALAR_RE(trs[0]) / Y.p);
 	       mpi_assert_equal(d_norm);
 
 	       /* dE = 2 * tr Gt D.  (Use prev_G instead of G so that
 		  it works even when we are using Polak-Ribiere.) */
-	       dE = 2.0 * SCALAR_RE(evectmatrix_traceXtY(prev_G, D)) / d_norm;
+	       dE = 2.0 * SCALAR_RE(trs[1]) / d_norm;
 
 	       /* shift Y by prev_theta along D, in the downhill direction: */
 	       t = dE < 0 ? -fabs(prev_theta) : fabs(prev_theta);
 	       evectmatrix_aXpbY(1.0, Y, t / d_norm, D);
 
-               if (B) {
+               if (B)
                    B(Y, BY, Bdata, 1, G); /* B*Y; G is scratch */
-                   evectmatrix_XtY(U, Y, BY, S2);
-               }
-               else
-                   evectmatrix_XtX(U, Y, S2);
+	       A(Y, G, Adata, 1, X); /* G = AY; X is scratch */
+	       compute_YtBY_YtAY(U, S1, Y, BY, G, Sgram); /* S1 = Yt A Y */
 	       CHECK(sqmatrix_invert(U, 1, S2),
 		     "singular YtBY");  /* U = 1 / (Yt B Y) */
-	       A(Y, G, Adata, 1, X); /* G = AY; X is scratch */
-	       evectmatrix_XtY(S1, Y, G, S2);  /* S1 = Yt A Y */
 
 	       E2 = SCALAR_RE(sqmatrix_traceAtB(S1, U));
 
@@ -640,38 +914,44 @@ void eigensolver_lagrange(evectmatrix Y, real *eigenvals,
 	       real dE, d2E;
 
                if (B) B(D, BD, Bdata, 0, G); /* B*Y; G is scratch */
+	       A(D, G, Adata, 0, X); /* G = A D; X is scratch */
+
+	       /* DtBD, DtAD, S1 = YtBD, and S3 = YtAD, with a single
+		  reduction; we normalize D (by d_scale) afterwards. */
+	       {
+		    sqmatrix Ugr[4];
+		    evectmatrix Xgr[4], Ygr[4];
+		    Ugr[0] = DtBD; Xgr[0] = D; Ygr[0] = BD;
+		    Ugr[1] = DtAD; Xgr[1] = D; Ygr[1] = G;
+		    Ugr[2] = S1; Xgr[2] = Y; Ygr[2] = BD;
+		    Ugr[3] = S3; Xgr[3] = Y; Ygr[3] = G;
+		    evectmatrix_XtY_multi(4, Ugr, Xgr, Ygr, Sgram);
+	       }
                
-	       d_scale = sqrt(SCALAR_RE(evectmatrix_traceXtY(BD, D)) / Y.p);
+	       d_scale = sqrt(SCALAR_RE(sqmatrix_trace(DtBD)) / Y.p);
 	       mpi_assert_equal(d_scale);
 	       blasglue_rscal(Y.p * Y.n, 1/d_scale, D.data, 1);
-	       if (B) blasglue_rscal(Y.p * Y.n, 1/d_scale, BD.data, 1);
-
-	       A(D, G, Adata, 0, X); /* G = A D; X is scratch */
-               if (B)
-                   evectmatrix_XtY(DtBD, D, BD, S2);
-               else
-                   evectmatrix_XtX(DtBD, D, S2);
-	       evectmatrix_XtY(DtAD, D, G, S2);
+	       if (B) evectmatrix_rscal(1/d_scale, BD);
+	       blasglue_rscal(Y.p * Y.p, 1/(d_scale*d_scale), DtBD.data, 1);
+	       blasglue_rscal(Y.p * Y.p, 1/(d_scale*d_scale), DtAD.data, 1);
+	       blasglue_rscal(Y.p * Y.p, 1/d_scale, S1.data, 1);
+	       blasglue_rscal(Y.p * Y.p, 1/d_scale, S3.data, 1);
 	       sqmatrix_assert_hermitian(DtBD);
 	       sqmatrix_assert_hermitian(DtAD);
 	       
-	       evectmatrix_XtY(S1, Y, BD, S2);
 	       sqmatrix_symmetrize(symYtBD, S1);
+	       sqmatrix_symmetrize(symYtAD, S3);
 
-	       evectmatrix_XtY(S1, Y, G, S2);
-	       sqmatrix_symmetrize(symYtAD, S1);
-
-	       sqmatrix_AeBC(S1, U, 0, symYtBD, 1);
-	       dE = 2.0 * (SCALAR_RE(sqmatrix_traceAtB(U, symYtAD)) -
-			   SCALAR_RE(sqmatrix_traceAtB(YtAYU, S1)));
+	       /* derivatives of the trace at theta = 0, using YtBY = 1: */
+	       dE = 2.0 * (SCALAR_RE(sqmatrix_trace(symYtAD)) -
+			   SCALAR_RE(sqmatrix_traceAtB(YtAYU, symYtBD)));
 
 	       sqmatrix_copy(S2, DtBD);
-	       sqmatrix_ApaBC(S2, -4.0, symYtBD, 0, S1, 0);
-	       sqmatrix_AeBC(S3, symYtAD, 0, S1, 0);
-	       sqmatrix_AeBC(S1, U, 0, S2, 1);
-	       d2E = 2.0 * (SCALAR_RE(sqmatrix_traceAtB(U, DtAD)) -
-			    SCALAR_RE(sqmatrix_traceAtB(YtAYU, S1)) -
-			    4.0 * SCALAR_RE(sqmatrix_traceAtB(U, S3)));
+	       sqmatrix_ApaBC(S2, -4.0, symYtBD, 0, symYtBD, 0);
+	       sqmatrix_AeBC(S3, symYtAD, 0, symYtBD, 0);
+	       d2E = 2.0 * (SCALAR_RE(sqmatrix_trace(DtAD)) -
+			    SCALAR_RE(sqmatrix_traceAtB(YtAYU, S2)) -
+			    4.0 * SCALAR_RE(sqmatrix_trace(S3)));
 	       
 	       if (L) {
 		    d_lag *= 1/d_scale;
@@ -711,10 +991,9 @@ void eigensolver_lagrange(evectmatrix Y, real *eigenvals,
 		    theta = dE > 0 ? -fabs(prev_theta) : fabs(prev_theta);
 	       }
 
-	       /* Set S1 to YtAYU * YtBY = YtAY for use in linmin.
-		  (tfd.YtAY == S1). */
-	       sqmatrix_AeBC(S1, YtAYU, 0, YtBY, 1);
-	       sqmatrix_assert_hermitian(S1);
+	       /* Set S1 to YtAY for use in linmin (tfd.YtAY == S1);
+		  YtAYU is used as scratch by trace_func. */
+	       sqmatrix_copy(S1, YtAYU);
 
 	       mpi_assert_equal(theta);
 	       {
@@ -739,53 +1018,57 @@ void eigensolver_lagrange(evectmatrix Y, real *eigenvals,
 	  /* In exact arithmetic, we don't need to do this, but in practice
 	     it is probably a good idea to keep errors from adding up and
 	     eventually violating the constraints. */
-	  if (constraint)
-               constraint(Y, constraint_data);
+	  APPLY_CONSTRAINTS(Y);
 
 	  prev_traceGtX = traceGtX;
           prev_theta = theta;
           prev_E = E;
 
-	  /* Finally, we use the times for the various operations to
-	     help us pick an algorithm for the next iteration: */
-	  {
-	       real t_exact, t_approx;
-	       t_exact = EXACT_LINMIN_TIME(time_AZ, time_KZ, time_ZtW,
-					   time_ZS, time_ZtZ, time_linmin);
-	       t_approx = APPROX_LINMIN_TIME(time_AZ, time_KZ, time_ZtW,
-					     time_ZS, time_ZtZ);
-	       if (flags & EIGS_PROJECT_PRECONDITIONING) {
-		    t_exact += time_ZtW + time_ZS;
-		    t_approx += time_ZtW + time_ZS;
-	       }
-
-	       /* Sum the times over the processors so that all the
-		  processors compare the same, average times. */
-	       mpi_allreduce_1(&t_exact,
-			       real, SCALAR_MPI_TYPE, MPI_SUM, mpb_comm);
-	       mpi_allreduce_1(&t_approx, 
-			       real, SCALAR_MPI_TYPE, MPI_SUM, mpb_comm);
+	  /* Save the state, so that we can resume at the next iteration: */
+	  if (checkpoint && checkpoint_interval > 0 &&
+	      (iteration + 1) % checkpoint_interval == 0) {
+	       ckvals[0] = iteration + 1;
+	       ckvals[1] = nlocked;
+	       ckvals[2] = use_linmin;
+	       ckvals[3] = (flags & EIGS_FORCE_EXACT_LINMIN) != 0;
+	       ckvals[4] = num_emergency_restarts;
+	       ckvals[5] = prev_traceGtX;
+	       ckvals[6] = prev_theta;
+	       ckvals[7] = prev_E;
+	       ckvals[8] = d_scale;
+	       ckvals[9] = prev_g_lag;
+	       ckvals[10] = d_lag;
+	       ckvals[11] = L ? *lag : 0;
+	       ckvals[12] = linmin_improvement;
+	       for (i = 0; i < EIG_HISTORY_SIZE; ++i)
+		    ckvals[13 + i] = convergence_history[i];
+	       for (i = 0; i < Yall.p; ++i)
+		    ckvals[CHECKPOINT_NVALS + i] = eigenvals[i];
+	       SET_CHECKPOINT_ARRAYS;
+	       checkpoint(1, ck, nck, ckvals, nckvals, checkpoint_data);
+	  }
 
-	       if (!(flags & EIGS_FORCE_EXACT_LINMIN) &&
-		   linmin_improvement > 0 &&
-		   linmin_improvement <= APPROX_LINMIN_IMPROVEMENT_THRESHOLD &&
-		   t_exact > t_approx * APPROX_LINMIN_SLOWDOWN_GUESS) {
-		    if ((flags & EIGS_VERBOSE) && use_linmin)
-			 mpi_one_printf("    switching to approximate "
-				"line minimization (decrease time by %g%%)\n",
-			    (double) ((t_exact - t_approx) * 100.0 / t_exact));
-		    use_linmin = 0;
-	       }
-	       else if (!(flags & EIGS_FORCE_APPROX_LINMIN)) {
-		    if ((flags & EIGS_VERBOSE) && !use_linmin)
-			 mpi_one_printf("    switching back to exact "
-					"line minimization\n");
-		    use_linmin = 1;
-		    prev_theta = atan(prev_theta); /* convert to angle */
-	       }
+	  /* Finally, we use the times for the various operations to
+	     help us pick an algorithm for the next iteration.  We sum
+	     the times over the processors so that all the processors
+	     compare the same, average times; this reduction is started
+	     here but not completed until the next iteration's line
+	     minimization, so that it can overlap the operator application. */
+	  times[0] = EXACT_LINMIN_TIME(time_AZ, time_KZ,
+				       time_ZS, time_ZtZ, time_linmin);
+	  times[1] = APPROX_LINMIN_TIME(time_AZ, time_KZ, time_ZS, time_ZtZ);
+	  if (flags & EIGS_PROJECT_PRECONDITIONING) {
+	       times[0] += 0.5 * time_ZtZ + time_ZS;
+	       times[1] += 0.5 * time_ZtZ + time_ZS;
 	  }
+	  mpi_iallreduce(times, times_sum, 2,
+			 real, SCALAR_MPI_TYPE, MPI_SUM, mpb_comm, &times_req);
+	  times_pending = 1;
      } while (++iteration < EIGENSOLVER_MAX_ITERATIONS);
 
+     if (times_pending)
+	  mpi_wait(&times_req);
+
      CHECK(iteration < EIGENSOLVER_MAX_ITERATIONS,
            "failure to converge after "
            STRINGIZE(EIGENSOLVER_MAX_ITERATIONS)
@@ -798,10 +1081,20 @@ void eigensolver_lagrange(evectmatrix Y, real *eigenvals,
      else
          evectmatrix_XtX(U, Y, S2);
      CHECK(sqmatrix_invert(U, 1, S2), "singular YtBY at end");
-     eigensolver_get_eigenvals_aux(Y, eigenvals, A, Adata,
+     eigensolver_get_eigenvals_aux(Y, eigenvals + nlocked, A, Adata,
 				   X, G, U, S1, S2);
 
+#undef SET_CHECKPOINT_ARRAYS
+#undef SET_ACTIVE_BLOCK
+#undef APPLY_CONSTRAINTS
+
      *num_iterations = iteration;
+
+     free(ckvals);
+     free(Sgram);
+     free(Sdefl2);
+     free(Sdefl);
+     free(band_err);
      
      destroy_sqmatrix(S3);
      destroy_sqmatrix(S2);
@@ -827,5 +1120,6 @@ void eigensolver(evectmatrix Y, real *eigenvals,
      eigensolver_lagrange(Y, eigenvals, A, Adata, B, Bdata, K, Kdata,
 			  constraint, constraint_data,
 			  0, 0, 0,
-			  Work, nWork, tolerance, num_iterations, flags);
+			  Work, nWork, tolerance, num_iterations, flags,
+			  0, 0, 0);
 }
@@ -28,6 +28,9 @@
 extern "C" {
 #endif /* __cplusplus */
 
+/* Note that the evectmatrix arguments of the operators, preconditioners,
+   and constraints may be strided views (see evectmatrix_view), e.g. the
+   active block of the bands when locking (EIGS_LOCK_BANDS). */
 typedef void (*evectoperator) (evectmatrix Xin, evectmatrix Xout,
 			       void *data, int is_current_eigenvector,
 			       evectmatrix Work);
@@ -39,6 +42,12 @@ typedef void (*evectpreconditioner) (evectmatrix Xin, evectmatrix Xout,
 
 typedef void (*evectconstraint) (evectmatrix X, void *data);
 
+/* Checkpoint I/O for the eigensolver state: if write is nonzero, save
+   the nX column bundles X[] and the nvals scalars vals[]; otherwise,
+   read them (if a saved state exists), returning nonzero on success. */
+typedef int (*evectcheckpoint) (int write, evectmatrix *X, int nX,
+				real *vals, int nvals, void *data);
+
 extern void eigensolver(evectmatrix Y, real *eigenvals,
 			evectoperator A, void *Adata,
 			evectoperator B, void *Bdata,
@@ -56,10 +65,13 @@ extern void eigensolver_lagrange(evectmatrix Y, real *eigenvals,
 			evectoperator L, void *Ldata, real *lag,
 			evectmatrix Work[], int nWork,
 			real tolerance, int *num_iterations,
-			int flags);
+			int flags,
+			evectcheckpoint checkpoint, void *checkpoint_data,
+			int checkpoint_interval);
 
 extern void eigensolver_davidson(evectmatrix Y, real *eigenvals,
 				 evectoperator A, void *Adata,
+				 evectoperator B, void *Bdata,
 				 evectpreconditioner K, void *Kdata,
 				 evectconstraint constraint,
 				 void *constraint_data,
@@ -68,10 +80,43 @@ extern void eigensolver_davidson(evectmatrix Y, real *eigenvals,
 				 int flags,
 				 real target);
 
+extern void eigensolver_lobpcg(evectmatrix Y, real *eigenvals,
+			       evectoperator A, void *Adata,
+			       evectoperator B, void *Bdata,
+			       evectpreconditioner K, void *Kdata,
+			       evectconstraint constraint,
+			       void *constraint_data,
+			       evectmatrix Work[], int nWork,
+			       real tolerance, int *num_iterations,
+			       int flags);
+
+extern void eigensolver_chebyshev(evectmatrix Y, real *eigenvals,
+				  evectoperator A, void *Adata,
+				  evectconstraint constraint,
+				  void *constraint_data,
+				  evectmatrix Work[], int nWork,
+				  int degree, real tolerance,
+				  int *num_iterations, int flags);
+
+extern void eigensolver_jacobi_davidson(evectmatrix Y, real *eigenvals,
+					evectoperator A, void *Adata,
+					evectpreconditioner K, void *Kdata,
+					evectconstraint constraint,
+					void *constraint_data,
+					evectmatrix Work[], int nWork,
+					real target, int inner_iterations,
+					real tolerance, int *num_iterations,
+					int flags);
+
 extern void eigensolver_get_eigenvals(evectmatrix Y, real *eigenvals,
 				      evectoperator A, void *Adata,
 				      evectmatrix Work1, evectmatrix Work2);
 
+extern real eigensolver_extrapolate(evectmatrix Y0, evectmatrix Y1, real t,
+				    real min_overlap);
+extern real eigensolver_match_bands(evectmatrix Y0, evectmatrix Y1,
+				    int *match, real *overlap);
+
 /* eigensolver option flags, designed to be combined with a bitwise or ('|');
    each flag should set exactly one bit. */
 #define EIGS_VERBOSE (1<<0)
@@ -83,10 +128,20 @@ extern void eigensolver_get_eigenvals(evectmatrix Y, real *eigenvals,
 #define EIGS_REORTHOGONALIZE (1<<6)
 #define EIGS_DYNAMIC_RESET_CG (1<<7)
 #define EIGS_ORTHOGONAL_PRECONDITIONER (1<<8)
+#define EIGS_LOCK_BANDS (1<<9)
 
 /* default flags: what we think works best most of the time: */
 #define EIGS_DEFAULT_FLAGS (EIGS_RESET_CG | EIGS_REORTHOGONALIZE)
 
+/* The per-band convergence test |r|^2 < tolerance * lambda^2 of the
+   LOBPCG, Davidson, Chebyshev and Jacobi-Davidson solvers is relative,
+   which would never be satisfied for a band whose eigenvalue is (or
+   tends to) zero, such as the zero-frequency bands at k = 0, where the
+   residual only becomes as small as the roundoff.  So, they use
+   lambda^2 + LAMBDA2_FLOOR instead (as the trace test in eigensolver.c
+   adds 1e-7 to the trace). */
+#define LAMBDA2_FLOOR 1e-7
+
 typedef struct evectconstraint_chain_struct {
      evectconstraint C;
      void *constraint_data;
@@ -0,0 +1,318 @@
+/* Copyright (C) 1999-2014 Massachusetts Institute of Technology.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* This file contains an alternative eigensolver for computing many
+   bands at once, Chebyshev-filtered subspace iteration:
+
+   Y. Zhou, Y. Saad, M. L. Tiago, and J. R. Chelikowsky,
+   "Self-consistent-field calculations using Chebyshev-filtered subspace
+   iteration," J. Comput. Phys. 219, pp. 172-184 (2006).
+
+   Instead of minimizing the Rayleigh quotient (which needs O(np^2)
+   dense linear algebra on every iteration), we repeatedly multiply the
+   unconverged eigenvector estimates by a degree-m Chebyshev polynomial
+   in A that damps the unwanted part [a, b] of the spectrum, where b is
+   an upper bound on the spectrum (from a few steps of Lanczos) and a
+   is the largest current Ritz value.  The filter only needs applications
+   of A, which are FFT-bound and parallelize well; the orthonormalization
+   and Rayleigh-Ritz step are done only once per filter application
+   (i.e. once every m applications of A).
+
+   The preconditioner is not used, and there is no B operator (the
+   filter would need B^-1 A).  As in eigensolver_lobpcg, convergence is
+   band by band: |r|^2 < tolerance * lambda^2 for the residual r, and
+   converged bands are no longer filtered (but stay in the subspace).
+   It helps to ask for a few more bands than you need, so that the
+   filter bound a is not too close to the highest band of interest. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+
+#include "config.h"
+#include <mpiglue.h>
+#include <mpi_utils.h>
+#include <check.h>
+#include <scalar.h>
+#include <matrices.h>
+#include <blasglue.h>
+
+#include "eigensolver.h"
+
+#define STRINGIZEx(x) #x /* a hack so that we can stringize macro values */
+#define STRINGIZE(x) STRINGIZEx(x)
+
+/**************************************************************************/
+
+#define EIGENSOLVER_MAX_ITERATIONS 100000
+#define FEEDBACK_TIME 4.0 /* elapsed time before we print progress feedback */
+
+/* default polynomial degree of the filter */
+#define CHEBYSHEV_DEFAULT_DEGREE 10
+
+/* number of Lanczos steps for the upper bound of the spectrum */
+#define LANCZOS_STEPS 12
+
+/**************************************************************************/
+
+#define SWAP(a,b) { evectmatrix xxx_swap_tmp = a; a = b; b = xxx_swap_tmp; }
+
+/* Return an upper bound for the spectrum of A (restricted by the
+   constraint), from a few steps of Lanczos starting from a random
+   vector: the largest Ritz value plus the norm of the last residual.
+   v, w, u, and t are single-column work arrays (t is the scratch
+   array for A). */
+static real spectrum_upper_bound(evectoperator A, void *Adata,
+				 evectconstraint constraint,
+				 void *constraint_data,
+				 evectmatrix v, evectmatrix w, evectmatrix u,
+				 evectmatrix t)
+{
+     sqmatrix T, Twork;
+     real alpha[LANCZOS_STEPS], beta[LANCZOS_STEPS], *eigs, bound;
+     int i, k;
+
+     for (i = 0; i < v.n; ++i)
+	  ASSIGN_SCALAR(v.data[i],
+			rand() * 1.0 / RAND_MAX - 0.5,
+			rand() * 1.0 / RAND_MAX - 0.5);
+     if (constraint)
+	  constraint(v, constraint_data);
+     bound = sqrt(SCALAR_RE(evectmatrix_traceXtY(v, v)));
+     mpi_assert_equal(bound);
+     blasglue_rscal(v.n, 1/bound, v.data, 1);
+
+     for (k = 0; k < LANCZOS_STEPS; ++k) {
+	  A(v, w, Adata, 0, t); /* w = A v */
+	  alpha[k] = SCALAR_RE(evectmatrix_traceXtY(v, w));
+	  evectmatrix_aXpbY(1.0, w, -alpha[k], v);
+	  if (k > 0)
+	       evectmatrix_aXpbY(1.0, w, -beta[k-1], u);
+	  beta[k] = sqrt(SCALAR_RE(evectmatrix_traceXtY(w, w)));
+	  mpi_assert_equal(beta[k]);
+	  if (beta[k] == 0) {
+	       ++k;
+	       break;
+	  }
+	  /* u = v, v = w / beta */
+	  evectmatrix_copy(u, v);
+	  evectmatrix_copy(v, w);
+	  blasglue_rscal(v.n, 1/beta[k], v.data, 1);
+     }
+     if (k > LANCZOS_STEPS)
+	  k = LANCZOS_STEPS;
+
+     T = create_sqmatrix(k);
+     Twork = create_sqmatrix(k);
+     for (i = 0; i < k * k; ++i)
+	  ASSIGN_ZERO(T.data[i]);
+     for (i = 0; i < k; ++i) {
+	  ASSIGN_REAL(T.data[i * k + i], alpha[i]);
+	  if (i + 1 < k) {
+	       ASSIGN_REAL(T.data[i * k + i + 1], beta[i]);
+	       ASSIGN_REAL(T.data[(i + 1) * k + i], beta[i]);
+	  }
+     }
+     CHK_MALLOC(eigs, real, k);
+     sqmatrix_eigensolve(T, eigs, Twork);
+     bound = eigs[k - 1] + fabs(beta[k - 1]);
+     free(eigs);
+     destroy_sqmatrix(Twork);
+     destroy_sqmatrix(T);
+     return bound;
+}
+
+/* Replace X by p_m(A) X, where p_m is the degree-m Chebyshev polynomial
+   that is bounded by 1 on [a, b] and is scaled to 1 at a0 < a (using
+   the scaled three-term recurrence to avoid overflow).  Y1 and Y2 are
+   work arrays the same size as X; on output, *X may be any of the
+   three (the others are scratch).  T, also the same size as X, is the
+   scratch array for A, which may overwrite it (as does e.g. the
+   operator for target frequencies), so it must not be X, Y1 or Y2. */
+static void chebyshev_filter(evectmatrix *X, evectmatrix *Y1, evectmatrix *Y2,
+			     evectmatrix T, evectoperator A, void *Adata,
+			     int m, real a, real b, real a0)
+{
+     real e = (b - a) / 2, c = (b + a) / 2;
+     real sigma = e / (a0 - c), sigma1 = sigma, tau = 2 / sigma1;
+     int i;
+
+     /* Y1 = (A X - c X) * sigma / e */
+     A(*X, *Y1, Adata, 0, T);
+     evectmatrix_aXpbY(sigma / e, *Y1, -c * sigma / e, *X);
+
+     for (i = 2; i <= m; ++i) {
+	  real sigma2 = 1 / (tau - sigma);
+	  /* Y2 = (A Y1 - c Y1) * 2 sigma2 / e - sigma sigma2 X */
+	  A(*Y1, *Y2, Adata, 0, T);
+	  evectmatrix_aXpbY(2 * sigma2 / e, *Y2, -2 * c * sigma2 / e, *Y1);
+	  evectmatrix_aXpbY(1.0, *Y2, -sigma * sigma2, *X);
+	  SWAP(*X, *Y1); /* X = Y1 */
+	  SWAP(*Y1, *Y2); /* Y1 = Y2 */
+	  sigma = sigma2;
+     }
+     SWAP(*X, *Y1);
+}
+
+void eigensolver_chebyshev(evectmatrix Y, real *eigenvals,
+			   evectoperator A, void *Adata,
+			   evectconstraint constraint, void *constraint_data,
+			   evectmatrix Work[], int nWork,
+			   int degree, real tolerance, int *num_iterations,
+			   int flags)
+{
+     evectmatrix AY, W1, W2, T;
+     sqmatrix U, S1, S2;
+     real *rnorm2, upper, lower, lowest, prev_E = 0;
+     int *active, p = Y.p, nact = Y.p, iteration = 0, napply = 0, i, j, b;
+     mpiglue_clock_t prev_feedback_time;
+
+     prev_feedback_time = MPIGLUE_CLOCK;
+
+#ifdef DEBUG
+     flags |= EIGS_VERBOSE;
+#endif
+
+     CHECK(nWork >= 4, "not enough workspace");
+     if (degree <= 0)
+	  degree = CHEBYSHEV_DEFAULT_DEGREE;
+     AY = Work[0];
+     W1 = Work[1];
+     W2 = Work[2];
+     T = Work[3]; /* scratch for A */
+
+     U = create_sqmatrix(p);
+     S1 = create_sqmatrix(p);
+     S2 = create_sqmatrix(p);
+     CHK_MALLOC(rnorm2, real, 2 * p);
+     CHK_MALLOC(active, int, p);
+     for (b = 0; b < p; ++b)
+	  active[b] = b;
+
+     evectmatrix_resize(&AY, 1, 0);
+     evectmatrix_resize(&W1, 1, 0);
+     evectmatrix_resize(&W2, 1, 0);
+     evectmatrix_resize(&T, 1, 0);
+     upper = spectrum_upper_bound(A, Adata, constraint, constraint_data,
+				  AY, W1, W2, T);
+     napply += LANCZOS_STEPS;
+     evectmatrix_resize(&AY, p, 0);
+
+     if (constraint)
+	  constraint(Y, constraint_data);
+
+     do {
+	  real E;
+
+	  /* orthonormalize Y: */
+	  evectmatrix_resize(&W1, p, 0);
+	  evectmatrix_resize(&T, p, 0);
+	  evectmatrix_XtX(U, Y, S1);
+	  CHECK(sqmatrix_invert(U, 1, S1), "non-independent Y");
+	  sqmatrix_sqrt(S2, U, S1); /* S2 = 1/sqrt(Yt*Y) */
+	  evectmatrix_XeYS(W1, Y, S2, 1);
+
+	  /* Rayleigh-Ritz: Y = W1 Q, AY = A W1 Q, where Q diagonalizes
+	     W1t A W1 */
+	  A(W1, AY, Adata, 1, T);
+	  napply += p;
+	  evectmatrix_XtY(U, W1, AY, S1);
+	  sqmatrix_eigensolve(U, eigenvals, S1);
+	  evectmatrix_XeYS(Y, W1, U, 1);
+	  evectmatrix_XeYS(W1, AY, U, 1);
+	  evectmatrix_copy(AY, W1);
+
+	  for (E = 0.0, b = 0; b < p; ++b)
+	       E += eigenvals[b];
+	  mpi_assert_equal(E);
+
+	  /* residual norms, and locking of converged bands: */
+	  evectmatrix_copy(W1, AY);
+	  evectmatrix_XpaY_diag_real(W1, -1.0, Y, eigenvals);
+	  evectmatrix_XtX_diag_real(W1, rnorm2, rnorm2 + p);
+	  for (nact = 0, b = 0; b < p; ++b)
+	       if (rnorm2[b] > tolerance * (eigenvals[b] * eigenvals[b]
+					    + LAMBDA2_FLOOR))
+		    active[nact++] = b;
+
+	  if (iteration > 0 && mpi_is_master() &&
+	      ((flags & EIGS_VERBOSE) ||
+	       MPIGLUE_CLOCK_DIFF(MPIGLUE_CLOCK, prev_feedback_time)
+	       > FEEDBACK_TIME)) {
+	       printf("    iteration %4d: "
+		      "trace = %0.16g (%g%% change), %d/%d bands active\n",
+		      iteration, (double) E,
+		      (double) (200.0 * fabs(E - prev_E)
+				/ (fabs(E) + fabs(prev_E))), nact, p);
+	       fflush(stdout); /* make sure output appears */
+	       prev_feedback_time = MPIGLUE_CLOCK; /* reset feedback clock */
+	  }
+
+	  if (nact == 0)
+	       break; /* convergence!  hooray! */
+	  prev_E = E;
+
+	  /* Filter out the spectrum above the highest Ritz value.  If the
+	     bound were exactly the highest Ritz value, the highest band
+	     would not be amplified relative to the next one and would
+	     converge very slowly, so we use the mean band spacing as a
+	     crude estimate of the next eigenvalue above it. */
+	  lowest = eigenvals[0];
+	  lower = eigenvals[p - 1];
+	  if (p > 1)
+	       lower += (eigenvals[p - 1] - eigenvals[0]) / (p - 1);
+	  if (upper <= lower) /* shouldn't happen, but be safe */
+	       upper = lower + fabs(lower) + 1.0;
+	  if (flags & EIGS_VERBOSE)
+	       mpi_one_printf("    filtering [%g, %g] with degree %d\n",
+			      (double) lower, (double) upper, degree);
+	  {
+	       evectmatrix X = W1, Y1 = W2, Y2 = AY, T1 = T;
+	       evectmatrix_resize(&X, nact, 0);
+	       evectmatrix_resize(&Y1, nact, 0);
+	       evectmatrix_resize(&Y2, nact, 0);
+	       evectmatrix_resize(&T1, nact, 0);
+	       for (i = 0; i < Y.n; ++i) /* X = active columns of Y */
+		    for (j = 0; j < nact; ++j)
+			 X.data[i * nact + j] = Y.data[i * Y.fd + active[j]];
+	       chebyshev_filter(&X, &Y1, &Y2, T1, A, Adata, degree,
+				lower, upper, lowest);
+	       napply += degree * nact;
+	       if (constraint)
+		    constraint(X, constraint_data);
+	       for (i = 0; i < Y.n; ++i)
+		    for (j = 0; j < nact; ++j)
+			 Y.data[i * Y.fd + active[j]] = X.data[i * nact + j];
+	  }
+     } while (++iteration < EIGENSOLVER_MAX_ITERATIONS);
+
+     CHECK(iteration < EIGENSOLVER_MAX_ITERATIONS,
+           "failure to converge after "
+           STRINGIZE(EIGENSOLVER_MAX_ITERATIONS)
+           " iterations");
+
+     free(active);
+     free(rnorm2);
+     destroy_sqmatrix(S2);
+     destroy_sqmatrix(S1);
+     destroy_sqmatrix(U);
+
+     /* Report the cost in the same units as the other eigensolvers,
+	i.e. (roughly) the number of applications of A to the whole
+	block, rather than the number of filter steps. */
+     *num_iterations = (napply + p - 1) / p;
+}
@@ -19,10 +19,31 @@
    based on the Davidson method (a preconditioned variant of Lanczos):
 
    M. Crouzeix, B. Philippe, and M. Sadkane, "The Davidson Method,"
-   SIAM J. Sci. Comput. 15, no. 1, pp. 62-76 (January 1994). */
+   SIAM J. Sci. Comput. 15, no. 1, pp. 62-76 (January 1994).
+
+   The search basis V is kept B-orthonormal and grows by one block of
+   preconditioned residuals per iteration, up to nWork/2 blocks (nWork/3
+   if B is given, since we also store BV).  When it is full, we do a
+   "thick" restart that keeps the best Ritz vectors along with the Ritz
+   vectors of the previous iteration (the "GD+k" method of
+
+   A. Stathopoulos and Y. Saad, "Restarting techniques for the
+   (Jacobi-)Davidson symmetric eigenvalue methods," Electron. Trans.
+   Numer. Anal. 7, pp. 163-181 (1998)),
+
+   so that (as in conjugate-gradient methods) restarting does not throw
+   away the information about the most recent search direction.  The
+   restart is done in place, so the memory use is fixed by nWork.
+   Since the restarted basis slowly loses its B-orthonormality to
+   roundoff (which lets the Ritz values drop below the eigenvalues),
+   it is re-B-orthonormalized after each restart.
+
+   As in eigensolver_lobpcg, a band is converged when its residual
+   r = AY - BY lambda satisfies |r|^2 < tolerance * lambda^2. */
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
 
 #include "config.h"
@@ -49,10 +70,128 @@ extern void eigensolver_get_eigenvals_aux(evectmatrix Y, real *eigenvals,
 #define EIGENSOLVER_MAX_ITERATIONS 100000
 #define FEEDBACK_TIME 4.0 /* elapsed time before we print progress feedback */
 
+#define MIN2(a,b) ((a) < (b) ? (a) : (b))
+#define RESTART_ROWS 64 /* number of rows transformed at once in restart */
+
+/**************************************************************************/
+
+/* Copy the upper triangle of the q x q matrix G (with leading dimension
+   ldG) into the Hermitian sqmatrix S. */
+static void hermitian_from_upper(sqmatrix S, scalar *G, int ldG)
+{
+     int i, j, q = S.p;
+     for (i = 0; i < q; ++i) {
+	  ASSIGN_SCALAR(S.data[i*q + i], SCALAR_RE(G[i*ldG + i]), 0);
+	  for (j = i + 1; j < q; ++j) {
+	       S.data[i*q + j] = G[i*ldG + j];
+	       ASSIGN_CONJ(S.data[j*q + i], G[i*ldG + j]);
+	  }
+     }
+}
+
+/* Replace the first m/p blocks V[0..] of the basis by V C, where V
+   is viewed as the n x q matrix [V[0] V[1] ... V[nb-1]] (q = nb * p)
+   and C is q x m.  Since each row of V C depends only on the same row
+   of V, we can do this in place, RESTART_ROWS rows at a time; rowbuf
+   must hold RESTART_ROWS * (q + m) entries. */
+static void restart_blocks(evectmatrix *V, int nb, scalar *C, int m,
+			   scalar *rowbuf)
+{
+     int p = V[0].p, n = V[0].n, q = nb * p, i0, i, j;
+     scalar *xold = rowbuf, *xnew = rowbuf + RESTART_ROWS * q;
+
+     for (i0 = 0; i0 < n; i0 += RESTART_ROWS) {
+	  int rows = MIN2(RESTART_ROWS, n - i0);
+	  for (j = 0; j < nb; ++j)
+	       for (i = 0; i < rows; ++i)
+		    memcpy(xold + i * q + j * p, V[j].data + (i0 + i) * p,
+			   sizeof(scalar) * p);
+	  blasglue_gemm('N', 'N', rows, m, q,
+			1.0, xold, q, C, m, 0.0, xnew, m);
+	  for (j = 0; j < m / p; ++j)
+	       for (i = 0; i < rows; ++i)
+		    memcpy(V[j].data + (i0 + i) * p, xnew + i * m + j * p,
+			   sizeof(scalar) * p);
+     }
+     evectmatrix_flops += V[0].N * V[0].c * 2 * m * q;
+}
+
+/* Given the q x p coefficients Cp (leading dimension m + p) of the
+   previous Ritz vectors, stored in columns m..m+p-1 of C to the right
+   of the m orthonormal coefficient vectors of the new Ritz vectors,
+   orthonormalize Cp against the latter and among themselves.  Returns
+   0 (and leaves Cp garbage) if Cp is (nearly) in the span of the new
+   Ritz vectors, which happens as the Ritz vectors converge. */
+static int orthonormalize_previous(scalar *C, int q, int m, int p,
+				   sqmatrix U, sqmatrix S2, sqmatrix S3,
+				   scalar *scratch)
+{
+     int ld = m + p, pass, i;
+
+     /* classical Gram-Schmidt, twice for stability: */
+     for (pass = 0; pass < 2; ++pass) {
+	  blasglue_gemm('C', 'N', m, p, q,
+			1.0, C, ld, C + m, ld, 0.0, scratch, p);
+	  blasglue_gemm('N', 'N', q, p, m,
+			-1.0, C, ld, scratch, p, 1.0, C + m, ld);
+     }
+
+     blasglue_gemm('C', 'N', p, p, q, 1.0, C + m, ld, C + m, ld,
+		   0.0, U.data, p);
+     for (i = 0; i < p; ++i)
+	  if (SCALAR_RE(U.data[i*p + i]) < 1e-8)
+	       return 0;
+     if (!sqmatrix_invert(U, 1, S3))
+	  return 0;
+     sqmatrix_sqrt(S2, U, S3); /* S2 = 1/sqrt(Cpt*Cp) */
+     blasglue_gemm('N', 'N', q, p, p, 1.0, C + m, ld, S2.data, p,
+		   0.0, scratch, p);
+     for (i = 0; i < q; ++i)
+	  memcpy(C + i * ld + m, scratch + i * p, sizeof(scalar) * p);
+     return 1;
+}
+
+/* Re-B-orthonormalize the nb blocks of the basis V (with BV = B V, or
+   BV = V if B is the identity) by block Gram-Schmidt, with two passes
+   of classical Gram-Schmidt against the previous blocks and CholeskyQR2
+   within each block, applying the same transformations to AV = A V.
+   Then recompute the upper triangle of G = Vt A V from scratch, since
+   the transformed G has accumulated the same roundoff errors.
+   U and S are p x p scratch matrices, and scratch must hold
+   max(2 p^2, p^2 + 2 p) entries. */
+static void reorthonormalize_blocks(evectmatrix *V, evectmatrix *AV,
+				    evectmatrix *BV, int nb,
+				    scalar *G, int ldG,
+				    sqmatrix U, sqmatrix S, scalar *scratch)
+{
+     int p = V[0].p, i, j, pass;
+
+     for (j = 0; j < nb; ++j) {
+	  for (pass = 0; pass < 2; ++pass)
+	       for (i = 0; i < j; ++i) {
+		    evectmatrix_XtY(U, BV[i], V[j], S);
+		    evectmatrix_XpaYS(V[j], -1.0, V[i], U, 0);
+		    evectmatrix_XpaYS(AV[j], -1.0, AV[i], U, 0);
+		    if (BV != V)
+			 evectmatrix_XpaYS(BV[j], -1.0, BV[i], U, 0);
+	       }
+	  evectmatrix_XtY(U, V[j], BV[j], S);
+	  CHECK(evectmatrix_cholqr2(V[j], BV[j], &AV[j], 1, U, NULL, 1,
+				    S, scratch),
+		"non-independent basis after restart");
+     }
+
+     for (j = 0; j < nb; ++j)
+	  for (i = 0; i <= j; ++i)
+	       evectmatrix_XtY_block(G + i * p * ldG + j * p, ldG,
+				     V[i], AV[j], scratch);
+}
+
 /**************************************************************************/
 
 void eigensolver_davidson(evectmatrix Y, real *eigenvals,
 			  evectoperator A, void *Adata,
+			  evectoperator B, void *Bdata,
 			  evectpreconditioner K, void *Kdata,
 			  evectconstraint constraint, void *constraint_data,
 			  evectmatrix Work[], int nWork,
@@ -60,12 +199,13 @@ void eigensolver_davidson(evectmatrix Y, real *eigenvals,
 			  int flags,
 			  real target)
 {
-     int nbasis, q;
-     evectmatrix *AV, *V;
-     sqmatrix VAV, S, Swork, U, S2, S3, I;
+     int p = Y.p, nbasis, qmax, q, qprev = 0;
+     evectmatrix *AV, *V, *BV;
+     sqmatrix S, Swork, U, S2, S3, I;
+     scalar *G, *C, *Cprev, *scratch, *rowbuf;
      mpiglue_clock_t prev_feedback_time;
-     int iteration = 0, ibasis = 0;
-     real *eigenvals2, prev_E = 0;
+     int iteration = 0, nb, *sel;
+     real *eigenvals2, *rnorm2, prev_E = 0;
 
      prev_feedback_time = MPIGLUE_CLOCK;
      
@@ -73,53 +213,65 @@ void eigensolver_davidson(evectmatrix Y, real *eigenvals,
      flags |= EIGS_VERBOSE;
 #endif
 
-     CHECK(nWork >= 4, "not enough workspace");
+     nbasis = nWork / (B ? 3 : 2);
+     CHECK(nbasis >= 2, "not enough workspace");
 
-     nbasis = nWork / 2;
      V = Work;
      AV = Work + nbasis;
+     BV = B ? Work + 2 * nbasis : V; /* BV = V if B is the identity */
 
-     q = Y.p * nbasis;
-     VAV = create_sqmatrix(q);
-     S = create_sqmatrix(q);
-     Swork = create_sqmatrix(q);
-
-     sqmatrix_resize(&VAV, 0, 0);
-     sqmatrix_resize(&S, 0, 0);
-     sqmatrix_resize(&Swork, 0, 0);
+     qmax = p * nbasis;
+     S = create_sqmatrix(qmax);
+     Swork = create_sqmatrix(qmax);
 
-     CHK_MALLOC(eigenvals2, real, q);
+     CHK_MALLOC(eigenvals2, real, qmax);
+     CHK_MALLOC(rnorm2, real, 2 * p);
+     CHK_MALLOC(sel, int, qmax);
+     CHK_MALLOC(G, scalar, qmax * qmax); /* upper triangle of V^t A V */
+     CHK_MALLOC(C, scalar, qmax * qmax);
+     CHK_MALLOC(Cprev, scalar, qmax * p);
+     CHK_MALLOC(scratch, scalar, qmax * qmax);
+     CHK_MALLOC(rowbuf, scalar, RESTART_ROWS * 2 * qmax);
 
-     U = create_sqmatrix(Y.p);
-     S2 = create_sqmatrix(Y.p);
-     S3 = create_sqmatrix(Y.p);
+     U = create_sqmatrix(p);
+     S2 = create_sqmatrix(p);
+     S3 = create_sqmatrix(p);
 
      I = create_sqmatrix(0);
 
      if (constraint)
 	  constraint(Y, constraint_data);
 
-     evectmatrix_XtX(U, Y, S3);
+     if (B) {
+	  B(Y, BV[0], Bdata, 1, AV[0]);
+	  evectmatrix_XtY(U, Y, BV[0], S3);
+     }
+     else
+	  evectmatrix_XtX(U, Y, S3);
      CHECK(sqmatrix_invert(U, 1, S3), "singular YtY at start");
-     sqmatrix_sqrt(S2, U, S3); /* S2 = 1/sqrt(Yt*Y) */
+     sqmatrix_sqrt(S2, U, S3); /* S2 = 1/sqrt(Yt*B*Y) */
      evectmatrix_XeYS(V[0], Y, S2, 1); /* V[0] = orthonormalize Y */
+     if (B) {
+	  evectmatrix_copy(AV[0], BV[0]);
+	  evectmatrix_XeYS(BV[0], AV[0], S2, 1);
+     }
+     nb = 1;
 
      do {
 	  real E;
-	  int itarget, i;
+	  int itarget, i, b, ib = nb - 1, restart;
+	  evectmatrix BY;
 
-	  A(V[ibasis], AV[ibasis], Adata, 0, Y);
+	  /* apply A to the newest block and update G = Vt A V: */
+	  A(V[ib], AV[ib], Adata, 0, Y);
+	  for (i = 0; i <= ib; ++i)
+	       evectmatrix_XtY_block(G + i * p * qmax + ib * p, qmax,
+				     V[i], AV[ib], scratch);
 
-	  q = Y.p * (ibasis + 1);
-	  sqmatrix_resize(&VAV, q, 1);
+	  q = p * nb;
 	  sqmatrix_resize(&S, q, 0);
 	  sqmatrix_resize(&Swork, q, 0);
-
-	  for (i = 0; i <= ibasis; ++i) {
-	       evectmatrixXtY_sub(VAV, Y.p * (q * i + ibasis),
-				  V[i], AV[ibasis], S3);
-	  }
-	  sqmatrix_copy_upper2full(S, VAV);
+	  hermitian_from_upper(S, G, qmax);
 
 	  sqmatrix_eigensolve(S, eigenvals2, Swork);
 
@@ -141,7 +293,7 @@ void eigensolver_davidson(evectmatrix Y, real *eigenvals,
 	  mpi_assert_equal(E);
 
 	  /* compute Y = best eigenvectors */
-	  for (i = 0; i <= ibasis; ++i) {
+	  for (i = 0; i < nb; ++i) {
 	       evectmatrix_aXpbYS_sub(i ? 1.0 : 0.0, Y,
 				      1.0, V[i],
 				      S, itarget * q + Y.p * i, 1);
@@ -158,66 +310,132 @@ void eigensolver_davidson(evectmatrix Y, real *eigenvals,
                prev_feedback_time = MPIGLUE_CLOCK; /* reset feedback clock */
           }
 
-	  if (iteration > 0 &&
-              fabs(E - prev_E) < tolerance * 0.5 * (fabs(E) + 
-						    fabs(prev_E) + 1e-7))
-               break; /* convergence!  hooray! */
-	  
-	  /* compute new directions from residual & update basis: */
-	  {
-	       int ibasis2 = (ibasis + 1) % nbasis;
-
-	       /* compute V[ibasis2] = AY */
-#if 1
-	       for (i = 0; i <= ibasis; ++i) {
-		    evectmatrix_aXpbYS_sub(i ? 1.0 : 0.0, V[ibasis2],
+	  restart = nb == nbasis;
+	  if (restart) {
+	       /* Thick restart: keep the Ritz vectors of the window
+		  first (so that V[0] = Y), then the Ritz vectors
+		  nearest to the window, then the (orthonormalized)
+		  Ritz vectors of the previous iteration if there is
+		  room for them along with the new residual block. */
+	       int nkeep = nbasis / 2 - 1 > 1 ? nbasis / 2 - 1 : 1;
+	       int m = nkeep * p, mtot, lo = itarget - 1, hi = itarget + p;
+
+	       for (i = 0; i < p; ++i)
+		    sel[i] = itarget + i;
+	       for (; i < m; ++i) {
+		    if (lo >= 0 && (hi >= q || fabs(target - eigenvals2[lo])
+				    < fabs(target - eigenvals2[hi])))
+			 sel[i] = lo--;
+		    else
+			 sel[i] = hi++;
+	       }
+
+	       mtot = m + (nkeep + 1 < nbasis && qprev > 0 ? p : 0);
+	       for (i = 0; i < q; ++i) {
+		    for (b = 0; b < m; ++b)
+			 ASSIGN_CONJ(C[i * mtot + b], S.data[sel[b] * q + i]);
+		    for (b = m; b < mtot; ++b) {
+			 if (i < qprev)
+			      C[i * mtot + b] = Cprev[i * p + b - m];
+			 else {
+			      ASSIGN_ZERO(C[i * mtot + b]);
+			 }
+		    }
+	       }
+	       if (mtot > m && !orthonormalize_previous(C, q, m, p,
+							U, S2, S3, scratch)) {
+		    /* drop the previous Ritz vectors: */
+		    for (i = 0; i < q; ++i)
+			 memmove(C + i * m, C + i * mtot,
+				 sizeof(scalar) * m);
+		    mtot = m;
+	       }
+
+	       restart_blocks(V, nb, C, mtot, rowbuf);
+	       restart_blocks(AV, nb, C, mtot, rowbuf);
+	       if (B)
+		    restart_blocks(BV, nb, C, mtot, rowbuf);
+	       nb = mtot / p;
+
+	       /* V[0] is now Y, so AY = AV[0] and BY = BV[0]: */
+	       evectmatrix_copy(V[nb], AV[0]);
+	       BY = B ? BV[0] : Y;
+	  }
+	  else {
+	       /* compute V[nb] = AY and BV[nb] = BY */
+	       for (i = 0; i < nb; ++i) {
+		    evectmatrix_aXpbYS_sub(i ? 1.0 : 0.0, V[nb],
 					   1.0, AV[i],
 					   S, itarget * q + Y.p * i, 1);
+		    if (B)
+			 evectmatrix_aXpbYS_sub(i ? 1.0 : 0.0, BV[nb],
+						1.0, BV[i],
+						S, itarget * q + Y.p * i, 1);
 	       }
-#else
-	       A(Y, V[ibasis2], Adata, 1, Y);
-#endif
-	  
-	       /* handle restart case: */
-	       if (ibasis2 == 0) {
-		    evectmatrix_copy(AV[0], V[0]);
-		    evectmatrix_copy(V[0], Y);
-		    sqmatrix_resize(&VAV, Y.p, 0);
-		    evectmatrix_XtY(VAV, V[0], AV[0], S3);
-		    ibasis2 = 1;
-		    evectmatrix_copy(V[ibasis2], AV[0]);
-	       }
+	       BY = B ? BV[nb] : Y;
+	  }
 
-	       /* V[ibasis2] = residual = AY - Y * eigenvals */
-	       matrix_XpaY_diag_real(V[ibasis2].data, 
-				     -1.0, Y.data,
-				     eigenvals, Y.n, Y.p);
-
-	       /* AV[ibasis2] = precondition V[ibasis2]: */
-	       if (K != NULL)
-		    K(V[ibasis2], AV[ibasis2], Kdata, Y, eigenvals, I);
-	       else
-		    evectmatrix_copy(AV[ibasis2], V[ibasis2]);
-
-	       /* project by the constraints, if any: */
-	       if (constraint)
-		    constraint(AV[ibasis2], constraint_data);
-
-	       /* orthogonalize against previous V: */
-	       for (i = 0; i < ibasis2; ++i) {
-		    evectmatrix_XtY(U, V[i], AV[ibasis2], S3);
-		    evectmatrix_XpaYS(AV[ibasis2], -1.0, V[i], U, 0);
+	  /* save the coefficients of Y in the current basis, for the
+	     next restart: */
+	  qprev = p * nb;
+	  for (i = 0; i < qprev; ++i)
+	       for (b = 0; b < p; ++b) {
+		    if (restart) {
+			 ASSIGN_SCALAR(Cprev[i * p + b], i == b, 0);
+		    }
+		    else
+			 ASSIGN_CONJ(Cprev[i * p + b],
+				     S.data[(itarget + b) * q + i]);
 	       }
 
-	       /* orthonormalize within itself: */
-	       evectmatrix_XtX(U, AV[ibasis2], S3);
-	       CHECK(sqmatrix_invert(U, 1, S3), "non-independent AV subspace");
-	       sqmatrix_sqrt(S2, U, S3);
-	       evectmatrix_XeYS(V[ibasis2], AV[ibasis2], S2, 1);
+	  /* V[nb] = residual = AY - BY * eigenvals */
+	  evectmatrix_XpaY_diag_real(V[nb], -1.0, BY, eigenvals);
+
+	  evectmatrix_XtX_diag_real(V[nb], rnorm2, rnorm2 + p);
+	  for (b = 0; b < p && rnorm2[b] <= tolerance *
+		    (eigenvals[b] * eigenvals[b] + LAMBDA2_FLOOR); ++b)
+	       ;
+	  if (b == p)
+	       break; /* convergence!  hooray! */
+
+	  /* after a restart, the residual was computed from AY = AV[0]
+	     and BY = BV[0], so only now can we re-B-orthonormalize the
+	     basis (which also recomputes G): */
+	  if (restart)
+	       reorthonormalize_blocks(V, AV, BV, nb, G, qmax,
+				       U, S3, scratch);
+
+	  /* AV[nb] = precondition V[nb]: */
+	  if (K != NULL)
+	       K(V[nb], AV[nb], Kdata, Y, eigenvals, I);
+	  else
+	       evectmatrix_copy(AV[nb], V[nb]);
+
+	  /* project by the constraints, if any: */
+	  if (constraint)
+	       constraint(AV[nb], constraint_data);
+
+	  /* B-orthogonalize against previous V (twice, for stability): */
+	  for (b = 0; b < 2; ++b)
+	       for (i = 0; i < nb; ++i) {
+		    evectmatrix_XtY(U, BV[i], AV[nb], S3);
+		    evectmatrix_XpaYS(AV[nb], -1.0, V[i], U, 0);
+	       }
 
-	       ibasis = ibasis2;
+	  /* B-orthonormalize within itself, by CholeskyQR2 since the
+	     residuals of converged bands are nearly dependent: */
+	  if (B) {
+	       B(AV[nb], BV[nb], Bdata, 0, V[nb]);
+	       evectmatrix_XtY(U, AV[nb], BV[nb], S3);
 	  }
-
+	  else
+	       evectmatrix_XtX(U, AV[nb], S3);
+	  CHECK(evectmatrix_cholqr2(AV[nb], B ? BV[nb] : AV[nb], NULL, 0,
+				    U, NULL, 1, S3, scratch),
+		"non-independent AV subspace");
+	  evectmatrix_copy(V[nb], AV[nb]);
+
+	  ++nb;
 	  prev_E = E;
      } while (++iteration < EIGENSOLVER_MAX_ITERATIONS);
 
@@ -226,14 +444,27 @@ void eigensolver_davidson(evectmatrix Y, real *eigenvals,
            STRINGIZE(EIGENSOLVER_MAX_ITERATIONS)
            " iterations");
 
-     evectmatrix_XtX(U, Y, S3);
-     CHECK(sqmatrix_invert(U, 1, S3), "singular YtY at end");
+     /* diagonalize A in the Y subspace, B-orthonormalizing Y with
+	U = 1/(Yt B Y): */
+     if (B) {
+	  B(Y, AV[0], Bdata, 1, V[0]);
+	  evectmatrix_XtY(U, Y, AV[0], S3);
+     }
+     else
+	  evectmatrix_XtX(U, Y, S3);
+     CHECK(sqmatrix_invert(U, 1, S3), "singular YtBY at end");
      eigensolver_get_eigenvals_aux(Y, eigenvals, A, Adata,
 				   V[0], AV[0], U, S3, S2);
 
+     free(rowbuf);
+     free(scratch);
+     free(Cprev);
+     free(C);
+     free(G);
+     free(sel);
+     free(rnorm2);
      free(eigenvals2);
 
-     destroy_sqmatrix(VAV);
      destroy_sqmatrix(S);
      destroy_sqmatrix(Swork);
      destroy_sqmatrix(U);
@@ -0,0 +1,697 @@
+/* Copyright (C) 1999-2014 Massachusetts Institute of Technology.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* This file contains an eigensolver for the Y.p eigenvalues of A closest
+   to a given target (i.e. interior eigenvalues), the Jacobi-Davidson
+   method with harmonic Ritz values:
+
+   G. L. G. Sleijpen and H. A. van der Vorst, "A Jacobi-Davidson
+   iteration method for linear eigenvalue problems," SIAM J. Matrix
+   Anal. Appl. 17, no. 2, pp. 401-425 (1996).
+
+   Finding interior eigenvalues with eigensolver() requires minimizing
+   over (A - target)^2 instead, which squares the condition number and
+   makes convergence very slow.  Here, we never square the operator.
+
+   We build up an orthonormal basis V of the search space, along with
+   AV = (A - target) V.  Approximate eigenvectors u = V y are extracted
+   with harmonic Ritz values, which are much better than ordinary Ritz
+   values at picking out the eigenvalues closest to the target: we solve
+   the small generalized eigenproblem
+
+              adjoint(AV) V y = mu adjoint(AV) AV y
+
+   and take the eigenvectors with the largest |mu|, since 1/mu
+   approximates the eigenvalue minus the target.  The eigenvalue
+   estimate is the Rayleigh quotient theta = u* A u, and the residual
+   r = (A - theta) u can be computed from AV without applying A.
+
+   The basis is then expanded by an approximate solution t (with t
+   orthogonal to u) of the correction equation
+
+             (1 - u u*) (A - theta) (1 - u u*) t = -r
+
+   for each band, computed with a few steps of MINRES.  (The shifted
+   operator is indefinite, but MINRES only needs it to be Hermitian.)
+   The preconditioner K should approximate the inverse of A (not of
+   the shifted or squared operator), since it must be positive-definite.
+
+   When the basis is full, it is restarted with the harmonic Ritz
+   vectors closest to the target (which fill about half of it).  The
+   Work arrays provide (nWork - 7) / 2 arrays for each of V and AV, so
+   nWork must be at least 11, and more workspace gives a bigger basis
+   between restarts.  As in eigensolver_lobpcg, convergence is determined band
+   by band (|r|^2 < tolerance * theta^2), and converged bands are "soft
+   locked": they stay in the basis, but we stop computing corrections
+   for them.
+
+   With a small basis, the theta-shifted correction equation can get
+   stuck in a cycle where every correction is discarded at the next
+   restart and the residuals stop changing.  If the residuals of the
+   active bands stagnate, we use the target shift for a while to break
+   the cycle; if that doesn't help either, we give up and return the
+   current Ritz pairs (with a warning) rather than spinning until the
+   iteration limit. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "config.h"
+#include <mpiglue.h>
+#include <mpi_utils.h>
+#include <check.h>
+#include <scalar.h>
+#include <matrices.h>
+#include <blasglue.h>
+
+#include "eigensolver.h"
+
+extern void eigensolver_get_eigenvals_aux(evectmatrix Y, real *eigenvals,
+                                          evectoperator A, void *Adata,
+                                          evectmatrix Work1, evectmatrix Work2,
+                                          sqmatrix U, sqmatrix Usqrt,
+                                          sqmatrix Uwork);
+
+#define MIN2(a,b) ((a) < (b) ? (a) : (b))
+#define MAX2(a,b) ((a) > (b) ? (a) : (b))
+
+/**************************************************************************/
+
+#define EIGENSOLVER_MAX_ITERATIONS 100000
+#define FEEDBACK_TIME 4.0 /* elapsed time before we print progress feedback */
+
+/* default number of MINRES steps for the correction equation */
+#define JD_INNER_ITERATIONS 10
+
+/* Far from convergence, theta is a poor eigenvalue estimate, and using
+   it as the shift in the correction equation tends to steer the search
+   towards whatever eigenvalues are near theta instead of the target.
+   So, we use the target as the shift until |r| < JD_SHIFT_SWITCH * theta. */
+#define JD_SHIFT_SWITCH 0.1
+
+/* The residuals are stagnant if their (relative) sum over the active
+   bands has not dropped by a factor of JD_STAGNATION_FACTOR within
+   JD_STAGNATION_ITERATIONS iterations. */
+#define JD_STAGNATION_ITERATIONS 1000
+#define JD_STAGNATION_FACTOR 0.99
+
+/**************************************************************************/
+
+#define SWAP(a,b) { evectmatrix xxx_swap_tmp = a; a = b; b = xxx_swap_tmp; }
+
+/* Subtract from each column of X its projection onto the corresponding
+   (normalized) column of U.  c is a scratch array of 2 * X.p scalars. */
+static void project_columns(evectmatrix X, evectmatrix U, scalar *c)
+{
+     evectmatrix_XtY_diag(U, X, c, c + X.p);
+     evectmatrix_XpaY_diag(X, -1.0, U, c);
+}
+
+/* Set X = Y, with column j multiplied by s[j]. */
+static void scale_columns(evectmatrix X, evectmatrix Y, real *s)
+{
+     int i, j;
+
+     CHECK(X.n == Y.n && X.p == Y.p, "arrays not conformant");
+     for (i = 0; i < X.n; ++i)
+	  for (j = 0; j < X.p; ++j)
+	       ASSIGN_SCALAR(X.data[i*X.fd + j],
+			     s[j] * SCALAR_RE(Y.data[i*Y.fd + j]),
+			     s[j] * SCALAR_IM(Y.data[i*Y.fd + j]));
+}
+
+/* Z = (1 - u u*) K R for each column, with the constraints applied. */
+static void precondition_projected(evectmatrix R, evectmatrix Z,
+				   evectmatrix U,
+				   evectpreconditioner K, void *Kdata,
+				   evectconstraint constraint,
+				   void *constraint_data,
+				   sqmatrix I, scalar *c)
+{
+     if (K != NULL)
+	  K(R, Z, Kdata, U, NULL, I);
+     else
+	  evectmatrix_copy(Z, R);
+     if (constraint)
+	  constraint(Z, constraint_data);
+     project_columns(Z, U, c);
+}
+
+/* Approximately solve the correction equations
+
+          (1 - u u*) (A - theta) (1 - u u*) t = r,  with t orthogonal to u,
+
+   for each column u of U, with shift theta and right-hand side r the
+   corresponding elements of theta and columns of R, by niter steps of
+   MINRES with preconditioner (1 - u u*) K (1 - u u*).  (Since only the
+   span of t matters, we drop the minus sign of the usual correction
+   equation.)  Each column is solved independently, as in:
+
+   C. C. Paige and M. A. Saunders, "Solution of sparse indefinite
+   systems of linear equations," SIAM J. Numer. Anal. 12, no. 4,
+   pp. 617-629 (1975).
+
+   The solution is stored in T.  R is overwritten, and Z and the four
+   Work arrays are used as scratch; all must have U.p columns. */
+static void solve_correction(evectmatrix T, evectmatrix R, evectmatrix Z,
+			     evectmatrix U, real *theta, int niter,
+			     evectoperator A, void *Adata,
+			     evectpreconditioner K, void *Kdata,
+			     evectconstraint constraint,
+			     void *constraint_data,
+			     evectmatrix Work[4], sqmatrix I)
+{
+     int p = U.p, it, b;
+     evectmatrix R1 = R, R2 = Work[0], Vk = Work[1], Wk = Work[2],
+	  Wold = Work[3];
+     real *s, *beta, *oldb, *dbar, *epsln, *phibar, *cs, *sn, *alfa,
+	  *c1, *c2, *c3, *phi, *rscratch;
+     scalar *c;
+
+     CHK_MALLOC(s, real, 14 * p);
+     beta = s; oldb = s + p; dbar = s + 2*p; epsln = s + 3*p;
+     phibar = s + 4*p; cs = s + 5*p; sn = s + 6*p; alfa = s + 7*p;
+     c1 = s + 8*p; c2 = s + 9*p; c3 = s + 10*p; phi = s + 11*p;
+     rscratch = s + 12*p;
+     CHK_MALLOC(c, scalar, 2 * p);
+
+     precondition_projected(R1, Z, U, K, Kdata, constraint, constraint_data,
+			    I, c);
+     evectmatrix_XtY_diag_real(R1, Z, beta, rscratch);
+     for (b = 0; b < p; ++b) {
+	  beta[b] = sqrt(MAX2(beta[b], 0.0));
+	  phibar[b] = beta[b];
+	  oldb[b] = dbar[b] = epsln[b] = sn[b] = 0.0;
+	  cs[b] = -1.0;
+     }
+     evectmatrix_copy(R2, R1);
+     memset(T.data, 0, sizeof(scalar) * T.n * T.p);
+     memset(Wk.data, 0, sizeof(scalar) * Wk.n * Wk.p);
+     memset(Wold.data, 0, sizeof(scalar) * Wold.n * Wold.p);
+
+     for (it = 0; it < niter; ++it) {
+	  /* Lanczos step: Vk = Z / beta, Z = (A - theta) Vk - ... */
+	  for (b = 0; b < p; ++b)
+	       c1[b] = beta[b] > 0 ? 1.0 / beta[b] : 0.0;
+	  scale_columns(Vk, Z, c1);
+	  A(Vk, Z, Adata, 0, Z);
+	  matrix_XpaY_diag_real(Z.data, -1.0, Vk.data, theta, Z.n, p);
+	  project_columns(Z, U, c);
+	  if (it > 0) {
+	       for (b = 0; b < p; ++b)
+		    c1[b] = oldb[b] > 0 ? beta[b] / oldb[b] : 0.0;
+	       matrix_XpaY_diag_real(Z.data, -1.0, R1.data, c1, Z.n, p);
+	  }
+	  evectmatrix_XtY_diag_real(Vk, Z, alfa, rscratch);
+	  for (b = 0; b < p; ++b)
+	       c1[b] = beta[b] > 0 ? alfa[b] / beta[b] : 0.0;
+	  matrix_XpaY_diag_real(Z.data, -1.0, R2.data, c1, Z.n, p);
+
+	  /* R1 = R2, R2 = Z, Z = K R2 */
+	  SWAP(R1, R2);
+	  SWAP(R2, Z);
+	  precondition_projected(R2, Z, U, K, Kdata,
+				 constraint, constraint_data, I, c);
+	  evectmatrix_XtY_diag_real(R2, Z, c1, rscratch);
+
+	  /* update the QR factorization of the tridiagonal matrix: */
+	  for (b = 0; b < p; ++b) {
+	       real oldeps = epsln[b], delta, gbar, gamma;
+
+	       oldb[b] = beta[b];
+	       beta[b] = sqrt(MAX2(c1[b], 0.0));
+	       delta = cs[b] * dbar[b] + sn[b] * alfa[b];
+	       gbar = sn[b] * dbar[b] - cs[b] * alfa[b];
+	       epsln[b] = sn[b] * beta[b];
+	       dbar[b] = -cs[b] * beta[b];
+	       gamma = sqrt(gbar * gbar + beta[b] * beta[b]);
+	       if (gamma == 0.0) { /* breakdown: this column is solved */
+		    c1[b] = c2[b] = c3[b] = phi[b] = 0.0;
+		    beta[b] = 0.0;
+		    continue;
+	       }
+	       cs[b] = gbar / gamma;
+	       sn[b] = beta[b] / gamma;
+	       phi[b] = cs[b] * phibar[b];
+	       phibar[b] *= sn[b];
+	       c1[b] = 1.0 / gamma;
+	       c2[b] = -oldeps / gamma;
+	       c3[b] = -delta / gamma;
+	  }
+
+	  /* new direction Vk = (Vk - oldeps Wold - delta Wk) / gamma,
+	     rotated into Wk, and T += phi Wk: */
+	  matrix_X_diag_real_pY_diag_real(Vk.data, c1, Wold.data, c2,
+					  Vk.n, p);
+	  matrix_XpaY_diag_real(Vk.data, 1.0, Wk.data, c3, Vk.n, p);
+	  SWAP(Wold, Wk);
+	  SWAP(Wk, Vk);
+	  matrix_XpaY_diag_real(T.data, 1.0, Wk.data, phi, T.n, p);
+     }
+
+     free(c);
+     free(s);
+}
+
+/* The basis V, and AV = (A - target) V, are stored in the Work arrays
+   as a sequence of "segments": segment s holds the basis vectors
+   off[s]..off[s]+w[s]-1 as an n x w[s] matrix in buffer buf[s], starting
+   at column col[s] (i.e. at offset n * col[s] in its data).  This way,
+   the narrow blocks that we get when only a few bands are active are
+   packed together, and the basis size does not depend on the number
+   of active bands. */
+typedef struct {
+     evectmatrix *V, *AV; /* the nbuf buffers holding the segments */
+     int nbuf, p; /* number and width of the buffers */
+     int nseg, q; /* number of segments and total size of the basis */
+     int *buf, *col, *w, *off;
+} jd_basis;
+
+static evectmatrix basis_segment(jd_basis *B, int s, int av)
+{
+     evectmatrix X = av ? B->AV[B->buf[s]] : B->V[B->buf[s]];
+     X.data += X.n * B->col[s];
+     X.p = X.alloc_p = X.fd = B->w[s];
+     return X;
+}
+
+/* Set X = V C (or AV C, if av != 0), where C is B->q x X.p. */
+static void basis_combine(jd_basis *B, int av, evectmatrix X, scalar *C)
+{
+     int s;
+     for (s = 0; s < B->nseg; ++s)
+	  evectmatrix_XpYC(s ? 1.0 : 0.0, X, 1.0, basis_segment(B, s, av),
+			   C + B->off[s] * X.p);
+}
+
+/* Orthogonalize X against the basis, with two passes of classical
+   Gram-Schmidt.  C must hold B->p * X.p entries. */
+static void basis_orthogonalize(jd_basis *B, evectmatrix X,
+				scalar *C, scalar *scratch)
+{
+     int pass, s;
+     for (pass = 0; pass < 2; ++pass)
+	  for (s = 0; s < B->nseg; ++s) {
+	       evectmatrix Vs = basis_segment(B, s, 0);
+	       evectmatrix_XtY_block(C, X.p, Vs, X, scratch);
+	       evectmatrix_XpYC(1.0, X, -1.0, Vs, C);
+	  }
+}
+
+/* Append the columns of X (which must be orthonormal, and orthogonal
+   to the basis) to the basis, computing the corresponding columns of
+   AV and of the upper triangles of G1 = V* AV and G2 = AV* AV (which
+   have leading dimension ldG).  Work is passed to A as scratch. */
+static void basis_append(jd_basis *B, evectmatrix X,
+			 evectoperator A, void *Adata, real target,
+			 evectmatrix Work,
+			 scalar *G1, scalar *G2, int ldG, scalar *scratch)
+{
+     int done, s, t;
+
+     for (done = 0; done < X.p; done += B->w[s]) {
+	  evectmatrix Vs, AVs;
+	  int buf = 0, col = 0;
+
+	  if (B->nseg > 0) { /* start after the last segment */
+	       buf = B->buf[B->nseg - 1];
+	       col = B->col[B->nseg - 1] + B->w[B->nseg - 1];
+	       if (col == B->p) {
+		    ++buf;
+		    col = 0;
+	       }
+	  }
+	  CHECK(buf < B->nbuf, "Jacobi-Davidson basis overflow");
+
+	  s = B->nseg++;
+	  B->buf[s] = buf;
+	  B->col[s] = col;
+	  B->w[s] = MIN2(X.p - done, B->p - col);
+	  B->off[s] = B->q;
+	  B->q += B->w[s];
+
+	  Vs = basis_segment(B, s, 0);
+	  AVs = basis_segment(B, s, 1);
+	  evectmatrix_copy_slice(Vs, X, 0, done, Vs.p);
+	  A(Vs, AVs, Adata, 0, Work);
+	  evectmatrix_aXpbY(1.0, AVs, -target, Vs);
+
+	  for (t = 0; t <= s; ++t) {
+	       evectmatrix_XtY_block(G1 + B->off[t] * ldG + B->off[s], ldG,
+				     basis_segment(B, t, 0), AVs, scratch);
+	       evectmatrix_XtY_block(G2 + B->off[t] * ldG + B->off[s], ldG,
+				     basis_segment(B, t, 1), AVs, scratch);
+	  }
+     }
+}
+
+#define RESTART_ROWS 64 /* number of rows transformed at once in restart */
+
+/* Restart, replacing V by V C and AV by AV C, where C is q x m and m
+   is the size of the first nkeep segments, which are reused to store
+   the new basis.  Since each row of V C depends only on the same row
+   of V, we can do this in place, RESTART_ROWS rows at a time; rowbuf
+   must hold RESTART_ROWS * (q + m) entries. */
+static void basis_restart(jd_basis *B, int nkeep, scalar *C, scalar *rowbuf)
+{
+     int q = B->q, m = nkeep < B->nseg ? B->off[nkeep] : q;
+     int n = B->V[0].n, av, i0, i, s;
+     scalar *xold = rowbuf, *xnew = rowbuf + RESTART_ROWS * q;
+
+     for (av = 0; av < 2; ++av)
+	  for (i0 = 0; i0 < n; i0 += RESTART_ROWS) {
+	       int rows = MIN2(RESTART_ROWS, n - i0);
+	       for (s = 0; s < B->nseg; ++s) {
+		    evectmatrix Vs = basis_segment(B, s, av);
+		    for (i = 0; i < rows; ++i)
+			 memcpy(xold + i * q + B->off[s],
+				Vs.data + (i0 + i) * Vs.p,
+				sizeof(scalar) * Vs.p);
+	       }
+	       blasglue_gemm('N', 'N', rows, m, q,
+			     1.0, xold, q, C, m, 0.0, xnew, m);
+	       for (s = 0; s < nkeep; ++s) {
+		    evectmatrix Vs = basis_segment(B, s, av);
+		    for (i = 0; i < rows; ++i)
+			 memcpy(Vs.data + (i0 + i) * Vs.p,
+				xnew + i * m + B->off[s],
+				sizeof(scalar) * Vs.p);
+	       }
+	  }
+     evectmatrix_flops += B->V[0].N * B->V[0].c * 2 * m * (2 * q);
+
+     B->nseg = nkeep;
+     B->q = m;
+}
+
+/* Copy the upper triangle of the q x q matrix G (with leading dimension
+   ldG) into the Hermitian sqmatrix S. */
+static void hermitian_from_upper(sqmatrix S, scalar *G, int ldG)
+{
+     int i, j, q = S.p;
+     for (i = 0; i < q; ++i) {
+	  ASSIGN_SCALAR(S.data[i*q + i], SCALAR_RE(G[i*ldG + i]), 0);
+	  for (j = i + 1; j < q; ++j) {
+	       S.data[i*q + j] = G[i*ldG + j];
+	       ASSIGN_CONJ(S.data[j*q + i], G[i*ldG + j]);
+	  }
+     }
+}
+
+/* Replace the q x q matrix G (upper triangle, leading dimension ldG) by
+   adjoint(C) G C, where C is q x m.  S is a scratch sqmatrix, and
+   scratch must hold q * m entries. */
+static void project_upper(scalar *G, int ldG, int q, scalar *C, int m,
+			  sqmatrix S, scalar *scratch)
+{
+     sqmatrix_resize(&S, q, 0);
+     hermitian_from_upper(S, G, ldG);
+     blasglue_gemm('N', 'N', q, m, q, 1.0, S.data, q, C, m, 0.0, scratch, m);
+     blasglue_gemm('C', 'N', m, m, q, 1.0, C, m, scratch, m, 0.0, G, ldG);
+}
+
+void eigensolver_jacobi_davidson(evectmatrix Y, real *eigenvals,
+				 evectoperator A, void *Adata,
+				 evectpreconditioner K, void *Kdata,
+				 evectconstraint constraint,
+				 void *constraint_data,
+				 evectmatrix Work[], int nWork,
+				 real target, int inner_iterations,
+				 real tolerance, int *num_iterations,
+				 int flags)
+{
+     int p = Y.p, qmax, q, nact, i, j, b;
+     jd_basis B;
+     evectmatrix R, T, Z, *MWork;
+     int *sel, *active;
+     scalar *G1, *G2, *C, *C2, *scratch, *rowbuf;
+     sqmatrix H, Hb, Hwork, U, S2, S3, I;
+     real *mu, *theta, *shift, *rnorm2, *rscratch;
+     mpiglue_clock_t prev_feedback_time;
+     int iteration = 0, last_progress = 0, target_until = -1, stalled = 0;
+     real prev_E = 0, best_res = -1;
+
+     prev_feedback_time = MPIGLUE_CLOCK;
+
+#ifdef DEBUG
+     flags |= EIGS_VERBOSE;
+#endif
+
+     if (inner_iterations <= 0)
+	  inner_iterations = JD_INNER_ITERATIONS;
+
+     /* Work = [ V buffers | AV buffers | R, T, Z | 4 MINRES arrays ] */
+     CHECK(nWork >= 11, "not enough workspace");
+     B.nbuf = (nWork - 7) / 2;
+     B.V = Work;
+     B.AV = Work + B.nbuf;
+     B.p = p;
+     B.nseg = B.q = 0;
+     R = Work[2 * B.nbuf];
+     T = Work[2 * B.nbuf + 1];
+     Z = Work[2 * B.nbuf + 2];
+     MWork = Work + 2 * B.nbuf + 3;
+
+     qmax = p * B.nbuf;
+     CHK_MALLOC(B.buf, int, qmax);
+     CHK_MALLOC(B.col, int, qmax);
+     CHK_MALLOC(B.w, int, qmax);
+     CHK_MALLOC(B.off, int, qmax);
+     CHK_MALLOC(G1, scalar, qmax * qmax);
+     CHK_MALLOC(G2, scalar, qmax * qmax);
+     CHK_MALLOC(C, scalar, qmax * qmax);
+     CHK_MALLOC(C2, scalar, qmax * qmax);
+     CHK_MALLOC(scratch, scalar, p * p + 2 * p);
+     CHK_MALLOC(rowbuf, scalar, RESTART_ROWS * 2 * qmax);
+     CHK_MALLOC(sel, int, qmax);
+     CHK_MALLOC(active, int, p);
+     CHK_MALLOC(mu, real, qmax);
+     CHK_MALLOC(theta, real, p);
+     CHK_MALLOC(shift, real, p);
+     CHK_MALLOC(rnorm2, real, p);
+     CHK_MALLOC(rscratch, real, p);
+
+     H = create_sqmatrix(qmax);
+     Hb = create_sqmatrix(qmax);
+     Hwork = create_sqmatrix(qmax);
+     U = create_sqmatrix(p);
+     S2 = create_sqmatrix(p);
+     S3 = create_sqmatrix(p);
+     I = create_sqmatrix(0);
+
+     /* initial basis = orthonormalized Y: */
+     if (constraint)
+	  constraint(Y, constraint_data);
+     evectmatrix_XtX(U, Y, S3);
+     CHECK(sqmatrix_invert(U, 1, S3), "singular YtY at start");
+     sqmatrix_sqrt(S2, U, S3); /* S2 = 1/sqrt(Yt*Y) */
+     evectmatrix_XeYS(T, Y, S2, 1);
+     basis_append(&B, T, A, Adata, target, R, G1, G2, qmax, scratch);
+
+     do {
+	  real E, res;
+
+	  /* harmonic Ritz values and vectors: */
+	  q = B.q;
+	  sqmatrix_resize(&H, q, 0);
+	  sqmatrix_resize(&Hb, q, 0);
+	  sqmatrix_resize(&Hwork, q, 0);
+	  hermitian_from_upper(H, G1, qmax);
+	  hermitian_from_upper(Hb, G2, qmax);
+	  sqmatrix_gen_eigensolve(H, Hb, mu, Hwork);
+
+	  /* sort by decreasing |mu|, i.e. closest to the target first,
+	     merging from the two ends of the (ascending) spectrum: */
+	  for (i = 0, j = q - 1, b = 0; b < q; ++b)
+	       sel[b] = fabs(mu[i]) > fabs(mu[j]) ? i++ : j--;
+
+	  /* C = normalized coefficients y of the first p; since y* G2 y = 1
+	     and G1 y = mu G2 y, we have theta = target + mu / |y|^2. */
+	  for (b = 0; b < p; ++b) {
+	       real norm2 = 0, s;
+	       for (i = 0; i < q; ++i)
+		    norm2 += SCALAR_NORMSQR(H.data[sel[b] * q + i]);
+	       theta[b] = target + mu[sel[b]] / norm2;
+	       shift[b] = theta[b] - target;
+	       s = 1.0 / sqrt(norm2);
+	       for (i = 0; i < q; ++i) {
+		    scalar h = H.data[sel[b] * q + i];
+		    ASSIGN_SCALAR(C[i*p + b],
+				  s * SCALAR_RE(h), -s * SCALAR_IM(h));
+	       }
+	  }
+
+	  /* Y = V C, R = AV C - Y (theta - target) = (A - theta) Y: */
+	  evectmatrix_resize(&Y, p, 0);
+	  evectmatrix_resize(&R, p, 0);
+	  basis_combine(&B, 0, Y, C);
+	  basis_combine(&B, 1, R, C);
+	  evectmatrix_XpaY_diag_real(R, -1.0, Y, shift);
+
+	  evectmatrix_XtX_diag_real(R, rnorm2, rscratch);
+	  for (E = res = 0.0, nact = b = 0; b < p; ++b) {
+	       real scale = theta[b]*theta[b] + LAMBDA2_FLOOR;
+	       E += (eigenvals[b] = theta[b]);
+	       if (rnorm2[b] > tolerance * scale) {
+		    active[nact++] = b;
+		    res += rnorm2[b] / scale;
+	       }
+	  }
+	  mpi_assert_equal(E);
+
+	  if (iteration > 0 && mpi_is_master() &&
+	      ((flags & EIGS_VERBOSE) ||
+	       MPIGLUE_CLOCK_DIFF(MPIGLUE_CLOCK, prev_feedback_time)
+	       > FEEDBACK_TIME)) {
+	       printf("    iteration %4d: "
+		      "trace = %0.16g (%g%% change), %d/%d bands active\n",
+		      iteration, (double) E,
+		      (double) (200.0 * fabs(E - prev_E)
+				/ (fabs(E) + fabs(prev_E))), nact, p);
+	       fflush(stdout); /* make sure output appears */
+	       prev_feedback_time = MPIGLUE_CLOCK; /* reset feedback clock */
+	  }
+
+	  if (nact == 0)
+	       break; /* convergence!  hooray! */
+	  prev_E = E;
+
+	  /* if the residuals stagnate, use the target shift for a while,
+	     and give up if that doesn't help either: */
+	  if (best_res < 0 || res < JD_STAGNATION_FACTOR * best_res) {
+	       best_res = res;
+	       last_progress = iteration;
+	       stalled = 0;
+	  }
+	  else if (iteration - last_progress > JD_STAGNATION_ITERATIONS) {
+	       if (stalled)
+		    break;
+	       stalled = 1;
+	       last_progress = iteration;
+	       target_until = iteration + JD_STAGNATION_ITERATIONS;
+	       if (flags & EIGS_VERBOSE)
+		    mpi_one_printf("    residuals stagnated at iteration %d; "
+				   "using the target shift\n", iteration);
+	  }
+
+	  /* thick restart when the basis is full, keeping the harmonic
+	     Ritz vectors closest to the target in (the storage of) the
+	     first segments, of total size m <= qmax / 2: */
+	  if (q + nact > qmax) {
+	       int nkeep, m;
+	       for (nkeep = 1; nkeep + 1 < B.nseg
+			 && B.off[nkeep + 1] <= MAX2(p, qmax / 2); ++nkeep)
+		    ;
+	       m = B.off[nkeep];
+
+	       /* C2 = orthonormalized coefficients of the first m: */
+	       for (i = 0; i < q; ++i)
+		    for (j = 0; j < m; ++j)
+			 ASSIGN_CONJ(C[i*m + j], H.data[sel[j] * q + i]);
+	       sqmatrix_resize(&Hb, m, 0);
+	       sqmatrix_resize(&Hwork, m, 0);
+	       sqmatrix_resize(&H, m, 0);
+	       blasglue_gemm('C', 'N', m, m, q, 1.0, C, m, C, m,
+			     0.0, Hb.data, m);
+	       CHECK(sqmatrix_invert(Hb, 1, Hwork), "singular restart basis");
+	       sqmatrix_sqrt(H, Hb, Hwork);
+	       blasglue_gemm('N', 'N', q, m, m, 1.0, C, m, H.data, m,
+			     0.0, C2, m);
+
+	       basis_restart(&B, nkeep, C2, rowbuf);
+	       project_upper(G1, qmax, q, C2, m, H, C);
+	       project_upper(G2, qmax, q, C2, m, H, C);
+	  }
+
+	  /* correction equations for the active bands, shifted by theta
+	     or (far from convergence) by the target: */
+	  evectmatrix_keep_columns(&Y, active, nact);
+	  evectmatrix_keep_columns(&R, active, nact);
+	  for (b = 0; b < nact; ++b)
+	       shift[b] = iteration >= target_until
+		    && rnorm2[active[b]] < JD_SHIFT_SWITCH * JD_SHIFT_SWITCH
+		    * theta[active[b]] * theta[active[b]]
+		    ? theta[active[b]] : target;
+	  evectmatrix_resize(&T, nact, 0);
+	  evectmatrix_resize(&Z, nact, 0);
+	  for (i = 0; i < 4; ++i)
+	       evectmatrix_resize(&MWork[i], nact, 0);
+	  solve_correction(T, R, Z, Y, shift, inner_iterations,
+			   A, Adata, K, Kdata, constraint, constraint_data,
+			   MWork, I);
+
+	  /* orthonormalize the corrections and add them to the basis: */
+	  if (constraint)
+	       constraint(T, constraint_data);
+	  basis_orthogonalize(&B, T, C, scratch);
+	  sqmatrix_resize(&U, nact, 0);
+	  sqmatrix_resize(&S2, nact, 0);
+	  sqmatrix_resize(&S3, nact, 0);
+	  evectmatrix_XtX(U, T, S3);
+	  CHECK(sqmatrix_invert(U, 1, S3), "non-independent correction");
+	  sqmatrix_sqrt(S2, U, S3);
+	  evectmatrix_XeYS(Z, T, S2, 1);
+	  basis_append(&B, Z, A, Adata, target, R, G1, G2, qmax, scratch);
+     } while (++iteration < EIGENSOLVER_MAX_ITERATIONS);
+
+     if (nact > 0)
+	  mpi_one_fprintf(stderr, "eigensolver_jacobi_davidson: "
+			  "%d/%d bands failed to converge after %d "
+			  "iterations\n", nact, p, iteration);
+
+     /* diagonalize A in the span of the (non-orthogonal) harmonic
+	Ritz vectors Y: */
+     evectmatrix_resize(&T, p, 0);
+     evectmatrix_resize(&Z, p, 0);
+     sqmatrix_resize(&U, p, 0);
+     sqmatrix_resize(&S2, p, 0);
+     sqmatrix_resize(&S3, p, 0);
+     evectmatrix_XtX(U, Y, S3);
+     CHECK(sqmatrix_invert(U, 1, S3), "singular YtY at end");
+     eigensolver_get_eigenvals_aux(Y, eigenvals, A, Adata,
+				   T, Z, U, S3, S2);
+
+     destroy_sqmatrix(I);
+     destroy_sqmatrix(S3);
+     destroy_sqmatrix(S2);
+     destroy_sqmatrix(U);
+     destroy_sqmatrix(Hwork);
+     destroy_sqmatrix(Hb);
+     destroy_sqmatrix(H);
+
+     free(rscratch);
+     free(rnorm2);
+     free(shift);
+     free(theta);
+     free(mu);
+     free(active);
+     free(sel);
+     free(rowbuf);
+     free(scratch);
+     free(C2);
+     free(C);
+     free(G2);
+     free(G1);
+     free(B.off);
+     free(B.w);
+     free(B.col);
+     free(B.buf);
+
+     *num_iterations = iteration;
+}
@@ -0,0 +1,412 @@
+/* Copyright (C) 1999-2014 Massachusetts Institute of Technology.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* This file contains an alternative eigensolver, the locally optimal
+   block preconditioned conjugate-gradient (LOBPCG) method:
+
+   A. V. Knyazev, "Toward the optimal preconditioned eigensolver:
+   Locally optimal block preconditioned conjugate gradient method,"
+   SIAM J. Sci. Comput. 23, no. 2, pp. 517-541 (2001).
+
+   Each iteration does a Rayleigh-Ritz step in the subspace spanned by
+   the current eigenvector estimates X, the preconditioned residuals W,
+   and the previous search directions P.  For robustness, W and P are
+   explicitly B-orthonormalized against X (and each other) first, as in
+   U. Hetmaniuk and R. Lehoucq, "Basis selection in LOBPCG," J. Comput.
+   Phys. 218, pp. 324-332 (2006); P is dropped for an iteration if it
+   becomes linearly dependent on the other blocks.
+
+   Columns whose residual has converged are "soft locked": they stay
+   in X (and in the Rayleigh-Ritz step), but we stop computing residual
+   and search directions for them, so each iteration only applies the
+   operator and the preconditioner to the bands that are still active.
+
+   Unlike eigensolver(), convergence is determined band by band: a band
+   is converged when |r|^2 < tolerance * lambda^2, where r = AX - BX lambda
+   is its residual (which corresponds roughly to a relative error of
+   tolerance in the eigenvalue, as in the convergence criterion on the
+   trace used by eigensolver). */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+
+#include "config.h"
+#include <mpiglue.h>
+#include <mpi_utils.h>
+#include <check.h>
+#include <scalar.h>
+#include <matrices.h>
+#include <blasglue.h>
+
+#include "eigensolver.h"
+
+#define STRINGIZEx(x) #x /* a hack so that we can stringize macro values */
+#define STRINGIZE(x) STRINGIZEx(x)
+
+/**************************************************************************/
+
+#define EIGENSOLVER_MAX_ITERATIONS 100000
+#define FEEDBACK_TIME 4.0 /* elapsed time before we print progress feedback */
+
+/**************************************************************************/
+
+/* Set C (a rows x ncols matrix) to the coefficients of the basis
+   vectors row0..row0+rows-1 in the Ritz vectors col[0..ncols-1]
+   (or 0..ncols-1 if col == NULL), from the output of
+   sqmatrix_eigensolve (whose rows are the conjugated eigenvectors). */
+static void ritz_coefficients(scalar *C, sqmatrix E, int row0, int rows,
+			      const int *col, int ncols)
+{
+     int i, j;
+     for (i = 0; i < rows; ++i)
+	  for (j = 0; j < ncols; ++j)
+	       ASSIGN_CONJ(C[i*ncols + j],
+			   E.data[(col ? col[j] : j) * E.p + row0 + i]);
+}
+
+#define SWAP(a,b) { evectmatrix xxx_swap_tmp = a; a = b; b = xxx_swap_tmp; }
+
+/* B-orthogonalize X (and AX and BX, if non-NULL) against the
+   B-orthonormal block Y (with BY = B Y), in two passes of classical
+   Gram-Schmidt, updating AX by the same linear combination of AY. */
+static void orthogonalize_against(evectmatrix X, evectmatrix *AX,
+				  evectmatrix *BX,
+				  evectmatrix Y, evectmatrix BY,
+				  evectmatrix *AY, evectmatrix *BY2,
+				  scalar *C, scalar *scratch)
+{
+     int pass;
+     for (pass = 0; pass < 2; ++pass) {
+	  evectmatrix_XtY_block(C, X.p, BY, X, scratch);
+	  evectmatrix_XpYC(1.0, X, -1.0, Y, C);
+	  if (AX)
+	       evectmatrix_XpYC(1.0, *AX, -1.0, *AY, C);
+	  if (BX)
+	       evectmatrix_XpYC(1.0, *BX, -1.0, *BY2, C);
+     }
+}
+
+void eigensolver_lobpcg(evectmatrix Y, real *eigenvals,
+			evectoperator A, void *Adata,
+			evectoperator B, void *Bdata,
+			evectpreconditioner K, void *Kdata,
+			evectconstraint constraint, void *constraint_data,
+			evectmatrix Work[], int nWork,
+			real tolerance, int *num_iterations,
+			int flags)
+{
+     evectmatrix X, AX, BX, W, AW, BW, P, AP, BP, T;
+     sqmatrix G, Gwork, U, S1, S2, I;
+     scalar *C, *scratch;
+     real *ritz, *rnorm2, *lam_act, prev_E = 0;
+     int *active, *prev_active, *index;
+     static int warned_no_P = 0;
+     int p = Y.p, nact, np = 0, use_P, iteration = 0, i, b;
+     mpiglue_clock_t prev_feedback_time;
+
+     prev_feedback_time = MPIGLUE_CLOCK;
+
+#ifdef DEBUG
+     flags |= EIGS_VERBOSE;
+#endif
+
+     /* Work: AX, W, AW, T, [P, AP], [BX, BW, [BP]] */
+     CHECK(nWork >= 4 + 2 * (B != NULL), "not enough workspace");
+     use_P = nWork >= 6 + 3 * (B != NULL);
+     if (!use_P && !warned_no_P) {
+	  mpi_one_printf("    (not enough workspace for LOBPCG search "
+			 "directions: using block steepest descent)\n");
+	  warned_no_P = 1; /* only print this once */
+     }
+     X = Y;
+     AX = Work[0];
+     W = Work[1];
+     AW = Work[2];
+     T = Work[3];
+     if (use_P) {
+	  P = Work[4];
+	  AP = Work[5];
+     }
+     else
+	  P = AP = T; /* not used */
+     if (B) {
+	  BX = Work[4 + 2*use_P];
+	  BW = Work[5 + 2*use_P];
+	  BP = use_P ? Work[8] : T;
+     }
+     else
+	  BX = BW = BP = T; /* not used: B is the identity */
+
+     evectmatrix_resize(&AX, p, 0);
+     evectmatrix_resize(&T, p, 0);
+
+     G = create_sqmatrix(3 * p);
+     Gwork = create_sqmatrix(3 * p);
+     U = create_sqmatrix(p);
+     S1 = create_sqmatrix(p);
+     S2 = create_sqmatrix(p);
+     I = create_sqmatrix(0);
+     CHK_MALLOC(C, scalar, 3 * p * p);
+     CHK_MALLOC(scratch, scalar, 3 * p * p);
+     CHK_MALLOC(ritz, real, 3 * p);
+     CHK_MALLOC(rnorm2, real, 2 * p);
+     CHK_MALLOC(lam_act, real, p);
+     CHK_MALLOC(active, int, p);
+     CHK_MALLOC(prev_active, int, p);
+     CHK_MALLOC(index, int, p);
+
+     /* B-orthonormalize the initial X: */
+     if (constraint)
+	  constraint(X, constraint_data);
+     if (B) {
+	  evectmatrix_resize(&BX, p, 0);
+	  B(X, BX, Bdata, 1, T);
+	  evectmatrix_XtY(U, X, BX, S1);
+     }
+     else
+	  evectmatrix_XtX(U, X, S1);
+     CHECK(sqmatrix_invert(U, 1, S1), "non-independent initial Y");
+     sqmatrix_sqrt(S2, U, S1); /* S2 = 1/sqrt(Yt*B*Y) */
+     evectmatrix_XeYS(T, X, S2, 1);
+     SWAP(X, T);
+     if (B) {
+	  evectmatrix_XeYS(T, BX, S2, 1);
+	  SWAP(BX, T);
+     }
+     A(X, AX, Adata, 1, T);
+
+     for (b = 0; b < p; ++b)
+	  active[b] = b;
+     nact = 0; /* first Rayleigh-Ritz step is in the span of X only */
+     evectmatrix_resize(&W, 0, 0);
+     evectmatrix_resize(&AW, 0, 0);
+     evectmatrix_resize(&P, 0, 0);
+     evectmatrix_resize(&AP, 0, 0);
+
+     do {
+	  int q, nw = nact, j;
+	  real E;
+
+	  /* Rayleigh-Ritz: Gram matrix [X W P]^t A [X W P], where the
+	     basis is B-orthonormal, so the B Gram matrix is the identity */
+	  q = p + nw + np;
+	  sqmatrix_resize(&G, q, 0);
+	  sqmatrix_resize(&Gwork, q, 0);
+	  evectmatrix_XtY_block(G.data, q, X, AX, scratch);
+	  evectmatrix_XtY_block(G.data + p, q, X, AW, scratch);
+	  evectmatrix_XtY_block(G.data + p + nw, q, X, AP, scratch);
+	  evectmatrix_XtY_block(G.data + p * q + p, q, W, AW, scratch);
+	  evectmatrix_XtY_block(G.data + p * q + p + nw, q, W, AP, scratch);
+	  evectmatrix_XtY_block(G.data + (p + nw) * q + p + nw, q, P, AP,
+				scratch);
+	  for (i = 0; i < q; ++i) /* hermitian: fill in the lower half */
+	       for (j = i + 1; j < q; ++j)
+		    ASSIGN_CONJ(G.data[j * q + i], G.data[i * q + j]);
+	  sqmatrix_eigensolve(G, ritz, Gwork);
+
+	  /* X = X Cx + (W Cw + P Cp) and P = (W Cw + P Cp), restricted
+	     to the active columns; same for AX, AP, BX, and BP.  To avoid
+	     extra storage, we rotate the W and T arrays into X and P. */
+#define UPDATE_XP(X, W, P) {						\
+	       if (nw + np > 0) {					\
+		    ritz_coefficients(C, G, p, nw, NULL, p);		\
+		    evectmatrix_resize(&T, p, 0);			\
+		    evectmatrix_XpYC(0.0, T, 1.0, W, C);		\
+		    if (np > 0) {					\
+			 ritz_coefficients(C, G, p + nw, np, NULL, p);	\
+			 evectmatrix_XpYC(1.0, T, 1.0, P, C);		\
+		    }							\
+		    ritz_coefficients(C, G, 0, p, NULL, p);		\
+		    evectmatrix_resize(&W, p, 0);			\
+		    evectmatrix_XpYC(0.0, W, 1.0, X, C);		\
+		    evectmatrix_aXpbY(1.0, W, 1.0, T);			\
+		    SWAP(X, W);						\
+		    if (use_P) {					\
+			 evectmatrix_keep_columns(&T, active, nact);	\
+			 SWAP(P, T);					\
+		    }							\
+	       }							\
+	       else {							\
+		    ritz_coefficients(C, G, 0, p, NULL, p);		\
+		    evectmatrix_resize(&W, p, 0);			\
+		    evectmatrix_XpYC(0.0, W, 1.0, X, C);		\
+		    SWAP(X, W);						\
+	       }							\
+	  }
+	  UPDATE_XP(X, W, P);
+	  UPDATE_XP(AX, AW, AP);
+	  if (B)
+	       UPDATE_XP(BX, BW, BP);
+#undef UPDATE_XP
+	  np = (use_P && nw > 0) ? nact : 0;
+
+	  for (E = 0.0, b = 0; b < p; ++b)
+	       E += (eigenvals[b] = ritz[b]);
+	  mpi_assert_equal(E);
+
+	  /* residuals W = AX - BX lambda, and their norms: */
+	  evectmatrix_resize(&W, p, 0);
+	  evectmatrix_copy(W, AX);
+	  evectmatrix_XpaY_diag_real(W, -1.0, B ? BX : X, eigenvals);
+	  evectmatrix_XtX_diag_real(W, rnorm2, rnorm2 + p);
+
+	  /* soft locking: drop converged bands from the active set */
+	  {
+	       int prev_nact = iteration == 0 ? p : nact, nkeep = 0;
+	       for (i = 0; i < prev_nact; ++i)
+		    prev_active[i] = active[i];
+	       nact = 0;
+	       for (i = 0; i < prev_nact; ++i) {
+		    b = prev_active[i];
+		    if (rnorm2[b] > tolerance * (eigenvals[b] * eigenvals[b]
+						 + LAMBDA2_FLOOR)) {
+			 index[nkeep++] = i; /* position in old P */
+			 active[nact++] = b;
+		    }
+	       }
+	       if (np > 0 && nact < np) {
+		    evectmatrix_keep_columns(&P, index, nkeep);
+		    evectmatrix_keep_columns(&AP, index, nkeep);
+		    if (B)
+			 evectmatrix_keep_columns(&BP, index, nkeep);
+	       }
+	       np = np > 0 ? nact : 0;
+	  }
+
+	  if (iteration > 0 && mpi_is_master() &&
+	      ((flags & EIGS_VERBOSE) ||
+	       MPIGLUE_CLOCK_DIFF(MPIGLUE_CLOCK, prev_feedback_time)
+	       > FEEDBACK_TIME)) {
+	       printf("    iteration %4d: "
+		      "trace = %0.16g (%g%% change), %d/%d bands active\n",
+		      iteration, (double) E,
+		      (double) (200.0 * fabs(E - prev_E)
+				/ (fabs(E) + fabs(prev_E))), nact, p);
+	       fflush(stdout); /* make sure output appears */
+	       prev_feedback_time = MPIGLUE_CLOCK; /* reset feedback clock */
+	  }
+
+	  if (nact == 0)
+	       break; /* convergence!  hooray! */
+	  prev_E = E;
+
+	  /* W = preconditioned residuals of the active bands: */
+	  evectmatrix_keep_columns(&W, active, nact);
+	  for (i = 0; i < nact; ++i)
+	       lam_act[i] = eigenvals[active[i]];
+	  evectmatrix_resize(&T, nact, 0);
+	  if (K != NULL)
+	       K(W, T, Kdata, X, lam_act, I);
+	  else
+	       evectmatrix_copy(T, W);
+	  SWAP(W, T);
+	  if (constraint)
+	       constraint(W, constraint_data);
+
+	  /* B-orthonormalize W against X and itself: */
+	  orthogonalize_against(W, NULL, NULL, X, B ? BX : X, NULL, NULL,
+				C, scratch);
+	  if (B) {
+	       evectmatrix_resize(&BW, nact, 0);
+	       B(W, BW, Bdata, 0, T);
+	  }
+	  sqmatrix_resize(&U, nact, 0);
+	  sqmatrix_resize(&S1, nact, 0);
+	  sqmatrix_resize(&S2, nact, 0);
+	  evectmatrix_XtY(U, W, B ? BW : W, S1);
+	  if (!sqmatrix_invert(U, 1, S1)) {
+	       mpi_one_printf("    LOBPCG breakdown (dependent residuals) "
+			      "on iteration %d\n", iteration);
+	       break;
+	  }
+	  sqmatrix_sqrt(S2, U, S1);
+	  evectmatrix_resize(&T, nact, 0);
+	  evectmatrix_XeYS(T, W, S2, 1);
+	  SWAP(W, T);
+	  if (B) {
+	       evectmatrix_resize(&T, nact, 0);
+	       evectmatrix_XeYS(T, BW, S2, 1);
+	       SWAP(BW, T);
+	  }
+	  evectmatrix_resize(&AW, nact, 0);
+	  evectmatrix_resize(&T, nact, 0);
+	  A(W, AW, Adata, 0, T);
+
+	  /* B-orthonormalize P against X, W, and itself (or drop it): */
+	  if (np > 0) {
+	       orthogonalize_against(P, &AP, B ? &BP : NULL,
+				     X, B ? BX : X, &AX, B ? &BX : NULL,
+				     C, scratch);
+	       orthogonalize_against(P, &AP, B ? &BP : NULL,
+				     W, B ? BW : W, &AW, B ? &BW : NULL,
+				     C, scratch);
+	       evectmatrix_XtY(U, P, B ? BP : P, S1);
+	       if (!sqmatrix_invert(U, 1, S1)) {
+		    if (flags & EIGS_VERBOSE)
+			 mpi_one_printf("    dropping LOBPCG search "
+					"directions\n");
+		    np = 0;
+	       }
+	       else {
+		    sqmatrix_sqrt(S2, U, S1);
+		    evectmatrix_resize(&T, np, 0);
+		    evectmatrix_XeYS(T, P, S2, 1);
+		    SWAP(P, T);
+		    evectmatrix_resize(&T, np, 0);
+		    evectmatrix_XeYS(T, AP, S2, 1);
+		    SWAP(AP, T);
+		    if (B) {
+			 evectmatrix_resize(&T, np, 0);
+			 evectmatrix_XeYS(T, BP, S2, 1);
+			 SWAP(BP, T);
+		    }
+	       }
+	  }
+	  if (np == 0) { /* empty blocks, for the Gram matrix above */
+	       evectmatrix_resize(&P, 0, 0);
+	       evectmatrix_resize(&AP, 0, 0);
+	  }
+     } while (++iteration < EIGENSOLVER_MAX_ITERATIONS);
+
+     CHECK(iteration < EIGENSOLVER_MAX_ITERATIONS,
+           "failure to converge after "
+           STRINGIZE(EIGENSOLVER_MAX_ITERATIONS)
+           " iterations");
+
+     if (X.data != Y.data) {
+	  evectmatrix_resize(&X, p, 0);
+	  evectmatrix_copy(Y, X);
+     }
+
+     free(index);
+     free(prev_active);
+     free(active);
+     free(lam_act);
+     free(rnorm2);
+     free(ritz);
+     free(scratch);
+     free(C);
+     destroy_sqmatrix(I);
+     destroy_sqmatrix(S2);
+     destroy_sqmatrix(S1);
+     destroy_sqmatrix(U);
+     destroy_sqmatrix(Gwork);
+     destroy_sqmatrix(G);
+
+     *num_iterations = iteration;
+}
@@ -22,8 +22,10 @@
 #include "config.h"
 #include <mpiglue.h>
 #include <check.h>
+#include <prof.h>
 #include <scalar.h>
 #include <matrices.h>
+#include <blasglue.h>
 
 #include "eigensolver.h"
 
@@ -68,6 +70,116 @@ void eigensolver_get_eigenvals(evectmatrix Y, real *eigenvals,
 
 /**************************************************************************/
 
+/* Routines for continuation, i.e. for solving a sequence of nearby
+   eigenproblems (e.g. along a path of k points), where the solution
+   of one problem is used to predict the next.  Y0 and Y1 are the
+   (orthonormal) eigenvectors from two of the problems.  Since only the
+   subspaces matter, we compare them via the overlap matrix
+   S = adjoint(Y0) * Y1, whose singular values are the cosines of the
+   principal angles between the subspaces. */
+
+/* Compute S = adjoint(Y0) * Y1 and its polar decomposition: U is the
+   unitary matrix that best aligns Y0 with Y1 (minimizing |Y0 U - Y1|),
+   i.e. U = S / sqrt(adjoint(S) S).  Returns the overlap of the two
+   subspaces, the square of the smallest singular value of S, or 0 if
+   S is singular (in which case U is not computed). */
+static real subspace_alignment(evectmatrix Y0, evectmatrix Y1,
+			       sqmatrix S, sqmatrix U)
+{
+     sqmatrix M, W;
+     real *sigma2, overlap = 1.0;
+     int i;
+
+     if (S.p == 0)
+	  return overlap;
+
+     M = create_sqmatrix(S.p);
+     W = create_sqmatrix(S.p);
+     CHK_MALLOC(sigma2, real, S.p);
+
+     evectmatrix_XtY(S, Y0, Y1, W);
+     sqmatrix_AeBC(M, S, 1, S, 0); /* M = adjoint(S) S */
+     sqmatrix_eigensolve(M, sigma2, W); /* M <- V, M = adjoint(V) sigma2 V */
+     overlap = sigma2[0] > 0 ? sigma2[0] : 0; /* (ascending order) */
+
+     if (overlap > 0) {
+	  /* W = diag(1/sigma) V, U = adjoint(V) W = 1/sqrt(adjoint(S) S): */
+	  for (i = 0; i < S.p; ++i) {
+	       blasglue_copy(S.p, M.data + i*S.p, 1, W.data + i*S.p, 1);
+	       blasglue_rscal(S.p, 1.0 / sqrt(sigma2[i]), W.data + i*S.p, 1);
+	  }
+	  sqmatrix_AeBC(U, M, 1, W, 0);
+	  sqmatrix_copy(M, U);
+	  sqmatrix_AeBC(U, S, 0, M, 0);
+     }
+
+     free(sigma2);
+     destroy_sqmatrix(W);
+     destroy_sqmatrix(M);
+     return overlap;
+}
+
+/* Given the solutions Y0 and Y1 at two points x0 and x1 of a path,
+   overwrite Y0 with (a basis for) the linear extrapolation of the
+   subspace to x1 + t (x1 - x0), namely Y1 + t (Y1 - Y0 U), where U
+   aligns Y0 with Y1 (see above); this is insensitive to the arbitrary
+   phases of the eigenvectors, to degeneracies, and to crossings of the
+   bands within the subspace.  Returns the overlap of the subspaces of
+   Y0 and Y1; if it is less than min_overlap (e.g. because another band
+   has crossed into the subspace), a linear extrapolation is unlikely
+   to help, and Y0 is left unchanged.  (The result is not orthonormal.) */
+real eigensolver_extrapolate(evectmatrix Y0, evectmatrix Y1, real t,
+			     real min_overlap)
+{
+     sqmatrix S, U;
+     real overlap;
+
+     CHECK(Y0.p == Y1.p && Y0.n == Y1.n, "arrays not conformant");
+     S = create_sqmatrix(Y0.p);
+     U = create_sqmatrix(Y0.p);
+     overlap = subspace_alignment(Y0, Y1, S, U);
+     if (overlap >= min_overlap && overlap > 0) {
+	  /* Y0 = (1+t) Y1 adjoint(U) - t Y0, which spans the same subspace
+	     as Y1 + t (Y1 - Y0 U) = (that) * U: */
+	  evectmatrix_aXpbYS_sub(-t, Y0, 1 + t, Y1, U, 0, 1);
+     }
+     destroy_sqmatrix(U);
+     destroy_sqmatrix(S);
+     return overlap;
+}
+
+/* Match the bands of Y1 to those of Y0: match[j] is set to the index
+   of the column of Y0 with the largest overlap |adjoint(Y0_i) Y1_j|^2
+   with the column j of Y1, and overlap[j] to that overlap.  Where
+   match[j] != j, the order of the bands has changed, e.g. because two
+   bands crossed.  Returns the overlap of the subspaces, as above. */
+real eigensolver_match_bands(evectmatrix Y0, evectmatrix Y1,
+			     int *match, real *overlap)
+{
+     sqmatrix S, U;
+     real subspace_overlap;
+     int i, j;
+
+     CHECK(Y0.p == Y1.p && Y0.n == Y1.n, "arrays not conformant");
+     S = create_sqmatrix(Y0.p);
+     U = create_sqmatrix(Y0.p);
+     subspace_overlap = subspace_alignment(Y0, Y1, S, U);
+     for (j = 0; j < S.p; ++j) {
+	  match[j] = 0;
+	  overlap[j] = -1;
+	  for (i = 0; i < S.p; ++i)
+	       if (SCALAR_NORMSQR(S.data[i*S.p + j]) > overlap[j]) {
+		    match[j] = i;
+		    overlap[j] = SCALAR_NORMSQR(S.data[i*S.p + j]);
+	       }
+     }
+     destroy_sqmatrix(U);
+     destroy_sqmatrix(S);
+     return subspace_overlap;
+}
+
+/**************************************************************************/
+
 /* Subroutines for chaining constraints, to make it easy to pass
    multiple constraint functions to the eigensolver: */
 
@@ -97,12 +209,16 @@ void evect_destroy_constraints(evectconstraint_chain *constraints)
 void evectconstraint_chain_func(evectmatrix X, void *data)
 {
      evectconstraint_chain *constraints = (evectconstraint_chain *) data;
+     prof_clock_t prof_start = 0;
 
+     PROF_START(prof_start);
      while (constraints) {
 	  if (constraints->C)
 	       constraints->C(X, constraints->constraint_data);
           constraints = constraints->next;
      }
+     PROF_STOP(PROF_CONSTRAINT, prof_start,
+	       X.n * (double) X.p * sizeof(scalar));
 }
 
 	       
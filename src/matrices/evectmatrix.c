@@ -18,6 +18,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
+#include <float.h>
 
 #include "config.h"
 #include <mpiglue.h>
@@ -31,14 +33,22 @@ double evectmatrix_flops = 0;
 
 /* Operations on evectmatrix blocks:
        X + a Y, X * S, X + a Y * S, Xt * X, Xt * Y, trace(Xt * Y), etc.
-   (X, Y: evectmatrix, S: sqmatrix) */
+   (X, Y: evectmatrix, S: sqmatrix)
+
+   Any of the arguments may be views (see evectmatrix_view) of a subset
+   of the columns of a bigger matrix; the BLAS calls simply use the row
+   stride fd as the leading dimension, while the vector operations on
+   the whole matrix are done row by row unless the rows are contiguous. */
 
 /* X = Y */
 void evectmatrix_copy(evectmatrix X, evectmatrix Y)
 {
      CHECK(X.n == Y.n && X.p == Y.p, "arrays not conformant");
 
-     blasglue_copy(X.n * X.p, Y.data, 1, X.data, 1);
+     if (EVECTMATRIX_CONTIGUOUS(X) && EVECTMATRIX_CONTIGUOUS(Y))
+	  blasglue_copy(X.n * X.p, Y.data, 1, X.data, 1);
+     else
+	  evectmatrix_copy_slice(X, Y, 0, 0, X.p);
 }
 
 /* set p selected columns of X to those in Y, starting at ix and iy.  */
@@ -48,15 +58,15 @@ void evectmatrix_copy_slice(evectmatrix X, evectmatrix Y,
      CHECK(ix + p <= X.p && iy + p <= Y.p && ix >= 0 && iy >= 0 && X.n == Y.n,
 	   "invalid arguments to evectmatrix_copy_slice");
 
-     if (ix == 0 && iy == 0 && p == X.p && p == Y.p)
+     if (ix == 0 && iy == 0 && p == X.fd && p == Y.fd)
 	  evectmatrix_copy(X, Y);
      else if (p == 1)
-	  blasglue_copy(X.n, Y.data + iy, Y.p, X.data + ix, X.p);
+	  blasglue_copy(X.n, Y.data + iy, Y.fd, X.data + ix, X.fd);
      else {
 	  int i;
 	  for (i = 0; i < X.n; ++i)
-	       blasglue_copy(p, Y.data + iy + i * Y.p, 1,
-			     X.data + ix + i * X.p, 1);
+	       blasglue_copy(p, Y.data + iy + i * Y.fd, 1,
+			     X.data + ix + i * X.fd, 1);
      }
 }
 
@@ -64,11 +74,17 @@ void evectmatrix_copy_slice(evectmatrix X, evectmatrix Y,
    A was initially allocated to hold at least this big a matrix.
    If preserve_data is nonzero, copies the existing data in A (or
    a subset of it, if the matrix is shrinking) to the corresponding
-   entries of the resized matrix. */
+   entries of the resized matrix.  (If A is a strided view, the columns
+   stay where they are, so the data is always preserved.) */
 void evectmatrix_resize(evectmatrix *A, int p, short preserve_data)
 {
      CHECK(p <= A->alloc_p, "tried to resize beyond allocated limit");
 
+     if (!EVECTMATRIX_CONTIGUOUS(*A)) {
+	  A->p = p;
+	  return;
+     }
+
      if (preserve_data) {
 	  int i, j;
 	  
@@ -84,7 +100,36 @@ void evectmatrix_resize(evectmatrix *A, int p, short preserve_data)
 	  }
      }
 
-     A->p = p;
+     A->p = A->fd = p;
+}
+
+/* X = a * X */
+void evectmatrix_rscal(real a, evectmatrix X)
+{
+     if (EVECTMATRIX_CONTIGUOUS(X))
+	  blasglue_rscal(X.n * X.p, a, X.data, 1);
+     else {
+	  int i;
+	  for (i = 0; i < X.n; ++i)
+	       blasglue_rscal(X.p, a, X.data + i * X.fd, 1);
+     }
+}
+
+/* return the (local) sum of conj(X) * Y over all the elements */
+static scalar evectmatrix_dotc(evectmatrix X, evectmatrix Y)
+{
+     if (EVECTMATRIX_CONTIGUOUS(X) && EVECTMATRIX_CONTIGUOUS(Y))
+	  return blasglue_dotc(X.n * X.p, X.data, 1, Y.data, 1);
+     else {
+	  scalar sum = SCALAR_INIT_ZERO, d;
+	  int i;
+	  for (i = 0; i < X.n; ++i) {
+	       d = blasglue_dotc(X.p, X.data + i * X.fd, 1,
+				 Y.data + i * Y.fd, 1);
+	       ACCUMULATE_SUM(sum, d);
+	  }
+	  return sum;
+     }
 }
 
 /* compute X = a*X + b*Y; X and Y may be equal. */
@@ -93,9 +138,16 @@ void evectmatrix_aXpbY(real a, evectmatrix X, real b, evectmatrix Y)
      CHECK(X.n == Y.n && X.p == Y.p, "arrays not conformant");
      
      if (a != 1.0)
-	  blasglue_rscal(X.n * X.p, a, X.data, 1);
+	  evectmatrix_rscal(a, X);
 
-     blasglue_axpy(X.n * X.p, b, Y.data, 1, X.data, 1);
+     if (EVECTMATRIX_CONTIGUOUS(X) && EVECTMATRIX_CONTIGUOUS(Y))
+	  blasglue_axpy(X.n * X.p, b, Y.data, 1, X.data, 1);
+     else {
+	  int i;
+	  for (i = 0; i < X.n; ++i)
+	       blasglue_axpy(X.p, b, Y.data + i * Y.fd, 1,
+			     X.data + i * X.fd, 1);
+     }
      evectmatrix_flops += X.N * X.c * X.p * 3;
 }
 
@@ -114,8 +166,8 @@ void evectmatrix_aXpbYS_sub(real a, evectmatrix X, real b, evectmatrix Y,
 	  CHECK(Soffset + (Y.p-1)*S.p + Y.p <= S.p*S.p,
 		"submatrix exceeds matrix bounds");
 	  blasglue_gemm('N', sdagger ? 'C' : 'N', X.n, X.p, X.p,
-			b, Y.data, Y.p, S.data + Soffset, S.p,
-			a, X.data, X.p);
+			b, Y.data, Y.fd, S.data + Soffset, S.p,
+			a, X.data, X.fd);
 	  evectmatrix_flops += X.N * X.c * X.p * (3 + 2 * X.p);
      }
 }
@@ -149,7 +201,7 @@ void evectmatrix_XtX(sqmatrix U, evectmatrix X, sqmatrix S)
      /* take advantage of the fact that U is Hermitian and only write
 	out the upper triangle of the matrix */
      memset(S.data, 0, sizeof(scalar) * (U.p * U.p));
-     blasglue_herk('U', 'C', X.p, X.n, 1.0, X.data, X.p, 0.0, S.data, U.p);
+     blasglue_herk('U', 'C', X.p, X.n, 1.0, X.data, X.fd, 0.0, S.data, U.p);
      evectmatrix_flops += X.N * X.c * X.p * (X.p - 1);
 
      /* Now, copy the conjugate of the upper half onto the lower half of S */
@@ -176,7 +228,7 @@ void evectmatrix_XtY_slice(sqmatrix U, evectmatrix X, evectmatrix Y,
 
      memset(S.data, 0, sizeof(scalar) * (U.p * U.p));
      blasglue_gemm('C', 'N', p, p, X.n,
-                   1.0, X.data + ix, X.p, Y.data + iy, Y.p, 0.0, S.data, U.p);
+                   1.0, X.data + ix, X.fd, Y.data + iy, Y.fd, 0.0, S.data, U.p);
      evectmatrix_flops += X.N * X.c * p * (2*p);
 
      mpi_allreduce(S.data, U.data, U.p * U.p * SCALAR_NUMVALS,
@@ -206,7 +258,7 @@ void evectmatrixXtY_sub(sqmatrix U, int Uoffset, evectmatrix X, evectmatrix Y,
      
      memset(S.data, 0, sizeof(scalar) * (Y.p * Y.p));
      blasglue_gemm('C', 'N', X.p, X.p, X.n,
-		   1.0, X.data, X.p, Y.data, Y.p, 0.0, S.data, Y.p);
+		   1.0, X.data, X.fd, Y.data, Y.fd, 0.0, S.data, Y.p);
      evectmatrix_flops += X.N * X.c * X.p * (2*X.p);
 
      for (i = 0; i < Y.p; ++i) {
@@ -216,12 +268,235 @@ void evectmatrixXtY_sub(sqmatrix U, int Uoffset, evectmatrix X, evectmatrix Y,
      }
 }
 
+/* Compute U = adjoint(X) * Y, an X.p x Y.p matrix stored with leading
+   dimension ldU (so that U can be a block of a bigger matrix, and X
+   and Y can have different numbers of columns).  scratch must hold
+   X.p * Y.p entries. */
+void evectmatrix_XtY_block(scalar *U, int ldU, evectmatrix X, evectmatrix Y,
+			   scalar *scratch)
+{
+     int i;
+
+     CHECK(X.n == Y.n, "matrices not conformant");
+     if (X.p * Y.p == 0)
+	  return;
+
+     blasglue_gemm('C', 'N', X.p, Y.p, X.n,
+		   1.0, X.data, X.fd, Y.data, Y.fd, 0.0, scratch, Y.p);
+     evectmatrix_flops += X.N * X.c * X.p * (2*Y.p);
+
+     for (i = 0; i < X.p; ++i)
+	  mpi_allreduce(scratch + i*Y.p, U + i*ldU, Y.p * SCALAR_NUMVALS,
+			real, SCALAR_MPI_TYPE, MPI_SUM, mpb_comm);
+}
+
+/* Compute the k square matrices U[j] = adjoint(X[j]) * Y[j] with a
+   single global reduction, instead of one reduction per matrix as in
+   evectmatrix_XtY; when the matrices are small (and there are many
+   processes), the reductions are latency-bound and this is much
+   cheaper.  If X[j] and Y[j] are the same array, only the upper
+   triangle is computed, as in evectmatrix_XtX.  scratch must hold
+   2 * sum(U[j].p^2) entries. */
+void evectmatrix_XtY_multi(int k, sqmatrix *U, const evectmatrix *X,
+			   const evectmatrix *Y, scalar *scratch)
+{
+     int j, i, l, off, ntot = 0;
+
+     for (j = 0; j < k; ++j) {
+	  int p = U[j].p;
+	  CHECK(X[j].p == p && Y[j].p == p && X[j].n == Y[j].n,
+		"matrices not conformant");
+	  if (X[j].data == Y[j].data) {
+	       memset(scratch + ntot, 0, sizeof(scalar) * (p * p));
+	       blasglue_herk('U', 'C', p, X[j].n,
+			     1.0, X[j].data, X[j].fd, 0.0, scratch + ntot, p);
+	       evectmatrix_flops += X[j].N * X[j].c * p * (p - 1);
+	  }
+	  else {
+	       blasglue_gemm('C', 'N', p, p, X[j].n,
+			     1.0, X[j].data, X[j].fd, Y[j].data, Y[j].fd,
+			     0.0, scratch + ntot, p);
+	       evectmatrix_flops += X[j].N * X[j].c * p * (2*p);
+	  }
+	  ntot += p * p;
+     }
+
+     mpi_allreduce(scratch, scratch + ntot, ntot * SCALAR_NUMVALS,
+		   real, SCALAR_MPI_TYPE, MPI_SUM, mpb_comm);
+
+     for (j = off = 0; j < k; ++j) {
+	  int p = U[j].p;
+	  memcpy(U[j].data, scratch + ntot + off, sizeof(scalar) * (p * p));
+	  if (X[j].data == Y[j].data)
+	       for (i = 0; i < p; ++i)
+		    for (l = i + 1; l < p; ++l)
+			 ASSIGN_CONJ(U[j].data[l * p + i],
+				     U[j].data[i * p + l]);
+	  off += p * p;
+     }
+}
+
+/* Compute tr[j] = trace(adjoint(X[j]) * Y[j]) for j = 0..k-1, with a
+   single global reduction.  scratch must hold k entries. */
+void evectmatrix_traceXtY_multi(int k, scalar *tr, const evectmatrix *X,
+				const evectmatrix *Y, scalar *scratch)
+{
+     int j;
+
+     for (j = 0; j < k; ++j) {
+	  CHECK(X[j].p == Y[j].p && X[j].n == Y[j].n,
+		"matrices not conformant");
+	  scratch[j] = evectmatrix_dotc(X[j], Y[j]);
+	  evectmatrix_flops += X[j].N * X[j].c * X[j].p * (2*X[j].p) + X[j].p;
+     }
+     mpi_allreduce(scratch, tr, k * SCALAR_NUMVALS,
+		   real, SCALAR_MPI_TYPE, MPI_SUM, mpb_comm);
+}
+
+/* Compute X = a X + b Y C, where C is a Y.p x X.p matrix (with leading
+   dimension X.p).  X and Y must be distinct. */
+void evectmatrix_XpYC(real a, evectmatrix X, real b, evectmatrix Y, scalar *C)
+{
+     CHECK(X.n == Y.n, "matrices not conformant");
+     if (Y.p == 0) {
+	  if (a != 1.0)
+	       evectmatrix_rscal(a, X);
+	  return;
+     }
+     blasglue_gemm('N', 'N', X.n, X.p, Y.p,
+		   b, Y.data, Y.fd, C, X.p, a, X.data, X.fd);
+     evectmatrix_flops += X.N * X.c * X.p * (3 + 2 * Y.p);
+}
+
+/* Keep only the columns index[0..nkeep-1] (which must be increasing)
+   of X, in place. */
+void evectmatrix_keep_columns(evectmatrix *X, const int *index, int nkeep)
+{
+     int fd = EVECTMATRIX_CONTIGUOUS(*X) ? nkeep : X->fd, i, j;
+     for (i = 0; i < X->n; ++i)
+	  for (j = 0; j < nkeep; ++j)
+	       X->data[i*fd + j] = X->data[i*X->fd + index[j]];
+     X->p = nkeep;
+     X->fd = fd;
+}
+
+/* Set X = X * 1/R, where R is upper-triangular (e.g. a Cholesky
+   factor from sqmatrix_cholesky). */
+void evectmatrix_XeXRinv(evectmatrix X, sqmatrix R)
+{
+     CHECK(X.p == R.p, "matrices not conformant");
+     blasglue_trsm('R', 'U', 'N', 'N', X.n, X.p, 1.0, R.data, R.p,
+		   X.data, X.fd);
+     evectmatrix_flops += X.N * X.c * X.p * X.p;
+}
+
+#if defined(SCALAR_SINGLE_PREC)
+#  define REAL_EPSILON FLT_EPSILON
+#elif defined(SCALAR_LONG_DOUBLE_PREC)
+#  define REAL_EPSILON LDBL_EPSILON
+#else
+#  define REAL_EPSILON DBL_EPSILON
+#endif
+
+/* After one pass of CholeskyQR, the B-orthonormality error is roughly
+   REAL_EPSILON * cond(X)^2.  We do a second pass if cond(X)^2, as
+   estimated from the diagonal of the Cholesky factor, exceeds: */
+#define CHOLQR_COND2_THRESHOLD 1e4
+
+/* B-orthonormalize X in place by CholeskyQR2 (see e.g. Fukaya et al.,
+   SIAM J. Sci. Comput. 42, A477 (2020)): each pass factorizes the Gram
+   matrix Xt B X = Rt R by Cholesky and sets X = X * 1/R, for a cost of
+   one Gram matrix (a single reduction), one p x p Cholesky
+   factorization, and one triangular solve per array.  This is much
+   cheaper than the eigendecomposition needed for 1/sqrt(Xt B X).
+
+   BX is B*X, or X itself if B is the identity.  On input, R must hold
+   Xt BX (so that the caller can compute it along with other matrices
+   in a single reduction); on output, it is garbage.  X and BX (if it
+   is distinct from X) are transformed, as are the nC arrays C[] (e.g.
+   A*X, which stays equal to A times the new X); if M is not NULL,
+   it is replaced by 1/Rt * M * 1/R (e.g. to update Xt A X).
+
+   A single pass leaves an error of order REAL_EPSILON cond(X)^2 in
+   Xt B X = 1, so we do a second pass if two_pass is true or if X is
+   ill-conditioned.  If the Cholesky factorization fails, we first do
+   a shifted CholeskyQR pass, factorizing Xt B X + s I with a shift s
+   that guarantees success, followed by two ordinary passes.
+
+   S is a p x p scratch matrix, and scratch must hold 2 p^2 entries
+   (as for evectmatrix_XtY_multi).  Returns the number of passes (3
+   if and only if the shifted pass was required), or 0 if X is
+   numerically rank-deficient. */
+int evectmatrix_cholqr2(evectmatrix X, evectmatrix BX,
+			evectmatrix *C, int nC, sqmatrix R,
+			sqmatrix *M, short two_pass,
+			sqmatrix S, scalar *scratch)
+{
+     int i, npass = 0, nneeded = two_pass ? 2 : 1;
+
+     CHECK(X.p == R.p && BX.p == X.p && BX.n == X.n && S.p == R.p,
+	   "matrices not conformant");
+     if (X.p == 0)
+	  return 1;
+
+     while (1) {
+	  sqmatrix_copy(S, R); /* R is overwritten if potrf fails */
+	  if (!sqmatrix_cholesky(R, 0.0)) {
+	       real m = X.N * X.c, p = X.p, shift;
+	       if (npass > 0)
+		    return 0;
+	       /* the shift of Fukaya et al., bounding the squared
+		  2-norm of X by trace(Xt B X): */
+	       shift = 11 * (m * p + p * (p + 1)) * REAL_EPSILON
+		    * SCALAR_RE(sqmatrix_trace(S));
+	       sqmatrix_copy(R, S);
+	       if (!sqmatrix_cholesky(R, shift))
+		    return 0;
+	       nneeded = 3;
+	  }
+	  else if (npass == 0 && nneeded == 1) {
+	       real dmin = fabs(SCALAR_RE(R.data[0])), dmax = dmin;
+	       for (i = 1; i < R.p; ++i) {
+		    real d = fabs(SCALAR_RE(R.data[i * R.p + i]));
+		    if (d < dmin) dmin = d;
+		    if (d > dmax) dmax = d;
+	       }
+	       if (dmax > dmin * sqrt(CHOLQR_COND2_THRESHOLD))
+		    nneeded = 2;
+	  }
+
+	  evectmatrix_XeXRinv(X, R);
+	  if (BX.data != X.data)
+	       evectmatrix_XeXRinv(BX, R);
+	  for (i = 0; i < nC; ++i)
+	       evectmatrix_XeXRinv(C[i], R);
+	  if (M)
+	       sqmatrix_RtinvARinv(*M, R);
+
+	  if (++npass >= nneeded)
+	       return npass;
+	  evectmatrix_XtY_multi(1, &R, &X, &BX, scratch);
+     }
+}
+
 /* Compute only the diagonal elements of XtY, storing in diag
    (with scratch_diag a scratch array of the same size as diag). */
 void evectmatrix_XtY_diag(evectmatrix X, evectmatrix Y, scalar *diag,
 			  scalar *scratch_diag)
 {
-     matrix_XtY_diag(X.data, Y.data, X.n, X.p, scratch_diag);
+     if (EVECTMATRIX_CONTIGUOUS(X) && EVECTMATRIX_CONTIGUOUS(Y))
+	  matrix_XtY_diag(X.data, Y.data, X.n, X.p, scratch_diag);
+     else {
+	  int i, j;
+	  for (j = 0; j < X.p; ++j)
+	       ASSIGN_ZERO(scratch_diag[j]);
+	  for (i = 0; i < X.n; ++i)
+	       for (j = 0; j < X.p; ++j) {
+		    ACCUMULATE_SUM_CONJ_MULT(scratch_diag[j],
+					     X.data[i * X.fd + j],
+					     Y.data[i * Y.fd + j]);
+	       }
+     }
      evectmatrix_flops += X.N * X.c * X.p * 2;
      mpi_allreduce(scratch_diag, diag, X.p * SCALAR_NUMVALS, 
 		   real, SCALAR_MPI_TYPE, MPI_SUM, mpb_comm);
@@ -231,7 +506,19 @@ void evectmatrix_XtY_diag(evectmatrix X, evectmatrix Y, scalar *diag,
 void evectmatrix_XtY_diag_real(evectmatrix X, evectmatrix Y, real *diag,
 			       real *scratch_diag)
 {
-     matrix_XtY_diag_real(X.data, Y.data, X.n, X.p, scratch_diag);
+     if (EVECTMATRIX_CONTIGUOUS(X) && EVECTMATRIX_CONTIGUOUS(Y))
+	  matrix_XtY_diag_real(X.data, Y.data, X.n, X.p, scratch_diag);
+     else {
+	  int i, j;
+	  for (j = 0; j < X.p; ++j)
+	       scratch_diag[j] = 0;
+	  for (i = 0; i < X.n; ++i)
+	       for (j = 0; j < X.p; ++j) {
+		    scalar x = X.data[i * X.fd + j], y = Y.data[i * Y.fd + j];
+		    scratch_diag[j] += (SCALAR_RE(x) * SCALAR_RE(y) +
+					SCALAR_IM(x) * SCALAR_IM(y));
+	       }
+     }
      evectmatrix_flops += X.N * X.c * X.p * (2*X.p);
      mpi_allreduce(scratch_diag, diag, X.p,
 		   real, SCALAR_MPI_TYPE, MPI_SUM, mpb_comm);
@@ -240,12 +527,52 @@ void evectmatrix_XtY_diag_real(evectmatrix X, evectmatrix Y, real *diag,
 /* As above, but compute only the diagonal elements of XtX. */
 void evectmatrix_XtX_diag_real(evectmatrix X, real *diag, real *scratch_diag)
 {
-     matrix_XtX_diag_real(X.data, X.n, X.p, scratch_diag);
+     if (EVECTMATRIX_CONTIGUOUS(X))
+	  matrix_XtX_diag_real(X.data, X.n, X.p, scratch_diag);
+     else {
+	  int i, j;
+	  for (j = 0; j < X.p; ++j)
+	       scratch_diag[j] = 0;
+	  for (i = 0; i < X.n; ++i)
+	       for (j = 0; j < X.p; ++j) {
+		    ACCUMULATE_SUM_SQ(scratch_diag[j], X.data[i * X.fd + j]);
+	       }
+     }
      evectmatrix_flops += X.N * X.c * X.p * (2*X.p);
      mpi_allreduce(scratch_diag, diag, X.p,
 		   real, SCALAR_MPI_TYPE, MPI_SUM, mpb_comm);
 }
 
+/* compute X += a * Y * diag(diag) */
+void evectmatrix_XpaY_diag(evectmatrix X, real a, evectmatrix Y,
+			   scalar *diag)
+{
+     CHECK(X.n == Y.n && X.p == Y.p, "arrays not conformant");
+     if (EVECTMATRIX_CONTIGUOUS(X) && EVECTMATRIX_CONTIGUOUS(Y))
+	  matrix_XpaY_diag(X.data, a, Y.data, diag, X.n, X.p);
+     else {
+	  int i;
+	  for (i = 0; i < X.n; ++i)
+	       matrix_XpaY_diag(X.data + i * X.fd, a, Y.data + i * Y.fd,
+				diag, 1, X.p);
+     }
+}
+
+/* compute X += a * Y * diag(diag), where diag is real */
+void evectmatrix_XpaY_diag_real(evectmatrix X, real a, evectmatrix Y,
+				real *diag)
+{
+     CHECK(X.n == Y.n && X.p == Y.p, "arrays not conformant");
+     if (EVECTMATRIX_CONTIGUOUS(X) && EVECTMATRIX_CONTIGUOUS(Y))
+	  matrix_XpaY_diag_real(X.data, a, Y.data, diag, X.n, X.p);
+     else {
+	  int i;
+	  for (i = 0; i < X.n; ++i)
+	       matrix_XpaY_diag_real(X.data + i * X.fd, a, Y.data + i * Y.fd,
+				     diag, 1, X.p);
+     }
+}
+
 /* compute trace(adjoint(X) * Y) */
 scalar evectmatrix_traceXtY(evectmatrix X, evectmatrix Y)
 {
@@ -253,7 +580,7 @@ scalar evectmatrix_traceXtY(evectmatrix X, evectmatrix Y)
 
      CHECK(X.p == Y.p && X.n == Y.n, "matrices not conformant");
      
-     trace_scratch = blasglue_dotc(X.n * X.p, X.data, 1, Y.data, 1);
+     trace_scratch = evectmatrix_dotc(X, Y);
      evectmatrix_flops += X.N * X.c * X.p * (2*X.p) + X.p;
 
      mpi_allreduce(&trace_scratch, &trace, SCALAR_NUMVALS,
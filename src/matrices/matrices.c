@@ -20,6 +20,7 @@
 
 #include "config.h"
 #include <check.h>
+#include <bigmem.h>
 
 #include "matrices.h"
 
@@ -40,11 +41,12 @@ evectmatrix create_evectmatrix(int N, int c, int p,
      X.c = c;
      
      X.n = localN * c;
-     X.alloc_p = X.p = p;
+     X.alloc_p = X.p = X.fd = p;
      
-     if (allocN > 0) {
-	  CHK_MALLOC(X.data, scalar, allocN * c * p);
-     }
+     /* (one chunk per row, for first-touch placement; see bigmem.h) */
+     if (allocN > 0)
+	  X.data = (scalar *) bigmem_malloc(sizeof(scalar) * allocN * c * p,
+					    allocN);
      else
 	  X.data = NULL;
 
@@ -53,7 +55,22 @@ evectmatrix create_evectmatrix(int N, int c, int p,
 
 void destroy_evectmatrix(evectmatrix X)
 {
-     free(X.data);
+     bigmem_free(X.data);
+}
+
+/* Return a view of the p columns ix..ix+p-1 of X, i.e. an evectmatrix
+   that shares X's data (with row stride X.fd) instead of copying it.
+   A view must not be destroyed, and can be resized only to a smaller
+   number of columns (which does not move the data, unlike resizing a
+   contiguous matrix).  A view of all the columns of X is simply X. */
+evectmatrix evectmatrix_view(evectmatrix X, int ix, int p)
+{
+     CHECK(ix >= 0 && p >= 0 && ix + p <= X.p, "invalid evectmatrix view");
+     if (ix == 0 && p == X.p)
+	  return X;
+     X.data += ix;
+     X.p = X.alloc_p = p;
+     return X;
 }
 
 sqmatrix create_sqmatrix(int p)
@@ -24,13 +24,22 @@
 extern "C" {
 #endif /* __cplusplus */
 
+/* An evectmatrix is an n x p matrix (n = localN * c rows on this
+   process), stored in row-major order: element (i,j) is data[i*fd + j].
+   Normally, fd == p, but the matrix may also be a "view" of a subset of
+   the columns of a wider matrix (see evectmatrix_view), in which case fd
+   is the row stride of the parent matrix. */
 typedef struct {
      int N, localN, Nstart, allocN;
      int c;
      int n, p, alloc_p;
+     int fd; /* final dimension (row stride) of data */
      scalar *data;
 } evectmatrix;
 
+/* true if the rows of X are stored contiguously (not a strided view) */
+#define EVECTMATRIX_CONTIGUOUS(X) ((X).fd == (X).p)
+
 typedef struct {
      int p, alloc_p;
      scalar *data;
@@ -44,6 +53,7 @@ extern double evectmatrix_flops;
 extern evectmatrix create_evectmatrix(int N, int c, int p,
 				      int localN, int Nstart, int allocN);
 extern void destroy_evectmatrix(evectmatrix X);
+extern evectmatrix evectmatrix_view(evectmatrix X, int ix, int p);
 extern sqmatrix create_sqmatrix(int p);
 extern void destroy_sqmatrix(sqmatrix X);
 
@@ -70,6 +80,7 @@ extern void evectmatrix_resize(evectmatrix *A, int p, short preserve_data);
 extern void evectmatrix_copy(evectmatrix X, evectmatrix Y);
 extern void evectmatrix_copy_slice(evectmatrix X, evectmatrix Y,
 				   int ix, int iy, int p);
+extern void evectmatrix_rscal(real a, evectmatrix X);
 extern void evectmatrix_aXpbY(real a, evectmatrix X, real b, evectmatrix Y);
 extern void evectmatrix_aXpbYS_sub(real a, evectmatrix X, 
 				   real b, evectmatrix Y,
@@ -85,12 +96,33 @@ extern void evectmatrix_XtY_slice(sqmatrix U, evectmatrix X, evectmatrix Y,
 				  int ix, int iy, int p, sqmatrix S);
 extern void evectmatrixXtY_sub(sqmatrix U, int Uoffset,
 			       evectmatrix X, evectmatrix Y, sqmatrix S);
+extern void evectmatrix_XtY_block(scalar *U, int ldU,
+				  evectmatrix X, evectmatrix Y,
+				  scalar *scratch);
+extern void evectmatrix_XtY_multi(int k, sqmatrix *U, const evectmatrix *X,
+				  const evectmatrix *Y, scalar *scratch);
+extern void evectmatrix_traceXtY_multi(int k, scalar *tr,
+				       const evectmatrix *X,
+				       const evectmatrix *Y, scalar *scratch);
+extern void evectmatrix_XpYC(real a, evectmatrix X, real b, evectmatrix Y,
+			     scalar *C);
+extern void evectmatrix_keep_columns(evectmatrix *X, const int *index,
+				     int nkeep);
+extern void evectmatrix_XeXRinv(evectmatrix X, sqmatrix R);
+extern int evectmatrix_cholqr2(evectmatrix X, evectmatrix BX,
+			       evectmatrix *C, int nC, sqmatrix R,
+			       sqmatrix *M, short two_pass,
+			       sqmatrix S, scalar *scratch);
 extern void evectmatrix_XtY_diag(evectmatrix X, evectmatrix Y, scalar *diag,
 				 scalar *scratch_diag);
 extern void evectmatrix_XtY_diag_real(evectmatrix X, evectmatrix Y,
 				      real *diag, real *scratch_diag);
 extern void evectmatrix_XtX_diag_real(evectmatrix X, real *diag,
 				      real *scratch_diag);
+extern void evectmatrix_XpaY_diag(evectmatrix X, real a, evectmatrix Y,
+				  scalar *diag);
+extern void evectmatrix_XpaY_diag_real(evectmatrix X, real a, evectmatrix Y,
+				       real *diag);
 extern scalar evectmatrix_traceXtY(evectmatrix X, evectmatrix Y);
 
 /* sqmatrix operations, defined in sqmatrix.c: */
@@ -110,6 +142,8 @@ extern void sqmatrix_ApaB(sqmatrix A, real a, sqmatrix B);
 extern void sqmatrix_aApbB(real a, sqmatrix A, real b, sqmatrix B);
 extern int sqmatrix_invert(sqmatrix U, short positive_definite,
 			    sqmatrix Work);
+extern int sqmatrix_cholesky(sqmatrix U, real shift);
+extern void sqmatrix_RtinvARinv(sqmatrix A, sqmatrix R);
 extern void sqmatrix_eigensolve(sqmatrix U, real *eigenvals, sqmatrix W);
 extern void sqmatrix_gen_eigensolve(sqmatrix U, sqmatrix B, real *eigenvals, sqmatrix W);
 extern void sqmatrix_sqrt(sqmatrix Usqrt, sqmatrix U, sqmatrix W);
@@ -245,6 +245,36 @@ int sqmatrix_invert(sqmatrix U, short positive_definite,
      return 1;
 }
 
+/* U <- R, the Cholesky factor of U + shift * I, where U must be
+   Hermitian.  R is upper-triangular (its lower triangle is zeroed)
+   and U + shift * I = adjoint(R) * R.  Returns 0 if U + shift * I is
+   not positive-definite (in which case U is garbage), and 1 otherwise. */
+int sqmatrix_cholesky(sqmatrix U, real shift)
+{
+     int i, j;
+
+     sqmatrix_assert_hermitian(U);
+     for (i = 0; i < U.p; ++i)
+	  SCALAR_RE(U.data[i * U.p + i]) += shift;
+     if (!lapackglue_potrf('U', U.p, U.data, U.p)) return 0;
+     for (i = 0; i < U.p; ++i)
+	  for (j = 0; j < i; ++j)
+	       ASSIGN_ZERO(U.data[i * U.p + j]);
+     return 1;
+}
+
+/* A <- 1/adjoint(R) * A * 1/R, where R is upper-triangular (e.g. from
+   sqmatrix_cholesky).  This is the transformation of adjoint(X) A X
+   when X is replaced by X * 1/R. */
+void sqmatrix_RtinvARinv(sqmatrix A, sqmatrix R)
+{
+     CHECK(A.p == R.p, "matrices not conformant");
+     blasglue_trsm('L', 'U', 'C', 'N', A.p, A.p, 1.0, R.data, R.p,
+		   A.data, A.p);
+     blasglue_trsm('R', 'U', 'N', 'N', A.p, A.p, 1.0, R.data, R.p,
+		   A.data, A.p);
+}
+
 /* U <- eigenvectors of Ux=lambda B x, while B is overwritten (by its
    Cholesky factors).  U and B must be Hermitian, and B must be
    positive-definite; if B==NULL then it is taken to be the
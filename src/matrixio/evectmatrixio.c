@@ -18,20 +18,36 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <math.h>
 
 #include "config.h"
 
+#include <mpiglue.h>
+#include <mpi_utils.h>
 #include <check.h>
 #include <matrices.h>
 
 #include "matrixio.h"
 
-void evectmatrixio_writeall_raw(const char *filename, evectmatrix a)
+/* Write/read a as the dataset "name" in the (open) file file_id, in
+   raw form: an N x c x p x SCALAR_NUMVALS array.  If a is a strided view
+   (see evectmatrix_view), it is copied through a contiguous buffer. */
+static void evectmatrixio_write_raw(matrixio_id file_id, const char *name,
+				    evectmatrix a)
 {
      int dims[4], start[4] = {0, 0, 0, 0};
      const int rank = 4;
-     matrixio_id file_id, data_id;
+     matrixio_id data_id;
      
+     if (!EVECTMATRIX_CONTIGUOUS(a)) {
+	  evectmatrix b = create_evectmatrix(a.N, a.c, a.p,
+					     a.localN, a.Nstart, a.localN);
+	  evectmatrix_copy(b, a);
+	  evectmatrixio_write_raw(file_id, name, b);
+	  destroy_evectmatrix(b);
+	  return;
+     }
+
      dims[0] = a.N;
      dims[1] = a.c;
      dims[2] = a.p;
@@ -39,31 +55,173 @@ void evectmatrixio_writeall_raw(const char *filename, evectmatrix a)
 
      start[0] = a.Nstart;
 
-     file_id = matrixio_create(filename);     
-     data_id = matrixio_create_dataset(file_id, "rawdata", NULL, rank, dims);
+     data_id = matrixio_create_dataset(file_id, name, NULL, rank, dims);
      
      dims[0] = a.localN;
      matrixio_write_real_data(data_id, dims, start, 1, (real *) a.data);
 
      matrixio_close_dataset(data_id);
-     matrixio_close(file_id);
 }
 
-void evectmatrixio_readall_raw(const char *filename, evectmatrix a)
+static void evectmatrixio_read_raw(matrixio_id file_id, const char *name,
+				   evectmatrix a)
 {
      int rank = 4, dims[4];
-     matrixio_id file_id;
+
+     if (!EVECTMATRIX_CONTIGUOUS(a)) {
+	  evectmatrix b = create_evectmatrix(a.N, a.c, a.p,
+					     a.localN, a.Nstart, a.localN);
+	  evectmatrixio_read_raw(file_id, name, b);
+	  evectmatrix_copy(a, b);
+	  destroy_evectmatrix(b);
+	  return;
+     }
 
      dims[0] = a.N;
      dims[1] = a.c;
      dims[2] = a.p;
      dims[3] = SCALAR_NUMVALS;
 
-     file_id = matrixio_open(filename, 1);
-     
-     CHECK(matrixio_read_real_data(file_id, "rawdata", &rank, dims, 
+     CHECK(matrixio_read_real_data(file_id, name, &rank, dims, 
 				   a.localN, a.Nstart, 1, (real *) a.data),
 	   "error reading data set in file");
+}
 
+void evectmatrixio_writeall_raw(const char *filename, evectmatrix a)
+{
+     matrixio_id file_id;
+
+     file_id = matrixio_create(filename);     
+     evectmatrixio_write_raw(file_id, "rawdata", a);
      matrixio_close(file_id);
 }
+
+void evectmatrixio_readall_raw(const char *filename, evectmatrix a)
+{
+     matrixio_id file_id;
+
+     file_id = matrixio_open(filename, 1);
+     evectmatrixio_read_raw(file_id, "rawdata", a);
+     matrixio_close(file_id);
+}
+
+/*************************************************************************/
+
+/* Eigensolver checkpoint I/O (an evectcheckpoint, see eigensolver.h),
+   where data is an evectmatrixio_checkpoint_data (see matrixio.h); the
+   name of the checkpoint file must end in ".h5".  X[i] is stored as the
+   raw dataset "X<i>", and vals as the "state" attribute, along with the
+   sizes of the problem and its id.
+
+   A checkpoint is first written to a temporary file, which then
+   replaces the previous one, so that the old checkpoint is not lost
+   if we are interrupted while writing.  Reading returns 0 (leaving
+   X and vals untouched) if there is no checkpoint file, or if it was
+   written for a problem of a different size or id.  The id is compared
+   to a relative tolerance, so that it may include sums over the grid
+   (which depend on the order of summation, i.e. on the number of
+   processes).  Like evectmatrixio_readall_raw, each process reads its
+   rows at their global offset (Nstart), so a run can be resumed with
+   a different number of processes. */
+int evectmatrixio_checkpoint(int write, evectmatrix *X, int nX,
+			     real *vals, int nvals, void *data)
+{
+#if defined(HAVE_HDF5)
+     const evectmatrixio_checkpoint_data *d =
+	  (const evectmatrixio_checkpoint_data *) data;
+     const char *fname = d->fname;
+     char dname[32];
+     real sizes[4];
+     int i, dims[1];
+
+     CHECK(strlen(fname) > 3 && !strcmp(fname + strlen(fname) - 3, ".h5"),
+	   "checkpoint file name must end in .h5");
+
+     sizes[0] = X[0].N; sizes[1] = X[0].c; sizes[2] = X[0].p;
+     sizes[3] = nX;
+
+     if (write) {
+	  char *tmpname;
+	  matrixio_id file_id;
+
+	  CHK_MALLOC(tmpname, char, strlen(fname) + 8);
+	  strcpy(tmpname, fname);
+	  strcpy(tmpname + strlen(fname) - 3, "-tmp.h5");
+
+	  file_id = matrixio_create(tmpname);
+	  for (i = 0; i < nX; ++i) {
+	       sprintf(dname, "X%d", i);
+	       evectmatrixio_write_raw(file_id, dname, X[i]);
+	  }
+	  dims[0] = 4;
+	  matrixio_write_data_attr(file_id, "sizes", sizes, 1, dims);
+	  dims[0] = nvals;
+	  matrixio_write_data_attr(file_id, "state", vals, 1, dims);
+	  if (d->nid > 0) {
+	       dims[0] = d->nid;
+	       matrixio_write_data_attr(file_id, "id", d->id, 1, dims);
+	  }
+	  matrixio_close(file_id);
+
+	  MPI_Barrier(mpb_comm);
+	  if (mpi_is_master())
+	       CHECK(rename(tmpname, fname) == 0,
+		     "error renaming checkpoint file");
+	  MPI_Barrier(mpb_comm);
+
+	  free(tmpname);
+	  return 1;
+     }
+     else {
+	  matrixio_id file_id;
+	  real *fsizes, *fid = NULL, *fvals = NULL;
+	  int rank, ok;
+	  FILE *f;
+
+	  ok = (f = fopen(fname, "rb")) != NULL;
+	  if (f)
+	       fclose(f);
+	  mpi_allreduce_1(&ok, int, MPI_INT, MPI_MIN, mpb_comm);
+	  if (!ok)
+	       return 0;
+
+	  file_id = matrixio_open(fname, 1);
+	  fsizes = matrixio_read_data_attr(file_id, "sizes", &rank, 1, dims);
+	  ok = fsizes && rank == 1 && dims[0] == 4;
+	  for (i = 0; ok && i < 4; ++i)
+	       ok = fsizes[i] == sizes[i];
+	  if (ok && d->nid > 0) {
+	       fid = matrixio_read_data_attr(file_id, "id", &rank, 1, dims);
+	       ok = fid && rank == 1 && dims[0] == d->nid;
+	       for (i = 0; ok && i < d->nid; ++i)
+		    ok = fabs(fid[i] - d->id[i])
+			 <= 1e-10 * (fabs(fid[i]) + fabs(d->id[i]));
+	  }
+	  if (ok) {
+	       fvals = matrixio_read_data_attr(file_id, "state",
+					       &rank, 1, dims);
+	       ok = fvals && rank == 1 && dims[0] == nvals;
+	  }
+	  if (ok) {
+	       for (i = 0; i < nX; ++i) {
+		    sprintf(dname, "X%d", i);
+		    evectmatrixio_read_raw(file_id, dname, X[i]);
+	       }
+	       for (i = 0; i < nvals; ++i)
+		    vals[i] = fvals[i];
+	  }
+	  matrixio_close(file_id);
+
+	  if (!ok)
+	       mpi_one_fprintf(stderr, "ignoring checkpoint \"%s\", which "
+			       "is for a different problem\n", fname);
+
+	  free(fvals);
+	  free(fid);
+	  free(fsizes);
+	  return ok;
+     }
+#else
+     return 0; /* no checkpoints without HDF5 */
+#endif
+}
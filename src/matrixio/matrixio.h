@@ -85,6 +85,18 @@ extern real *matrixio_read_data_attr(matrixio_id id, const char *name,
 extern void evectmatrixio_writeall_raw(const char *filename, evectmatrix a);
 extern void evectmatrixio_readall_raw(const char *filename, evectmatrix a);
 
+/* the data argument of evectmatrixio_checkpoint: the checkpoint file,
+   and nid numbers identifying the problem (e.g. its k vector), which a
+   checkpoint must match in order to be read */
+typedef struct {
+     const char *fname;
+     const real *id;
+     int nid;
+} evectmatrixio_checkpoint_data;
+
+extern int evectmatrixio_checkpoint(int write, evectmatrix *X, int nX,
+				    real *vals, int nvals, void *data);
+
 extern void fieldio_write_complex_field(scalar_complex *field,
 					int rank,
 					const int dims[3],
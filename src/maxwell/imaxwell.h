@@ -91,4 +91,32 @@
 #  endif
 #endif
 
+#if defined(HAVE_FFTW3)
+/* plan cache, in maxwell_fftplans.c */
+
+/* kinds of cached plans: */
+#define FFT_PLAN_DFT 0 /* plan, iplan = backward, forward transforms */
+/* For the z-mirror transforms (see compute_fft_zmirror in maxwell_op.c): */
+#define FFT_PLAN_ZMIRROR_XY 1 /* as for FFT_PLAN_DFT, xy planes only */
+#define FFT_PLAN_ZMIRROR_Z 2 /* plan, iplan = z DCT/DST of xy/z comps. */
+
+extern int maxwell_fft_plans_lookup(const maxwell_data *d, int kind,
+				    int howmany, int stride, int dist,
+				    int inplace,
+				    fftplan *plan, fftplan *iplan);
+extern void maxwell_fft_plans_insert(const maxwell_data *d, int kind,
+				     int howmany, int stride, int dist,
+				     int inplace,
+				     fftplan plan, fftplan iplan);
+#endif
+
+/* in maxwell_op.c */
+extern int maxwell_te_tm_components(const maxwell_data *d);
+extern void maxwell_te_tm_eps_inv(const maxwell_data *d, int i, int nc,
+				  symmetric_matrix_xy *xy, real *zz);
+
+/* in maxwell_eps.c */
+extern void maxwell_destroy_compressed_eps_inv(compressed_eps_inv *c);
+extern void maxwell_update_te_tm_eps_inv(maxwell_data *md);
+
 #endif /* IMAXWELL_H */
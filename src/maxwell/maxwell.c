@@ -21,12 +21,24 @@
 
 #include "imaxwell.h"
 #include "check.h"
+#include "bigmem.h"
+
+#ifdef USE_OPENMP
+#  include <omp.h>
+#endif
 
 /* This file is has too many #ifdef's...blech. */
 
 #define MIN2(a,b) ((a) < (b) ? (a) : (b))
 #define MAX2(a,b) ((a) > (b) ? (a) : (b))
 
+static void alloc_k_plus_G(maxwell_data *d)
+{
+     int N = d->local_N;
+     CHK_MALLOC(d->k_plus_G, k_data, N);
+     CHK_MALLOC(d->k_plus_G_normsqr, real, N);
+}
+
 maxwell_data *create_maxwell_data(int nx, int ny, int nz,
 				  int *local_N, int *N_start, int *alloc_N,
 				  int num_bands,
@@ -34,7 +46,7 @@ maxwell_data *create_maxwell_data(int nx, int ny, int nz,
 {
      int n[3], rank = (nz == 1) ? (ny == 1 ? 1 : 2) : 3;
      maxwell_data *d = 0;
-     int fft_data_size;
+     int fft_data_size, i;
 
      n[0] = nx;
      n[1] = ny;
@@ -60,7 +72,10 @@ maxwell_data *create_maxwell_data(int nx, int ny, int nz,
      maxwell_set_num_bands(d, num_bands);
 
      d->current_k[0] = d->current_k[1] = d->current_k[2] = 0.0;
+     for (i = 0; i < 9; ++i)
+	  d->G[i/3][i%3] = 0.0;
      d->parity = NO_PARITY;
+     d->fft_rigor = FFT_ESTIMATE;
 
      d->last_dim_size = d->last_dim = n[rank - 1];
 
@@ -122,7 +137,6 @@ maxwell_data *create_maxwell_data(int nx, int ny, int nz,
 
 #  if defined(HAVE_FFTW3)
 {
-     int i;
      ptrdiff_t np[3], local_nx, local_ny, local_x_start, local_y_start;
 
      CHECK(rank > 1, "rank < 2 MPI computations are not supported");
@@ -219,21 +233,21 @@ maxwell_data *create_maxwell_data(int nx, int ny, int nz,
 
      CHK_MALLOC(d->eps_inv, symmetric_matrix, d->fft_output_size);
      d->mu_inv = NULL;
+     d->eps_inv_c = d->mu_inv_c = NULL;
+     d->eps_inv_te_tm = 0;
+     d->eps_inv_xy = NULL;
+     d->eps_inv_zz = NULL;
+     d->eps_inv_zmirror = 0;
 
      /* A scratch output array is required because the "ordinary" arrays
 	are not in a cartesian basis (or even a constant basis). */
+     d->fft_data_size = fft_data_size;
      fft_data_size *= d->max_fft_bands;
-#if defined(HAVE_FFTW3)
-     d->fft_data = (scalar *) FFTW(malloc)(sizeof(scalar) * 3 * fft_data_size);
-     CHECK(d->fft_data, "out of memory!");
+     /* (bigmem_malloc aligns at least as well as FFTW(malloc); the chunks
+	are those processed by each iteration of the other_dims loops) */
+     d->fft_data = (scalar *) bigmem_malloc(sizeof(scalar) * 3 * fft_data_size,
+					    d->other_dims);
      d->fft_data2 = d->fft_data; /* works in-place */
-#else     
-     CHK_MALLOC(d->fft_data, scalar, 3 * fft_data_size);
-     d->fft_data2 = d->fft_data; /* works in-place */
-#endif
-
-     CHK_MALLOC(d->k_plus_G, k_data, *local_N);
-     CHK_MALLOC(d->k_plus_G_normsqr, real, *local_N);
 
      d->eps_inv_mean = 1.0;
      d->mu_inv_mean = 1.0;
@@ -243,6 +257,8 @@ maxwell_data *create_maxwell_data(int nx, int ny, int nz,
      d->alloc_N = *alloc_N;
      d->N = nx * ny * nz;
 
+     alloc_k_plus_G(d);
+
      return d;
 }
 
@@ -251,11 +267,9 @@ void destroy_maxwell_data(maxwell_data *d)
      if (d) {
 	  int i;
 
+	  /* (FFTW3 plans are owned by the plan cache, not by d) */
 	  for (i = 0; i < d->nplans; ++i) {
-#if defined(HAVE_FFTW3)
-	       FFTW(destroy_plan)((fftplan) (d->plans[i]));
-	       FFTW(destroy_plan)((fftplan) (d->iplans[i]));
-#elif defined(HAVE_FFTW)
+#if defined(HAVE_FFTW)
 #  ifdef HAVE_MPI
 #    ifdef SCALAR_COMPLEX
 	       fftwnd_mpi_destroy_plan((fftplan) (d->plans[i]));
@@ -278,13 +292,13 @@ void destroy_maxwell_data(maxwell_data *d)
 
 	  free(d->eps_inv);
           if (d->mu_inv) free(d->mu_inv);
-#if defined(HAVE_FFTW3)
-	  FFTW(free)(d->fft_data);
+	  maxwell_destroy_compressed_eps_inv(d->eps_inv_c);
+	  maxwell_destroy_compressed_eps_inv(d->mu_inv_c);
+	  free(d->eps_inv_xy);
+	  free(d->eps_inv_zz);
+	  bigmem_free(d->fft_data);
 	  if (d->fft_data2 != d->fft_data)
-	       FFTW(free)(d->fft_data2);
-#else
-	  free(d->fft_data);
-#endif
+	       bigmem_free(d->fft_data2);
 	  free(d->k_plus_G);
 	  free(d->k_plus_G_normsqr);
 
@@ -298,6 +312,70 @@ void maxwell_set_num_bands(maxwell_data *d, int num_bands)
      d->num_fft_bands = MIN2(num_bands, d->max_fft_bands);
 }
 
+/* Set the planner rigor (FFT_ESTIMATE, FFT_MEASURE, ...) for the FFT
+   plans used from now on.  The rigor is part of the plan-cache key, so
+   transforms are re-planned with the new rigor when they are next
+   needed.  (This only affects FFTW3, whose plans are created lazily;
+   the FFTW2 plans are always created with FFTW_ESTIMATE in
+   create_maxwell_data.) */
+void maxwell_set_fft_rigor(maxwell_data *d, int rigor)
+{
+     CHECK(rigor >= FFT_ESTIMATE && rigor <= FFT_EXHAUSTIVE,
+	   "invalid FFT planner rigor");
+     d->fft_rigor = rigor;
+}
+
+/* Set the number of threads used by the Maxwell operator and
+   preconditioner loops and (with FFTW3) by FFT plans created from now
+   on.  This does nothing unless we were compiled with OpenMP, in which
+   case FFTW(init_threads) must already have been called. */
+void maxwell_set_num_threads(int nthreads)
+{
+     CHECK(nthreads > 0, "invalid number of threads");
+#ifdef USE_OPENMP
+     omp_set_num_threads(nthreads);
+#  if defined(HAVE_FFTW3)
+     FFTW(plan_with_nthreads)(nthreads);
+#  endif
+#endif
+}
+
+/* Import FFTW wisdom (accumulated plans) from the file fname, returning
+   whether this succeeded.  With MPI, the file is only read by the master
+   process and the wisdom is then broadcast to the other processes, so
+   that all processes create the same plans.  Not supported for FFTW2,
+   for which we always return 0. */
+int maxwell_import_fft_wisdom(const char *fname)
+{
+     int ok = 0;
+#if defined(HAVE_FFTW3)
+     if (mpi_is_master())
+	  ok = FFTW(import_wisdom_from_filename)(fname);
+#  ifdef HAVE_MPI
+     FFTW(mpi_broadcast_wisdom)(mpb_comm);
+     MPI_Bcast(&ok, 1, MPI_INT, 0, mpb_comm);
+#  endif
+#endif
+     return ok;
+}
+
+/* Save the current FFTW wisdom to the file fname, returning whether
+   the file was written.  With MPI, the wisdom from all processes is
+   first gathered, and the file is written by a single process only
+   (the return value is 0 on the other processes). */
+int maxwell_export_fft_wisdom(const char *fname)
+{
+     int ok = 0;
+#if defined(HAVE_FFTW3)
+#  ifdef HAVE_MPI
+     FFTW(mpi_gather_wisdom)(mpb_comm);
+#  endif
+     if (mpi_is_master() && my_global_rank() == 0)
+	  ok = FFTW(export_wisdom_to_filename)(fname);
+#endif
+     return ok;
+}
+
 /* compute a = b x c */
 static void compute_cross(real *a0, real *a1, real *a2,
 			  real b0, real b1, real b2,
@@ -308,16 +386,143 @@ static void compute_cross(real *a0, real *a1, real *a2,
      *a2 = b0 * c1 - b1 * c0;
 }
 
+/* Compute the k_data for the plane wave k+G, where k is a cartesian
+   vector (usually d->current_k) and G = (kxi, kyi, kzi) in the basis
+   of the reciprocal lattice vectors d->G, returning |k+G|^2.  (If kpG
+   is NULL, only |k+G|^2 is computed.) */
+static real compute_k_data(const maxwell_data *d, const real k[3],
+			   int kxi, int kyi, int kzi, k_data *kpG)
+{
+     const real *G1 = d->G[0], *G2 = d->G[1], *G3 = d->G[2];
+     real kpGx, kpGy, kpGz, a, b, c, kpGn2, leninv;
+
+     /* Compute k+G (noting that G is negative because
+	of the choice of sign in the FFTW Fourier transform): */
+     kpGx = k[0] - (G1[0]*kxi + G2[0]*kyi + G3[0]*kzi);
+     kpGy = k[1] - (G1[1]*kxi + G2[1]*kyi + G3[1]*kzi);
+     kpGz = k[2] - (G1[2]*kxi + G2[2]*kyi + G3[2]*kzi);
+
+     a = kpGn2 = kpGx*kpGx + kpGy*kpGy + kpGz*kpGz;
+     if (!kpG)
+	  return kpGn2;
+     kpG->kmag = sqrt(a);
+
+     /* Now, compute the two normal vectors: */
+     /* (Note that we choose them so that m has odd/even
+	parity in z/y, and n is even/odd in z/y.) */
+
+     if (a == 0) {
+	  kpG->nx = 0.0; kpG->ny = 1.0; kpG->nz = 0.0;
+	  kpG->mx = 0.0; kpG->my = 0.0; kpG->mz = 1.0;
+     }
+     else {
+	  if (kpGx == 0.0 && kpGy == 0.0) {
+	       /* put n in the y direction if k+G is in z: */
+	       kpG->nx = 0.0;
+	       kpG->ny = 1.0;
+	       kpG->nz = 0.0;
+	  }
+	  else {
+	       /* otherwise, let n = z x (k+G), normalized: */
+	       compute_cross(&a, &b, &c,
+			     0.0, 0.0, 1.0,
+			     kpGx, kpGy, kpGz);
+	       leninv = 1.0 / sqrt(a*a + b*b + c*c);
+	       kpG->nx = a * leninv;
+	       kpG->ny = b * leninv;
+	       kpG->nz = c * leninv;
+	  }
+
+	  /* m = n x (k+G), normalized */
+	  compute_cross(&a, &b, &c,
+			kpG->nx, kpG->ny, kpG->nz,
+			kpGx, kpGy, kpGz);
+	  leninv = 1.0 / sqrt(a*a + b*b + c*c);
+	  kpG->mx = a * leninv;
+	  kpG->my = b * leninv;
+	  kpG->mz = c * leninv;
+     }
+
+#ifdef DEBUG
+#define DOT(u0,u1,u2,v0,v1,v2) ((u0)*(v0) + (u1)*(v1) + (u2)*(v2))
+
+     /* check orthogonality */
+     CHECK(fabs(DOT(kpGx, kpGy, kpGz,
+		    kpG->nx, kpG->ny, kpG->nz)) < 1e-6,
+	   "vectors not orthogonal!");
+     CHECK(fabs(DOT(kpGx, kpGy, kpGz,
+		    kpG->mx, kpG->my, kpG->mz)) < 1e-6,
+	   "vectors not orthogonal!");
+     CHECK(fabs(DOT(kpG->mx, kpG->my, kpG->mz,
+		    kpG->nx, kpG->ny, kpG->nz)) < 1e-6,
+	   "vectors not orthogonal!");
+
+     /* check normalization */
+     CHECK(fabs(DOT(kpG->nx, kpG->ny, kpG->nz,
+		    kpG->nx, kpG->ny, kpG->nz) - 1.0) < 1e-6,
+	   "vectors not unit vectors!");
+     CHECK(fabs(DOT(kpG->mx, kpG->my, kpG->mz,
+		    kpG->mx, kpG->my, kpG->mz) - 1.0) < 1e-6,
+	   "vectors not unit vectors!");
+#endif
+
+     return kpGn2;
+}
+
+/* As compute_k_data, but for the i-th local point of the grid (in the
+   same order as the d->k_plus_G arrays). */
+static real compute_k_data_i(const maxwell_data *d, const real k[3], int i,
+			     k_data *kpG)
+{
+     int nx = d->nx, ny = d->ny, nz = d->nz;
+     int cx = MAX2(1,d->nx/2), cy = MAX2(1,d->ny/2), cz = MAX2(1,d->nz/2);
+     int x, y, z;
+
+     z = i % nz; i /= nz;
+     y = i % ny;
+     x = i / ny + d->local_x_start;
+     return compute_k_data(d, k, (x >= cx) ? (x - nx) : x,
+			   (y >= cy) ? (y - ny) : y,
+			   (z >= cz) ? (z - nz) : z, kpG);
+}
+
+/* Compute the k_data for the i-th local point (in the same order as
+   the d->k_plus_G arrays), returning |k+G|^2; kpG may be NULL if only
+   the latter is wanted.  This is used in place
+   of the k_plus_G arrays when these are not stored (see
+   maxwell_set_kpG_on_the_fly), and gives exactly the same results. */
+real maxwell_compute_k_data(const maxwell_data *d, int i, k_data *kpG)
+{
+     return compute_k_data_i(d, d->current_k, i, kpG);
+}
+
+/* Fill the k_plus_G arrays for the current k point. */
+static void compute_k_plus_G(maxwell_data *d)
+{
+     int nx = d->nx, ny = d->ny, nz = d->nz;
+     int cx = MAX2(1,d->nx/2), cy = MAX2(1,d->ny/2), cz = MAX2(1,d->nz/2);
+     real *kpGn2 = d->k_plus_G_normsqr;
+     int x, y, z, i = 0;
+
+     for (x = d->local_x_start; x < d->local_x_start + d->local_nx; ++x) {
+	  int kxi = (x >= cx) ? (x - nx) : x;
+	  for (y = 0; y < ny; ++y) {
+	       int kyi = (y >= cy) ? (y - ny) : y;
+	       for (z = 0; z < nz; ++z, ++i) {
+		    int kzi = (z >= cz) ? (z - nz) : z;
+		    kpGn2[i] = compute_k_data(d, d->current_k, kxi, kyi, kzi,
+					      d->k_plus_G + i);
+	       }
+	  }
+     }
+}
+
 /* Set the current k point for the Maxwell solver.  k is given in the
    basis of the reciprocal lattice vectors, G1, G2, and G3. */
 void update_maxwell_data_k(maxwell_data *d, real k[3],
 			   real G1[3], real G2[3], real G3[3])
 {
-     int nx = d->nx, ny = d->ny, nz = d->nz;
-     int cx = MAX2(1,d->nx/2), cy = MAX2(1,d->ny/2), cz = MAX2(1,d->nz/2);
-     k_data *kpG = d->k_plus_G;
-     real *kpGn2 = d->k_plus_G_normsqr;
-     int x, y, z;
+     int i;
      real kx, ky, kz;
 
      kx = G1[0]*k[0] + G2[0]*k[1] + G3[0]*k[2];
@@ -330,90 +535,76 @@ void update_maxwell_data_k(maxwell_data *d, real k[3],
      d->current_k[1] = ky;
      d->current_k[2] = kz;
 
+     for (i = 0; i < 3; ++i) {
+	  d->G[0][i] = G1[i];
+	  d->G[1][i] = G2[i];
+	  d->G[2][i] = G3[i];
+     }
+
      /* make sure current parity is still valid: */
      set_maxwell_data_parity(d, d->parity);
 
-     for (x = d->local_x_start; x < d->local_x_start + d->local_nx; ++x) {
-	  int kxi = (x >= cx) ? (x - nx) : x;
-	  for (y = 0; y < ny; ++y) {
-	       int kyi = (y >= cy) ? (y - ny) : y;
-	       for (z = 0; z < nz; ++z, kpG++, kpGn2++) {
-		    int kzi = (z >= cz) ? (z - nz) : z;
-		    real kpGx, kpGy, kpGz, a, b, c, leninv;
-
-		    /* Compute k+G (noting that G is negative because
-		       of the choice of sign in the FFTW Fourier transform): */
-		    kpGx = kx - (G1[0]*kxi + G2[0]*kyi + G3[0]*kzi);
-		    kpGy = ky - (G1[1]*kxi + G2[1]*kyi + G3[1]*kzi);
-		    kpGz = kz - (G1[2]*kxi + G2[2]*kyi + G3[2]*kzi);
-
-		    a = kpGx*kpGx + kpGy*kpGy + kpGz*kpGz;
-		    kpG->kmag = sqrt(a);
-		    *kpGn2 = a;
-		    
-		    /* Now, compute the two normal vectors: */
-		    /* (Note that we choose them so that m has odd/even
-		       parity in z/y, and n is even/odd in z/y.) */
-
-		    if (a == 0) {
-			 kpG->nx = 0.0; kpG->ny = 1.0; kpG->nz = 0.0;
-			 kpG->mx = 0.0; kpG->my = 0.0; kpG->mz = 1.0;
-		    }
-		    else {
-			 if (kpGx == 0.0 && kpGy == 0.0) {
-			      /* put n in the y direction if k+G is in z: */
-			      kpG->nx = 0.0;
-			      kpG->ny = 1.0;
-			      kpG->nz = 0.0;
-			 }
-			 else {
-			      /* otherwise, let n = z x (k+G), normalized: */
-			      compute_cross(&a, &b, &c,
-					    0.0, 0.0, 1.0,
-					    kpGx, kpGy, kpGz);
-			      leninv = 1.0 / sqrt(a*a + b*b + c*c);
-			      kpG->nx = a * leninv;
-			      kpG->ny = b * leninv;
-			      kpG->nz = c * leninv;
-			 }
-			 
-			 /* m = n x (k+G), normalized */
-			 compute_cross(&a, &b, &c,
-				       kpG->nx, kpG->ny, kpG->nz,
-				       kpGx, kpGy, kpGz);
-			 leninv = 1.0 / sqrt(a*a + b*b + c*c);
-			 kpG->mx = a * leninv;
-			 kpG->my = b * leninv;
-			 kpG->mz = c * leninv;
-		    }
-
-#ifdef DEBUG
-#define DOT(u0,u1,u2,v0,v1,v2) ((u0)*(v0) + (u1)*(v1) + (u2)*(v2))
+     if (d->k_plus_G_normsqr)
+	  compute_k_plus_G(d);
+}
 
-		    /* check orthogonality */
-		    CHECK(fabs(DOT(kpGx, kpGy, kpGz,
-				   kpG->nx, kpG->ny, kpG->nz)) < 1e-6,
-			  "vectors not orthogonal!");
-		    CHECK(fabs(DOT(kpGx, kpGy, kpGz,
-				   kpG->mx, kpG->my, kpG->mz)) < 1e-6,
-			  "vectors not orthogonal!");
-		    CHECK(fabs(DOT(kpG->mx, kpG->my, kpG->mz,
-				   kpG->nx, kpG->ny, kpG->nz)) < 1e-6,
-			  "vectors not orthogonal!");
-
-		    /* check normalization */
-		    CHECK(fabs(DOT(kpG->nx, kpG->ny, kpG->nz,
-				   kpG->nx, kpG->ny, kpG->nz) - 1.0) < 1e-6,
-			  "vectors not unit vectors!");
-		    CHECK(fabs(DOT(kpG->mx, kpG->my, kpG->mz,
-				   kpG->mx, kpG->my, kpG->mz) - 1.0) < 1e-6,
-			  "vectors not unit vectors!");
-#endif
-	       }
+/* Re-express the fields H, given in the transverse (m,n) basis of the
+   (cartesian) k vector old_k, in the basis of the current k point of d,
+   by projecting each plane-wave component onto the new plane transverse
+   to k+G.  This makes the solution at one k point a good starting
+   guess at a nearby k point; otherwise, the change of the m and n
+   vectors (which is large where |k+G| is small) scrambles it. */
+void maxwell_change_k_basis(maxwell_data *d, evectmatrix H,
+			    const real old_k[3])
+{
+     int i, b;
+
+     CHECK(H.c == 2, "fields don't have two transverse components");
+     CHECK(H.localN == d->local_N, "fields don't match maxwell data");
+
+     for (i = 0; i < H.localN; ++i) {
+	  k_data kold, knew;
+	  real mm, mn, nm, nn;
+
+	  compute_k_data_i(d, old_k, i, &kold);
+	  MAXWELL_K_DATA(knew, d, i);
+	  mm = knew.mx * kold.mx + knew.my * kold.my + knew.mz * kold.mz;
+	  mn = knew.mx * kold.nx + knew.my * kold.ny + knew.mz * kold.nz;
+	  nm = knew.nx * kold.mx + knew.ny * kold.my + knew.nz * kold.mz;
+	  nn = knew.nx * kold.nx + knew.ny * kold.ny + knew.nz * kold.nz;
+
+	  for (b = 0; b < H.p; ++b) {
+	       scalar *v = H.data + i * 2 * H.fd + b;
+	       scalar v0 = v[0], v1 = v[H.fd];
+	       ASSIGN_SCALAR(v[0],
+			     mm * SCALAR_RE(v0) + mn * SCALAR_RE(v1),
+			     mm * SCALAR_IM(v0) + mn * SCALAR_IM(v1));
+	       ASSIGN_SCALAR(v[H.fd],
+			     nm * SCALAR_RE(v0) + nn * SCALAR_RE(v1),
+			     nm * SCALAR_IM(v0) + nn * SCALAR_IM(v1));
 	  }
      }
 }
 
+/* Choose whether to store the k+G data (7 reals plus |k+G|^2 for
+   each local point) for the current k point, or to recompute it from
+   the grid indices and the reciprocal lattice vectors whenever it is
+   needed.  The latter uses no storage and less memory bandwidth, at
+   the expense of a sqrt and a few divisions per point and use. */
+void maxwell_set_kpG_on_the_fly(maxwell_data *d, int on_the_fly)
+{
+     if (on_the_fly && d->k_plus_G_normsqr) {
+	  free(d->k_plus_G);
+	  free(d->k_plus_G_normsqr);
+	  d->k_plus_G = NULL;
+	  d->k_plus_G_normsqr = NULL;
+     }
+     else if (!on_the_fly && !d->k_plus_G_normsqr) {
+	  alloc_k_plus_G(d);
+	  compute_k_plus_G(d);
+     }
+}
+
 void set_maxwell_data_parity(maxwell_data *d, int parity)
 {
      if ((parity & EVEN_Z_PARITY) && (parity & ODD_Z_PARITY))
@@ -425,6 +616,7 @@ void set_maxwell_data_parity(maxwell_data *d, int parity)
      if (d->current_k[1] != 0.0)
 	  parity &= ~(EVEN_Y_PARITY | ODD_Y_PARITY);
      d->parity = parity;
+     maxwell_update_te_tm_eps_inv(d);
 }
 
 maxwell_target_data *create_maxwell_target_data(maxwell_data *md, 
@@ -39,6 +39,18 @@ typedef struct {
      real nx, ny, nz;
 } k_data;
 
+/* assign k = the k_data for local point i of the maxwell_data d,
+   from d->k_plus_G or, if that is not stored, computed on the fly
+   (see maxwell_set_kpG_on_the_fly) */
+#define MAXWELL_K_DATA(k, d, i) { \
+     if ((d)->k_plus_G) (k) = (d)->k_plus_G[i]; \
+     else maxwell_compute_k_data(d, i, &(k)); \
+}
+
+/* |k+G|^2 for local point i of the maxwell_data d */
+#define MAXWELL_KPG_NORMSQR(d, i) ((d)->k_plus_G_normsqr ? \
+     (d)->k_plus_G_normsqr[i] : maxwell_compute_k_data(d, i, NULL))
+
 
 /* Data structure to hold the upper triangle of a symmetric real matrix
    or possibly a Hermitian complex matrix (e.g. the dielectric tensor). */
@@ -75,13 +87,51 @@ typedef struct {
 				    (m).m12 == 0.0)
 #endif
 
+/* Compressed form of an eps_inv (or mu_inv) array, used by the
+   operator in place of the full array in order to reduce the memory
+   bandwidth.  Most grid points lie inside one of a handful of
+   homogeneous materials, so each point stores only a one-byte index
+   into a table of (at most MAX_EPS_MATERIALS) distinct tensors; the
+   remaining (interface) points have the index EPS_INTERFACE and are
+   listed, along with their full averaged tensors, separately. */
+#define MAX_EPS_MATERIALS 255
+#define EPS_INTERFACE 255
+#define EPS_ISOTROPIC 0 /* all materials are scalars */
+#define EPS_DIAGONAL 1 /* all materials are diagonal tensors */
+#define EPS_GENERAL 2
+typedef struct {
+     int nmaterials, kind;  /* kind is one of the EPS_* constants */
+     symmetric_matrix *materials;
+     real *diag; /* 3 * nmaterials diagonal entries */
+     unsigned char *index; /* material index of each point */
+     int ninterface;
+     int *interface_index;
+     symmetric_matrix *interface_eps_inv;
+} compressed_eps_inv;
+
+/* The in-plane (xy) block of a symmetric_matrix, which is all that is
+   needed for TE fields in 2d (see maxwell_data.eps_inv_xy). */
+typedef struct {
+#if defined(WITH_HERMITIAN_EPSILON)
+     real m00, m11;
+     scalar_complex m01;
+#else
+     real m00, m01, m11;
+#endif
+} symmetric_matrix_xy;
+
 #define NO_PARITY (0)
 #define EVEN_Z_PARITY (1<<0)
 #define ODD_Z_PARITY (1<<1)
 #define EVEN_Y_PARITY (1<<2)
 #define ODD_Y_PARITY (1<<3)
 
-#define MAX_NPLANS 32
+/* FFTW planner rigor, in order of increasing planning time (and
+   potentially faster transforms); see maxwell_set_fft_rigor. */
+#define FFT_ESTIMATE 0
+#define FFT_MEASURE 1
+#define FFT_PATIENT 2
+#define FFT_EXHAUSTIVE 3
 
 typedef struct {
      int nx, ny, nz;
@@ -97,21 +147,45 @@ typedef struct {
      int max_fft_bands, num_fft_bands;
 
      real current_k[3];  /* (in cartesian basis) */
+     real G[3][3];  /* reciprocal lattice vectors (in cartesian basis) */
      int parity;
 
-     void *plans[MAX_NPLANS], *iplans[MAX_NPLANS];
-     int nplans, plans_howmany[MAX_NPLANS], plans_stride[MAX_NPLANS], plans_dist[MAX_NPLANS];
+     /* FFTW2 plans (FFTW3 plans are created as needed and kept
+	in a global cache shared by all maxwell_data objects) */
+     void *plans[1], *iplans[1];
+     int nplans;
+     int fft_rigor; /* one of the FFT_* planner rigor constants */
 
      scalar *fft_data, *fft_data2;
+     int fft_data_size; /* # scalars per field component in fft_data */
      
      int zero_k;  /* non-zero if k is zero (handled specially) */
-     k_data *k_plus_G;
+     k_data *k_plus_G; /* NULL if computed on the fly */
      real *k_plus_G_normsqr;
 
      symmetric_matrix *eps_inv;
      real eps_inv_mean;
      symmetric_matrix *mu_inv;
      real mu_inv_mean;
+
+     /* compressed eps_inv and mu_inv, or NULL if compression
+	does not pay off (see maxwell_compress_dielectric) */
+     compressed_eps_inv *eps_inv_c, *mu_inv_c;
+
+     /* non-zero for 2d grids where eps_inv has no xz or yz couplings,
+	so that the TE and TM (EVEN_Z_PARITY and ODD_Z_PARITY) operators,
+	which only transform the non-zero field components, can be used */
+     int eps_inv_te_tm;
+
+     /* if eps_inv_te_tm and there is no eps_inv_c, the xy block (TE)
+	or the zz component (TM) of eps_inv for the current parity, for
+	the TE/TM operators; NULL otherwise */
+     symmetric_matrix_xy *eps_inv_xy;
+     real *eps_inv_zz;
+
+     /* non-zero if eps_inv is symmetric under z -> -z, which allows
+	z-parity states to be computed from half of the grid */
+     int eps_inv_zmirror;
 } maxwell_data;
 
 extern maxwell_data *create_maxwell_data(int nx, int ny, int nz,
@@ -123,8 +197,24 @@ extern void destroy_maxwell_data(maxwell_data *d);
 
 extern void maxwell_set_num_bands(maxwell_data *d, int num_bands);
 
+extern void maxwell_set_num_threads(int nthreads);
+extern void maxwell_set_fft_rigor(maxwell_data *d, int rigor);
+extern int maxwell_import_fft_wisdom(const char *fname);
+extern int maxwell_export_fft_wisdom(const char *fname);
+
+extern void maxwell_set_fft_plan_cache_size(int max_plans);
+extern void maxwell_clear_fft_plan_cache(void);
+extern void maxwell_fft_plan_cache_stats(int *nplans,
+					 double *hits, double *misses);
+
 extern void update_maxwell_data_k(maxwell_data *d, real k[3],
 				  real G1[3], real G2[3], real G3[3]);
+extern void maxwell_change_k_basis(maxwell_data *d, evectmatrix H,
+				   const real old_k[3]);
+
+extern void maxwell_set_kpG_on_the_fly(maxwell_data *d, int on_the_fly);
+extern real maxwell_compute_k_data(const maxwell_data *d, int i,
+				   k_data *kpG);
 
 extern void set_maxwell_data_parity(maxwell_data *d, int parity);
 
@@ -153,6 +243,7 @@ extern void set_maxwell_mu(maxwell_data *md,
                            maxwell_dielectric_function mu,
                            maxwell_dielectric_mean_function mmu,
                            void *mu_data);
+extern void maxwell_compress_dielectric(maxwell_data *md);
     
 extern void maxwell_sym_matrix_eigs(real eigs[3], const symmetric_matrix *V);
 extern void maxwell_sym_matrix_invert(symmetric_matrix *Vinv,
@@ -214,6 +305,12 @@ extern void maxwell_preconditioner2(evectmatrix Xin, evectmatrix Xout,
 
 extern void maxwell_ucross_op(evectmatrix Xin, evectmatrix Xout,
 			      maxwell_data *d, const real u[3]);
+extern void maxwell_ucross_vcross_op(evectmatrix Xin, evectmatrix Xout,
+				     maxwell_data *d, const real u[3],
+				     const real v[3]);
+extern void maxwell_k_derivatives(maxwell_data *d, evectmatrix H,
+				  const real *eigenvals,
+				  real *grad, real *hess);
 
 extern void maxwell_parity_constraint(evectmatrix X, void *data);
 extern void maxwell_zparity_constraint(evectmatrix X, void *data);
@@ -250,6 +347,24 @@ extern void maxwell_target_preconditioner2(evectmatrix Xin, evectmatrix Xout,
 					   evectmatrix Y, real *eigenvals,
 					   sqmatrix YtY);
 
+/* A k.p model of the bands near a k point k0: the Maxwell operator at
+   k0 + q, in the basis of p eigenvectors at k0, is exactly
+   A0 + sum_i q_i A1[i] + sum_{i<=j} q_i q_j A2[ij], where ij indexes
+   xx, yy, zz, xy, yz, zx (see maxwell_kdotp.c). */
+typedef struct {
+     int p;
+     real k0[3]; /* cartesian */
+     sqmatrix A0, A1[3], A2[6];
+} maxwell_kdotp_model;
+
+extern maxwell_kdotp_model *create_maxwell_kdotp_model(maxwell_data *d,
+						       evectmatrix H,
+						       const real *eigenvals,
+						       evectmatrix Work);
+extern void destroy_maxwell_kdotp_model(maxwell_kdotp_model *m);
+extern void maxwell_kdotp_eigenvals(const maxwell_kdotp_model *m,
+				    const real k[3], real *eigenvals);
+
 extern void spherical_quadrature_points(real *x, real *y, real *z,
 					real *weight, int num_sq_pts);
 
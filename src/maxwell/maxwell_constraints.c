@@ -86,12 +86,12 @@ void maxwell_zparity_constraint(evectmatrix X, void *data)
 	  if (zparity == +1)
 	       for (i = 0; i < nxy; ++i) 
 		    for (b = 0; b < X.p; ++b) {
-			 ASSIGN_ZERO(X.data[(i * X.c + 1) * X.p + b]);
+			 ASSIGN_ZERO(X.data[(i * X.c + 1) * X.fd + b]);
 		    }
 	  else if (zparity == -1)
 	       for (i = 0; i < nxy; ++i) 
 		    for (b = 0; b < X.p; ++b) {
-			 ASSIGN_ZERO(X.data[(i * X.c) * X.p + b]);
+			 ASSIGN_ZERO(X.data[(i * X.c) * X.fd + b]);
 		    }
 	  return;
      }
@@ -102,20 +102,20 @@ void maxwell_zparity_constraint(evectmatrix X, void *data)
 	       int ij2 = i * nz + (j > 0 ? nz - j : 0);
 	       for (b = 0; b < X.p; ++b) {
 		    scalar u,v, u2,v2;
-		    u = X.data[(ij * 2) * X.p + b];
-		    v = X.data[(ij * 2 + 1) * X.p + b];
-		    u2 = X.data[(ij2 * 2) * X.p + b];
-		    v2 = X.data[(ij2 * 2 + 1) * X.p + b];
-		    ASSIGN_SCALAR(X.data[(ij * 2) * X.p + b],
+		    u = X.data[(ij * 2) * X.fd + b];
+		    v = X.data[(ij * 2 + 1) * X.fd + b];
+		    u2 = X.data[(ij2 * 2) * X.fd + b];
+		    v2 = X.data[(ij2 * 2 + 1) * X.fd + b];
+		    ASSIGN_SCALAR(X.data[(ij * 2) * X.fd + b],
 				  0.5*(SCALAR_RE(u) + zparity*SCALAR_RE(u2)),
 				  0.5*(SCALAR_IM(u) + zparity*SCALAR_IM(u2)));
-		    ASSIGN_SCALAR(X.data[(ij * 2 + 1) * X.p + b],
+		    ASSIGN_SCALAR(X.data[(ij * 2 + 1) * X.fd + b],
 				  0.5*(SCALAR_RE(v) - zparity*SCALAR_RE(v2)),
 				  0.5*(SCALAR_IM(v) - zparity*SCALAR_IM(v2)));
-		    ASSIGN_SCALAR(X.data[(ij2 * 2) * X.p + b],
+		    ASSIGN_SCALAR(X.data[(ij2 * 2) * X.fd + b],
 				  0.5*(SCALAR_RE(u2) + zparity*SCALAR_RE(u)),
 				  0.5*(SCALAR_IM(u2) + zparity*SCALAR_IM(u)));
-		    ASSIGN_SCALAR(X.data[(ij2 * 2 + 1) * X.p + b],
+		    ASSIGN_SCALAR(X.data[(ij2 * 2 + 1) * X.fd + b],
 				  0.5*(SCALAR_RE(v2) - zparity*SCALAR_RE(v)),
 				  0.5*(SCALAR_IM(v2) - zparity*SCALAR_IM(v)));
 	       }
@@ -160,10 +160,10 @@ double *maxwell_zparity(evectmatrix X, maxwell_data *d)
 	       int ij2 = i * nz + (j > 0 ? nz - j : 0);
 	       for (b = 0; b < X.p; ++b) {
 		    scalar u,v, u2,v2;
-		    u = X.data[(ij * 2) * X.p + b];
-		    v = X.data[(ij * 2 + 1) * X.p + b];
-		    u2 = X.data[(ij2 * 2) * X.p + b];
-		    v2 = X.data[(ij2 * 2 + 1) * X.p + b];
+		    u = X.data[(ij * 2) * X.fd + b];
+		    v = X.data[(ij * 2 + 1) * X.fd + b];
+		    u2 = X.data[(ij2 * 2) * X.fd + b];
+		    v2 = X.data[(ij2 * 2 + 1) * X.fd + b];
 		    zp_scratch[b] += (ij == ij2 ? 1.0 : 2.0) *
 			 (SCALAR_RE(u) * SCALAR_RE(u2) +
 			  SCALAR_IM(u) * SCALAR_IM(u2) -
@@ -223,20 +223,20 @@ void maxwell_yparity_constraint(evectmatrix X, void *data)
 		    int ijk2 = ij2 * nz + k;
 		    for (b = 0; b < X.p; ++b) {
 			 scalar u,v, u2,v2;
-			 u = X.data[(ijk * 2) * X.p + b];
-			 v = X.data[(ijk * 2 + 1) * X.p + b];
-			 u2 = X.data[(ijk2 * 2) * X.p + b];
-			 v2 = X.data[(ijk2 * 2 + 1) * X.p + b];
-			 ASSIGN_SCALAR(X.data[(ijk * 2) * X.p + b],
+			 u = X.data[(ijk * 2) * X.fd + b];
+			 v = X.data[(ijk * 2 + 1) * X.fd + b];
+			 u2 = X.data[(ijk2 * 2) * X.fd + b];
+			 v2 = X.data[(ijk2 * 2 + 1) * X.fd + b];
+			 ASSIGN_SCALAR(X.data[(ijk * 2) * X.fd + b],
 				  0.5*(SCALAR_RE(u) - yparity*SCALAR_RE(u2)),
 				  0.5*(SCALAR_IM(u) - yparity*SCALAR_IM(u2)));
-			 ASSIGN_SCALAR(X.data[(ijk * 2 + 1) * X.p + b],
+			 ASSIGN_SCALAR(X.data[(ijk * 2 + 1) * X.fd + b],
 				  0.5*(SCALAR_RE(v) + yparity*SCALAR_RE(v2)),
 				  0.5*(SCALAR_IM(v) + yparity*SCALAR_IM(v2)));
-			 ASSIGN_SCALAR(X.data[(ijk2 * 2) * X.p + b],
+			 ASSIGN_SCALAR(X.data[(ijk2 * 2) * X.fd + b],
 				  0.5*(SCALAR_RE(u2) - yparity*SCALAR_RE(u)),
 				  0.5*(SCALAR_IM(u2) - yparity*SCALAR_IM(u)));
-			 ASSIGN_SCALAR(X.data[(ijk2 * 2 + 1) * X.p + b],
+			 ASSIGN_SCALAR(X.data[(ijk2 * 2 + 1) * X.fd + b],
 				  0.5*(SCALAR_RE(v2) + yparity*SCALAR_RE(v)),
 				  0.5*(SCALAR_IM(v2) + yparity*SCALAR_IM(v)));
 		    }
@@ -280,10 +280,10 @@ double *maxwell_yparity(evectmatrix X, maxwell_data *d)
 		    int ijk2 = ij2 * nz + k;
 		    for (b = 0; b < X.p; ++b) {
 			 scalar u,v, u2,v2;
-			 u = X.data[(ijk * 2) * X.p + b];
-			 v = X.data[(ijk * 2 + 1) * X.p + b];
-			 u2 = X.data[(ijk2 * 2) * X.p + b];
-			 v2 = X.data[(ijk2 * 2 + 1) * X.p + b];
+			 u = X.data[(ijk * 2) * X.fd + b];
+			 v = X.data[(ijk * 2 + 1) * X.fd + b];
+			 u2 = X.data[(ijk2 * 2) * X.fd + b];
+			 v2 = X.data[(ijk2 * 2 + 1) * X.fd + b];
 			 yp_scratch[b] += (ijk == ijk2 ? 1.0 : 2.0) *
 			      (SCALAR_RE(v) * SCALAR_RE(v2) +
 			       SCALAR_IM(v) * SCALAR_IM(v2) -
@@ -355,7 +355,7 @@ void maxwell_zero_k_set_const_bands(evectmatrix X, maxwell_data *d)
      /* Initialize num_const_bands to zero: */
      for (i = 0; i < X.n; ++i) 
 	  for (j = 0; j < num_const_bands; ++j) {
-	       ASSIGN_ZERO(X.data[i * X.p + j]);
+	       ASSIGN_ZERO(X.data[i * X.fd + j]);
 	  }
      
      if (X.Nstart > 0)
@@ -370,11 +370,11 @@ void maxwell_zero_k_set_const_bands(evectmatrix X, maxwell_data *d)
 
      if (m_band) {
 	  ASSIGN_SCALAR(X.data[0], 1.0, 0.0);
-	  ASSIGN_SCALAR(X.data[X.p], 0.0, 0.0);
+	  ASSIGN_SCALAR(X.data[X.fd], 0.0, 0.0);
      }
      if (n_band && (!m_band || X.p >= 2)) {
 	  ASSIGN_SCALAR(X.data[m_band], 0.0, 0.0);
-	  ASSIGN_SCALAR(X.data[X.p + m_band], 1.0, 0.0);
+	  ASSIGN_SCALAR(X.data[X.fd + m_band], 1.0, 0.0);
      }
 }
 
@@ -389,7 +389,7 @@ void maxwell_zero_k_constraint(evectmatrix X, void *data)
 		      
      for (j = 0; j < X.p; ++j) {
 	  ASSIGN_ZERO(X.data[j]);
-	  ASSIGN_ZERO(X.data[X.p + j]);
+	  ASSIGN_ZERO(X.data[X.fd + j]);
      }
      (void)data; /* avoid warning about unused parameter */
 }
@@ -17,6 +17,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
 
 #include "config.h"
@@ -25,7 +26,7 @@
 #include <mpiglue.h>
 #include <mpi_utils.h>
 
-#include "maxwell.h"
+#include "imaxwell.h"
 
 /**************************************************************************/
 
@@ -357,6 +358,265 @@ static void get_mesh(int nx, int ny, int nz, const int mesh_size[3],
 
 /**************************************************************************/
 
+/* Compression of eps_inv (see compressed_eps_inv in maxwell.h).  We
+   first count the occurrences of the distinct tensors (up to
+   MAX_DISTINCT_EPS of them, in an open-addressed hash table), and then
+   make table entries for the MAX_EPS_MATERIALS most common ones.  All
+   other points (mostly the interface points, each of which has its own
+   averaged tensor) go into the interface list. */
+
+#define MAX_DISTINCT_EPS 4096
+
+typedef struct {
+     symmetric_matrix m;
+     int count, material;
+} eps_count;
+
+static unsigned hash_sym_matrix(const symmetric_matrix *m)
+{
+     const unsigned char *p = (const unsigned char *) m;
+     unsigned h = 2166136261U;
+     size_t i;
+     for (i = 0; i < sizeof(symmetric_matrix); ++i)
+	  h = (h ^ p[i]) * 16777619U;
+     return h;
+}
+
+/* return the index of m in the hash table t of size nt (a power of 2),
+   or of the empty slot where it would go */
+static int find_eps_count(const eps_count *t, int nt,
+			  const symmetric_matrix *m)
+{
+     int j = hash_sym_matrix(m) & (nt - 1);
+     while (t[j].count && memcmp(&t[j].m, m, sizeof(symmetric_matrix)))
+	  j = (j + 1) & (nt - 1);
+     return j;
+}
+
+static int cmp_eps_count(const void *a, const void *b)
+{
+     const eps_count *ea = *((eps_count * const *) a);
+     const eps_count *eb = *((eps_count * const *) b);
+     return (eb->count - ea->count); /* most common first */
+}
+
+static int eps_kind(const symmetric_matrix *m)
+{
+     if (!DIAG_SYMMETRIC_MATRIX(*m))
+	  return EPS_GENERAL;
+     else if (m->m00 != m->m11 || m->m00 != m->m22)
+	  return EPS_DIAGONAL;
+     return EPS_ISOTROPIC;
+}
+
+void maxwell_destroy_compressed_eps_inv(compressed_eps_inv *c)
+{
+     if (c) {
+	  free(c->materials);
+	  free(c->diag);
+	  free(c->index);
+	  free(c->interface_index);
+	  free(c->interface_eps_inv);
+	  free(c);
+     }
+}
+
+/* Return the compressed form of the n tensors eps_inv, or NULL if
+   this would not at least halve the storage. */
+static compressed_eps_inv *compress_eps_inv(const symmetric_matrix *eps_inv,
+					    int n)
+{
+     const int nt = 2 * MAX_DISTINCT_EPS;
+     eps_count *t, **sorted;
+     compressed_eps_inv *c;
+     int i, j, ndistinct = 0, nmaterials, ninterface = n, kind;
+
+     CHK_MALLOC(t, eps_count, nt);
+     for (j = 0; j < nt; ++j)
+	  t[j].count = 0;
+     for (i = 0; i < n; ++i) {
+	  j = find_eps_count(t, nt, eps_inv + i);
+	  if (t[j].count)
+	       ++t[j].count;
+	  else if (ndistinct < MAX_DISTINCT_EPS) {
+	       t[j].m = eps_inv[i];
+	       t[j].count = 1;
+	       t[j].material = EPS_INTERFACE;
+	       ++ndistinct;
+	  }
+     }
+
+     CHK_MALLOC(sorted, eps_count *, ndistinct);
+     for (i = j = 0; j < nt; ++j)
+	  if (t[j].count)
+	       sorted[i++] = t + j;
+     qsort(sorted, ndistinct, sizeof(eps_count *), cmp_eps_count);
+
+     /* The kind of the table is that of the most common tensor;
+	less-special tensors (e.g. the anisotropic averages at interfaces
+	between isotropic materials) go into the interface list, so as
+	not to lose the fast paths for the bulk of the points. */
+     kind = ndistinct ? eps_kind(&sorted[0]->m) : EPS_ISOTROPIC;
+     for (i = nmaterials = 0; i < ndistinct && nmaterials < MAX_EPS_MATERIALS;
+	  ++i)
+	  if (eps_kind(&sorted[i]->m) <= kind) {
+	       sorted[nmaterials++] = sorted[i];
+	       ninterface -= sorted[i]->count;
+	  }
+
+     if (2 * (sizeof(unsigned char) * n +
+	      (sizeof(int) + sizeof(symmetric_matrix)) * ninterface)
+	 > sizeof(symmetric_matrix) * n) {
+	  free(sorted);
+	  free(t);
+	  return NULL;
+     }
+
+     CHK_MALLOC(c, compressed_eps_inv, 1);
+     c->nmaterials = nmaterials;
+     c->kind = kind;
+     CHK_MALLOC(c->materials, symmetric_matrix, nmaterials);
+     CHK_MALLOC(c->diag, real, 3 * nmaterials);
+     for (i = 0; i < nmaterials; ++i) {
+	  symmetric_matrix m = sorted[i]->m;
+	  sorted[i]->material = i;
+	  c->materials[i] = m;
+	  c->diag[3*i] = m.m00;
+	  c->diag[3*i+1] = m.m11;
+	  c->diag[3*i+2] = m.m22;
+     }
+     free(sorted);
+
+     c->ninterface = ninterface;
+     CHK_MALLOC(c->index, unsigned char, n);
+     CHK_MALLOC(c->interface_index, int, ninterface);
+     CHK_MALLOC(c->interface_eps_inv, symmetric_matrix, ninterface);
+     for (i = j = 0; i < n; ++i) {
+	  eps_count *e = t + find_eps_count(t, nt, eps_inv + i);
+	  if (e->count && e->material != EPS_INTERFACE)
+	       c->index[i] = e->material;
+	  else {
+	       c->index[i] = EPS_INTERFACE;
+	       c->interface_index[j] = i;
+	       c->interface_eps_inv[j++] = eps_inv[i];
+	  }
+     }
+     CHECK(j == ninterface, "bug in compress_eps_inv");
+
+     free(t);
+     return c;
+}
+
+/* In 2d, check whether eps_inv has no xz or yz couplings (so that TE
+   and TM fields decouple and the TE/TM operators can be used), setting
+   md->eps_inv_te_tm, and (re)build md->eps_inv_xy or md->eps_inv_zz
+   if they are needed. */
+static void check_eps_inv_te_tm(maxwell_data *md)
+{
+     int i, decoupled = md->nz == 1;
+
+     free(md->eps_inv_xy); md->eps_inv_xy = NULL;
+     free(md->eps_inv_zz); md->eps_inv_zz = NULL;
+
+     for (i = 0; decoupled && i < md->fft_output_size; ++i) {
+	  const symmetric_matrix *m = md->eps_inv + i;
+#if defined(WITH_HERMITIAN_EPSILON)
+	  decoupled = m->m02.re == 0.0 && m->m02.im == 0.0
+	       && m->m12.re == 0.0 && m->m12.im == 0.0;
+#else
+	  decoupled = m->m02 == 0.0 && m->m12 == 0.0;
+#endif
+     }
+     mpi_allreduce_1(&decoupled, int, MPI_INT, MPI_MIN, mpb_comm);
+     md->eps_inv_te_tm = decoupled;
+     maxwell_update_te_tm_eps_inv(md);
+}
+
+/* Allocate md->eps_inv_xy (for TE) or md->eps_inv_zz (for TM) if the
+   TE/TM operators will be used for the current parity, and deallocate
+   them otherwise.  With a compressed eps_inv_c, the TE/TM operators
+   read its tables directly (see maxwell_te_tm_eps_inv), so neither is
+   needed.  (Called whenever the parity or eps_inv changes.) */
+void maxwell_update_te_tm_eps_inv(maxwell_data *md)
+{
+     int i, te = 0, tm = 0;
+
+     if (md->eps_inv_te_tm && !md->eps_inv_c && !md->mu_inv) {
+	  te = (md->parity & EVEN_Z_PARITY) != 0;
+	  tm = (md->parity & ODD_Z_PARITY) != 0;
+     }
+     if (!te) {
+	  free(md->eps_inv_xy);
+	  md->eps_inv_xy = NULL;
+     }
+     if (!tm) {
+	  free(md->eps_inv_zz);
+	  md->eps_inv_zz = NULL;
+     }
+     if (te && !md->eps_inv_xy) {
+	  CHK_MALLOC(md->eps_inv_xy, symmetric_matrix_xy, md->fft_output_size);
+	  for (i = 0; i < md->fft_output_size; ++i) {
+	       md->eps_inv_xy[i].m00 = md->eps_inv[i].m00;
+	       md->eps_inv_xy[i].m01 = md->eps_inv[i].m01;
+	       md->eps_inv_xy[i].m11 = md->eps_inv[i].m11;
+	  }
+     }
+     if (tm && !md->eps_inv_zz) {
+	  CHK_MALLOC(md->eps_inv_zz, real, md->fft_output_size);
+	  for (i = 0; i < md->fft_output_size; ++i)
+	       md->eps_inv_zz[i] = md->eps_inv[i].m22;
+     }
+}
+
+/* Return whether eps_inv is symmetric (up to roundoff) under the mirror
+   flip z -> -z of the grid, which also flips the sign of its xz and yz
+   entries.  (This is only needed for the z-mirror transforms in
+   maxwell_op.c, which are only implemented for serial complex
+   transforms.) */
+static int eps_inv_zmirror_symmetric(const maxwell_data *md)
+{
+#if defined(SCALAR_COMPLEX) && !defined(HAVE_MPI)
+     int i, z, nz = md->nz;
+
+     if (nz == 1)
+	  return 0;
+     for (i = 0; i < md->other_dims; ++i)
+	  for (z = 0; 2*z <= nz; ++z) {
+	       symmetric_matrix m = md->eps_inv[i * nz + (nz - z) % nz];
+#  if defined(WITH_HERMITIAN_EPSILON)
+	       m.m02.re = -m.m02.re; m.m02.im = -m.m02.im;
+	       m.m12.re = -m.m12.re; m.m12.im = -m.m12.im;
+#  else
+	       m.m02 = -m.m02;
+	       m.m12 = -m.m12;
+#  endif
+	       if (!sym_matrix_eq(md->eps_inv[i * nz + z], m, 1e-8))
+		    return 0;
+	  }
+     return 1;
+#else
+     (void) md;
+     return 0;
+#endif
+}
+
+/* (Re)compute the compressed forms of md->eps_inv and md->mu_inv, which
+   are what the Maxwell operator actually uses.  This is done
+   automatically by set_maxwell_dielectric and set_maxwell_mu, but must
+   be called again if eps_inv or mu_inv is modified directly. */
+void maxwell_compress_dielectric(maxwell_data *md)
+{
+     maxwell_destroy_compressed_eps_inv(md->eps_inv_c);
+     md->eps_inv_c = compress_eps_inv(md->eps_inv, md->fft_output_size);
+     check_eps_inv_te_tm(md);
+     md->eps_inv_zmirror = eps_inv_zmirror_symmetric(md);
+     maxwell_destroy_compressed_eps_inv(md->mu_inv_c);
+     md->mu_inv_c = md->mu_inv
+	  ? compress_eps_inv(md->mu_inv, md->fft_output_size) : NULL;
+}
+
+/**************************************************************************/
+
 /* The following function initializes the dielectric tensor md->eps_inv,
    using the dielectric function epsilon(&eps, &eps_inv, r, epsilon_data).
 
@@ -813,6 +1073,11 @@ void set_maxwell_dielectric(maxwell_data *md,
      n1 = md->fft_output_size;
      mpi_allreduce_1(&n1, int, MPI_INT, MPI_SUM, mpb_comm);
      md->eps_inv_mean = eps_inv_total / (3 * n1);
+
+     maxwell_destroy_compressed_eps_inv(md->eps_inv_c);
+     md->eps_inv_c = compress_eps_inv(md->eps_inv, md->fft_output_size);
+     check_eps_inv_te_tm(md);
+     md->eps_inv_zmirror = eps_inv_zmirror_symmetric(md);
 }
 
 void set_maxwell_mu(maxwell_data *md,
@@ -822,14 +1087,29 @@ void set_maxwell_mu(maxwell_data *md,
                     maxwell_dielectric_mean_function mmu,
                     void *mu_data) {
     symmetric_matrix *eps_inv = md->eps_inv;
+    compressed_eps_inv *eps_inv_c = md->eps_inv_c;
+    int eps_inv_te_tm = md->eps_inv_te_tm;
+    symmetric_matrix_xy *eps_inv_xy = md->eps_inv_xy;
+    real *eps_inv_zz = md->eps_inv_zz;
+    int eps_inv_zmirror = md->eps_inv_zmirror;
     real eps_inv_mean = md->eps_inv_mean;
     if (md->mu_inv == NULL) {
         CHK_MALLOC(md->mu_inv, symmetric_matrix, md->fft_output_size);        
     }
     /* just re-use code to set epsilon, but initialize mu_inv instead */
     md->eps_inv = md->mu_inv;
+    md->eps_inv_c = md->mu_inv_c;
+    md->eps_inv_xy = NULL;
+    md->eps_inv_zz = NULL;
     set_maxwell_dielectric(md, mesh_size, R, G, mu, mmu, mu_data);
     md->eps_inv = eps_inv;
+    md->mu_inv_c = md->eps_inv_c;
+    md->eps_inv_c = eps_inv_c;
+    md->eps_inv_te_tm = eps_inv_te_tm;
+    md->eps_inv_xy = eps_inv_xy;
+    md->eps_inv_zz = eps_inv_zz;
+    maxwell_update_te_tm_eps_inv(md); /* (not used with mu) */
+    md->eps_inv_zmirror = eps_inv_zmirror;
     md->mu_inv_mean = md->eps_inv_mean;
     md->eps_inv_mean = eps_inv_mean;
 }
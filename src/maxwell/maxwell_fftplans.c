@@ -0,0 +1,249 @@
+/* Copyright (C) 1999-2014 Massachusetts Institute of Technology.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* A cache of FFTW3 plans, shared between all maxwell_data objects.
+
+   Plans are indexed by everything that determines them: the kind of
+   transform (FFT_PLAN_* in imaxwell.h), the grid size, the (howmany,
+   stride, dist) of the transform, whether it is in-place, the planner
+   rigor, the number of threads, and (with MPI) the communicator.
+   Since we always execute plans with the new-array execute functions
+   on FFTW-allocated arrays, a plan can be re-used for any maxwell_data
+   with the same grid, so re-creating the maxwell_data (e.g. in a new
+   init-params) or changing the number of bands back and forth never
+   re-plans a transform that we have already seen.
+
+   The cache is a hash table (with chaining), which is grown as needed.
+   Optionally, the number of cached plan pairs can be limited, in which
+   case the least-recently used plans are destroyed first. */
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "imaxwell.h"
+#include "check.h"
+
+#ifdef USE_OPENMP
+#  include <omp.h>
+#  define CUR_NTHREADS omp_get_max_threads()
+#else
+#  define CUR_NTHREADS 1
+#endif
+
+#if defined(HAVE_FFTW3)
+
+typedef struct fft_plan_entry_s {
+     int kind, nx, ny, nz, howmany, stride, dist, inplace, rigor, nthreads;
+#  ifdef HAVE_MPI
+     MPI_Comm comm;
+#  endif
+     fftplan plan, iplan;
+     unsigned long last_use;
+     struct fft_plan_entry_s *next; /* next entry in the same bucket */
+} fft_plan_entry;
+
+static fft_plan_entry **buckets = NULL;
+static int nbuckets = 0, nentries = 0, max_entries = 0; /* 0 = no limit */
+static unsigned long use_count = 0;
+static double nhits = 0, nmisses = 0;
+
+static unsigned hash_key(int kind, int nx, int ny, int nz,
+			 int howmany, int stride, int dist,
+			 int inplace, int rigor, int nthreads)
+{
+     unsigned h = 2166136261U;
+#  define HASH_INT(i) h = (h ^ (unsigned) (i)) * 16777619U
+     HASH_INT(kind); HASH_INT(nx); HASH_INT(ny); HASH_INT(nz);
+     HASH_INT(howmany); HASH_INT(stride); HASH_INT(dist);
+     HASH_INT(inplace); HASH_INT(rigor); HASH_INT(nthreads);
+#  undef HASH_INT
+     return h;
+}
+
+static unsigned entry_hash(const fft_plan_entry *e)
+{
+     return hash_key(e->kind, e->nx, e->ny, e->nz,
+		     e->howmany, e->stride, e->dist,
+		     e->inplace, e->rigor, e->nthreads);
+}
+
+static void destroy_entry(fft_plan_entry *e)
+{
+     FFTW(destroy_plan)(e->plan);
+     FFTW(destroy_plan)(e->iplan);
+     free(e);
+}
+
+static void grow_buckets(void)
+{
+     int i, new_nbuckets = nbuckets ? nbuckets * 2 : 64;
+     fft_plan_entry **new_buckets;
+
+     CHK_MALLOC(new_buckets, fft_plan_entry *, new_nbuckets);
+     for (i = 0; i < new_nbuckets; ++i)
+	  new_buckets[i] = NULL;
+     for (i = 0; i < nbuckets; ++i) {
+	  fft_plan_entry *e = buckets[i], *next;
+	  for (; e; e = next) {
+	       int b = entry_hash(e) % new_nbuckets;
+	       next = e->next;
+	       e->next = new_buckets[b];
+	       new_buckets[b] = e;
+	  }
+     }
+     free(buckets);
+     buckets = new_buckets;
+     nbuckets = new_nbuckets;
+}
+
+/* destroy the least-recently used plans */
+static void evict_lru(void)
+{
+     fft_plan_entry **lru = NULL;
+     int i;
+     for (i = 0; i < nbuckets; ++i) {
+	  fft_plan_entry **pe;
+	  for (pe = buckets + i; *pe; pe = &(*pe)->next)
+	       if (!lru || (*pe)->last_use < (*lru)->last_use)
+		    lru = pe;
+     }
+     if (lru) {
+	  fft_plan_entry *e = *lru;
+	  *lru = e->next;
+	  destroy_entry(e);
+	  --nentries;
+     }
+}
+
+/* Look for cached plans for the given transform of d's grid, returning
+   1 (and setting *plan and *iplan) if they were found, 0 otherwise. */
+int maxwell_fft_plans_lookup(const maxwell_data *d, int kind,
+			     int howmany, int stride, int dist, int inplace,
+			     fftplan *plan, fftplan *iplan)
+{
+     fft_plan_entry *e;
+     int nthreads = CUR_NTHREADS;
+
+     if (nbuckets) {
+	  e = buckets[hash_key(kind, d->nx, d->ny, d->nz, howmany, stride,
+			       dist, inplace, d->fft_rigor, nthreads)
+		      % nbuckets];
+	  for (; e; e = e->next)
+	       if (e->kind == kind && e->nx == d->nx && e->ny == d->ny &&
+		   e->nz == d->nz && e->howmany == howmany &&
+		   e->stride == stride &&
+		   e->dist == dist && e->inplace == inplace &&
+		   e->rigor == d->fft_rigor && e->nthreads == nthreads
+#  ifdef HAVE_MPI
+		   && e->comm == mpb_comm
+#  endif
+		    ) {
+		    e->last_use = ++use_count;
+		    *plan = e->plan;
+		    *iplan = e->iplan;
+		    nhits += 1;
+		    return 1;
+	       }
+     }
+     nmisses += 1;
+     return 0;
+}
+
+/* Add newly created plans to the cache, which then owns them. */
+void maxwell_fft_plans_insert(const maxwell_data *d, int kind,
+			      int howmany, int stride, int dist, int inplace,
+			      fftplan plan, fftplan iplan)
+{
+     fft_plan_entry *e;
+     int b;
+
+     if (max_entries > 0)
+	  while (nentries >= max_entries)
+	       evict_lru();
+     if (nentries >= nbuckets)
+	  grow_buckets();
+
+     CHK_MALLOC(e, fft_plan_entry, 1);
+     e->kind = kind;
+     e->nx = d->nx; e->ny = d->ny; e->nz = d->nz;
+     e->howmany = howmany; e->stride = stride; e->dist = dist;
+     e->inplace = inplace;
+     e->rigor = d->fft_rigor;
+     e->nthreads = CUR_NTHREADS;
+#  ifdef HAVE_MPI
+     e->comm = mpb_comm;
+#  endif
+     e->plan = plan;
+     e->iplan = iplan;
+     e->last_use = ++use_count;
+
+     b = entry_hash(e) % nbuckets;
+     e->next = buckets[b];
+     buckets[b] = e;
+     ++nentries;
+}
+
+#endif /* HAVE_FFTW3 */
+
+/* Limit the number of cached FFT plan pairs (the least-recently used
+   plans are destroyed first).  max_plans <= 0 means no limit.  At
+   least two pairs are always kept, since the z-mirror transforms in
+   maxwell_op.c use two pairs at once. */
+void maxwell_set_fft_plan_cache_size(int max_plans)
+{
+#if defined(HAVE_FFTW3)
+     max_entries = max_plans > 0 ? (max_plans < 2 ? 2 : max_plans) : 0;
+     if (max_entries > 0)
+	  while (nentries > max_entries)
+	       evict_lru();
+#endif
+}
+
+/* Destroy all cached FFT plans.  This must be called before FFTW is
+   cleaned up, and whenever mpb_comm changes (since an old communicator
+   handle might be re-used for a new communicator). */
+void maxwell_clear_fft_plan_cache(void)
+{
+#if defined(HAVE_FFTW3)
+     int i;
+     for (i = 0; i < nbuckets; ++i) {
+	  fft_plan_entry *e = buckets[i], *next;
+	  for (; e; e = next) {
+	       next = e->next;
+	       destroy_entry(e);
+	  }
+     }
+     free(buckets);
+     buckets = NULL;
+     nbuckets = nentries = 0;
+#endif
+}
+
+/* Return the number of cached plan pairs, along with the number of
+   cache hits and misses so far (all zero for FFTW2, which has no
+   plan cache). */
+void maxwell_fft_plan_cache_stats(int *nplans, double *hits, double *misses)
+{
+#if defined(HAVE_FFTW3)
+     *nplans = nentries;
+     *hits = nhits;
+     *misses = nmisses;
+#else
+     *nplans = 0;
+     *hits = *misses = 0;
+#endif
+}
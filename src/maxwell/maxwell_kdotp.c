@@ -0,0 +1,169 @@
+/* Copyright (C) 1999-2014 Massachusetts Institute of Technology.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+
+#include "config.h"
+#include <check.h>
+
+#include "maxwell.h"
+
+#define MIN2(a,b) ((a) < (b) ? (a) : (b))
+
+/**************************************************************************/
+
+/* k.p models of the bands.  If we write the fields as Bloch waves
+   H(x) exp(ik.x) with a fixed periodic (cartesian) H(x), the Maxwell
+   operator at k0 + q is adjoint(C) 1/epsilon C, with C = C0 + i q x
+   (where C0 is the curl at k0), which is a quadratic polynomial in q:
+
+        A(k0 + q) = A(k0) + sum_i q_i dA/dk_i
+                    + sum_ij q_i q_j adjoint(i e_i x) 1/epsilon (i e_j x)
+
+   Projecting this onto the span of the eigenvectors H at k0 gives a
+   small p x p matrix (whose coefficients we compute once, with
+   maxwell_ucross_op and maxwell_ucross_vcross_op), and its eigenvalues
+   at any q are the Rayleigh-Ritz approximations of the eigenvalues at
+   k0 + q in that subspace.  This is exact at k0, and accurate nearby
+   for the lower bands (more so, the more bands are in the basis),
+   while the highest bands of the basis are the least accurate since
+   they have no higher bands to repel them. */
+
+/* the (i,j) directions of A2[0..5]: */
+static const int kdotp_ij[6][2] = {{0,0}, {1,1}, {2,2}, {0,1}, {1,2}, {2,0}};
+
+/* Create the k.p model of the bands at the current k point of d, from
+   the (normalized) eigenvectors H and their eigenvalues.  Work is
+   a scratch matrix of the same size as H, with any number of columns
+   (H is processed in blocks of Work.p columns). */
+maxwell_kdotp_model *create_maxwell_kdotp_model(maxwell_data *d,
+						evectmatrix H,
+						const real *eigenvals,
+						evectmatrix Work)
+{
+     maxwell_kdotp_model *m;
+     sqmatrix S;
+     scalar *scratch;
+     int p = H.p, i, j, ib;
+
+     CHECK(d, "null maxwell data pointer!");
+     CHECK(H.c == 2, "fields don't have 2 components!");
+     CHECK(Work.n == H.n && Work.p > 0, "invalid work array for k.p model");
+     CHECK(!d->mu_inv, "k.p models are not implemented with mu");
+
+     CHK_MALLOC(m, maxwell_kdotp_model, 1);
+     m->p = p;
+     for (i = 0; i < 3; ++i)
+	  m->k0[i] = d->current_k[i];
+     m->A0 = create_sqmatrix(p);
+     for (i = 0; i < 3; ++i)
+	  m->A1[i] = create_sqmatrix(p);
+     for (j = 0; j < 6; ++j)
+	  m->A2[j] = create_sqmatrix(p);
+
+     /* A0 = adjoint(H) A(k0) H, which is diagonal: */
+     for (i = 0; i < p * p; ++i)
+	  ASSIGN_ZERO(m->A0.data[i]);
+     for (i = 0; i < p; ++i)
+	  ASSIGN_REAL(m->A0.data[i * p + i], eigenvals[i]);
+
+     /* first, the matrices adjoint(H) op H of the operators, computed a
+	block of columns at a time: */
+     CHK_MALLOC(scratch, scalar, p * Work.p);
+     for (ib = 0; ib < p; ib += Work.p) {
+	  int nb = MIN2(Work.p, p - ib);
+	  evectmatrix Hb = evectmatrix_view(H, ib, nb);
+	  evectmatrix Wb = evectmatrix_view(Work, 0, nb);
+
+	  for (i = 0; i < 3; ++i) {
+	       real u[3] = {0, 0, 0};
+	       u[i] = 1;
+	       maxwell_ucross_op(Hb, Wb, d, u);
+	       evectmatrix_XtY_block(m->A1[i].data + ib, p, H, Wb, scratch);
+	  }
+	  for (j = 0; j < 6; ++j) {
+	       real u[3] = {0, 0, 0}, v[3] = {0, 0, 0};
+	       u[kdotp_ij[j][0]] = 1;
+	       v[kdotp_ij[j][1]] = 1;
+	       maxwell_ucross_vcross_op(Hb, Wb, d, u, v);
+	       evectmatrix_XtY_block(m->A2[j].data + ib, p, H, Wb, scratch);
+	  }
+     }
+     free(scratch);
+
+     /* ...then, add the adjoint terms: dA/dk_i = op + adjoint(op) for
+	maxwell_ucross_op, and similarly for the off-diagonal (i != j)
+	second-order terms, which appear twice in the sum; the diagonal
+	ones are Hermitian already (up to rounding errors). */
+     S = create_sqmatrix(p);
+     for (i = 0; i < 3; ++i) {
+	  sqmatrix_copy(S, m->A1[i]);
+	  sqmatrix_symmetrize(m->A1[i], S);
+	  sqmatrix_aApbB(2.0, m->A1[i], 0.0, m->A1[i]);
+     }
+     for (j = 0; j < 6; ++j) {
+	  sqmatrix_copy(S, m->A2[j]);
+	  sqmatrix_symmetrize(m->A2[j], S);
+	  if (kdotp_ij[j][0] != kdotp_ij[j][1])
+	       sqmatrix_aApbB(2.0, m->A2[j], 0.0, m->A2[j]);
+     }
+     destroy_sqmatrix(S);
+
+     return m;
+}
+
+void destroy_maxwell_kdotp_model(maxwell_kdotp_model *m)
+{
+     int i;
+
+     if (m) {
+	  destroy_sqmatrix(m->A0);
+	  for (i = 0; i < 3; ++i)
+	       destroy_sqmatrix(m->A1[i]);
+	  for (i = 0; i < 6; ++i)
+	       destroy_sqmatrix(m->A2[i]);
+	  free(m);
+     }
+}
+
+/* Compute the p eigenvalues (in ascending order) of the k.p model m
+   at the (cartesian) k point k. */
+void maxwell_kdotp_eigenvals(const maxwell_kdotp_model *m,
+			     const real k[3], real *eigenvals)
+{
+     sqmatrix M, W;
+     real q[3];
+     int i, j;
+
+     for (i = 0; i < 3; ++i)
+	  q[i] = k[i] - m->k0[i];
+
+     M = create_sqmatrix(m->p);
+     W = create_sqmatrix(m->p);
+
+     sqmatrix_copy(M, m->A0);
+     for (i = 0; i < 3; ++i)
+	  sqmatrix_ApaB(M, q[i], m->A1[i]);
+     for (j = 0; j < 6; ++j)
+	  sqmatrix_ApaB(M, q[kdotp_ij[j][0]] * q[kdotp_ij[j][1]], m->A2[j]);
+     sqmatrix_eigensolve(M, eigenvals, W);
+
+     destroy_sqmatrix(W);
+     destroy_sqmatrix(M);
+}
@@ -17,10 +17,13 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
 
 #include "imaxwell.h"
 #include <check.h>
+#include <mpiglue.h>
+#include <prof.h>
 
 /**************************************************************************/
 
@@ -165,9 +168,22 @@ static void assign_ucross_t2c(scalar *a, const real u[3], const k_data k,
 
 /**************************************************************************/
 
-void maxwell_compute_fft(int dir, maxwell_data *d, 
-			 scalar *array_in, scalar *array_out, 
-			 int howmany, int stride, int dist)
+#if defined(HAVE_FFTW3)
+/* FFTW3 planner flags corresponding to the FFT_* rigor constants */
+static unsigned fft_rigor_flags(int rigor)
+{
+     switch (rigor) {
+	 case FFT_MEASURE: return FFTW_MEASURE;
+	 case FFT_PATIENT: return FFTW_PATIENT;
+	 case FFT_EXHAUSTIVE: return FFTW_EXHAUSTIVE;
+	 default: return FFTW_ESTIMATE;
+     }
+}
+#endif
+
+static void compute_fft(int dir, maxwell_data *d,
+			scalar *array_in, scalar *array_out,
+			int howmany, int stride, int dist)
 {
 #if defined(HAVE_FFTW3)
      FFTW(plan) plan, iplan;
@@ -175,17 +191,25 @@ void maxwell_compute_fft(int dir, maxwell_data *d,
      real *rarray_in = (real *) array_in;
      FFTW(complex) *carray_out = (FFTW(complex) *) array_out;
      real *rarray_out = (real *) array_out;
-     int ip;
-     for (ip = 0; ip < d->nplans && (howmany != d->plans_howmany[ip] ||
-				     stride != d->plans_stride[ip] ||
-				     dist != d->plans_dist[ip]); ++ip);
-     if (ip < d->nplans) {
-	  plan = (FFTW(plan)) d->plans[ip];
-	  iplan = (FFTW(plan)) d->iplans[ip];
-     }
-     else { /* create new plans */
+     int inplace = array_in == array_out;
+     if (!maxwell_fft_plans_lookup(d, FFT_PLAN_DFT,
+				   howmany, stride, dist, inplace,
+				   &plan, &iplan)) { /* create new plans */
+	  unsigned flags = fft_rigor_flags(d->fft_rigor);
+	  scalar *array_save = NULL;
+	  size_t save_size = 0;
 	  ptrdiff_t np[3];
 	  int n[3]; np[0]=n[0]=d->nx; np[1]=n[1]=d->ny; np[2]=n[2]=d->nz;
+
+	  /* Anything other than FFTW_ESTIMATE overwrites the arrays while
+	     planning, but here we are planning on data we are about to
+	     transform, so we save and restore the input.  (All callers
+	     use stride == howmany, dist == 1.) */
+	  if (flags != FFTW_ESTIMATE) {
+	       save_size = sizeof(scalar) * d->fft_data_size * howmany;
+	       CHK_MALLOC(array_save, scalar, d->fft_data_size * howmany);
+	       memcpy(array_save, array_in, save_size);
+	  }
 #  ifdef SCALAR_COMPLEX
 #    ifdef HAVE_MPI
 	  CHECK(stride==howmany && dist==1, "bug: unsupported stride/dist");
@@ -194,22 +218,22 @@ void maxwell_compute_fft(int dir, maxwell_data *d,
 					 FFTW_MPI_DEFAULT_BLOCK,
 					 carray_in, carray_out,
 					 mpb_comm, FFTW_BACKWARD,
-					 FFTW_ESTIMATE
+					 flags
 					 | FFTW_MPI_TRANSPOSED_IN);
 	  iplan = FFTW(mpi_plan_many_dft)(3, np, howmany, 
 					  FFTW_MPI_DEFAULT_BLOCK,
 					  FFTW_MPI_DEFAULT_BLOCK,
 					  carray_in, carray_out,
 					  mpb_comm, FFTW_FORWARD,
-					  FFTW_ESTIMATE
+					  flags
 					  | FFTW_MPI_TRANSPOSED_OUT);
 #    else /* !HAVE_MPI */
 	  plan = FFTW(plan_many_dft)(3, n, howmany, carray_in, 0, stride, dist,
 				     carray_out, 0, stride, dist,
-				     FFTW_BACKWARD, FFTW_ESTIMATE);
+				     FFTW_BACKWARD, flags);
 	  iplan = FFTW(plan_many_dft)(3, n, howmany, carray_in,0,stride, dist,
 				      carray_out, 0, stride, dist,
-				      FFTW_FORWARD, FFTW_ESTIMATE);
+				      FFTW_FORWARD, flags);
 #    endif /* !HAVE_MPI */
 #  else /* !SCALAR_COMPLEX */
 	  {
@@ -222,32 +246,40 @@ void maxwell_compute_fft(int dir, maxwell_data *d,
 					     FFTW_MPI_DEFAULT_BLOCK,
 					     FFTW_MPI_DEFAULT_BLOCK,
 					     carray_in, rarray_out,
-					     mpb_comm, FFTW_ESTIMATE
+					     mpb_comm, flags
 					     | FFTW_MPI_TRANSPOSED_IN);
 	  iplan = FFTW(mpi_plan_many_dft_r2c)(rnk, np, howmany, 
 					      FFTW_MPI_DEFAULT_BLOCK,
 					      FFTW_MPI_DEFAULT_BLOCK,
 					      rarray_in, carray_out,
-					      mpb_comm, FFTW_ESTIMATE
+					      mpb_comm, flags
 					      | FFTW_MPI_TRANSPOSED_OUT);
 #    else /* !HAVE_MPI */
 	       plan = FFTW(plan_many_dft_c2r)(rnk, n, howmany,
 					      carray_in, 0, stride, dist,
 					      rarray_out, nr, stride, dist,
-					      FFTW_ESTIMATE);
+					      flags);
 	       iplan = FFTW(plan_many_dft_r2c)(rnk, n, howmany,
 					       rarray_in, nr, stride, dist,
 					       carray_out, 0, stride, dist,
-					       FFTW_ESTIMATE);
+					       flags);
 #    endif /* !HAVE_MPI */
 	  }
 #  endif /* !SCALAR_COMPLEX */
 	  CHECK(plan && iplan, "Failure creating FFTW3 plans");
+	  if (array_save) {
+	       memcpy(array_in, array_save, save_size);
+	       free(array_save);
+	  }
+	  maxwell_fft_plans_insert(d, FFT_PLAN_DFT,
+				   howmany, stride, dist, inplace,
+				   plan, iplan);
      }
 
      /* note that the new-array execute functions should be safe
-	since we only apply maxwell_compute_fft to fftw_malloc'ed data 
-	(so we don't ever have misaligned arrays), and we check above
+	since we only apply maxwell_compute_fft to bigmem_malloc'ed data
+	(aligned at least as well as by fftw_malloc, so we don't ever
+	have misaligned arrays), and we check above
 	that the strides etc. match */
 #  ifdef SCALAR_COMPLEX
 #    ifdef HAVE_MPI
@@ -268,19 +300,6 @@ void maxwell_compute_fft(int dir, maxwell_data *d,
 	  FFTW(execute_dft_c2r)(plan, carray_in, rarray_out);
 #    endif /* !HAVE_MPI */
 #  endif
-
-     if (ip == MAX_NPLANS) { /* don't store too many plans */
-	  FFTW(destroy_plan)(plan);
-	  FFTW(destroy_plan)(iplan);
-     }
-     else if (ip == d->nplans) { /* save for later re-use */
-	  d->plans[ip] = plan;
-	  d->iplans[ip] = iplan;
-	  d->plans_howmany[ip] = howmany;
-	  d->plans_stride[ip] = stride;
-	  d->plans_dist[ip] = dist;
-	  d->nplans++;
-     }
 #elif defined(HAVE_FFTW)
 
      CHECK(array_in == array_out, "only in-place supported with FFTW2");
@@ -339,6 +358,15 @@ void maxwell_compute_fft(int dir, maxwell_data *d,
 #endif /* not HAVE_FFTW */
 }
 
+void maxwell_compute_fft(int dir, maxwell_data *d, 
+			 scalar *array_in, scalar *array_out, 
+			 int howmany, int stride, int dist)
+{
+     PROF_OP(PROF_FFT,
+	     howmany * (double) d->fft_output_size * sizeof(scalar_complex),
+	     compute_fft(dir, d, array_in, array_out, howmany, stride, dist));
+}
+
 /**************************************************************************/
 
 /* assigns newv = matrix * oldv.  matrix is symmetric and so is stored
@@ -385,6 +413,545 @@ void assign_symmatrix_vector(scalar_complex *newv,
 #endif
 }
 
+/* Specialized operators for TE and TM states in 2d.
+
+   For a 2d grid (nz == 1), k in the xy plane, and an eps_inv that does
+   not couple z to x or y, the m basis vector is exactly along z and n
+   is exactly in the xy plane.  The EVEN_Z_PARITY (TE) states then have
+   H = Hz (the m component only), and D and E in the xy plane, while
+   the ODD_Z_PARITY (TM) states have H in the xy plane (the n component
+   only), and D = Dz, E = Ez.  So, we only need to transform nc = 2
+   (TE) or nc = 1 (TM) components of D and E rather than 3, and only
+   the corresponding block of eps_inv (see maxwell_te_tm_eps_inv).
+
+   The position-space fields below are stored as fft_output_size x
+   cur_num_bands x nc arrays.  For fields of the given parity, the
+   results are the same as for the general code (where the other
+   components are all exactly zero). */
+
+/* Return the number of non-zero components of D and E for the current
+   parity (2 for TE, 1 for TM), or 3 if the TE/TM operators cannot be
+   used and the general code is required. */
+int maxwell_te_tm_components(const maxwell_data *d)
+{
+     if (d->nz != 1 || d->mu_inv || !d->eps_inv_te_tm)
+	  return 3;
+     if (d->parity & EVEN_Z_PARITY)
+	  return 2;
+     if (d->parity & ODD_Z_PARITY)
+	  return 1;
+     return 3;
+}
+
+/* Get the xy block (TE, nc = 2) or the zz component (TM, nc = 1) of
+   eps_inv at the local point i, from the compressed d->eps_inv_c if
+   there is one (looking up interface points, which are in increasing
+   order, by bisection), or else from d->eps_inv_xy or d->eps_inv_zz. */
+void maxwell_te_tm_eps_inv(const maxwell_data *d, int i, int nc,
+			   symmetric_matrix_xy *xy, real *zz)
+{
+     const compressed_eps_inv *c = d->eps_inv_c;
+     const symmetric_matrix *m;
+
+     if (!c) {
+	  if (nc == 2)
+	       *xy = d->eps_inv_xy[i];
+	  else
+	       *zz = d->eps_inv_zz[i];
+	  return;
+     }
+
+     if (c->index[i] != EPS_INTERFACE)
+	  m = c->materials + c->index[i];
+     else {
+	  int lo = 0, hi = c->ninterface - 1;
+	  while (lo < hi) {
+	       int mid = (lo + hi) / 2;
+	       if (c->interface_index[mid] < i)
+		    lo = mid + 1;
+	       else
+		    hi = mid;
+	  }
+	  m = c->interface_eps_inv + lo;
+     }
+     if (nc == 2) {
+	  xy->m00 = m->m00;
+	  xy->m01 = m->m01;
+	  xy->m11 = m->m11;
+     }
+     else
+	  *zz = m->m22;
+}
+
+/* Convert a position-space field with nc = 1 (z) or 2 (xy) components,
+   as computed below, in-place to the usual 3-component form. */
+static void expand_te_tm_field(maxwell_data *d, scalar_complex *field,
+			       int cur_num_bands, int nc)
+{
+     int i;
+     for (i = d->fft_output_size * cur_num_bands - 1; i >= 0; --i) {
+	  scalar_complex f0 = field[nc * i], f1 = field[nc * i + nc - 1];
+	  if (nc == 2) {
+	       field[3*i] = f0;
+	       field[3*i + 1] = f1;
+	       CASSIGN_ZERO(field[3*i + 2]);
+	  }
+	  else {
+	       field[3*i + 2] = f0;
+	       CASSIGN_ZERO(field[3*i + 1]);
+	       CASSIGN_ZERO(field[3*i]);
+	  }
+     }
+}
+
+/* TE/TM version of maxwell_compute_d_from_H */
+static void compute_d_from_H_te_tm(maxwell_data *d, evectmatrix Hin,
+				   scalar_complex *dfield,
+				   int cur_band_start, int cur_num_bands,
+				   int nc)
+{
+     scalar *fft_data = (scalar *) dfield;
+     scalar *fft_data_in = d->fft_data2 == d->fft_data ? fft_data : (fft_data == d->fft_data ? d->fft_data2 : d->fft_data);
+     int i, j, b;
+
+     /* (k+G) x H = |k+G| H0 n (TE) or -|k+G| H1 m (TM): */
+#ifdef USE_OPENMP
+#pragma omp parallel for private(j, b)
+#endif
+     for (i = 0; i < d->other_dims; ++i)
+	  for (j = 0; j < d->last_dim; ++j) {
+	       int ij = i * d->last_dim + j;
+	       int ij2 = i * d->last_dim_size + j;
+	       k_data cur_k;
+	       MAXWELL_K_DATA(cur_k, d, ij);
+
+	       for (b = 0; b < cur_num_bands; ++b) {
+		    scalar *a = &fft_data_in[nc * (ij2*cur_num_bands + b)];
+		    const scalar *v = &Hin.data[ij * 2 * Hin.fd +
+						b + cur_band_start];
+		    if (nc == 2) {
+			 ASSIGN_SCALAR(a[0],
+				       SCALAR_RE(v[0])*cur_k.nx * cur_k.kmag,
+				       SCALAR_IM(v[0])*cur_k.nx * cur_k.kmag);
+			 ASSIGN_SCALAR(a[1],
+				       SCALAR_RE(v[0])*cur_k.ny * cur_k.kmag,
+				       SCALAR_IM(v[0])*cur_k.ny * cur_k.kmag);
+		    }
+		    else
+			 ASSIGN_SCALAR(a[0],
+				       -(SCALAR_RE(v[Hin.fd])*cur_k.mz)
+				       * cur_k.kmag,
+				       -(SCALAR_IM(v[Hin.fd])*cur_k.mz)
+				       * cur_k.kmag);
+	       }
+	  }
+
+     maxwell_compute_fft(+1, d, fft_data_in, fft_data,
+			 cur_num_bands*nc, cur_num_bands*nc, 1);
+}
+
+/* TE/TM version of maxwell_compute_h_from_H: H has 3 - nc components */
+static void compute_h_from_H_te_tm(maxwell_data *d, evectmatrix Hin,
+				   scalar_complex *hfield,
+				   int cur_band_start, int cur_num_bands,
+				   int nc)
+{
+     scalar *fft_data = (scalar *) hfield;
+     scalar *fft_data_in = d->fft_data2 == d->fft_data ? fft_data : (fft_data == d->fft_data ? d->fft_data2 : d->fft_data);
+     int i, j, b, nh = 3 - nc;
+
+#ifdef USE_OPENMP
+#pragma omp parallel for private(j, b)
+#endif
+     for (i = 0; i < d->other_dims; ++i)
+	  for (j = 0; j < d->last_dim; ++j) {
+	       int ij = i * d->last_dim + j;
+	       int ij2 = i * d->last_dim_size + j;
+	       k_data cur_k;
+	       MAXWELL_K_DATA(cur_k, d, ij);
+
+	       for (b = 0; b < cur_num_bands; ++b) {
+		    scalar *a = &fft_data_in[nh * (ij2*cur_num_bands + b)];
+		    const scalar *v = &Hin.data[ij * 2 * Hin.fd +
+						b + cur_band_start];
+		    if (nh == 1) { /* TE: H = H0 m */
+			 ASSIGN_SCALAR(a[0],
+				       SCALAR_RE(v[0])*cur_k.mz,
+				       SCALAR_IM(v[0])*cur_k.mz);
+		    }
+		    else { /* TM: H = H1 n */
+			 ASSIGN_SCALAR(a[0],
+				       SCALAR_RE(v[Hin.fd])*cur_k.nx,
+				       SCALAR_IM(v[Hin.fd])*cur_k.nx);
+			 ASSIGN_SCALAR(a[1],
+				       SCALAR_RE(v[Hin.fd])*cur_k.ny,
+				       SCALAR_IM(v[Hin.fd])*cur_k.ny);
+		    }
+	       }
+	  }
+
+     maxwell_compute_fft(+1, d, fft_data_in, fft_data,
+			 cur_num_bands*nh, cur_num_bands*nh, 1);
+}
+
+/* TE/TM version of maxwell_compute_e_from_d */
+static void compute_e_from_d_te_tm(maxwell_data *d, scalar_complex *dfield,
+				   int cur_num_bands, int nc)
+{
+     int i, b;
+
+     if (nc == 1) {
+#ifdef USE_OPENMP
+#pragma omp parallel for private(b)
+#endif
+	  for (i = 0; i < d->fft_output_size; ++i) {
+	       real s;
+	       scalar_complex *v = dfield + i * cur_num_bands;
+	       maxwell_te_tm_eps_inv(d, i, 1, NULL, &s);
+	       for (b = 0; b < cur_num_bands; ++b) {
+		    v[b].re *= s;
+		    v[b].im *= s;
+	       }
+	  }
+	  return;
+     }
+
+#ifdef USE_OPENMP
+#pragma omp parallel for private(b)
+#endif
+     for (i = 0; i < d->fft_output_size; ++i) {
+	  symmetric_matrix_xy m;
+	  scalar_complex *v = dfield + 2 * i * cur_num_bands;
+	  maxwell_te_tm_eps_inv(d, i, 2, &m, NULL);
+	  for (b = 0; b < cur_num_bands; ++b, v += 2) {
+	       scalar_complex v0 = v[0], v1 = v[1];
+#if defined(WITH_HERMITIAN_EPSILON)
+	       v[0].re = m.m00 * v0.re;
+	       v[0].im = m.m00 * v0.im;
+	       CACCUMULATE_SUM_MULT(v[0], m.m01, v1);
+	       v[1].re = m.m11 * v1.re;
+	       v[1].im = m.m11 * v1.im;
+	       CACCUMULATE_SUM_CONJ_MULT(v[1], m.m01, v0);
+#else
+	       v[0].re = m.m00 * v0.re + m.m01 * v1.re;
+	       v[0].im = m.m00 * v0.im + m.m01 * v1.im;
+	       v[1].re = m.m01 * v0.re + m.m11 * v1.re;
+	       v[1].im = m.m01 * v0.im + m.m11 * v1.im;
+#endif
+	  }
+     }
+}
+
+/* TE/TM version of maxwell_compute_H_from_e */
+static void compute_H_from_e_te_tm(maxwell_data *d, evectmatrix Hout,
+				   scalar_complex *efield,
+				   int cur_band_start, int cur_num_bands,
+				   real scale, int nc)
+{
+     scalar *fft_data = (scalar *) efield;
+     scalar *fft_data_out = d->fft_data2 == d->fft_data ? fft_data : (fft_data == d->fft_data ? d->fft_data2 : d->fft_data);
+     int i, j, b;
+
+     maxwell_compute_fft(-1, d, fft_data, fft_data_out,
+			 cur_num_bands*nc, cur_num_bands*nc, 1);
+
+     /* (k+G) x E = -|k+G| (E*n) m (TE) or |k+G| (E*m) n (TM): */
+#ifdef USE_OPENMP
+#pragma omp parallel for private(j, b)
+#endif
+     for (i = 0; i < d->other_dims; ++i)
+	  for (j = 0; j < d->last_dim; ++j) {
+	       int ij = i * d->last_dim + j;
+	       int ij2 = i * d->last_dim_size + j;
+	       k_data cur_k;
+	       real s;
+	       MAXWELL_K_DATA(cur_k, d, ij);
+	       s = scale * cur_k.kmag;
+
+	       for (b = 0; b < cur_num_bands; ++b) {
+		    scalar *v = &Hout.data[ij * 2 * Hout.fd +
+					   b + cur_band_start];
+		    const scalar *a = &fft_data_out[nc * (ij2*cur_num_bands
+							  + b)];
+		    if (nc == 2) {
+			 ASSIGN_SCALAR(v[0],
+				       - s * (SCALAR_RE(a[0])*cur_k.nx +
+					      SCALAR_RE(a[1])*cur_k.ny),
+				       - s * (SCALAR_IM(a[0])*cur_k.nx +
+					      SCALAR_IM(a[1])*cur_k.ny));
+			 ASSIGN_ZERO(v[Hout.fd]);
+		    }
+		    else {
+			 ASSIGN_ZERO(v[0]);
+			 ASSIGN_SCALAR(v[Hout.fd],
+				       s * (SCALAR_RE(a[0])*cur_k.mz),
+				       s * (SCALAR_IM(a[0])*cur_k.mz));
+		    }
+	       }
+	  }
+}
+
+/**************************************************************************/
+
+/* Reduced-grid transforms for z-mirror symmetric states.
+
+   If eps_inv is symmetric under z -> -z (and k_z = 0, as is required
+   for the z parity to be defined), a vector field (D or E) with
+   EVEN_Z_PARITY has x and y components that are even functions of z
+   and a z component that is odd; the Fourier amplitudes have the same
+   symmetries as functions of k_z.  The z transforms of the x and y
+   components are then DCT-I (REDFT00) transforms of the nz/2+1 planes
+   0 <= z <= nz/2, those of the z component are (-i or +i times) DST-I
+   (RODFT00) transforms of the nz/2-1 planes 0 < z < nz/2, and the xy
+   transforms need only be done for the planes 0 <= z <= nz/2.  This
+   halves the FFT work, as well as the work of multiplying by eps_inv,
+   which need only be done for the same planes of the position-space
+   fields.
+
+   The arrays keep the usual (nz-plane) layout, but only planes
+   0..nz/2 of the position-space fields are used.  The k-space inputs
+   are assumed to have the symmetry above (as is ensured by the parity
+   constraint), and the other half of the k-space outputs is filled in
+   from it.
+
+   (ODD_Z_PARITY states are not handled: the m vector of the transverse
+   basis has x and y components in the k_z = nz/2 plane, which is its
+   own mirror image, so the parity constraint does not make the x and y
+   components of D exactly odd there.)
+
+   This is currently implemented only for serial, complex FFTW3
+   transforms of 3d grids with even nz >= 4, without mu. */
+
+#if defined(HAVE_FFTW3) && defined(SCALAR_COMPLEX) && !defined(HAVE_MPI)
+#  define HAVE_ZMIRROR 1
+
+/* Return whether the z-mirror transforms can be used. */
+static int use_zmirror(const maxwell_data *d)
+{
+     return (d->eps_inv_zmirror && !d->mu_inv && d->nz >= 4 && d->nz % 2 == 0
+	     && (d->parity & EVEN_Z_PARITY));
+}
+
+/* Get the plans for compute_fft_zmirror, below: the backward and
+   forward xy transforms, and the z transforms of the x,y and z
+   components. */
+static void get_zmirror_plans(maxwell_data *d, scalar *array,
+			      int cur_num_bands,
+			      fftplan *xyplan, fftplan *ixyplan,
+			      fftplan *zplan_xy, fftplan *zplan_z)
+{
+     int howmany = 3 * cur_num_bands, nz = d->nz, h = nz / 2;
+     int have_xy, have_z;
+     unsigned flags = fft_rigor_flags(d->fft_rigor);
+     scalar *array_save = NULL;
+     size_t save_size = sizeof(scalar) * d->fft_data_size * howmany;
+
+     have_xy = maxwell_fft_plans_lookup(d, FFT_PLAN_ZMIRROR_XY,
+					howmany, howmany, 1, 1,
+					xyplan, ixyplan);
+     have_z = maxwell_fft_plans_lookup(d, FFT_PLAN_ZMIRROR_Z,
+				       howmany, howmany, 1, 1,
+				       zplan_xy, zplan_z);
+     if (have_xy && have_z)
+	  return;
+
+     /* (see maxwell_compute_fft) */
+     if (flags != FFTW_ESTIMATE) {
+	  CHK_MALLOC(array_save, scalar, d->fft_data_size * howmany);
+	  memcpy(array_save, array, save_size);
+     }
+
+     if (!have_xy) {
+	  FFTW(complex) *carray = (FFTW(complex) *) array;
+	  FFTW(iodim) dims[2], hdims[2];
+	  dims[0].n = d->nx; dims[0].is = dims[0].os = d->ny * nz * howmany;
+	  dims[1].n = d->ny; dims[1].is = dims[1].os = nz * howmany;
+	  hdims[0].n = h + 1; hdims[0].is = hdims[0].os = howmany;
+	  hdims[1].n = howmany; hdims[1].is = hdims[1].os = 1;
+	  *xyplan = FFTW(plan_guru_dft)(2, dims, 2, hdims, carray, carray,
+					FFTW_BACKWARD, flags);
+	  *ixyplan = FFTW(plan_guru_dft)(2, dims, 2, hdims, carray, carray,
+					 FFTW_FORWARD, flags);
+	  CHECK(*xyplan && *ixyplan, "Failure creating FFTW3 plans");
+	  maxwell_fft_plans_insert(d, FFT_PLAN_ZMIRROR_XY,
+				   howmany, howmany, 1, 1,
+				   *xyplan, *ixyplan);
+     }
+
+     if (!have_z) {
+	  real *rarray = (real *) array;
+	  FFTW(r2r_kind) even = FFTW_REDFT00, odd = FFTW_RODFT00;
+	  FFTW(iodim) dim, hdims[3];
+
+	  /* z transforms of the real and imaginary parts, separately: */
+	  dim.is = dim.os = 2 * howmany;
+	  hdims[0].n = d->other_dims;
+	  hdims[0].is = hdims[0].os = 2 * nz * howmany;
+	  hdims[1].n = cur_num_bands; hdims[1].is = hdims[1].os = 6;
+	  hdims[2].is = hdims[2].os = 1;
+
+	  dim.n = h + 1; hdims[2].n = 4; /* x and y components */
+	  *zplan_xy = FFTW(plan_guru_r2r)(1, &dim, 3, hdims,
+					  rarray, rarray, &even, flags);
+
+	  dim.n = h - 1; hdims[2].n = 2; /* z component, planes 1..h-1 */
+	  *zplan_z = FFTW(plan_guru_r2r)(1, &dim, 3, hdims,
+					 rarray + 2*howmany + 4,
+					 rarray + 2*howmany + 4, &odd, flags);
+	  CHECK(*zplan_xy && *zplan_z, "Failure creating FFTW3 plans");
+	  maxwell_fft_plans_insert(d, FFT_PLAN_ZMIRROR_Z,
+				   howmany, howmany, 1, 1,
+				   *zplan_xy, *zplan_z);
+     }
+
+     if (array_save) {
+	  memcpy(array, array_save, save_size);
+	  free(array_save);
+     }
+}
+
+/* Like maxwell_compute_fft(dir, d, array, array, 3*cur_num_bands,
+   3*cur_num_bands, 1), for even-z-parity vector fields, using the
+   reduced grid as described above. */
+static void compute_fft_zmirror(int dir, maxwell_data *d, scalar *array,
+				int cur_num_bands)
+{
+     fftplan xyplan, ixyplan, zplan_xy, zplan_z;
+     FFTW(complex) *carray = (FFTW(complex) *) array;
+     real *rarray = (real *) array;
+     int howmany = 3 * cur_num_bands, nz = d->nz, h = nz / 2;
+     real isign = dir > 0 ? -1.0 : +1.0; /* sign of the FFT exponent */
+     int i, z, b;
+
+     get_zmirror_plans(d, array, cur_num_bands,
+		       &xyplan, &ixyplan, &zplan_xy, &zplan_z);
+
+     FFTW(execute_dft)(dir > 0 ? ixyplan : xyplan, carray, carray);
+     FFTW(execute_r2r)(zplan_xy, rarray, rarray);
+     FFTW(execute_r2r)(zplan_z, rarray + 2*howmany + 4,
+		       rarray + 2*howmany + 4);
+
+     /* The DFT of an odd function is isign * i times its DST; also, fill
+	in the z components in the z = 0 and nz/2 planes, which are
+	zero, and (in k-space) the other half of the planes. */
+#ifdef USE_OPENMP
+#pragma omp parallel for private(z, b)
+#endif
+     for (i = 0; i < d->other_dims; ++i) {
+	  scalar *a = array + i * nz * howmany;
+	  for (b = 0; b < howmany; b += 3) {
+	       ASSIGN_ZERO(a[b + 2]);
+	       ASSIGN_ZERO(a[h * howmany + b + 2]);
+	  }
+	  for (z = 1; z < h; ++z)
+	       for (b = 0; b < howmany; b += 3) {
+		    scalar v = a[z * howmany + b + 2];
+		    ASSIGN_SCALAR(a[z * howmany + b + 2],
+				  -isign * SCALAR_IM(v), isign * SCALAR_RE(v));
+	       }
+	  if (dir < 0)
+	       for (z = 1; z < h; ++z)
+		    for (b = 0; b < howmany; b += 3) {
+			 scalar *v = a + z * howmany + b;
+			 scalar *v2 = a + (nz - z) * howmany + b;
+			 v2[0] = v[0];
+			 v2[1] = v[1];
+			 ASSIGN_SCALAR(v2[2], -SCALAR_RE(v[2]), -SCALAR_IM(v[2]));
+		    }
+     }
+}
+
+/* Analogues of maxwell_compute_d_from_H, maxwell_compute_e_from_d,
+   and maxwell_compute_H_from_e for the z-mirror transforms; in
+   position space, only the planes 0 <= z <= nz/2 are computed. */
+
+static void compute_d_from_H_zmirror(maxwell_data *d, evectmatrix Hin,
+				     scalar_complex *dfield,
+				     int cur_band_start, int cur_num_bands)
+{
+     scalar *fft_data = (scalar *) dfield;
+     int i, j, b, nz = d->nz, h = nz / 2;
+
+#ifdef USE_OPENMP
+#pragma omp parallel for private(j, b)
+#endif
+     for (i = 0; i < d->other_dims; ++i)
+	  for (j = 0; j <= h; ++j) {
+	       int ij = i * nz + j;
+	       k_data cur_k;
+	       MAXWELL_K_DATA(cur_k, d, ij);
+
+	       for (b = 0; b < cur_num_bands; ++b)
+		    assign_cross_t2c(&fft_data[3 * (ij*cur_num_bands + b)],
+				     cur_k,
+				     &Hin.data[ij * 2 * Hin.fd +
+					      b + cur_band_start],
+				     Hin.fd);
+	  }
+
+     PROF_OP(PROF_FFT, 3 * cur_num_bands * (double) d->fft_output_size
+	     * sizeof(scalar_complex),
+	     compute_fft_zmirror(+1, d, fft_data, cur_num_bands));
+}
+
+static void compute_e_from_d_zmirror(maxwell_data *d, scalar_complex *dfield,
+				     int cur_num_bands)
+{
+     const compressed_eps_inv *eps_inv_c = d->eps_inv_c;
+     int i, j, b, nz = d->nz, h = nz / 2;
+
+#ifdef USE_OPENMP
+#pragma omp parallel for private(j, b)
+#endif
+     for (i = 0; i < d->other_dims; ++i)
+	  for (j = 0; j <= h; ++j) {
+	       int ij = i * nz + j;
+	       symmetric_matrix eps_inv;
+	       if (eps_inv_c && eps_inv_c->index[ij] != EPS_INTERFACE)
+		    eps_inv = eps_inv_c->materials[eps_inv_c->index[ij]];
+	       else
+		    eps_inv = d->eps_inv[ij];
+	       for (b = 0; b < cur_num_bands; ++b) {
+		    int ib = 3 * (ij * cur_num_bands + b);
+		    assign_symmatrix_vector(&dfield[ib], eps_inv, &dfield[ib]);
+	       }
+	  }
+}
+
+static void compute_H_from_e_zmirror(maxwell_data *d, evectmatrix Hout,
+				     scalar_complex *efield,
+				     int cur_band_start, int cur_num_bands,
+				     real scale)
+{
+     scalar *fft_data = (scalar *) efield;
+     int i, j, b;
+
+     PROF_OP(PROF_FFT, 3 * cur_num_bands * (double) d->fft_output_size
+	     * sizeof(scalar_complex),
+	     compute_fft_zmirror(-1, d, fft_data, cur_num_bands));
+
+#ifdef USE_OPENMP
+#pragma omp parallel for private(j, b)
+#endif
+     for (i = 0; i < d->other_dims; ++i)
+	  for (j = 0; j < d->last_dim; ++j) {
+	       int ij = i * d->last_dim + j;
+	       k_data cur_k;
+	       MAXWELL_K_DATA(cur_k, d, ij);
+
+	       for (b = 0; b < cur_num_bands; ++b)
+		    assign_cross_c2t(&Hout.data[ij * 2 * Hout.fd +
+					       b + cur_band_start],
+				     Hout.fd, cur_k,
+				     &fft_data[3 * (ij*cur_num_bands+b)],
+				     scale);
+	  }
+}
+
+#endif /* HAVE_FFTW3 && SCALAR_COMPLEX && !HAVE_MPI */
+
+/**************************************************************************/
+
 /* compute the D field in position space from Hin, which holds the H
    field in Fourier space, for the specified bands; this amounts to
    taking the curl and then Fourier transforming.  The output array,
@@ -401,7 +968,7 @@ void maxwell_compute_d_from_H(maxwell_data *d, evectmatrix Hin,
 {
      scalar *fft_data = (scalar *) dfield;
      scalar *fft_data_in = d->fft_data2 == d->fft_data ? fft_data : (fft_data == d->fft_data ? d->fft_data2 : d->fft_data);
-     int i, j, b;
+     int i, j, b, nc;
 
      CHECK(Hin.c == 2, "fields don't have 2 components!");
      CHECK(d, "null maxwell data pointer!");
@@ -409,20 +976,31 @@ void maxwell_compute_d_from_H(maxwell_data *d, evectmatrix Hin,
      CHECK(cur_band_start >= 0 && cur_band_start + cur_num_bands <= Hin.p,
 	   "invalid range of bands for computing fields");
 
+     if ((nc = maxwell_te_tm_components(d)) < 3) {
+	  compute_d_from_H_te_tm(d, Hin, dfield,
+				 cur_band_start, cur_num_bands, nc);
+	  expand_te_tm_field(d, dfield, cur_num_bands, nc);
+	  return;
+     }
+
      /* first, compute fft_data = curl(Hin) (really (k+G) x H) : */
+#ifdef USE_OPENMP
+#pragma omp parallel for private(j, b)
+#endif
      for (i = 0; i < d->other_dims; ++i)
 	  for (j = 0; j < d->last_dim; ++j) {
 	       int ij = i * d->last_dim + j;
 	       int ij2 = i * d->last_dim_size + j;
-	       k_data cur_k = d->k_plus_G[ij];
+	       k_data cur_k;
+	       MAXWELL_K_DATA(cur_k, d, ij);
 	       
 	       for (b = 0; b < cur_num_bands; ++b)
 		    assign_cross_t2c(&fft_data_in[3 * (ij2*cur_num_bands 
 						    + b)], 
 				     cur_k, 
-				     &Hin.data[ij * 2 * Hin.p + 
+				     &Hin.data[ij * 2 * Hin.fd + 
 					      b + cur_band_start],
-				     Hin.p);
+				     Hin.fd);
 	  }
 
      /* now, convert to position space via FFT: */
@@ -433,30 +1011,104 @@ void maxwell_compute_d_from_H(maxwell_data *d, evectmatrix Hin,
 /* Compute E (output in dfield) from D (input in dfield); this amounts
    to just dividing by the dielectric tensor.  dfield is in position
    space and corresponds to the output from maxwell_compute_d_from_H,
-   above. */
+   above.  If the compressed eps_inv_c is non-NULL, it is used instead
+   of eps_inv_, with special cases for scalar and diagonal materials. */
 void maxwell_compute_e_from_d_(maxwell_data *d,
                                scalar_complex *dfield,
                                int cur_num_bands,
-                               symmetric_matrix *eps_inv_)
+                               symmetric_matrix *eps_inv_,
+			       const compressed_eps_inv *eps_inv_c)
 {
      int i, b;
 
      CHECK(d, "null maxwell data pointer!");
      CHECK(dfield, "null field input/output data!");
 
-     for (i = 0; i < d->fft_output_size; ++i) {
-	  symmetric_matrix eps_inv = eps_inv_[i];
+     if (!eps_inv_c) {
+#ifdef USE_OPENMP
+#pragma omp parallel for private(b)
+#endif
+	  for (i = 0; i < d->fft_output_size; ++i) {
+	       symmetric_matrix eps_inv = eps_inv_[i];
+	       for (b = 0; b < cur_num_bands; ++b) {
+		    int ib = 3 * (i * cur_num_bands + b);
+		    assign_symmatrix_vector(&dfield[ib], eps_inv, &dfield[ib]);
+	       }
+	  }
+	  return;
+     }
+
+     /* First, the points inside homogeneous materials: */
+     switch (eps_inv_c->kind) {
+     case EPS_ISOTROPIC:
+#ifdef USE_OPENMP
+#pragma omp parallel for private(b)
+#endif
+	  for (i = 0; i < d->fft_output_size; ++i) {
+	       int m = eps_inv_c->index[i];
+	       if (m != EPS_INTERFACE) {
+		    real s = eps_inv_c->diag[3*m];
+		    scalar_complex *v = dfield + 3 * i * cur_num_bands;
+		    for (b = 0; b < 3 * cur_num_bands; ++b) {
+			 v[b].re *= s;
+			 v[b].im *= s;
+		    }
+	       }
+	  }
+	  break;
+     case EPS_DIAGONAL:
+#ifdef USE_OPENMP
+#pragma omp parallel for private(b)
+#endif
+	  for (i = 0; i < d->fft_output_size; ++i) {
+	       int m = eps_inv_c->index[i];
+	       if (m != EPS_INTERFACE) {
+		    const real *s = eps_inv_c->diag + 3*m;
+		    scalar_complex *v = dfield + 3 * i * cur_num_bands;
+		    for (b = 0; b < cur_num_bands; ++b, v += 3) {
+			 v[0].re *= s[0]; v[0].im *= s[0];
+			 v[1].re *= s[1]; v[1].im *= s[1];
+			 v[2].re *= s[2]; v[2].im *= s[2];
+		    }
+	       }
+	  }
+	  break;
+     default:
+#ifdef USE_OPENMP
+#pragma omp parallel for private(b)
+#endif
+	  for (i = 0; i < d->fft_output_size; ++i) {
+	       int m = eps_inv_c->index[i];
+	       if (m != EPS_INTERFACE) {
+		    symmetric_matrix eps_inv = eps_inv_c->materials[m];
+		    for (b = 0; b < cur_num_bands; ++b) {
+			 int ib = 3 * (i * cur_num_bands + b);
+			 assign_symmatrix_vector(&dfield[ib], eps_inv,
+						 &dfield[ib]);
+		    }
+	       }
+	  }
+     }
+
+     /* ...then the interface points, with their full tensors: */
+#ifdef USE_OPENMP
+#pragma omp parallel for private(b)
+#endif
+     for (i = 0; i < eps_inv_c->ninterface; ++i) {
+	  int j = eps_inv_c->interface_index[i];
+	  symmetric_matrix eps_inv = eps_inv_c->interface_eps_inv[i];
 	  for (b = 0; b < cur_num_bands; ++b) {
-	       int ib = 3 * (i * cur_num_bands + b);
+	       int ib = 3 * (j * cur_num_bands + b);
 	       assign_symmatrix_vector(&dfield[ib], eps_inv, &dfield[ib]);
 	  }
-     }	  
+     }
 }
 void maxwell_compute_e_from_d(maxwell_data *d,
 			      scalar_complex *dfield,
 			      int cur_num_bands)
 {
-    maxwell_compute_e_from_d_(d, dfield, cur_num_bands, d->eps_inv);
+    maxwell_compute_e_from_d_(d, dfield, cur_num_bands,
+			      d->eps_inv, d->eps_inv_c);
 }
 
 /* Compute the magnetic (H) field in Fourier space from the electric
@@ -487,16 +1139,20 @@ void maxwell_compute_H_from_e(maxwell_data *d, evectmatrix Hout,
      
      /* then, compute Hout = curl(fft_data) (* scale factor): */
      
+#ifdef USE_OPENMP
+#pragma omp parallel for private(j, b)
+#endif
      for (i = 0; i < d->other_dims; ++i)
 	  for (j = 0; j < d->last_dim; ++j) {
 	       int ij = i * d->last_dim + j;
 	       int ij2 = i * d->last_dim_size + j;
-	       k_data cur_k = d->k_plus_G[ij];
+	       k_data cur_k;
+	       MAXWELL_K_DATA(cur_k, d, ij);
 	       
 	       for (b = 0; b < cur_num_bands; ++b)
-		    assign_cross_c2t(&Hout.data[ij * 2 * Hout.p + 
+		    assign_cross_c2t(&Hout.data[ij * 2 * Hout.fd + 
 					       b + cur_band_start],
-				     Hout.p, cur_k, 
+				     Hout.fd, cur_k, 
 				     &fft_data_out[3 * (ij2*cur_num_bands+b)],
 				     scale);
 	  }
@@ -511,7 +1167,7 @@ void maxwell_compute_h_from_H(maxwell_data *d, evectmatrix Hin,
 {
      scalar *fft_data = (scalar *) hfield;
      scalar *fft_data_in = d->fft_data2 == d->fft_data ? fft_data : (fft_data == d->fft_data ? d->fft_data2 : d->fft_data);
-     int i, j, b;
+     int i, j, b, nc;
 
      CHECK(Hin.c == 2, "fields don't have 2 components!");
      CHECK(d, "null maxwell data pointer!");
@@ -519,21 +1175,32 @@ void maxwell_compute_h_from_H(maxwell_data *d, evectmatrix Hin,
      CHECK(cur_band_start >= 0 && cur_band_start + cur_num_bands <= Hin.p,
 	   "invalid range of bands for computing fields");
 
+     if ((nc = maxwell_te_tm_components(d)) < 3) {
+	  compute_h_from_H_te_tm(d, Hin, hfield,
+				 cur_band_start, cur_num_bands, nc);
+	  expand_te_tm_field(d, hfield, cur_num_bands, 3 - nc);
+	  return;
+     }
+
      /* first, compute fft_data = Hin, with the vector field converted 
 	from transverse to cartesian basis: */
+#ifdef USE_OPENMP
+#pragma omp parallel for private(j, b)
+#endif
      for (i = 0; i < d->other_dims; ++i)
 	  for (j = 0; j < d->last_dim; ++j) {
 	       int ij = i * d->last_dim + j;
 	       int ij2 = i * d->last_dim_size + j;
-               k_data cur_k = d->k_plus_G[ij];
+               k_data cur_k;
+               MAXWELL_K_DATA(cur_k, d, ij);
 	       
 	       for (b = 0; b < cur_num_bands; ++b)
 		    assign_t2c(&fft_data_in[3 * (ij2*cur_num_bands 
 					      + b)], 
 			       cur_k,
-			       &Hin.data[ij * 2 * Hin.p + 
+			       &Hin.data[ij * 2 * Hin.fd + 
 					b + cur_band_start],
-			       Hin.p);
+			       Hin.fd);
 	  }
 
      /* now, convert to position space via FFT: */
@@ -560,28 +1227,146 @@ void maxwell_compute_H_from_B(maxwell_data *d, evectmatrix Bin,
      }
      
      maxwell_compute_h_from_H(d, Bin, hfield, Bin_band_start, cur_num_bands);
-     maxwell_compute_e_from_d_(d, hfield, cur_num_bands, d->mu_inv);
+     maxwell_compute_e_from_d_(d, hfield, cur_num_bands,
+			       d->mu_inv, d->mu_inv_c);
      
      /* convert back to Fourier space */
      maxwell_compute_fft(-1, d, fft_data, fft_data_out,
                          cur_num_bands*3, cur_num_bands*3, 1);
      
      /* then, compute Hout = (transverse component)(fft_data) * scale factor */
+#ifdef USE_OPENMP
+#pragma omp parallel for private(j, b)
+#endif
      for (i = 0; i < d->other_dims; ++i)
          for (j = 0; j < d->last_dim; ++j) {
              int ij = i * d->last_dim + j;
              int ij2 = i * d->last_dim_size + j;
-             k_data cur_k = d->k_plus_G[ij];
+             k_data cur_k;
+             MAXWELL_K_DATA(cur_k, d, ij);
              for (b = 0; b < cur_num_bands; ++b)
-                 project_c2t(&Hout.data[ij * 2 * Hout.p + 
+                 project_c2t(&Hout.data[ij * 2 * Hout.fd + 
                                         b + Hout_band_start],
-                             Hout.p, cur_k, 
+                             Hout.fd, cur_k, 
                                &fft_data_out[3 * (ij2*cur_num_bands+b)],
                              scale);
          }
 }
 
 
+/* Compute the D field in position space from Bin, where H = mu^-1 B;
+   this is equivalent to maxwell_compute_H_from_B followed by
+   maxwell_compute_d_from_H, except that the intermediate H is never
+   stored: the transverse projection and the curl are done in a single
+   pass over the Fourier-space data. */
+static void maxwell_compute_d_from_B(maxwell_data *d, evectmatrix Bin,
+				     scalar_complex *dfield,
+				     int cur_band_start, int cur_num_bands)
+{
+     scalar *fft_data = (scalar *) dfield;
+     scalar *fft_data_out = d->fft_data2 == d->fft_data ? fft_data : (fft_data == d->fft_data ? d->fft_data2 : d->fft_data);
+     int i, j, b;
+     real scale = 1.0 / Bin.N; /* scale factor to normalize FFTs */
+
+     CHECK(d->mu_inv, "maxwell_compute_d_from_B requires mu");
+
+     maxwell_compute_h_from_H(d, Bin, dfield, cur_band_start, cur_num_bands);
+     maxwell_compute_e_from_d_(d, dfield, cur_num_bands,
+			       d->mu_inv, d->mu_inv_c);
+     maxwell_compute_fft(-1, d, fft_data, fft_data_out,
+                         cur_num_bands*3, cur_num_bands*3, 1);
+
+     /* fft_data_out = (k+G) x (transverse component)(fft_data_out): */
+#ifdef USE_OPENMP
+#pragma omp parallel for private(j, b)
+#endif
+     for (i = 0; i < d->other_dims; ++i)
+	  for (j = 0; j < d->last_dim; ++j) {
+	       int ij = i * d->last_dim + j;
+	       int ij2 = i * d->last_dim_size + j;
+	       k_data cur_k;
+	       MAXWELL_K_DATA(cur_k, d, ij);
+
+	       for (b = 0; b < cur_num_bands; ++b) {
+		    scalar *a = &fft_data_out[3 * (ij2*cur_num_bands + b)];
+		    scalar v[2];
+		    project_c2t(v, 1, cur_k, a, scale);
+		    assign_cross_t2c(a, cur_k, v, 1);
+	       }
+	  }
+
+     maxwell_compute_fft(+1, d, fft_data_out, fft_data,
+			 cur_num_bands*3, cur_num_bands*3, 1);
+}
+
+/* Compute Hout = mu^-1 (k+G) x E, from the E field in position space;
+   this is equivalent to maxwell_compute_H_from_e followed by
+   maxwell_compute_H_from_B(d, Hout, Hout, ...), except that the
+   curl and the conversion back to cartesian coordinates are done in a
+   single pass, without storing the intermediate result in Hout. */
+static void maxwell_compute_muinvH_from_e(maxwell_data *d, evectmatrix Hout,
+					  scalar_complex *efield,
+					  int cur_band_start,
+					  int cur_num_bands,
+					  real scale)
+{
+     scalar *fft_data = (scalar *) efield;
+     scalar *fft_data_out = d->fft_data2 == d->fft_data ? fft_data : (fft_data == d->fft_data ? d->fft_data2 : d->fft_data);
+     int i, j, b;
+     real muscale = 1.0 / Hout.N; /* scale factor to normalize FFTs */
+
+     CHECK(d->mu_inv, "maxwell_compute_muinvH_from_e requires mu");
+     CHECK(cur_band_start >= 0 && cur_band_start + cur_num_bands <= Hout.p,
+	   "invalid range of bands for computing fields");
+
+     maxwell_compute_fft(-1, d, fft_data, fft_data_out,
+			 cur_num_bands*3, cur_num_bands*3, 1);
+
+     /* fft_data_out = (cartesian)(scale * (k+G) x fft_data_out): */
+#ifdef USE_OPENMP
+#pragma omp parallel for private(j, b)
+#endif
+     for (i = 0; i < d->other_dims; ++i)
+	  for (j = 0; j < d->last_dim; ++j) {
+	       int ij = i * d->last_dim + j;
+	       int ij2 = i * d->last_dim_size + j;
+	       k_data cur_k;
+	       MAXWELL_K_DATA(cur_k, d, ij);
+
+	       for (b = 0; b < cur_num_bands; ++b) {
+		    scalar *a = &fft_data_out[3 * (ij2*cur_num_bands + b)];
+		    scalar v[2];
+		    assign_cross_c2t(v, 1, cur_k, a, scale);
+		    assign_t2c(a, cur_k, v, 1);
+	       }
+	  }
+
+     /* multiply by mu^-1 in position space, and convert back: */
+     maxwell_compute_fft(+1, d, fft_data_out, fft_data,
+			 cur_num_bands*3, cur_num_bands*3, 1);
+     maxwell_compute_e_from_d_(d, efield, cur_num_bands,
+			       d->mu_inv, d->mu_inv_c);
+     maxwell_compute_fft(-1, d, fft_data, fft_data_out,
+			 cur_num_bands*3, cur_num_bands*3, 1);
+
+#ifdef USE_OPENMP
+#pragma omp parallel for private(j, b)
+#endif
+     for (i = 0; i < d->other_dims; ++i)
+	  for (j = 0; j < d->last_dim; ++j) {
+	       int ij = i * d->last_dim + j;
+	       int ij2 = i * d->last_dim_size + j;
+	       k_data cur_k;
+	       MAXWELL_K_DATA(cur_k, d, ij);
+	       for (b = 0; b < cur_num_bands; ++b)
+		    project_c2t(&Hout.data[ij * 2 * Hout.fd +
+					   b + cur_band_start],
+				Hout.fd, cur_k,
+				&fft_data_out[3 * (ij2*cur_num_bands+b)],
+				muscale);
+	  }
+}
+
 /**************************************************************************/
 
 /* The following functions take a complex or real vector field
@@ -1183,9 +1968,10 @@ void maxwell_operator(evectmatrix Xin, evectmatrix Xout, void *data,
 		      int is_current_eigenvector, evectmatrix Work)
 {
      maxwell_data *d = (maxwell_data *) data;
-     int cur_band_start;
+     int cur_band_start, nc;
      scalar_complex *cdata;
      real scale;
+     prof_clock_t prof_start = 0;
      
      CHECK(d, "null maxwell data pointer!");
      CHECK(Xin.c == 2, "fields don't have 2 components!");
@@ -1193,6 +1979,8 @@ void maxwell_operator(evectmatrix Xin, evectmatrix Xout, void *data,
      (void) is_current_eigenvector;  /* unused */
      (void) Work;
 
+     PROF_START(prof_start);
+     nc = maxwell_te_tm_components(d);
      cdata = (scalar_complex *) d->fft_data;
      scale = -1.0 / Xout.N;  /* scale factor to normalize FFT; 
 				negative sign comes from 2 i's from curls */
@@ -1201,24 +1989,47 @@ void maxwell_operator(evectmatrix Xin, evectmatrix Xout, void *data,
      for (cur_band_start = 0; cur_band_start < Xin.p; 
 	  cur_band_start += d->num_fft_bands) {
 	  int cur_num_bands = MIN2(d->num_fft_bands, Xin.p - cur_band_start);
-
-          if (d->mu_inv == NULL)
+	  double eps_bytes = (nc * cur_num_bands * (double) d->fft_output_size
+			      * sizeof(scalar_complex));
+
+	  if (nc < 3) { /* 2d TE or TM: transform only nc components */
+	      compute_d_from_H_te_tm(d, Xin, cdata,
+				     cur_band_start, cur_num_bands, nc);
+	      PROF_OP(PROF_EPSILON, eps_bytes,
+		      compute_e_from_d_te_tm(d, cdata, cur_num_bands, nc));
+	      compute_H_from_e_te_tm(d, Xout, cdata,
+				     cur_band_start, cur_num_bands, scale, nc);
+	  }
+#ifdef HAVE_ZMIRROR
+	  else if (use_zmirror(d)) { /* z-mirror symmetric: half grid */
+	      compute_d_from_H_zmirror(d, Xin, cdata,
+				       cur_band_start, cur_num_bands);
+	      PROF_OP(PROF_EPSILON, eps_bytes,
+		      compute_e_from_d_zmirror(d, cdata, cur_num_bands));
+	      compute_H_from_e_zmirror(d, Xout, cdata,
+				       cur_band_start, cur_num_bands, scale);
+	  }
+#endif
+          else if (d->mu_inv == NULL) {
               maxwell_compute_d_from_H(d, Xin, cdata,
                                        cur_band_start, cur_num_bands);
-          else {
-              maxwell_compute_H_from_B(d, Xin, Xout, cdata,
-                                       cur_band_start, cur_band_start,
-                                       cur_num_bands);
-              maxwell_compute_d_from_H(d, Xout, cdata,
-                                       cur_band_start, cur_num_bands);
+	      PROF_OP(PROF_EPSILON, eps_bytes,
+		      maxwell_compute_e_from_d(d, cdata, cur_num_bands));
+	      maxwell_compute_H_from_e(d, Xout, cdata,
+				       cur_band_start, cur_num_bands, scale);
+	  }
+          else { /* fused versions, avoiding extra passes over Xout */
+              maxwell_compute_d_from_B(d, Xin, cdata,
+				       cur_band_start, cur_num_bands);
+	      PROF_OP(PROF_EPSILON, eps_bytes,
+		      maxwell_compute_e_from_d(d, cdata, cur_num_bands));
+	      maxwell_compute_muinvH_from_e(d, Xout, cdata,
+					    cur_band_start, cur_num_bands,
+					    scale);
           }
-	  maxwell_compute_e_from_d(d, cdata, cur_num_bands);
-	  maxwell_compute_H_from_e(d, Xout, cdata,
-				   cur_band_start, cur_num_bands, scale);
-          maxwell_compute_H_from_B(d, Xout, Xout, cdata,
-                                   cur_band_start, cur_band_start,
-                                   cur_num_bands);
      }
+     PROF_STOP(PROF_OPERATOR, prof_start,
+	       2 * Xin.n * (double) Xin.p * sizeof(scalar));
 }
 
 void maxwell_muinv_operator(evectmatrix Xin, evectmatrix Xout, void *data,
@@ -1227,6 +2038,7 @@ void maxwell_muinv_operator(evectmatrix Xin, evectmatrix Xout, void *data,
     maxwell_data *d = (maxwell_data *) data;
     int cur_band_start;
     scalar_complex *cdata;
+    prof_clock_t prof_start = 0;
     
     CHECK(d, "null maxwell data pointer!");
     CHECK(Xin.c == 2, "fields don't have 2 components!");
@@ -1234,6 +2046,7 @@ void maxwell_muinv_operator(evectmatrix Xin, evectmatrix Xout, void *data,
     (void) is_current_eigenvector;  /* unused */
     (void) Work;
     
+    PROF_START(prof_start);
     cdata = (scalar_complex *) d->fft_data;
 
      /* compute the operator, num_fft_bands at a time: */
@@ -1244,6 +2057,8 @@ void maxwell_muinv_operator(evectmatrix Xin, evectmatrix Xout, void *data,
                                    cur_band_start, cur_band_start,
                                    cur_num_bands);
      }
+     PROF_STOP(PROF_OPERATOR, prof_start,
+	       2 * Xin.n * (double) Xin.p * sizeof(scalar));
 }
 
 /* Compute the operation Xout = (M - w^2) Xin, where M is the Maxwell
@@ -1308,19 +2123,23 @@ void maxwell_ucross_op(evectmatrix Xin, evectmatrix Xout,
           int cur_num_bands = MIN2(d->num_fft_bands, Xin.p - cur_band_start);
 	  
 	  /* first, compute fft_data = u x Xin: */
+#ifdef USE_OPENMP
+#pragma omp parallel for private(j, b)
+#endif
 	  for (i = 0; i < d->other_dims; ++i)
 	       for (j = 0; j < d->last_dim; ++j) {
 		    int ij = i * d->last_dim + j;
 		    int ij2 = i * d->last_dim_size + j;
-		    k_data cur_k = d->k_plus_G[ij];
+		    k_data cur_k;
+		    MAXWELL_K_DATA(cur_k, d, ij);
 		    
 		    for (b = 0; b < cur_num_bands; ++b)
 			 assign_ucross_t2c(&fft_data_in[3 * (ij2*cur_num_bands
 							  + b)], 
 					   u, cur_k, 
-					   &Xin.data[ij * 2 * Xin.p + 
+					   &Xin.data[ij * 2 * Xin.fd + 
 						    b + cur_band_start],
-					   Xin.p);
+					   Xin.fd);
 	       }
 	  
 	  /* now, convert to position space via FFT: */
@@ -1332,3 +2151,314 @@ void maxwell_ucross_op(evectmatrix Xin, evectmatrix Xout,
                                    cur_band_start, cur_num_bands, scale);
      }
 }
+
+/* Compute Xout = -u x 1/epsilon v x Xin, projected onto the transverse
+   basis of the current k.  The second derivative of the Maxwell
+   operator with respect to k (in the directions u and v) is the sum of
+   this and the same with u and v swapped, and there are no higher
+   derivatives; since Xout is projected, this is only useful for matrix
+   elements between fields that are transverse at the current k. */
+void maxwell_ucross_vcross_op(evectmatrix Xin, evectmatrix Xout,
+			      maxwell_data *d, const real u[3],
+			      const real v[3])
+{
+     scalar *fft_data, *fft_data_in;
+     scalar_complex *cdata;
+     real scale;
+     int cur_band_start;
+     int i, j, b;
+
+     CHECK(d, "null maxwell data pointer!");
+     CHECK(Xin.c == 2, "fields don't have 2 components!");
+
+     cdata = (scalar_complex *) (fft_data = d->fft_data);
+     fft_data_in = d->fft_data2;
+
+     scale = -1.0 / Xout.N;  /* scale factor to normalize FFT;
+				negative sign is from (u x)^T = -u x */
+
+     for (cur_band_start = 0; cur_band_start < Xin.p;
+          cur_band_start += d->num_fft_bands) {
+          int cur_num_bands = MIN2(d->num_fft_bands, Xin.p - cur_band_start);
+
+	  /* first, compute fft_data = v x Xin: */
+#ifdef USE_OPENMP
+#pragma omp parallel for private(j, b)
+#endif
+	  for (i = 0; i < d->other_dims; ++i)
+	       for (j = 0; j < d->last_dim; ++j) {
+		    int ij = i * d->last_dim + j;
+		    int ij2 = i * d->last_dim_size + j;
+		    k_data cur_k;
+		    MAXWELL_K_DATA(cur_k, d, ij);
+
+		    for (b = 0; b < cur_num_bands; ++b)
+			 assign_ucross_t2c(&fft_data_in[3 * (ij2*cur_num_bands
+							  + b)],
+					   v, cur_k,
+					   &Xin.data[ij * 2 * Xin.fd +
+						    b + cur_band_start],
+					   Xin.fd);
+	       }
+
+	  /* multiply by 1/epsilon in position space: */
+	  maxwell_compute_fft(+1, d, fft_data_in, fft_data,
+			      cur_num_bands*3, cur_num_bands*3, 1);
+          maxwell_compute_e_from_d(d, cdata, cur_num_bands);
+	  maxwell_compute_fft(-1, d, fft_data, fft_data_in,
+			      cur_num_bands*3, cur_num_bands*3, 1);
+
+	  /* finally, Xout = scale * u x fft_data, projected: */
+#ifdef USE_OPENMP
+#pragma omp parallel for private(j, b)
+#endif
+	  for (i = 0; i < d->other_dims; ++i)
+	       for (j = 0; j < d->last_dim; ++j) {
+		    int ij = i * d->last_dim + j;
+		    int ij2 = i * d->last_dim_size + j;
+		    k_data cur_k;
+		    MAXWELL_K_DATA(cur_k, d, ij);
+
+		    for (b = 0; b < cur_num_bands; ++b) {
+			 const scalar *a =
+			      &fft_data_in[3 * (ij2*cur_num_bands + b)];
+			 scalar w[3];
+			 int c;
+			 for (c = 0; c < 3; ++c) {
+			      int c1 = (c + 1) % 3, c2 = (c + 2) % 3;
+			      ASSIGN_SCALAR(w[c],
+					    u[c1] * SCALAR_RE(a[c2])
+					    - u[c2] * SCALAR_RE(a[c1]),
+					    u[c1] * SCALAR_IM(a[c2])
+					    - u[c2] * SCALAR_IM(a[c1]));
+			 }
+			 project_c2t(&Xout.data[ij * 2 * Xout.fd +
+						b + cur_band_start],
+				     Xout.fd, cur_k, w, scale);
+		    }
+	       }
+     }
+}
+
+/* Compute the derivatives with respect to the (cartesian) Bloch wavevector
+   k of the eigenvalues lambda_b = <H_b|A|H_b> of the Maxwell operator A,
+   for all of the bands b of H (normalized eigenvectors, which must be
+   in the "H" form; with mu, use maxwell_compute_H_from_B first):
+
+       grad[3*b + i] = d lambda_b / dk_i
+       hess[9*b + 3*i + j] = d^2 lambda_b / dk_i dk_j   (if hess != NULL)
+
+   grad is the Hellmann-Feynman result 2 Re <H_b| curl 1/eps i e_i x |H_b>
+   (the same quantity as is computed from maxwell_ucross_op, one
+   direction at a time).  Here, however, all three directions come from
+   a single round-trip FFT and eps_inv pass: writing A = C^T eps_inv C
+   with C = (k+G) x, and E = eps_inv C H (transformed back to k-space),
+   we have d lambda / dk = 2 Re sum_G conj(H_G) x E_G.
+
+   hess is from second-order perturbation theory: the expectation value
+   of the second derivative of A, plus the sum over the other states of
+   |<m|dA|b>|^2 / (lambda_b - lambda_m).  The sum over the longitudinal
+   (zero-frequency) states at each G is done exactly, but the sum over
+   the transverse states only includes the other bands of H (so the
+   result converges as more bands are computed), and terms with
+   (nearly) degenerate eigenvalues are omitted.  eigenvals must be
+   given for hess, and this is not implemented with mu. */
+void maxwell_k_derivatives(maxwell_data *d, evectmatrix H,
+			   const real *eigenvals, real *grad, real *hess)
+{
+     scalar *fft_data;
+     scalar_complex *cdata;
+     double *grad_s, *D = NULL, *L = NULL, *P = NULL, *scratch;
+     scalar *hm = NULL;
+     int p = H.p, cur_band_start, i, j, b, c, m, ij, nP = 6 * H.p * H.p;
+     real N = H.N;
+
+     CHECK(d, "null maxwell data pointer!");
+     CHECK(H.c == 2, "fields don't have 2 components!");
+     CHECK(!hess || (eigenvals && !d->mu_inv),
+	   "second k derivatives need eigenvalues and no mu");
+
+     cdata = (scalar_complex *) (fft_data = d->fft_data);
+
+     CHK_MALLOC(grad_s, double, 3 * p);
+     for (i = 0; i < 3 * p; ++i) grad_s[i] = 0;
+     if (hess) {
+	  CHK_MALLOC(D, double, 9 * p);
+	  CHK_MALLOC(L, double, 9 * p);
+	  CHK_MALLOC(P, double, nP);
+	  CHK_MALLOC(hm, scalar, 3 * p);
+	  for (i = 0; i < 9 * p; ++i) D[i] = L[i] = 0;
+	  for (i = 0; i < nP; ++i) P[i] = 0;
+     }
+
+     for (cur_band_start = 0; cur_band_start < p;
+	  cur_band_start += d->num_fft_bands) {
+	  int nb = MIN2(d->num_fft_bands, p - cur_band_start);
+
+	  /* fft_data = N * E, in k-space: */
+	  maxwell_compute_d_from_H(d, H, cdata, cur_band_start, nb);
+	  maxwell_compute_e_from_d(d, cdata, nb);
+	  maxwell_compute_fft(-1, d, fft_data, fft_data, nb*3, nb*3, 1);
+
+	  for (i = 0; i < d->other_dims; ++i)
+	       for (j = 0; j < d->last_dim; ++j) {
+		    int ij2 = i * d->last_dim_size + j;
+		    real l[3];
+		    k_data cur_k;
+		    ij = i * d->last_dim + j;
+		    MAXWELL_K_DATA(cur_k, d, ij);
+
+		    if (hess) {
+			 for (m = 0; m < p; ++m)
+			      assign_t2c(hm + 3*m, cur_k,
+					 &H.data[ij * 2 * H.fd + m], H.fd);
+			 /* unit vector along k+G, = m x n: */
+			 l[0] = cur_k.my * cur_k.nz - cur_k.mz * cur_k.ny;
+			 l[1] = cur_k.mz * cur_k.nx - cur_k.mx * cur_k.nz;
+			 l[2] = cur_k.mx * cur_k.ny - cur_k.my * cur_k.nx;
+		    }
+
+		    for (b = 0; b < nb; ++b) {
+			 const scalar *E = &fft_data[3 * (ij2 * nb + b)];
+			 scalar h[3];
+			 int ib = cur_band_start + b;
+			 real Er[3], Ei[3];
+			 for (c = 0; c < 3; ++c) {
+			      Er[c] = SCALAR_RE(E[c]) / N;
+			      Ei[c] = SCALAR_IM(E[c]) / N;
+			 }
+
+			 /* grad += 2 Re conj(h) x E */
+			 assign_t2c(h, cur_k, &H.data[ij * 2 * H.fd + ib], H.fd);
+			 for (c = 0; c < 3; ++c) {
+			      int c1 = (c + 1) % 3, c2 = (c + 2) % 3;
+			      grad_s[3*ib + c] += 2 *
+				   (SCALAR_RE(h[c1]) * Er[c2]
+				    + SCALAR_IM(h[c1]) * Ei[c2]
+				    - SCALAR_RE(h[c2]) * Er[c1]
+				    - SCALAR_IM(h[c2]) * Ei[c1]);
+			 }
+
+			 if (!hess)
+			      continue;
+
+			 /* longitudinal states: <L|dA/dk_i|b> = -l.(e_i x E)
+			    = -w_i, where w = E x l */
+			 if (cur_k.kmag != 0) {
+			      real wr[3], wi[3];
+			      int i1, i2;
+			      for (c = 0; c < 3; ++c) {
+				   int c1 = (c + 1) % 3, c2 = (c + 2) % 3;
+				   wr[c] = Er[c1] * l[c2] - Er[c2] * l[c1];
+				   wi[c] = Ei[c1] * l[c2] - Ei[c2] * l[c1];
+			      }
+			      for (i1 = 0; i1 < 3; ++i1)
+				   for (i2 = 0; i2 < 3; ++i2)
+					L[9*ib + 3*i1 + i2] +=
+					     wr[i1] * wr[i2] + wi[i1] * wi[i2];
+			 }
+
+			 /* P[c][m][ib] += (conj(h_m) x E)_c */
+			 for (m = 0; m < p; ++m) {
+			      const scalar *h2 = hm + 3*m;
+			      for (c = 0; c < 3; ++c) {
+				   int c1 = (c + 1) % 3, c2 = (c + 2) % 3;
+				   double *Pc = P + 2 * ((c * p + m) * p + ib);
+				   Pc[0] += SCALAR_RE(h2[c1]) * Er[c2]
+					+ SCALAR_IM(h2[c1]) * Ei[c2]
+					- SCALAR_RE(h2[c2]) * Er[c1]
+					- SCALAR_IM(h2[c2]) * Ei[c1];
+				   Pc[1] += SCALAR_RE(h2[c1]) * Ei[c2]
+					- SCALAR_IM(h2[c1]) * Er[c2]
+					- SCALAR_RE(h2[c2]) * Ei[c1]
+					+ SCALAR_IM(h2[c2]) * Er[c1];
+			      }
+			 }
+		    }
+	       }
+
+	  if (!hess)
+	       continue;
+
+	  /* D += Re <e_i x h| eps_inv |e_j x h>, in position space: */
+	  maxwell_compute_h_from_H(d, H, cdata, cur_band_start, nb);
+	  for (ij = 0; ij < d->fft_output_size; ++ij) {
+	       symmetric_matrix eps_inv = d->eps_inv[ij];
+	       real w = 1.0 / N;
+#ifndef SCALAR_COMPLEX
+	       { /* weight for the other half of the Hermitian fields */
+		    int jlast = ij % (d->last_dim_size / 2);
+		    if (jlast != 0 && 2 * jlast != d->last_dim)
+			 w *= 2;
+	       }
+#endif
+	       for (b = 0; b < nb; ++b) {
+		    const scalar_complex *h = cdata + 3 * (ij * nb + b);
+		    scalar_complex v[3][3], u[3][3];
+		    int i1, i2, ib = cur_band_start + b;
+		    for (i1 = 0; i1 < 3; ++i1) { /* v[i1] = e_i1 x h */
+			 int c1 = (i1 + 1) % 3, c2 = (i1 + 2) % 3;
+			 CASSIGN_ZERO(v[i1][i1]);
+			 CASSIGN_SCALAR(v[i1][c1], -h[c2].re, -h[c2].im);
+			 v[i1][c2] = h[c1];
+			 assign_symmatrix_vector(u[i1], eps_inv, v[i1]);
+		    }
+		    for (i1 = 0; i1 < 3; ++i1)
+			 for (i2 = 0; i2 < 3; ++i2)
+			      for (c = 0; c < 3; ++c)
+				   D[9*ib + 3*i1 + i2] += w *
+					(v[i1][c].re * u[i2][c].re
+					 + v[i1][c].im * u[i2][c].im);
+	       }
+	  }
+     }
+
+     CHK_MALLOC(scratch, double, hess ? nP : 3 * p);
+     mpi_allreduce(grad_s, scratch, 3 * p,
+		   double, MPI_DOUBLE, MPI_SUM, mpb_comm);
+     for (i = 0; i < 3 * p; ++i)
+	  grad[i] = scratch[i];
+
+     if (hess) {
+	  mpi_allreduce(P, scratch, nP, double, MPI_DOUBLE, MPI_SUM, mpb_comm);
+	  for (i = 0; i < nP; ++i) P[i] = scratch[i];
+	  mpi_allreduce(D, scratch, 9 * p,
+			double, MPI_DOUBLE, MPI_SUM, mpb_comm);
+	  for (i = 0; i < 9 * p; ++i) D[i] = scratch[i];
+	  mpi_allreduce(L, scratch, 9 * p,
+			double, MPI_DOUBLE, MPI_SUM, mpb_comm);
+	  for (i = 0; i < 9 * p; ++i) L[i] = scratch[i];
+
+	  for (b = 0; b < p; ++b) {
+	       int i1, i2;
+	       for (i1 = 0; i1 < 3; ++i1)
+		    for (i2 = 0; i2 < 3; ++i2) {
+			 double h2 = 2 * D[9*b + 3*i1 + i2];
+			 if (eigenvals[b] != 0)
+			      h2 += 2 * L[9*b + 3*i1 + i2] / eigenvals[b];
+			 for (m = 0; m < p; ++m) {
+			      /* <m|dA/dk_i|b> = P_i[m][b] + conj(P_i[b][m]) */
+			      double *P1 = P + 2 * ((i1 * p + m) * p + b);
+			      double *P1t = P + 2 * ((i1 * p + b) * p + m);
+			      double *P2 = P + 2 * ((i2 * p + m) * p + b);
+			      double *P2t = P + 2 * ((i2 * p + b) * p + m);
+			      double dl = eigenvals[b] - eigenvals[m];
+			      if (m == b || fabs(dl) <= 1e-8 *
+				  (fabs(eigenvals[b]) + fabs(eigenvals[m])))
+				   continue;
+			      h2 += 2 * ((P1[0] + P1t[0]) * (P2[0] + P2t[0])
+					 + (P1[1] - P1t[1]) * (P2[1] - P2t[1]))
+				   / dl;
+			 }
+			 hess[9*b + 3*i1 + i2] = h2;
+		    }
+	  }
+	  free(hm);
+	  free(P);
+	  free(L);
+	  free(D);
+     }
+
+     free(scratch);
+     free(grad_s);
+}
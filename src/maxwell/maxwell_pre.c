@@ -23,7 +23,8 @@
 #include <check.h>
 
 #include <mpiglue.h>
-#include "maxwell.h"
+#include <prof.h>
+#include "imaxwell.h"
 
 #define PRECOND_SUBTR_EIGS 0
 
@@ -39,17 +40,20 @@ void maxwell_simple_precondition(evectmatrix X, void *data, real *eigenvals)
 {
      maxwell_data *d = (maxwell_data *) data;
      int i, c, b;
-     real *kpGn2 = d->k_plus_G_normsqr;
 
 #if !PRECOND_SUBTR_EIGS
      (void) eigenvals; /* unused */
 #endif
 
+#ifdef USE_OPENMP
+#pragma omp parallel for private(c, b)
+#endif
      for (i = 0; i < X.localN; ++i) {
+	  real kpGn2 = MAXWELL_KPG_NORMSQR(d, i);
 	  for (c = 0; c < X.c; ++c) {
 	       for (b = 0; b < X.p; ++b) {
-		    int index = (i * X.c + c) * X.p + b;
-		    real scale = kpGn2[i] * d->eps_inv_mean;
+		    int index = (i * X.c + c) * X.fd + b;
+		    real scale = kpGn2 * d->eps_inv_mean;
 
 #if PRECOND_SUBTR_EIGS
 		    if (eigenvals) {
@@ -75,9 +79,13 @@ void maxwell_simple_precondition(evectmatrix X, void *data, real *eigenvals)
 void maxwell_preconditioner(evectmatrix Xin, evectmatrix Xout, void *data,
 			    evectmatrix Y, real *eigenvals, sqmatrix YtY)
 {
+     prof_clock_t prof_start = 0;
      (void) Y; /* unused */
+     PROF_START(prof_start);
      evectmatrix_XeYS(Xout, Xin, YtY, 1);
      maxwell_simple_precondition(Xout, data, eigenvals);
+     PROF_STOP(PROF_PRECONDITIONER, prof_start,
+	       2 * Xin.n * (double) Xin.p * sizeof(scalar));
 }
 
 void maxwell_target_preconditioner(evectmatrix Xin, evectmatrix Xout, 
@@ -91,20 +99,25 @@ void maxwell_target_preconditioner(evectmatrix Xin, evectmatrix Xout,
      real omega_sqr = td->target_frequency * td->target_frequency;
 #endif
      int i, c, b;
-     real *kpGn2 = d->k_plus_G_normsqr;
+     prof_clock_t prof_start = 0;
 
      (void) Y; /* unused */
 #if !PRECOND_SUBTR_EIGS
      (void) eigenvals; /* unused */
 #endif
 
+     PROF_START(prof_start);
      evectmatrix_XeYS(Xout, Xin, YtY, 1);
 
+#ifdef USE_OPENMP
+#pragma omp parallel for private(c, b)
+#endif
      for (i = 0; i < Xout.localN; ++i) {
+	  real kpGn2 = MAXWELL_KPG_NORMSQR(d, i);
 	  for (c = 0; c < Xout.c; ++c) {
 	       for (b = 0; b < Xout.p; ++b) {
-		    int index = (i * Xout.c + c) * Xout.p + b;
-		    real scale = kpGn2[i] * d->eps_inv_mean;
+		    int index = (i * Xout.c + c) * Xout.fd + b;
+		    real scale = kpGn2 * d->eps_inv_mean;
 
 #if PRECOND_SUBTR_EIGS
 		    scale -= omega_sqr;
@@ -131,6 +144,8 @@ void maxwell_target_preconditioner(evectmatrix Xin, evectmatrix Xout,
 	       }
 	  }
      }
+     PROF_STOP(PROF_PRECONDITIONER, prof_start,
+	       2 * Xin.n * (double) Xin.p * sizeof(scalar));
 }
 
 /**************************************************************************/
@@ -206,6 +221,123 @@ static void assign_crossinv_c2t(scalar *v, int vstride,
                    scale * SCALAR_IM(at0));
 }
 
+/* The fancy preconditioner (below) for 2d TE or TM states, where only
+   nc = 2 (TE) or 1 (TM) components of the fields are non-zero (see
+   the TE/TM operators in maxwell_op.c).  Here, the approximate inverse
+   of eps_inv is the inverse of the average of its xy block (TE), or
+   the exact inverse of its zz component (TM).  Operates in-place. */
+static void precondition2_te_tm(evectmatrix X, maxwell_data *d, int nc)
+{
+     int cur_band_start;
+     scalar *fft_data, *fft_data2;
+     scalar_complex *cdata;
+     real scale;
+     int i, j, b;
+
+     fft_data = d->fft_data;
+     fft_data2 = d->fft_data2;
+     cdata = (scalar_complex *) fft_data;
+
+     scale = -1.0 / X.N;  /* scale factor to normalize FFT;
+                             negative sign comes from 2 i's from curls */
+
+     for (cur_band_start = 0; cur_band_start < X.p;
+          cur_band_start += d->num_fft_bands) {
+          int cur_num_bands = MIN2(d->num_fft_bands, X.p - cur_band_start);
+
+	  /* inverse curl: a = -1/|k+G| H0 n (TE) or 1/|k+G| H1 m (TM) */
+#ifdef USE_OPENMP
+#pragma omp parallel for private(j, b)
+#endif
+	  for (i = 0; i < d->other_dims; ++i)
+	       for (j = 0; j < d->last_dim; ++j) {
+		    int ij = i * d->last_dim + j;
+		    int ij2 = i * d->last_dim_size + j;
+		    k_data cur_k;
+		    real kmag_inv;
+		    MAXWELL_K_DATA(cur_k, d, ij);
+		    kmag_inv = -1.0 / FIX_DENOM(cur_k.kmag);
+
+		    for (b = 0; b < cur_num_bands; ++b) {
+			 scalar *a = &fft_data2[nc * (ij2*cur_num_bands + b)];
+			 const scalar *v = &X.data[ij * 2 * X.fd +
+						   b + cur_band_start];
+			 if (nc == 2) {
+			      ASSIGN_SCALAR(a[0],
+					    SCALAR_RE(v[0])*cur_k.nx*kmag_inv,
+					    SCALAR_IM(v[0])*cur_k.nx*kmag_inv);
+			      ASSIGN_SCALAR(a[1],
+					    SCALAR_RE(v[0])*cur_k.ny*kmag_inv,
+					    SCALAR_IM(v[0])*cur_k.ny*kmag_inv);
+			 }
+			 else
+			      ASSIGN_SCALAR(a[0],
+					    -(SCALAR_RE(v[X.fd])*cur_k.mz)
+					    * kmag_inv,
+					    -(SCALAR_IM(v[X.fd])*cur_k.mz)
+					    * kmag_inv);
+		    }
+	       }
+
+	  maxwell_compute_fft(+1, d, fft_data2, fft_data,
+			      cur_num_bands*nc, cur_num_bands*nc, 1);
+
+	  /* multiply by (approximate) epsilon in position space: */
+#ifdef USE_OPENMP
+#pragma omp parallel for private(b)
+#endif
+	  for (i = 0; i < d->fft_output_size; ++i) {
+	       symmetric_matrix_xy m;
+	       real zz, eps;
+	       scalar_complex *v = cdata + nc * i * cur_num_bands;
+	       maxwell_te_tm_eps_inv(d, i, nc, &m, &zz);
+	       eps = nc == 2 ? 2.0 / (m.m00 + m.m11) : 1.0 / zz;
+	       for (b = 0; b < nc * cur_num_bands; ++b) {
+		    v[b].re *= eps;
+		    v[b].im *= eps;
+	       }
+	  }
+
+          maxwell_compute_fft(-1, d, fft_data, fft_data2,
+			      cur_num_bands*nc, cur_num_bands*nc, 1);
+
+	  /* second inverse curl: */
+#ifdef USE_OPENMP
+#pragma omp parallel for private(j, b)
+#endif
+          for (i = 0; i < d->other_dims; ++i)
+               for (j = 0; j < d->last_dim; ++j) {
+                    int ij = i * d->last_dim + j;
+                    int ij2 = i * d->last_dim_size + j;
+                    k_data cur_k;
+		    real s;
+                    MAXWELL_K_DATA(cur_k, d, ij);
+		    s = -scale / FIX_DENOM(cur_k.kmag);
+
+                    for (b = 0; b < cur_num_bands; ++b) {
+			 scalar *v = &X.data[ij * 2 * X.fd +
+					     b + cur_band_start];
+			 const scalar *a = &fft_data2[nc * (ij2*cur_num_bands
+							    + b)];
+			 if (nc == 2) {
+			      ASSIGN_SCALAR(v[0],
+					    - s * (SCALAR_RE(a[0])*cur_k.nx +
+						   SCALAR_RE(a[1])*cur_k.ny),
+					    - s * (SCALAR_IM(a[0])*cur_k.nx +
+						   SCALAR_IM(a[1])*cur_k.ny));
+			      ASSIGN_ZERO(v[X.fd]);
+			 }
+			 else {
+			      ASSIGN_ZERO(v[0]);
+			      ASSIGN_SCALAR(v[X.fd],
+					    s * (SCALAR_RE(a[0])*cur_k.mz),
+					    s * (SCALAR_IM(a[0])*cur_k.mz));
+			 }
+		    }
+	       }
+     }
+}
+
 /* Fancy preconditioner.  This is very similar to maxwell_op, except that
    the steps are (approximately) inverted: */
 
@@ -214,11 +346,12 @@ void maxwell_preconditioner2(evectmatrix Xin, evectmatrix Xout, void *data,
 			     sqmatrix YtY)
 {
      maxwell_data *d = (maxwell_data *) data;
-     int cur_band_start;
+     int cur_band_start, nc;
      scalar *fft_data, *fft_data2;
      scalar_complex *cdata;
      real scale;
      int i, j, b;
+     prof_clock_t prof_start = 0;
 
      (void) Y; /* unused */
      (void) eigenvals; /* unused */
@@ -226,9 +359,17 @@ void maxwell_preconditioner2(evectmatrix Xin, evectmatrix Xout, void *data,
      CHECK(d, "null maxwell data pointer!");
      CHECK(Xin.c == 2, "fields don't have 2 components!");
 
+     PROF_START(prof_start);
      if (Xout.data != Xin.data)
 	  evectmatrix_XeYS(Xout, Xin, YtY, 1);
 
+     if ((nc = maxwell_te_tm_components(d)) < 3) {
+	  precondition2_te_tm(Xout, d, nc);
+	  PROF_STOP(PROF_PRECONDITIONER, prof_start,
+		    2 * Xin.n * (double) Xin.p * sizeof(scalar));
+	  return;
+     }
+
      fft_data = d->fft_data;
      fft_data2 = d->fft_data2;
      cdata = (scalar_complex *) fft_data;
@@ -243,19 +384,23 @@ void maxwell_preconditioner2(evectmatrix Xin, evectmatrix Xout, void *data,
           /********************************************/
 	  /* Compute approx. inverse of curl (inverse cross product with k): */
 
+#ifdef USE_OPENMP
+#pragma omp parallel for private(j, b)
+#endif
 	  for (i = 0; i < d->other_dims; ++i)
 	       for (j = 0; j < d->last_dim; ++j) {
 		    int ij = i * d->last_dim + j;
 		    int ij2 = i * d->last_dim_size + j;
-		    k_data cur_k = d->k_plus_G[ij];
+		    k_data cur_k;
+		    MAXWELL_K_DATA(cur_k, d, ij);
 		    
 		    for (b = 0; b < cur_num_bands; ++b)
 			 assign_crossinv_t2c(&fft_data2[3 * (ij2*cur_num_bands
 							    + b)],
 					     cur_k,
-					     &Xout.data[ij * 2 * Xout.p +
+					     &Xout.data[ij * 2 * Xout.fd +
 						      b + cur_band_start],
-					     Xout.p);
+					     Xout.fd);
 	       }
 
 	  /********************************************/
@@ -268,6 +413,9 @@ void maxwell_preconditioner2(evectmatrix Xin, evectmatrix Xout, void *data,
 	  /* multiply by epsilon in position space.  Don't bother to
 	     invert the whole epsilon-inverse tensor; just take the
 	     inverse of the average epsilon-inverse (= trace / 3). */
+#ifdef USE_OPENMP
+#pragma omp parallel for private(b)
+#endif
 	  for (i = 0; i < d->fft_output_size; ++i) {
 	       symmetric_matrix eps_inv = d->eps_inv[i];
 	       real eps = 3.0 / (eps_inv.m00 + eps_inv.m11 + eps_inv.m22);
@@ -289,16 +437,20 @@ void maxwell_preconditioner2(evectmatrix Xin, evectmatrix Xout, void *data,
 	  /********************************************/
 	  /* Finally, do second inverse curl (inverse cross product with k): */
 
+#ifdef USE_OPENMP
+#pragma omp parallel for private(j, b)
+#endif
           for (i = 0; i < d->other_dims; ++i)
                for (j = 0; j < d->last_dim; ++j) {
                     int ij = i * d->last_dim + j;
                     int ij2 = i * d->last_dim_size + j;
-                    k_data cur_k = d->k_plus_G[ij];
+                    k_data cur_k;
+                    MAXWELL_K_DATA(cur_k, d, ij);
 
                     for (b = 0; b < cur_num_bands; ++b)
-                         assign_crossinv_c2t(&Xout.data[ij * 2 * Xout.p +
+                         assign_crossinv_c2t(&Xout.data[ij * 2 * Xout.fd +
 						       b + cur_band_start],
-					     Xout.p,
+					     Xout.fd,
 					     cur_k,
 					     &fft_data2[3 * (ij2*cur_num_bands
 							    + b)],
@@ -308,6 +460,8 @@ void maxwell_preconditioner2(evectmatrix Xin, evectmatrix Xout, void *data,
           /********************************************/
 
      } /* end of cur_band_start loop */
+     PROF_STOP(PROF_PRECONDITIONER, prof_start,
+	       2 * Xin.n * (double) Xin.p * sizeof(scalar));
 }
 
 void maxwell_target_preconditioner2(evectmatrix Xin, evectmatrix Xout,
@@ -0,0 +1,134 @@
+/* Copyright (C) 1999-2014 Massachusetts Institute of Technology.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "config.h"
+#include <check.h>
+
+#include "arena.h"
+
+/* Each buffer is preceded by a header recording its size class, which
+   doubles as the link in the free list when the buffer is not in use.
+   The header is padded so that the buffer has the same alignment as
+   the pointer returned by malloc. */
+union arena_block_u {
+     struct {
+	  arena_block *next; /* next free block of the same class */
+	  int size_class;
+     } h;
+     double align[2];
+};
+
+/* the smallest size class is 2^MIN_SHIFT bytes; above that, there are
+   four classes per power of two, spaced by 1/4 of the power. */
+#define MIN_SHIFT 6
+
+static int size_class(size_t n)
+{
+     int e = MIN_SHIFT;
+     size_t quarter;
+
+     if (n <= ((size_t) 1 << MIN_SHIFT))
+	  return 0;
+     CHECK(n <= ((size_t) 1 << (sizeof(size_t) * 8 - 2)),
+	   "arena allocation is too large");
+     while ((n - 1) >> (e + 1)) /* find e such that 2^e < n <= 2^(e+1) */
+	  ++e;
+     quarter = ((size_t) 1 << e) / 4;
+     return (e - MIN_SHIFT) * 4
+	  + (int) ((n - ((size_t) 1 << e) + quarter - 1) / quarter);
+}
+
+static size_t class_size(int c)
+{
+     int e;
+     if (c == 0)
+	  return (size_t) 1 << MIN_SHIFT;
+     e = MIN_SHIFT + (c - 1) / 4;
+     return ((size_t) 1 << e) + ((size_t) ((c - 1) % 4 + 1) << (e - 2));
+}
+
+void arena_init(arena *a)
+{
+     int c;
+     for (c = 0; c < ARENA_NUM_CLASSES; ++c)
+	  a->free_list[c] = NULL;
+     a->bytes_held = a->bytes_in_use = a->high_water = 0;
+     a->nalloc = a->nreuse = 0;
+}
+
+/* Return a buffer of at least n bytes from the arena a, which must
+   be returned with arena_free(a, p). */
+void *arena_alloc(arena *a, size_t n)
+{
+     int c = size_class(n);
+     size_t size = class_size(c);
+     arena_block *b = a->free_list[c];
+
+     if (b) {
+	  a->free_list[c] = b->h.next;
+	  a->nreuse += 1;
+     }
+     else {
+	  b = (arena_block *) malloc(sizeof(arena_block) + size);
+	  CHECK(b, "out of memory!");
+	  b->h.size_class = c;
+	  a->bytes_held += size;
+     }
+     a->nalloc += 1;
+     a->bytes_in_use += size;
+     if (a->bytes_in_use > a->high_water)
+	  a->high_water = a->bytes_in_use;
+     return (void *) (b + 1);
+}
+
+/* Return p (from arena_alloc(a, ...), or NULL) to the free list of a;
+   the memory is kept for reuse until arena_reset(a). */
+void arena_free(arena *a, void *p)
+{
+     arena_block *b;
+     int c;
+
+     if (!p)
+	  return;
+     b = ((arena_block *) p) - 1;
+     c = b->h.size_class;
+     CHECK(c >= 0 && c < ARENA_NUM_CLASSES, "arena_free of invalid pointer");
+     if (c < 0 || c >= ARENA_NUM_CLASSES)
+	  return; /* not reached; tells the compiler that c is in range */
+     b->h.next = a->free_list[c];
+     a->free_list[c] = b;
+     a->bytes_in_use -= class_size(c);
+}
+
+/* Release all of the cached memory of a back to the system, and
+   reset its statistics.  None of the buffers may be in use. */
+void arena_reset(arena *a)
+{
+     int c;
+
+     CHECK(a->bytes_in_use == 0, "arena_reset called with buffers in use");
+     for (c = 0; c < ARENA_NUM_CLASSES; ++c)
+	  while (a->free_list[c]) {
+	       arena_block *b = a->free_list[c];
+	       a->free_list[c] = b->h.next;
+	       free(b);
+	  }
+     arena_init(a);
+}
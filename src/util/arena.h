@@ -0,0 +1,63 @@
+/* Copyright (C) 1999-2014 Massachusetts Institute of Technology.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/* An arena is a cache of scratch buffers, for temporaries that are
+   allocated and freed over and over again (e.g. on every k point) with
+   the same sizes.  Requests are rounded up to one of a set of size
+   classes (four per power of two, so that at most 25% is wasted), and
+   arena_free puts a buffer on the free list of its class instead of
+   returning it to the system, so that the next arena_alloc of a
+   similar size reuses it without a new malloc (and the page faults
+   that come with it for large buffers).
+
+   Nothing is returned to the system until arena_reset, which must only
+   be called when none of the buffers are in use.  An arena that is all
+   zeros (e.g. a global variable) is a valid empty arena.
+
+   Like the rest of the code, arenas are not thread-safe; they are meant
+   to be used outside of the parallel loops. */
+
+#define ARENA_NUM_CLASSES 256
+
+typedef union arena_block_u arena_block;
+
+typedef struct {
+     arena_block *free_list[ARENA_NUM_CLASSES];
+     size_t bytes_held; /* bytes obtained from malloc, in use or cached */
+     size_t bytes_in_use;
+     size_t high_water; /* maximum bytes_in_use since the last reset */
+     double nalloc; /* number of arena_alloc calls */
+     double nreuse; /* ...of which were satisfied from the free lists */
+} arena;
+
+extern void arena_init(arena *a);
+extern void *arena_alloc(arena *a, size_t n);
+extern void arena_free(arena *a, void *p);
+extern void arena_reset(arena *a);
+
+/* analogous to CHK_MALLOC in check.h, except that p must be
+   deallocated by arena_free(a, p) rather than free(p) */
+#define ARENA_MALLOC(a, p, t, n) { \
+     (p) = (t *) arena_alloc(a, sizeof(t) * (n)); \
+}
+
+#endif /* ARENA_H */
@@ -0,0 +1,133 @@
+/* Copyright (C) 1999-2014 Massachusetts Institute of Technology.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "config.h"
+#include <check.h>
+
+#ifdef HAVE_SYS_MMAN_H
+#  include <sys/mman.h>
+#endif
+
+#include "bigmem.h"
+
+int bigmem_policy = BIGMEM_DEFAULT;
+int bigmem_first_touch = 0;
+
+/* The size of a huge page; this is the default on x86-64 (and on
+   aarch64 with 4k pages), and is only used for alignment, so it does
+   not hurt much if the actual huge pages are larger. */
+#define HUGE_PAGE_SIZE ((size_t) 2 * 1024 * 1024)
+
+/* alignment of the arrays (enough for any SIMD instructions) */
+#define ALIGNMENT 64
+
+#if defined(HAVE_SYS_MMAN_H) && defined(MAP_HUGETLB)
+#  define USE_HUGETLB 1
+#endif
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MADVISE) && defined(MADV_HUGEPAGE)
+#  define USE_MADV_HUGEPAGE 1
+#endif
+
+/* Each array is preceded by a header that says how to deallocate it. */
+typedef struct {
+     void *base; /* the address returned by malloc or mmap */
+     size_t len; /* the length of the mmap */
+     int mapped; /* whether base is from mmap (vs. malloc) */
+} bigmem_header;
+
+static size_t round_up(size_t n, size_t m)
+{
+     return ((n + m - 1) / m) * m;
+}
+
+void *bigmem_malloc(size_t n, int nchunks)
+{
+     bigmem_header h;
+     char *data = NULL;
+
+     if (n == 0)
+	  return NULL;
+
+#ifdef USE_HUGETLB
+     if (bigmem_policy == BIGMEM_HUGETLB && n >= HUGE_PAGE_SIZE) {
+	  size_t len = round_up(n + ALIGNMENT, HUGE_PAGE_SIZE);
+	  void *base = mmap(NULL, len, PROT_READ | PROT_WRITE,
+			    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	  if (base != MAP_FAILED) {
+	       h.base = base;
+	       h.len = len;
+	       h.mapped = 1;
+	       data = (char *) base + ALIGNMENT;
+	  }
+     }
+#endif
+
+     if (!data) {
+	  size_t align = ALIGNMENT;
+#ifdef USE_MADV_HUGEPAGE
+	  if (bigmem_policy != BIGMEM_DEFAULT && n >= HUGE_PAGE_SIZE)
+	       align = HUGE_PAGE_SIZE;
+#endif
+	  h.base = malloc(n + align + sizeof(bigmem_header));
+	  CHECK(h.base, "out of memory!");
+	  h.len = 0;
+	  h.mapped = 0;
+	  data = (char *) h.base + sizeof(bigmem_header);
+	  data += (align - ((size_t) data) % align) % align;
+#ifdef USE_MADV_HUGEPAGE
+	  /* only whole huge pages can be backed by huge pages: */
+	  if (align == HUGE_PAGE_SIZE)
+	       madvise(data, (n / HUGE_PAGE_SIZE) * HUGE_PAGE_SIZE,
+		       MADV_HUGEPAGE);
+#endif
+     }
+
+     memcpy(data - sizeof(bigmem_header), &h, sizeof(bigmem_header));
+
+     if (bigmem_first_touch && nchunks > 0) {
+	  int i;
+#ifdef USE_OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+	  for (i = 0; i < nchunks; ++i) {
+	       size_t start = n * i / nchunks, end = n * (i + 1) / nchunks;
+	       memset(data + start, 0, end - start);
+	  }
+     }
+
+     return (void *) data;
+}
+
+void bigmem_free(void *p)
+{
+     bigmem_header h;
+
+     if (!p)
+	  return;
+     memcpy(&h, (char *) p - sizeof(bigmem_header), sizeof(bigmem_header));
+#ifdef USE_HUGETLB
+     if (h.mapped) {
+	  munmap(h.base, h.len);
+	  return;
+     }
+#endif
+     free(h.base);
+}
@@ -0,0 +1,61 @@
+/* Copyright (C) 1999-2014 Massachusetts Institute of Technology.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef BIGMEM_H
+#define BIGMEM_H
+
+#include <stddef.h>
+
+/* Allocation of the big arrays (the eigenvectors and the FFT data),
+   whose memory placement matters for large grids.  bigmem_policy
+   selects how the memory is obtained:
+
+   BIGMEM_DEFAULT: ordinary malloc.
+
+   BIGMEM_HUGE_PAGES: aligned to huge-page boundaries and marked with
+     madvise(MADV_HUGEPAGE), so that the kernel backs it with
+     transparent huge pages (if they are enabled in "madvise" mode or
+     better), reducing TLB misses.
+
+   BIGMEM_HUGETLB: mapped with mmap(MAP_HUGETLB) from the pool of
+     reserved huge pages (see /proc/sys/vm/nr_hugepages); if the pool
+     is exhausted, we fall back to BIGMEM_HUGE_PAGES.
+
+   Arrays smaller than a huge page always use malloc.  If the system
+   doesn't support a policy, it is silently equivalent to the default.
+
+   If bigmem_first_touch is set, the arrays are zeroed when they are
+   allocated, by the same OpenMP threads (with the same static
+   schedule) that process them in the Maxwell operator loops, which
+   divide an array of nchunks equal chunks among the threads.  Since
+   the operating system places each page on the NUMA node of the
+   thread that first touches it, this keeps each thread's data local.
+
+   The policy applies to arrays allocated after it is set, and the
+   arrays must be deallocated with bigmem_free. */
+
+typedef enum {
+     BIGMEM_DEFAULT = 0, BIGMEM_HUGE_PAGES = 1, BIGMEM_HUGETLB = 2
+} bigmem_policy_kind;
+
+extern int bigmem_policy;
+extern int bigmem_first_touch;
+
+extern void *bigmem_malloc(size_t n, int nchunks);
+extern void bigmem_free(void *p);
+
+#endif /* BIGMEM_H */
@@ -31,7 +31,24 @@ typedef double mpiglue_clock_t;
 #define MPIGLUE_CLOCK_DIFF(t2, t1) ((t2) - (t1))
 
 #define mpi_allreduce(sb, rb, n, ctype, t, op, comm) \
-     MPI_Allreduce(sb,rb,n,t,op,comm)
+     PROF_OP(PROF_REDUCTION, (n) * sizeof(ctype), \
+	     MPI_Allreduce(sb,rb,n,t,op,comm))
+
+/* Non-blocking reduction, so that communication can overlap computation:
+   rb is not valid until mpi_wait(req) is called.  (Requires MPI-3;
+   otherwise, we fall back on a blocking reduction.) */
+#if MPI_VERSION >= 3
+typedef MPI_Request mpiglue_request_t;
+#define mpi_iallreduce(sb, rb, n, ctype, t, op, comm, req) \
+     PROF_OP(PROF_REDUCTION, (n) * sizeof(ctype), \
+	     MPI_Iallreduce(sb,rb,n,t,op,comm,req))
+#define mpi_wait(req) MPI_Wait(req, MPI_STATUS_IGNORE)
+#else
+typedef int mpiglue_request_t;
+#define mpi_iallreduce(sb, rb, n, ctype, t, op, comm, req) { \
+     mpi_allreduce(sb,rb,n,ctype,t,op,comm); *(req) = 0; }
+#define mpi_wait(req) ((void) 0)
+#endif
 
 #else /* don't have MPI */
 
@@ -52,9 +69,16 @@ typedef double mpiglue_clock_t;
    for sb in order to be in-place, but I don't want to require that. */
 #define mpi_allreduce(sb, rb, n, ctype, t, op, comm) { \
      CHECK((sb) != (rb), "MPI_Allreduce doesn't work for sendbuf == recvbuf");\
-     memcpy((rb), (sb), (n) * sizeof(ctype)); \
+     PROF_OP(PROF_REDUCTION, (n) * sizeof(ctype), \
+	     memcpy((rb), (sb), (n) * sizeof(ctype))); \
 }
 
+typedef int mpiglue_request_t;
+#define mpi_iallreduce(sb, rb, n, ctype, t, op, comm, req) { \
+     PROF_OP(PROF_REDUCTION, (n) * sizeof(ctype), \
+	     memcpy((rb), (sb), (n) * sizeof(ctype))); *(req) = 0; }
+#define mpi_wait(req) ((void) 0)
+
 #define MPI_Bcast(b, n, t, root, comm) 0
 
 #define MPI_Abort(comm, errcode) exit(errcode)
@@ -79,4 +103,7 @@ typedef clock_t mpiglue_clock_t;
 
 #endif /* HAVE_MPI */
 
+/* the reductions above are timed for the profiling report: */
+#include <prof.h>
+
 #endif /* MPIGLUE_H */
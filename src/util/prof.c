@@ -0,0 +1,111 @@
+/* Copyright (C) 1999-2014 Massachusetts Institute of Technology.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "config.h"
+#include <check.h>
+#include <mpiglue.h>
+#include "mpi_utils.h"
+
+#if defined(HAVE_MPI)
+/* use MPI_Wtime */
+#elif defined(USE_OPENMP)
+#  include <omp.h>
+#elif defined(HAVE_GETTIMEOFDAY) && defined(HAVE_SYS_TIME_H)
+#  include <sys/time.h>
+#else
+#  include <time.h>
+#endif
+
+#include "prof.h"
+
+int prof_enabled = 0;
+prof_counter prof_counters[PROF_NUM_PHASES];
+
+prof_clock_t prof_clock(void)
+{
+#if defined(HAVE_MPI)
+     return MPI_Wtime();
+#elif defined(USE_OPENMP)
+     return omp_get_wtime();
+#elif defined(HAVE_GETTIMEOFDAY) && defined(HAVE_SYS_TIME_H)
+     struct timeval tv;
+     gettimeofday(&tv, NULL);
+     return tv.tv_sec + tv.tv_usec * 1e-6;
+#else
+     return clock() * 1.0 / CLOCKS_PER_SEC; /* CPU time, as a last resort */
+#endif
+}
+
+const char *prof_phase_name(int phase)
+{
+     static const char *names[PROF_NUM_PHASES] = {
+	  "operator", "fft", "epsilon", "preconditioner",
+	  "gemm", "reduction", "constraint", "deflation"
+     };
+     CHECK(phase >= 0 && phase < PROF_NUM_PHASES, "invalid profiling phase");
+     return names[phase];
+}
+
+void prof_add(int phase, double time, double bytes)
+{
+     prof_counters[phase].time += time;
+     prof_counters[phase].count += 1;
+     prof_counters[phase].bytes += bytes;
+}
+
+void prof_reset(prof_counter *c)
+{
+     int i;
+     for (i = 0; i < PROF_NUM_PHASES; ++i)
+	  c[i].time = c[i].count = c[i].bytes = 0;
+}
+
+void prof_accumulate(prof_counter *sum, const prof_counter *c)
+{
+     int i;
+     for (i = 0; i < PROF_NUM_PHASES; ++i) {
+	  sum[i].time += c[i].time;
+	  sum[i].count += c[i].count;
+	  sum[i].bytes += c[i].bytes;
+     }
+}
+
+/* Combine the counters c of all the processes into out (which may
+   not be the same as c): the time and call count are the maxima over
+   the processes (the slowest process determines the elapsed time),
+   while the bytes are the totals. */
+void prof_allreduce(const prof_counter *c, prof_counter *out)
+{
+     double *bytes, *bytes_sum;
+     int i;
+
+     mpi_allreduce((double *) c, (double *) out, 3 * PROF_NUM_PHASES,
+		   double, MPI_DOUBLE, MPI_MAX, mpb_comm);
+
+     CHK_MALLOC(bytes, double, 2 * PROF_NUM_PHASES);
+     bytes_sum = bytes + PROF_NUM_PHASES;
+     for (i = 0; i < PROF_NUM_PHASES; ++i)
+	  bytes[i] = c[i].bytes;
+     mpi_allreduce(bytes, bytes_sum, PROF_NUM_PHASES,
+		   double, MPI_DOUBLE, MPI_SUM, mpb_comm);
+     for (i = 0; i < PROF_NUM_PHASES; ++i)
+	  out[i].bytes = bytes_sum[i];
+     free(bytes);
+}
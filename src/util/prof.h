@@ -0,0 +1,75 @@
+/* Copyright (C) 1999-2014 Massachusetts Institute of Technology.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef PROF_H
+#define PROF_H
+
+#include <mpiglue.h>
+
+/* Accumulated timings of the main phases of an eigensolver run, for
+   profiling.  For each phase, we record the elapsed time, the number
+   of calls, and the number of bytes of (local) data operated on or
+   communicated.  The phases nest (e.g. the FFTs are also part of an
+   operator or preconditioner application), so the times are
+   inclusive and do not add up to the total.
+
+   Nothing is recorded unless prof_enabled is set; the caller (e.g. mpb)
+   resets and reports prof_counters as it sees fit. */
+
+typedef enum {
+     PROF_OPERATOR, PROF_FFT, PROF_EPSILON, PROF_PRECONDITIONER,
+     PROF_GEMM, PROF_REDUCTION, PROF_CONSTRAINT, PROF_DEFLATION,
+     PROF_NUM_PHASES
+} prof_phase;
+
+typedef struct {
+     double time; /* seconds */
+     double count; /* number of calls */
+     double bytes;
+} prof_counter;
+
+extern int prof_enabled;
+extern prof_counter prof_counters[PROF_NUM_PHASES];
+
+extern const char *prof_phase_name(int phase);
+extern void prof_add(int phase, double time, double bytes);
+extern void prof_reset(prof_counter *c);
+extern void prof_accumulate(prof_counter *sum, const prof_counter *c);
+extern void prof_allreduce(const prof_counter *c, prof_counter *out);
+
+/* Wall-clock time in seconds (from an arbitrary origin).  Unlike
+   MPIGLUE_CLOCK without MPI, which is the CPU time of the process (and
+   so counts the time of all OpenMP threads), this is the elapsed time,
+   which is what the phases are compared by. */
+typedef double prof_clock_t;
+extern prof_clock_t prof_clock(void);
+
+/* PROF_START(t) ... PROF_STOP(phase, t, nbytes) times the code in
+   between, where t is a prof_clock_t variable; PROF_OP does the
+   same for the single statement op (like TIME_OP in eigensolver.c). */
+#define PROF_START(t) { if (prof_enabled) (t) = prof_clock(); }
+#define PROF_STOP(phase, t, nbytes) { if (prof_enabled) \
+     prof_add(phase, prof_clock() - (t), nbytes); }
+
+#define PROF_OP(phase, nbytes, op) { \
+     prof_clock_t xxx_prof_op_start_time = 0; \
+     PROF_START(xxx_prof_op_start_time); \
+     op; \
+     PROF_STOP(phase, xxx_prof_op_start_time, nbytes); \
+}
+
+#endif /* PROF_H */
@@ -165,6 +165,15 @@ int main(void)
   printf("\nsqrtm(D) * sqrtm(D)\n");
   printmat(C,N,N);
 
+  /* CholeskyQR: with At * A = Rt * R, A * inverse(R) is orthonormal */
+  blasglue_herk('U', 'C', N, N, 1.0, A, N, 0.0, D, N);
+  lapackglue_potrf('U', N, D, N);
+  blasglue_copy(N*N, A, 1, C, 1);
+  blasglue_trsm('R', 'U', 'N', 'N', N, N, 1.0, D, N, C, N);
+  blasglue_gemm('C', 'N', N, N, N, 1.0, C, N, C, N, 0.0, E, N);
+  printf("\nQ = A / chol(A' * A); Q' * Q\n");
+  printmat(E,N,N);
+
   debug_check_memory_leaks();
 
   return EXIT_SUCCESS;
@@ -33,6 +33,8 @@ static sqmatrix A, Ainv, B;
 
 extern void Aop(evectmatrix Xin, evectmatrix Xout, void *data,
 		int is_current_eigenvector, evectmatrix Work);
+extern void Aop_scratch(evectmatrix Xin, evectmatrix Xout, void *data,
+			int is_current_eigenvector, evectmatrix Work);
 extern void Bop(evectmatrix Xin, evectmatrix Xout, void *data,
 		int is_current_eigenvector, evectmatrix Work);
 extern void Ainvop(evectmatrix Xin, evectmatrix Xout, void *data,
@@ -60,6 +62,7 @@ real norm_diff(scalar *a, scalar *b, int n)
 }
 
 #define NWORK 4
+#define NWORK_MAX 11 /* for eigensolver_lobpcg and eigensolver_jacobi_davidson */
 
 void rand_posdef(sqmatrix A, sqmatrix X)
 {
@@ -82,11 +85,158 @@ void rand_posdef(sqmatrix A, sqmatrix X)
 		     n * SCALAR_IM(A.data[i * n + i]));
 }
 
+/* Xout = M * Xin, for an n x n matrix M */
+static void sqmatrix_apply(sqmatrix M, evectmatrix Xin, evectmatrix Xout)
+{
+     blasglue_gemm('N', 'N', Xout.n, Xout.p, Xin.n,
+		   1.0, M.data, M.p, Xin.data, Xin.fd, 0.0, Xout.data, Xout.fd);
+}
+
+/* max |U - 1| over the elements of U */
+static real sqmatrix_identity_error(sqmatrix U)
+{
+     real err = 0.0;
+     int i, j;
+     for (i = 0; i < U.p; ++i)
+	  for (j = 0; j < U.p; ++j) {
+	       scalar u = U.data[i * U.p + j];
+	       real re = SCALAR_RE(u) - (i == j), im = SCALAR_IM(u);
+	       err = MAX(err, sqrt(re * re + im * im));
+	  }
+     return err;
+}
+
+/* Check evectmatrix_cholqr2 with random n x n matrices A and B: that
+   it B-orthonormalizes an ill-conditioned X, transforming B*X, A*X and
+   Xt A X consistently; that it recovers with the shifted pass when
+   Xt X does not factorize; and that it detects rank deficiency.  n
+   should be at least 10 p or so, so that the nearly dependent columns
+   of X below are still numerically independent. */
+static void check_cholqr2(int n, int p)
+{
+     sqmatrix Am, Bm, Mscratch, R, R2, M, M2, S;
+     evectmatrix X, BX, AX, Z;
+     scalar *scratch;
+     int i, j, npass;
+
+     Am = create_sqmatrix(n);
+     Bm = create_sqmatrix(n);
+     Mscratch = create_sqmatrix(n);
+     rand_posdef(Am, Mscratch);
+     rand_posdef(Bm, Mscratch);
+     R = create_sqmatrix(p);
+     R2 = create_sqmatrix(p);
+     M = create_sqmatrix(p);
+     M2 = create_sqmatrix(p);
+     S = create_sqmatrix(p);
+     X = create_evectmatrix(n, 1, p, n, 0, n);
+     BX = create_evectmatrix(n, 1, p, n, 0, n);
+     AX = create_evectmatrix(n, 1, p, n, 0, n);
+     Z = create_evectmatrix(n, 1, p, n, 0, n);
+     CHK_MALLOC(scratch, scalar, 2 * p * p);
+
+     printf("\nChecking CholeskyQR2 B-orthonormalization...\n");
+
+     /* nearly dependent columns: X[:,j] = X[:,0] + 1e-4 * random, for a
+	condition number of about 1e4, so that one pass is not enough
+	(it would leave an error of about 1e-8).  Since B*X, A*X and
+	Xt A X are transformed along with X rather than recomputed, they
+	(and hence Xt B X) have errors of order DBL_EPSILON * cond(X), or
+	cond(X)^2 for Xt A X, so the tolerances are set accordingly: */
+     for (i = 0; i < n; ++i) {
+	  ASSIGN_SCALAR(X.data[i * p],
+			rand() * 1.0 / RAND_MAX, rand() * 1.0 / RAND_MAX);
+	  for (j = 1; j < p; ++j)
+	       ASSIGN_SCALAR(X.data[i * p + j],
+			     SCALAR_RE(X.data[i * p])
+			     + 1e-4 * rand() / RAND_MAX,
+			     SCALAR_IM(X.data[i * p])
+			     + 1e-4 * rand() / RAND_MAX);
+     }
+     sqmatrix_apply(Bm, X, BX);
+     sqmatrix_apply(Am, X, AX);
+     evectmatrix_XtY(R, X, BX, S);
+     evectmatrix_XtY(M, X, AX, S);
+     npass = evectmatrix_cholqr2(X, BX, &AX, 1, R, &M, 0, S, scratch);
+     printf("ill-conditioned X: %d passes\n", npass);
+     CHECK(npass == (p > 1 ? 2 : 1), "wrong number of CholeskyQR passes");
+     sqmatrix_apply(Bm, X, Z);
+     evectmatrix_XtY(R, X, Z, S);
+     printf("|Xt B X - 1| = %g\n", sqmatrix_identity_error(R));
+     CHECK(sqmatrix_identity_error(R) < 1e-10, "X is not B-orthonormal");
+     CHECK(norm_diff(Z.data, BX.data, n * p) < 1e-10,
+	   "B*X was not transformed with X");
+     sqmatrix_apply(Am, X, Z);
+     CHECK(norm_diff(Z.data, AX.data, n * p) < 1e-10,
+	   "A*X was not transformed with X");
+     evectmatrix_XtY(M2, X, Z, S);
+     CHECK(norm_diff(M2.data, M.data, p * p) < 1e-5,
+	   "Xt A X was not transformed with X");
+
+     if (p > 1) {
+	  /* The shifted pass is taken when Xt X does not factorize, which
+	     happens through roundoff for nearly dependent columns.  To
+	     force it, make the last column of X nearly equal to the first,
+	     and pass in an indefinite Xt X, by subtracting twice the last
+	     Cholesky pivot (the small Schur complement) from its last
+	     diagonal element.  The shift is larger than the Schur
+	     complement, and the later passes use the exact Gram matrix, so
+	     X must still come out orthonormal.  (We use B = 1 here, since
+	     with cond(X) = 1e7 a transformed B*X would be inaccurate.) */
+	  for (i = 0; i < n; ++i) {
+	       for (j = 0; j < p - 1; ++j)
+		    ASSIGN_SCALAR(X.data[i * p + j], rand() * 1.0 / RAND_MAX,
+				  rand() * 1.0 / RAND_MAX);
+	       ASSIGN_SCALAR(X.data[i * p + p - 1],
+			     SCALAR_RE(X.data[i * p])
+			     + 1e-7 * rand() / RAND_MAX,
+			     SCALAR_IM(X.data[i * p])
+			     + 1e-7 * rand() / RAND_MAX);
+	  }
+	  evectmatrix_XtX(R, X, S);
+	  sqmatrix_copy(R2, R);
+	  CHECK(sqmatrix_cholesky(R2, 0.0), "X is not full rank");
+	  SCALAR_RE(R.data[p * p - 1]) -= 2 * SCALAR_NORMSQR(R2.data[p * p - 1]);
+	  npass = evectmatrix_cholqr2(X, X, NULL, 0, R, NULL, 0, S, scratch);
+	  printf("indefinite Xt X: %d passes\n", npass);
+	  CHECK(npass == 3, "shifted CholeskyQR pass was not taken");
+	  evectmatrix_XtX(R, X, S);
+	  printf("|Xt X - 1| = %g\n", sqmatrix_identity_error(R));
+	  CHECK(sqmatrix_identity_error(R) < 1e-12, "X is not orthonormal");
+     }
+
+     /* rank-deficient X (a zero column): */
+     for (i = 0; i < n * p; ++i)
+	  ASSIGN_SCALAR(X.data[i], rand() * 1.0 / RAND_MAX,
+			rand() * 1.0 / RAND_MAX);
+     for (i = 0; i < n; ++i)
+	  ASSIGN_ZERO(X.data[i * p + p - 1]);
+     sqmatrix_apply(Bm, X, BX);
+     evectmatrix_XtY(R, X, BX, S);
+     npass = evectmatrix_cholqr2(X, BX, NULL, 0, R, NULL, 1, S, scratch);
+     printf("rank-deficient X: %d passes\n", npass);
+     CHECK(npass == 0, "rank deficiency was not detected");
+
+     free(scratch);
+     destroy_evectmatrix(Z);
+     destroy_evectmatrix(AX);
+     destroy_evectmatrix(BX);
+     destroy_evectmatrix(X);
+     destroy_sqmatrix(S);
+     destroy_sqmatrix(M2);
+     destroy_sqmatrix(M);
+     destroy_sqmatrix(R2);
+     destroy_sqmatrix(R);
+     destroy_sqmatrix(Mscratch);
+     destroy_sqmatrix(Bm);
+     destroy_sqmatrix(Am);
+}
+
 int main(int argc, char **argv)
 {
      int i, j, n = 0, p, trial;
      sqmatrix X, U, YtY, Bcopy;
-     evectmatrix Y, Y2, Ystart, W[NWORK];
+     evectmatrix Y, Y2, Ystart, W[NWORK_MAX];
      real *eigvals, *eigvals_dense, sum = 0.0;
      int num_iters, nWork = NWORK;
      evectoperator bop = Bop;
@@ -135,7 +285,7 @@ int main(int argc, char **argv)
      Y = create_evectmatrix(n, 1, p, n, 0, n);
      Y2 = create_evectmatrix(n, 1, p, n, 0, n);
      Ystart = create_evectmatrix(n, 1, p, n, 0, n);
-     for (i = 0; i < nWork; ++i)
+     for (i = 0; i < NWORK_MAX; ++i)
          W[i] = create_evectmatrix(n, 1, p, n, 0, n);
      CHK_MALLOC(eigvals, real, p);
          
@@ -254,6 +404,119 @@ int main(int argc, char **argv)
          }
          printf("\nEigenvalue sum = %f\n", sum);
          
+         printf("\nSolving with band locking...\n");
+         evectmatrix_copy(Y, Ystart);
+         eigensolver(Y, eigvals, Aop,NULL, bop,NULL, Cop,NULL, NULL,NULL,
+                     W, nWork, 1e-10, &num_iters,
+                     EIGS_DEFAULT_FLAGS | EIGS_LOCK_BANDS);
+         printf("Solved for eigenvectors after %d iterations.\n", num_iters);
+         printf("\nEigenvalues = ");
+         for (sum = 0.0, i = 0; i < p; ++i) {
+              sum += eigvals[i];
+              printf("  %f", eigvals[i]);
+              CHECK(fabs(eigvals[i]-eigvals_dense[i]) < 1e-5 * eigvals_dense[i],
+                    "incorrect eigenvalue");
+         }
+         printf("\nEigenvalue sum = %f\n", sum);
+
+         printf("\nSolving with LOBPCG...\n");
+         evectmatrix_copy(Y, Ystart);
+         eigensolver_lobpcg(Y, eigvals, Aop,NULL, bop,NULL, Cop,NULL,
+                            NULL,NULL, W, bop ? 9 : 6, 1e-10, &num_iters,
+                            EIGS_DEFAULT_FLAGS);
+         printf("Solved for eigenvectors after %d iterations.\n", num_iters);
+         printf("\nEigenvalues = ");
+         for (sum = 0.0, i = 0; i < p; ++i) {
+             sum += eigvals[i];
+             printf("  %f", eigvals[i]);
+             CHECK(fabs(eigvals[i]-eigvals_dense[i]) < 1e-5 * eigvals_dense[i],
+                   "incorrect eigenvalue");
+         }
+         printf("\nEigenvalue sum = %f\n", sum);
+
+         printf("\nSolving with LOBPCG, without search directions...\n");
+         evectmatrix_copy(Y, Ystart);
+         eigensolver_lobpcg(Y, eigvals, Aop,NULL, bop,NULL, Cop,NULL,
+                            NULL,NULL, W, bop ? 6 : 4, 1e-10, &num_iters,
+                            EIGS_DEFAULT_FLAGS);
+         printf("Solved for eigenvectors after %d iterations.\n", num_iters);
+         printf("\nEigenvalues = ");
+         for (sum = 0.0, i = 0; i < p; ++i) {
+             sum += eigvals[i];
+             printf("  %f", eigvals[i]);
+             CHECK(fabs(eigvals[i]-eigvals_dense[i]) < 1e-5 * eigvals_dense[i],
+                   "incorrect eigenvalue");
+         }
+         printf("\nEigenvalue sum = %f\n", sum);
+
+         printf("\nSolving with thick-restarted Davidson...\n");
+         evectmatrix_copy(Y, Ystart);
+         eigensolver_davidson(Y, eigvals, Aop,NULL, bop,NULL, Cop,NULL,
+                              NULL,NULL, W, bop ? 9 : 6, 1e-10, &num_iters,
+                              EIGS_DEFAULT_FLAGS, 0.0);
+         printf("Solved for eigenvectors after %d iterations.\n", num_iters);
+         printf("\nEigenvalues = ");
+         for (sum = 0.0, i = 0; i < p; ++i) {
+             sum += eigvals[i];
+             printf("  %f", eigvals[i]);
+             CHECK(fabs(eigvals[i]-eigvals_dense[i]) < 1e-5 * eigvals_dense[i],
+                   "incorrect eigenvalue");
+         }
+         printf("\nEigenvalue sum = %f\n", sum);
+
+         if (!bop) {
+             printf("\nSolving with Chebyshev-filtered subspace iteration...\n");
+             evectmatrix_copy(Y, Ystart);
+             eigensolver_chebyshev(Y, eigvals, Aop_scratch,NULL, NULL,NULL,
+                                   W, 4, 0,
+                                   1e-10, &num_iters, EIGS_DEFAULT_FLAGS);
+             printf("Solved for eigenvectors after %d iterations.\n",
+                    num_iters);
+             printf("\nEigenvalues = ");
+             for (sum = 0.0, i = 0; i < p; ++i) {
+                  sum += eigvals[i];
+                  printf("  %f", eigvals[i]);
+                  CHECK(fabs(eigvals[i]-eigvals_dense[i])
+                        < 1e-5 * eigvals_dense[i], "incorrect eigenvalue");
+             }
+             printf("\nEigenvalue sum = %f\n", sum);
+         }
+
+         if (!bop) {
+             real target = 0.5 * (eigvals_dense[n/2-1] + eigvals_dense[n/2]);
+             int jprev = -1;
+
+             /* an interior eigensolver need not find exactly the p
+                eigenvalues closest to the target, so we only check that
+                it finds p distinct eigenvalues in the neighborhood: */
+             printf("\nSolving with Jacobi-Davidson for eigenvalues near %f...\n",
+                    target);
+             evectmatrix_copy(Y, Ystart);
+             eigensolver_jacobi_davidson(Y, eigvals, Aop,NULL, Cop,NULL,
+                                         NULL,NULL, W, NWORK_MAX, target, 0,
+                                         1e-10, &num_iters,
+                                         EIGS_DEFAULT_FLAGS);
+             printf("Solved for eigenvectors after %d iterations.\n",
+                    num_iters);
+             printf("\nEigenvalues = ");
+             for (sum = 0.0, i = 0; i < p; ++i) {
+                  int j, jbest = 0;
+                  sum += eigvals[i];
+                  printf("  %f", eigvals[i]);
+                  for (j = 1; j < n; ++j)
+                       if (fabs(eigvals[i] - eigvals_dense[j]) <
+                           fabs(eigvals[i] - eigvals_dense[jbest]))
+                            jbest = j;
+                  CHECK(fabs(eigvals[i]-eigvals_dense[jbest])
+                        < 1e-5 * fabs(eigvals_dense[jbest]),
+                        "incorrect eigenvalue");
+                  CHECK(jbest > jprev && jbest >= n/2 - p && jbest < n/2 + p,
+                        "eigenvalue not near target");
+                  jprev = jbest;
+             }
+             printf("\nEigenvalue sum = %f\n", sum);
+         }
+
          printf("\nSolving without conjugate-gradient or preconditioning...\n");
          evectmatrix_copy(Y, Ystart);
          eigensolver(Y, eigvals, Aop,NULL, bop,NULL, NULL,NULL, NULL,NULL,
@@ -269,6 +532,8 @@ int main(int argc, char **argv)
          printf("\nEigenvalue sum = %f\n", sum);
      }
 
+     check_cholqr2(MAX(n, 10 * p), p);
+
      destroy_sqmatrix(A);
      destroy_sqmatrix(B);
      destroy_sqmatrix(Bcopy);
@@ -279,7 +544,7 @@ int main(int argc, char **argv)
      destroy_evectmatrix(Y);
      destroy_evectmatrix(Y2);
      destroy_evectmatrix(Ystart);
-     for (i = 0; i < nWork; ++i)
+     for (i = 0; i < NWORK_MAX; ++i)
 	  destroy_evectmatrix(W[i]);
 
      free(eigvals);
@@ -297,7 +562,20 @@ void Aop(evectmatrix Xin, evectmatrix Xout, void *data,
 	   "matrices not conformant");
 
      blasglue_gemm('N', 'N', Xout.n, Xout.p, Xin.n,
-		   1.0, A.data, A.p, Xin.data, Xin.p, 0.0, Xout.data, Xout.p);
+		   1.0, A.data, A.p, Xin.data, Xin.fd, 0.0, Xout.data, Xout.fd);
+}
+
+/* Aop, computed via the Work array (as maxwell_target_operator does),
+   to check that the eigensolver gives it a scratch array it doesn't
+   need. */
+void Aop_scratch(evectmatrix Xin, evectmatrix Xout, void *data,
+		 int is_current_eigenvector, evectmatrix Work)
+{
+     CHECK(Work.p >= Xin.p && Work.data != Xin.data && Work.data != Xout.data,
+	   "invalid scratch array");
+     evectmatrix_resize(&Work, Xin.p, 0);
+     Aop(Xin, Work, data, is_current_eigenvector, Work);
+     evectmatrix_copy(Xout, Work);
 }
 
 void Bop(evectmatrix Xin, evectmatrix Xout, void *data,
@@ -307,7 +585,7 @@ void Bop(evectmatrix Xin, evectmatrix Xout, void *data,
 	   "matrices not conformant");
 
      blasglue_gemm('N', 'N', Xout.n, Xout.p, Xin.n,
-		   1.0, B.data, B.p, Xin.data, Xin.p, 0.0, Xout.data, Xout.p);
+		   1.0, B.data, B.p, Xin.data, Xin.fd, 0.0, Xout.data, Xout.fd);
 }
 
 void Ainvop(evectmatrix Xin, evectmatrix Xout, void *data,
@@ -318,7 +596,7 @@ void Ainvop(evectmatrix Xin, evectmatrix Xout, void *data,
 
      blasglue_gemm('N', 'N', Xout.n, Xout.p, Xin.n,
 		   1.0, Ainv.data, Ainv.p,
-		   Xin.data, Xin.p, 0.0, Xout.data, Xout.p);
+		   Xin.data, Xin.fd, 0.0, Xout.data, Xout.fd);
 }
 
 void Cop_old(evectmatrix Xin, evectmatrix Xout, void *data,
@@ -338,8 +616,8 @@ void Cop_old(evectmatrix Xin, evectmatrix Xout, void *data,
 	  diag = (diag == 0.0) ? 1.0 : 1.0 / sqrt(diag);
 	  
 	  for (ip = 0; ip < Xout.p; ++ip) {
-	       scalar xin = Xout.data[in * Xout.p + ip];
-	       ASSIGN_SCALAR(Xout.data[in * Xout.p + ip],
+	       scalar xin = Xout.data[in * Xout.fd + ip];
+	       ASSIGN_SCALAR(Xout.data[in * Xout.fd + ip],
 			     diag * SCALAR_RE(xin),
 			     diag * SCALAR_IM(xin));
 	  }
@@ -368,8 +646,8 @@ void Cop(evectmatrix Xin, evectmatrix Xout, void *data,
 	       }
 	       else
 		    scale = diag;
-	       ASSIGN_DIV(Xout.data[in * Xout.p + ip],
-			  Xout.data[in * Xout.p + ip],
+	       ASSIGN_DIV(Xout.data[in * Xout.fd + ip],
+			  Xout.data[in * Xout.fd + ip],
 			  scale);
 	  }
      }
@@ -53,6 +53,7 @@ int feenableexcept (int EXCEPTS);
 #define NWORK 3
 
 #define KX 0.5
+#define KDOTP_KX 0.3 /* k point for checking the k.p model */
 #define EPS_LOW 1.00
 #define EPS_HIGH 9.00
 #define EPS_HIGH_X 0.25
@@ -201,6 +202,50 @@ real norm_diff(scalar *a, scalar *b, int n)
 
 /*************************************************************************/
 
+/* Check the k.p model of the bands H (with eigenvalues eigvals) at the
+   current k point of d: at q = 0 it must reduce to diag(eigvals), and
+   the diagonal of its first-order terms must be the derivatives of the
+   eigenvalues computed by maxwell_k_derivatives. */
+void check_kdotp_model(maxwell_data *d, evectmatrix H, const real *eigvals,
+		       evectmatrix Work)
+{
+     maxwell_kdotp_model *m;
+     real *ev, *grad, gmax = 0, err0 = 0, err1 = 0;
+     int p = H.p, b, i;
+
+     m = create_maxwell_kdotp_model(d, H, eigvals, Work);
+     CHK_MALLOC(ev, real, p);
+     CHK_MALLOC(grad, real, 3 * p);
+
+     maxwell_kdotp_eigenvals(m, d->current_k, ev);
+     for (b = 0; b < p; ++b) {
+	  real e = fabs(ev[b] - eigvals[b]) / fabs(eigvals[b]);
+	  if (e > err0) err0 = e;
+     }
+
+     maxwell_k_derivatives(d, H, NULL, grad, NULL);
+     for (b = 0; b < 3 * p; ++b)
+	  if (fabs(grad[b]) > gmax) gmax = fabs(grad[b]);
+     for (b = 0; b < p; ++b)
+	  for (i = 0; i < 3; ++i) {
+	       real e = fabs(SCALAR_RE(m->A1[i].data[b * p + b])
+			     - grad[3*b + i]) / gmax;
+	       if (e > err1) err1 = e;
+	  }
+
+     printf("k.p model: relative error %e at q = 0, "
+	    "%e in the first-order terms\n", err0, err1);
+     CHECK(err0 < 1e-10, "k.p model is not diag(eigenvalues) at q = 0");
+     CHECK(gmax > 0 && err1 < 1e-8,
+	   "k.p model doesn't match maxwell_k_derivatives");
+
+     free(grad);
+     free(ev);
+     destroy_maxwell_kdotp_model(m);
+}
+
+/*************************************************************************/
+
 void usage(void)
 {
      printf("Syntax: maxwell_test [options]\n"
@@ -550,6 +595,18 @@ int main(int argc, char **argv)
      /*****************************************/
 
      }
+
+     /*****************************************/
+     printf("\nChecking the k.p model at k = (%g, 0, 0)...\n", KDOTP_KX);
+     kvector[0] = KDOTP_KX;
+     update_maxwell_data_k(mdata, kvector, G[0], G[1], G[2]);
+     evectmatrix_copy(H, Hstart);
+     eigensolver(H, eigvals,
+		 maxwell_operator, (void *) mdata, NULL,NULL,
+		 maxwell_preconditioner2, (void *) mdata,
+		 maxwell_parity_constraint, (void *) mdata,
+		 W, NWORK, error_tol, &num_iters, EIGS_DEFAULT_FLAGS);
+     check_kdotp_model(mdata, H, eigvals, W[0]);
      
      destroy_evectmatrix(H);
      destroy_evectmatrix(Hstart);